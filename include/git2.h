@@ -12,6 +12,7 @@
 #include "git2/blob.h"
 #include "git2/blame.h"
 #include "git2/branch.h"
+#include "git2/bundle.h"
 #include "git2/buffer.h"
 #include "git2/checkout.h"
 #include "git2/cherrypick.h"
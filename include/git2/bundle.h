@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_git_bundle_h__
+#define INCLUDE_git_bundle_h__
+
+#include "common.h"
+#include "types.h"
+#include "strarray.h"
+
+/**
+ * @file git2/bundle.h
+ * @brief Git bundle routines
+ * @defgroup git_bundle Git bundle routines
+ * @ingroup Git
+ * @{
+ *
+ * A bundle is a file holding references and a packfile with the objects
+ * they need, for moving history between repositories without a network
+ * connection.  Bundles are fetched from by using the path to the file as
+ * the URL of a remote.
+ */
+GIT_BEGIN_DECL
+
+typedef struct {
+	unsigned int version;
+
+	/** The version of the bundle format to write, 2 or 3.  Defaults to 2. */
+	unsigned int format;
+
+	/**
+	 * Revisions the recipient already has.  Their history is left out
+	 * of the bundle, which lists them as prerequisites for fetching
+	 * from it.
+	 */
+	git_strarray prerequisites;
+} git_bundle_create_options;
+
+#define GIT_BUNDLE_CREATE_OPTIONS_VERSION 1
+#define GIT_BUNDLE_CREATE_OPTIONS_INIT {GIT_BUNDLE_CREATE_OPTIONS_VERSION, 2}
+
+/**
+ * Initializes a `git_bundle_create_options` with default values.
+ * Equivalent to creating an instance with GIT_BUNDLE_CREATE_OPTIONS_INIT.
+ *
+ * @param opts the `git_bundle_create_options` struct to initialize
+ * @param version Version of struct; pass `GIT_BUNDLE_CREATE_OPTIONS_VERSION`
+ * @return Zero on success; -1 on failure.
+ */
+GIT_EXTERN(int) git_bundle_init_options(
+	git_bundle_create_options *opts,
+	unsigned int version);
+
+/**
+ * Write a bundle of the given references to a file.
+ *
+ * The references may be given by their full names or by any shorthand
+ * `git_reference_dwim()` understands.  The objects they point to are
+ * packed along with everything they need, except for the history of the
+ * prerequisites.
+ *
+ * @param repo the repository to take the references and objects from
+ * @param path the file to write the bundle to
+ * @param refs the references to put into the bundle
+ * @param opts the options (or NULL for defaults)
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_bundle_create(
+	git_repository *repo,
+	const char *path,
+	const git_strarray *refs,
+	const git_bundle_create_options *opts);
+
+/** @} */
+GIT_END_DECL
+#endif
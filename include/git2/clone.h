@@ -110,6 +110,22 @@ typedef struct git_clone_options {
 	 * use the default signature using the config.
 	 */
 	git_signature *signature;
+
+	/**
+	 * Create a shallow clone with a history truncated to this many
+	 * commits. Zero (the default) clones the full history. As with
+	 * `git_remote_set_depth()`, this needs a smart transport, so it
+	 * has no effect on clones which copy a local object database.
+	 */
+	int depth;
+
+	/**
+	 * Create a partial clone, leaving out the objects excluded by
+	 * this filter, which are fetched from the remote when they are
+	 * needed. See `git_remote_set_filter()` for the syntax. Like
+	 * `depth`, this needs a smart transport.
+	 */
+	const char *filter;
 } git_clone_options;
 
 #define GIT_CLONE_OPTIONS_VERSION 1
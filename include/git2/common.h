@@ -136,7 +136,20 @@ typedef enum {
 	GIT_OPT_ENABLE_CACHING,
 	GIT_OPT_GET_CACHED_MEMORY,
 	GIT_OPT_GET_TEMPLATE_PATH,
-	GIT_OPT_SET_TEMPLATE_PATH
+	GIT_OPT_SET_TEMPLATE_PATH,
+	GIT_OPT_GET_LOOSE_COMPRESSION_LEVEL,
+	GIT_OPT_SET_LOOSE_COMPRESSION_LEVEL,
+	GIT_OPT_GET_PACK_COMPRESSION_LEVEL,
+	GIT_OPT_SET_PACK_COMPRESSION_LEVEL,
+	GIT_OPT_GET_CONNECTION_POOL_SIZE,
+	GIT_OPT_SET_CONNECTION_POOL_SIZE,
+	GIT_OPT_GET_TRANSFER_PROGRESS_INTERVAL,
+	GIT_OPT_SET_TRANSFER_PROGRESS_INTERVAL,
+	GIT_OPT_GET_DISCOVERY_CACHE_SIZE,
+	GIT_OPT_SET_DISCOVERY_CACHE_SIZE,
+	GIT_OPT_GET_MWINDOW_FILE_LIMIT,
+	GIT_OPT_SET_MWINDOW_FILE_LIMIT,
+	GIT_OPT_ENABLE_WHOLE_PACK_MMAP
 } git_libgit2_opt_t;
 
 /**
@@ -221,6 +234,75 @@ typedef enum {
  *		>
  *		> - `path` directory of template.
  *
+ *	* opts(GIT_OPT_GET_LOOSE_COMPRESSION_LEVEL, int *level)
+ *	* opts(GIT_OPT_SET_LOOSE_COMPRESSION_LEVEL, int level)
+ *
+ *		> Get or set the zlib compression level (0-9, or -1 for zlib's
+ *		> default) used for newly written loose objects.  Defaults to 1.
+ *
+ *	* opts(GIT_OPT_GET_PACK_COMPRESSION_LEVEL, int *level)
+ *	* opts(GIT_OPT_SET_PACK_COMPRESSION_LEVEL, int level)
+ *
+ *		> Get or set the zlib compression level (0-9, or -1 for zlib's
+ *		> default) used for objects written to packfiles.  Repositories
+ *		> can override this with the `core.compression` and
+ *		> `pack.compression` config values.  Defaults to -1.
+ *
+ *	* opts(GIT_OPT_GET_CONNECTION_POOL_SIZE, size_t *size)
+ *	* opts(GIT_OPT_SET_CONNECTION_POOL_SIZE, size_t size)
+ *
+ *		> Get or set the number of idle HTTP connections kept open so
+ *		> later fetches and pushes to the same server can reuse them.
+ *		> 0 closes every connection once its transport is done with it.
+ *		> Defaults to 8.
+ *
+ *	* opts(GIT_OPT_GET_TRANSFER_PROGRESS_INTERVAL, int *msecs)
+ *	* opts(GIT_OPT_SET_TRANSFER_PROGRESS_INTERVAL, int msecs)
+ *
+ *		> Get or set the minimum number of milliseconds between two
+ *		> calls to a `git_transfer_progress_cb` while fetching or
+ *		> indexing a packfile.  The first and last updates of each
+ *		> phase are always reported.  Defaults to 0, which reports
+ *		> every object.
+ *
+ *	* opts(GIT_OPT_GET_DISCOVERY_CACHE_SIZE, size_t *entries)
+ *	* opts(GIT_OPT_SET_DISCOVERY_CACHE_SIZE, size_t entries)
+ *
+ *		> Get or set how many results of searching for a repository the
+ *		> process remembers.  Searching again from the same path with
+ *		> the same flags and ceiling directories then only checks that
+ *		> the repository found last time is still there.  A repository
+ *		> created between the start path and that one is not noticed,
+ *		> so this is meant for trees below a ceiling directory whose
+ *		> layout does not change.  The cache is emptied when it fills
+ *		> up and whenever its size is set.  Defaults to 0, which turns
+ *		> it off.
+ *
+ *	* opts(GIT_OPT_GET_MWINDOW_FILE_LIMIT, size_t *):
+ *
+ *		> Get the maximum number of pack files the library keeps open
+ *
+ *	* opts(GIT_OPT_SET_MWINDOW_FILE_LIMIT, size_t):
+ *
+ *		> Set the maximum number of pack files the library keeps open
+ *		> at any time, across all repositories.  Past this, the pack
+ *		> least recently read from is closed and is opened and checked
+ *		> against its index again the next time it's needed.  Packs
+ *		> being read from are never closed, so this is a soft limit.
+ *		> Defaults to 0, which means no limit.
+ *
+ *	* opts(GIT_OPT_ENABLE_WHOLE_PACK_MMAP, int enabled)
+ *
+ *		> Map each pack file in its entire length when it is opened,
+ *		> instead of in windows of `GIT_OPT_SET_MWINDOW_SIZE` bytes.
+ *		> Reading objects then needs no window bookkeeping or locking,
+ *		> and the descriptor is closed right away, so these packs don't
+ *		> count against `GIT_OPT_SET_MWINDOW_FILE_LIMIT`.  They don't
+ *		> count against `GIT_OPT_SET_MWINDOW_MAPPED_LIMIT` either: this
+ *		> is meant for 64-bit hosts with address space to spare, and
+ *		> it can't be enabled on 32-bit ones.  Packs already open keep
+ *		> being read through windows.  Disabled by default.
+ *
  * @param option Option key
  * @param ... value to set the option
  * @return 0 on success, <0 on failure
@@ -191,6 +191,58 @@ GIT_EXTERN(int) git_odb_exists_prefix(
  */
 GIT_EXTERN(int) git_odb_refresh(struct git_odb *db);
 
+/**
+ * Callback to fetch objects which are missing from an object database
+ *
+ * It's given the ids of the objects a read didn't find, which it can
+ * add to the database, typically by downloading them from the
+ * promisor remote of a partial clone.
+ *
+ * @param odb the object database
+ * @param ids the objects to provide
+ * @param count the number of ids
+ * @param payload the payload given to `git_odb_set_missing_cb()`
+ * @return 0 when the objects were added, GIT_ENOTFOUND if they
+ * can't be provided, or another error code to make the read fail
+ */
+typedef int (*git_odb_missing_cb)(
+	git_odb *odb, const git_oid *ids, size_t count, void *payload);
+
+/**
+ * Set the callback which provides the objects missing from the
+ * database
+ *
+ * When `git_odb_read()` (and everything reading through it) can't
+ * find an object, the callback is asked for it and the read is
+ * retried. Objects read by the callback itself, or on other threads
+ * while it runs, are not asked for again.
+ *
+ * A repository whose configuration has a promisor remote (see
+ * `git_remote_set_filter()`) sets a callback on its object database
+ * which fetches the missing objects from that remote.
+ *
+ * @param odb database to set the callback on
+ * @param cb the callback, or NULL to remove it
+ * @param payload payload passed to the callback
+ * @return 0 on success, error code otherwise
+ */
+GIT_EXTERN(int) git_odb_set_missing_cb(
+	git_odb *odb, git_odb_missing_cb cb, void *payload);
+
+/**
+ * Make sure the given objects are in the database
+ *
+ * The objects which are missing are asked for from the missing-object
+ * callback, all at once, which saves fetching them one by one when
+ * they're read.
+ *
+ * @param odb the object database
+ * @param ids the objects which are about to be read
+ * @param count the number of ids
+ * @return 0 on success, error code otherwise
+ */
+GIT_EXTERN(int) git_odb_prefetch(git_odb *odb, const git_oid *ids, size_t count);
+
 /**
  * List all objects available in the database
  *
@@ -38,7 +38,8 @@ GIT_EXTERN(int) git_odb_backend_pack(git_odb_backend **out, const char *objects_
  *
  * @param out location to store the odb backend pointer
  * @param objects_dir the Git repository's objects directory
- * @param compression_level zlib compression level to use
+ * @param compression_level zlib compression level to use, or -1 for the
+ *        library default (see `GIT_OPT_SET_LOOSE_COMPRESSION_LEVEL`)
  * @param do_fsync whether to do an fsync() after writing (currently ignored)
  * @param dir_mode permissions to use creating a directory or 0 for defaults
  * @param file_mode permissions to use creating a file or 0 for defaults
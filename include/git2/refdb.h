@@ -62,6 +62,100 @@ GIT_EXTERN(int) git_refdb_compress(git_refdb *refdb);
  */
 GIT_EXTERN(void) git_refdb_free(git_refdb *refdb);
 
+/**
+ * Flags for `git_refdb_transaction_new`
+ */
+typedef enum {
+	GIT_REFDB_TRANSACTION_DEFAULT = 0,
+
+	/**
+	 * Write the updates straight into the packed references, where
+	 * the backend keeps such a thing, rather than into one file per
+	 * reference.  This is much faster for large transactions.  The
+	 * filesystem backend still writes loose files if any of the
+	 * references it updates already has one.
+	 */
+	GIT_REFDB_TRANSACTION_PACKED = (1u << 0),
+} git_refdb_transaction_flag_t;
+
+/**
+ * Start a transaction on the direct references of a reference database.
+ *
+ * Updates are queued up with `git_refdb_transaction_set_target()` and
+ * `git_refdb_transaction_delete()`, and applied together on commit:
+ * every reference is locked and its old value checked before any of
+ * them changes, so a transaction whose check fails changes nothing.
+ *
+ * Backends without transaction support apply the updates one by one
+ * instead, after checking all the old values.  If an update still
+ * fails, the ones before it are undone, but other readers may see the
+ * references half way through.
+ *
+ * @param out the new transaction
+ * @param refdb the reference database to update
+ * @param flags a combination of `git_refdb_transaction_flag_t` values
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_refdb_transaction_new(
+	git_refdb_transaction **out,
+	git_refdb *refdb,
+	unsigned int flags);
+
+/**
+ * Queue up setting a reference to an object id.
+ *
+ * @param tx the transaction
+ * @param refname the name of the reference
+ * @param id the object the reference should point to
+ * @param old_id the id the reference must point to when the transaction
+ *  is committed, the zero id if it must not exist, or NULL to not check
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_refdb_transaction_set_target(
+	git_refdb_transaction *tx,
+	const char *refname,
+	const git_oid *id,
+	const git_oid *old_id);
+
+/**
+ * Queue up deleting a reference.
+ *
+ * Without an old id to check, deleting a reference which does not exist
+ * is not an error.
+ *
+ * @param tx the transaction
+ * @param refname the name of the reference
+ * @param old_id the id the reference must point to when the transaction
+ *  is committed, or NULL to not check
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_refdb_transaction_delete(
+	git_refdb_transaction *tx,
+	const char *refname,
+	const git_oid *old_id);
+
+/**
+ * Apply all the queued updates.
+ *
+ * @param tx the transaction
+ * @param who the identity for the reflog entries, or NULL to use the
+ *  repository's default signature
+ * @param message the message for the reflog entries, or NULL
+ * @return 0, GIT_EMODIFIED if a reference did not have the expected
+ *  old value, or an error code
+ */
+GIT_EXTERN(int) git_refdb_transaction_commit(
+	git_refdb_transaction *tx,
+	const git_signature *who,
+	const char *message);
+
+/**
+ * Free a transaction, dropping any updates which were not committed.
+ *
+ * @param tx the transaction or NULL
+ */
+GIT_EXTERN(void) git_refdb_transaction_free(git_refdb_transaction *tx);
+
 /** @} */
 GIT_END_DECL
 
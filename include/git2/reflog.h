@@ -37,6 +37,26 @@ GIT_BEGIN_DECL
  */
 GIT_EXTERN(int) git_reflog_read(git_reflog **out, git_repository *repo,  const char *name);
 
+/**
+ * Read the most recent entries of the reflog for the given reference
+ *
+ * Only the newest `count` entries are loaded, which is much cheaper
+ * than `git_reflog_read()` on a long reflog when just its tail is
+ * needed.  Entry 0 is still the most recent one.
+ *
+ * The resulting reflog is partial and cannot be written back with
+ * `git_reflog_write()`.  If there is no reflog for the reference, an
+ * empty reflog object is returned.
+ *
+ * @param out pointer to reflog
+ * @param repo the repository
+ * @param name reference to look up
+ * @param count the maximum number of entries to read
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_reflog_read_recent(
+	git_reflog **out, git_repository *repo, const char *name, size_t count);
+
 /**
  * Write an existing in-memory reflog object back to disk
  * using an atomic file lock.
@@ -289,6 +289,11 @@ GIT_EXTERN(int) git_remote_connect(git_remote *remote, git_direction direction);
  * its transport isn't changed, but a copy is recommended for usage of
  * the data.
  *
+ * When the server speaks protocol v2, only the refs which the remote's
+ * fetch refspecs can match are listed, along with HEAD and (unless tags
+ * are not downloaded) the tags. Set `protocol.version` to 0 in the
+ * repository's configuration to always get the full advertisement.
+ *
  * @param out pointer to the array
  * @param size the number of remote heads
  * @param remote the remote
@@ -561,6 +566,106 @@ GIT_EXTERN(void) git_remote_set_autotag(
 	git_remote *remote,
 	git_remote_autotag_option_t value);
 
+/** Depth to pass to `git_remote_set_depth()` to fetch the full history */
+#define GIT_REMOTE_DEPTH_UNSHALLOW 0x7fffffff
+
+/**
+ * Limit the history downloaded by the next fetches
+ *
+ * Only `depth` commits of history are fetched for each of the tips,
+ * making the repository shallow: the commits where the history was
+ * cut are recorded in its `shallow` file and treated as root commits
+ * from then on. Fetching into a shallow repository with a larger
+ * depth deepens it, and `GIT_REMOTE_DEPTH_UNSHALLOW` fetches whatever
+ * is missing and makes it complete again.
+ *
+ * Only the smart (git, http and ssh) transports support limiting the
+ * depth.
+ *
+ * @param remote the remote to configure
+ * @param depth the number of commits to fetch, or 0 not to change the
+ * depth of the repository
+ */
+GIT_EXTERN(void) git_remote_set_depth(git_remote *remote, int depth);
+
+/**
+ * Limit the history downloaded by the next fetches to the commits
+ * more recent than `since`
+ *
+ * This is the time-based counterpart of `git_remote_set_depth()`,
+ * and is ignored when a depth is set.
+ *
+ * @param remote the remote to configure
+ * @param since the time in seconds since epoch, or 0 for no limit
+ */
+GIT_EXTERN(void) git_remote_set_deepen_since(git_remote *remote, git_time_t since);
+
+/**
+ * Leave objects out of the next fetches (partial clone)
+ *
+ * The filter is one of
+ *
+ * - `blob:none` to fetch no blobs at all,
+ * - `blob:limit=<n>[kmg]` to fetch only the blobs smaller than `n` bytes,
+ * - `tree:<depth>` to fetch no trees (and blobs) deeper than `depth`
+ *   from the root tree of each commit.
+ *
+ * The remote becomes the repository's promisor remote: the packs it
+ * sends are marked as promisor packs, and objects missing from the
+ * object database are fetched from it when they're first read (see
+ * `git_odb_set_missing_cb()`). `git_remote_save()` stores the filter
+ * so later fetches keep using it.
+ *
+ * The remote must support filtering, which only the smart transports
+ * can.
+ *
+ * @param remote the remote to configure
+ * @param filter the filter specification, or NULL to fetch everything
+ * @return 0 or GIT_EINVALIDSPEC if the filter isn't valid
+ */
+GIT_EXTERN(int) git_remote_set_filter(git_remote *remote, const char *filter);
+
+/**
+ * Get the object filter of the remote
+ *
+ * @param remote the remote to query
+ * @return the filter specification, or NULL if everything is fetched
+ */
+GIT_EXTERN(const char *) git_remote_filter(const git_remote *remote);
+
+/**
+ * How the haves are picked when negotiating a fetch
+ */
+typedef enum {
+	/**
+	 * Use the `fetch.negotiationAlgorithm` configuration, or
+	 * `GIT_REMOTE_NEGOTIATION_CONSECUTIVE` if it's not set.
+	 */
+	GIT_REMOTE_NEGOTIATION_DEFAULT = 0,
+
+	/** Offer every local commit, newest first */
+	GIT_REMOTE_NEGOTIATION_CONSECUTIVE = 1,
+
+	/**
+	 * Offer only some of the local commits, skipping more and more
+	 * of them along each line of history. This finds the common
+	 * history in fewer round trips when the local branches have
+	 * many commits the remote doesn't know about, at the cost of a
+	 * possibly larger pack.
+	 */
+	GIT_REMOTE_NEGOTIATION_SKIPPING = 2,
+} git_remote_negotiation_t;
+
+/**
+ * Choose how the next fetches negotiate what to download
+ *
+ * @param remote the remote to configure
+ * @param algorithm the negotiation algorithm
+ */
+GIT_EXTERN(void) git_remote_set_negotiation(
+	git_remote *remote,
+	git_remote_negotiation_t algorithm);
+
 /**
  * Give the remote a new name
  *
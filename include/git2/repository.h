@@ -95,11 +95,20 @@ GIT_EXTERN(int) git_repository_discover(
  * * GIT_REPOSITORY_OPEN_BARE - Open repository as a bare repo regardless
  *   of core.bare config, and defer loading config file for faster setup.
  *   Unlike `git_repository_open_bare`, this can follow gitlinks.
+ * * GIT_REPOSITORY_OPEN_GITDIR - The path is the git directory itself, i.e.
+ *   a bare repository or the `.git` directory of a working directory.  It
+ *   is opened as it is, without looking for a `.git` inside of it, following
+ *   gitlinks or searching.
+ * * GIT_REPOSITORY_OPEN_DEFER_CONFIG - Do not read the config file while
+ *   opening.  Whether the repository is bare and where its working directory
+ *   is are looked up from it the first time they are needed.
  */
 typedef enum {
 	GIT_REPOSITORY_OPEN_NO_SEARCH = (1 << 0),
 	GIT_REPOSITORY_OPEN_CROSS_FS  = (1 << 1),
 	GIT_REPOSITORY_OPEN_BARE      = (1 << 2),
+	GIT_REPOSITORY_OPEN_GITDIR    = (1 << 3),
+	GIT_REPOSITORY_OPEN_DEFER_CONFIG = (1 << 4),
 } git_repository_open_flag_t;
 
 /**
@@ -711,6 +720,87 @@ GIT_EXTERN(const char *) git_repository_get_namespace(git_repository *repo);
  */
 GIT_EXTERN(int) git_repository_is_shallow(git_repository *repo);
 
+/**
+ * Create a pool of open repositories
+ *
+ * Servers that answer many requests against many repositories can
+ * keep them open between requests with a pool instead of paying for
+ * opening each one again, along with its config, pack indexes,
+ * mapped pack windows and object cache.
+ *
+ * A pool only keeps repositories nobody is using.  Mapped pack memory
+ * and cached objects of every repository count against the
+ * process-wide limits (`GIT_OPT_SET_MWINDOW_MAPPED_LIMIT` and
+ * `GIT_OPT_SET_CACHE_MAX_SIZE`), so idle repositories give up their
+ * windows and cache space first when other repositories need them.
+ *
+ * @param out pointer to the new pool
+ * @param max_idle how many unused repositories to keep open; past
+ *        this the least recently released ones are freed.  With 0
+ *        nothing is kept.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_repository_pool_new(
+	git_repository_pool **out, size_t max_idle);
+
+/**
+ * Open a repository through a pool
+ *
+ * If the pool holds an unused repository opened from the same `path`
+ * it is handed out, otherwise the repository is opened as with
+ * `git_repository_open_ext` and `GIT_REPOSITORY_OPEN_NO_SEARCH`.
+ * `path` is compared as given, so use the same spelling each time.
+ *
+ * Before a repository is reused, the pool checks the stamp of its
+ * `config` file and of its pack directory.  A changed config is read
+ * again, and a changed pack directory makes the object database
+ * reload its list of packs, so packs removed by a repack are let go.
+ * References and the index check their own files on every use.
+ *
+ * A repository is only ever handed to one caller at a time; several
+ * callers opening the same path get separate repositories.  Give it
+ * back with `git_repository_pool_release`.  Callers should not change
+ * the odb, refdb, config or index set on a pooled repository.
+ *
+ * @param out pointer to the repository
+ * @param pool the pool
+ * @param path path to the repository
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_repository_pool_open(
+	git_repository **out, git_repository_pool *pool, const char *path);
+
+/**
+ * Return a repository to the pool it was opened from
+ *
+ * The repository's namespace is reset.  It must not be used after
+ * this call.  Releasing a repository that did not come from a pool
+ * frees it; freeing a pooled repository with `git_repository_free`
+ * instead is fine as well.
+ *
+ * @param pool the pool it was opened from
+ * @param repo the repository to give back
+ */
+GIT_EXTERN(void) git_repository_pool_release(
+	git_repository_pool *pool, git_repository *repo);
+
+/**
+ * Free all the unused repositories held by a pool
+ *
+ * @param pool the pool
+ */
+GIT_EXTERN(void) git_repository_pool_clear(git_repository_pool *pool);
+
+/**
+ * Free a pool and the unused repositories it holds
+ *
+ * Repositories that are still handed out must be freed with
+ * `git_repository_free` rather than released.
+ *
+ * @param pool the pool to free
+ */
+GIT_EXTERN(void) git_repository_pool_free(git_repository_pool *pool);
+
 /** @} */
 GIT_END_DECL
 #endif
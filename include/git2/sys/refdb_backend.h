@@ -56,6 +56,22 @@ struct git_reference_iterator {
 		git_reference_iterator *iter);
 };
 
+/** One update of a reference transaction */
+typedef struct {
+	/** The name of the reference */
+	const char *name;
+
+	/** The new target of the reference, or the zero id to delete it */
+	git_oid id;
+
+	/**
+	 * The target the reference must have, or the zero id if it must
+	 * not exist.  Only looked at when `check_old` is set.
+	 */
+	git_oid old_id;
+	int check_old;
+} git_refdb_update;
+
 /** An instance for a custom backend */
 struct git_refdb_backend {
 	unsigned int version;
@@ -81,6 +97,10 @@ struct git_refdb_backend {
 	/**
 	 * Allocate an iterator object for the backend.
 	 *
+	 * Every reference matching `glob` starts with its literal part, up
+	 * to the first wildcard, so an implementation only needs to look at
+	 * the names starting with it.  A NULL `glob` matches everything.
+	 *
 	 * A refdb implementation must provide this function.
 	 */
 	int (*iterator)(
@@ -139,6 +159,13 @@ struct git_refdb_backend {
 	 */
 	int (*reflog_read)(git_reflog **out, git_refdb_backend *backend, const char *name);
 
+	/**
+	 * Read only the newest `count` entries of the reflog for the given
+	 * reference name.  A refdb implementation may provide this function;
+	 * if it is not provided, the whole reflog is read and trimmed.
+	 */
+	int (*reflog_read_recent)(git_reflog **out, git_refdb_backend *backend, const char *name, size_t count);
+
 	/**
 	 * Write a reflog to disk.
 	 */
@@ -153,6 +180,20 @@ struct git_refdb_backend {
 	 * Remove a reflog.
 	 */
 	int (*reflog_delete)(git_refdb_backend *backend, const char *name);
+
+	/**
+	 * Apply a set of updates to direct references atomically: either
+	 * every reference has the expected old value and all of them are
+	 * updated, or nothing changes.  `flags` are the flags the
+	 * transaction was created with.  A refdb implementation may provide
+	 * this function; if it is not provided, the updates are written and
+	 * deleted one at a time.
+	 */
+	int (*transaction)(
+		git_refdb_backend *backend,
+		const git_refdb_update *updates, size_t count,
+		unsigned int flags,
+		const git_signature *who, const char *message);
 };
 
 #define GIT_REFDB_BACKEND_VERSION 1
@@ -185,6 +226,26 @@ GIT_EXTERN(int) git_refdb_backend_fs(
 	git_refdb_backend **backend_out,
 	git_repository *repo);
 
+/**
+ * Constructor for the reftable refdb backend
+ *
+ * The references and their logs are kept in `$GIT_DIR/reftable/`, as
+ * a stack of immutable tables which are merged as it grows.  The
+ * repository uses this backend when `extensions.refStorage` is set to
+ * "reftable" in its own config, which also needs
+ * `core.repositoryformatversion` to be 1.  The first time around, the
+ * references are taken over from the files and both settings are
+ * written to the repository's config.  Namespaced repositories are
+ * not supported.
+ *
+ * @param backend_out Output pointer to the git_refdb_backend object
+ * @param repo Git repository to access
+ * @return 0 on success, <0 error code on failure
+ */
+GIT_EXTERN(int) git_refdb_backend_reftable(
+	git_refdb_backend **backend_out,
+	git_repository *repo);
+
 /**
  * Sets the custom backend to an existing reference DB
  *
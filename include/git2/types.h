@@ -98,12 +98,18 @@ typedef struct git_refdb git_refdb;
 /** A custom backend for refs */
 typedef struct git_refdb_backend git_refdb_backend;
 
+/** A set of reference updates applied together */
+typedef struct git_refdb_transaction git_refdb_transaction;
+
 /**
  * Representation of an existing git repository,
  * including all its object contents
  */
 typedef struct git_repository git_repository;
 
+/** A set of open repositories kept for reuse */
+typedef struct git_repository_pool git_repository_pool;
+
 /** Representation of a generic object in a repository */
 typedef struct git_object git_object;
 
@@ -223,6 +229,17 @@ typedef struct git_remote_callbacks git_remote_callbacks;
  * - local_objects: locally-available objects that have been injected
  *    in order to fix a thin pack.
  * - received-bytes: size of the packfile received up to now
+ *
+ * The remaining fields measure where the time went, in seconds, so a
+ * slow transfer can be pinned on a phase:
+ *
+ * - network_time: time spent waiting on the remote for data
+ * - inflate_time: time spent decompressing objects as they arrive
+ * - hash_time: time spent hashing objects and the packfile itself
+ * - resolve_time: time spent resolving deltas once the packfile is
+ *    complete, not counting the hashing of the resulting objects
+ * - bytes_per_second: average rate at which the packfile was received
+ * - objects_per_second: average rate at which objects were received
  */
 typedef struct git_transfer_progress {
 	unsigned int total_objects;
@@ -232,6 +249,12 @@ typedef struct git_transfer_progress {
 	unsigned int total_deltas;
 	unsigned int indexed_deltas;
 	size_t received_bytes;
+	double network_time;
+	double inflate_time;
+	double hash_time;
+	double resolve_time;
+	double bytes_per_second;
+	double objects_per_second;
 } git_transfer_progress;
 
 /**
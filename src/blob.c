@@ -236,6 +236,34 @@ done:
 	return error;
 }
 
+int git_blob__read_workdir_filtered(
+	git_buf *out, git_repository *repo, const char *path)
+{
+	int error;
+	git_filter_list *fl = NULL;
+	git_buf full_path = GIT_BUF_INIT;
+
+	if ((error = git_repository__ensure_not_bare(repo, "read workdir file")) < 0 ||
+		(error = git_buf_joinpath(
+			&full_path, git_repository_workdir(repo), path)) < 0)
+		return error;
+
+	error = git_filter_list_load(
+		&fl, repo, NULL, path, GIT_FILTER_TO_ODB, GIT_FILTER_OPT_DEFAULT);
+
+	if (error < 0)
+		/* well, that didn't work */;
+	else if (fl == NULL)
+		error = git_futils_readbuffer(out, full_path.ptr);
+	else {
+		error = git_filter_list_apply_to_file(out, fl, NULL, full_path.ptr);
+		git_filter_list_free(fl);
+	}
+
+	git_buf_free(&full_path);
+	return error;
+}
+
 int git_blob_create_fromworkdir(
 	git_oid *id, git_repository *repo, const char *path)
 {
@@ -30,4 +30,14 @@ extern int git_blob__create_from_paths(
 	mode_t hint_mode,
 	bool apply_filters);
 
+/*
+ * Read the contents of the workdir file at `path` (relative to the
+ * repository workdir) into `out`, applying the filters that would be
+ * used when writing it to the ODB.
+ */
+extern int git_blob__read_workdir_filtered(
+	git_buf *out,
+	git_repository *repo,
+	const char *path);
+
 #endif
@@ -186,13 +186,20 @@ int git_branch_iterator_new(
 	git_branch_t list_flags)
 {
 	branch_iter *iter;
+	const char *glob = NULL;
 
 	iter = git__calloc(1, sizeof(branch_iter));
 	GITERR_CHECK_ALLOC(iter);
 
 	iter->flags = list_flags;
 
-	if (git_reference_iterator_new(&iter->iter, repo) < 0) {
+	/* let the refdb skip over everything else */
+	if (list_flags == GIT_BRANCH_LOCAL)
+		glob = GIT_REFS_HEADS_DIR "*";
+	else if (list_flags == GIT_BRANCH_REMOTE)
+		glob = GIT_REFS_REMOTES_DIR "*";
+
+	if (git_reference_iterator_glob_new(&iter->iter, repo, glob) < 0) {
 		git__free(iter);
 		return -1;
 	}
@@ -0,0 +1,390 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "bundle.h"
+#include "buffer.h"
+#include "filebuf.h"
+#include "fileops.h"
+#include "posix.h"
+#include "pack-objects.h"
+#include "git2/commit.h"
+#include "git2/net.h"
+#include "git2/object.h"
+#include "git2/pack.h"
+#include "git2/refs.h"
+#include "git2/revparse.h"
+#include "git2/revwalk.h"
+#include "git2/tag.h"
+
+#define BUNDLE_HEADER_READ_SIZE 4096
+
+static int bundle_error(const char *message)
+{
+	giterr_set(GITERR_INVALID, "Invalid bundle: %s", message);
+	return -1;
+}
+
+bool git_bundle__is_bundle(const char *path)
+{
+	char signature[sizeof(GIT_BUNDLE_V2_SIGNATURE) - 1];
+	git_file fd;
+	bool is_bundle;
+
+	if (!git_path_isfile(path) || (fd = git_futils_open_ro(path)) < 0) {
+		giterr_clear();
+		return false;
+	}
+
+	is_bundle = p_read(fd, signature, sizeof(signature)) == sizeof(signature) &&
+		(!memcmp(signature, GIT_BUNDLE_V2_SIGNATURE, sizeof(signature)) ||
+		 !memcmp(signature, GIT_BUNDLE_V3_SIGNATURE, sizeof(signature)));
+
+	p_close(fd);
+	return is_bundle;
+}
+
+static int parse_capability(git_bundle_header *header, const char *line, size_t len)
+{
+	if (header->format < 3)
+		return bundle_error("capabilities need version 3");
+
+	/* The hash is the only thing we can agree to */
+	if (len == strlen("@object-format=sha1") &&
+		!memcmp(line, "@object-format=sha1", len))
+		return 0;
+
+	giterr_set(GITERR_INVALID, "Unsupported bundle capability '%.*s'",
+		(int)len - 1, line + 1);
+	return -1;
+}
+
+static int parse_prerequisite(git_bundle_header *header, const char *line, size_t len)
+{
+	git_oid *id;
+
+	/* Anything after the id is a comment */
+	if (len < GIT_OID_HEXSZ + 1 ||
+		(len > GIT_OID_HEXSZ + 1 && line[GIT_OID_HEXSZ + 1] != ' '))
+		return bundle_error("malformed prerequisite");
+
+	id = git_array_alloc(header->prerequisites);
+	GITERR_CHECK_ALLOC(id);
+
+	if (git_oid_fromstrn(id, line + 1, GIT_OID_HEXSZ) < 0)
+		return bundle_error("malformed prerequisite");
+
+	return 0;
+}
+
+static int parse_ref(git_bundle_header *header, const char *line, size_t len)
+{
+	git_remote_head *head;
+
+	if (len < GIT_OID_HEXSZ + 2 || line[GIT_OID_HEXSZ] != ' ')
+		return bundle_error("malformed reference");
+
+	head = git__calloc(1, sizeof(git_remote_head));
+	GITERR_CHECK_ALLOC(head);
+
+	if (git_oid_fromstrn(&head->oid, line, GIT_OID_HEXSZ) < 0) {
+		git__free(head);
+		return bundle_error("malformed reference");
+	}
+
+	head->name = git__strndup(line + GIT_OID_HEXSZ + 1, len - GIT_OID_HEXSZ - 1);
+
+	if (!head->name || git_vector_insert(&header->refs, head) < 0) {
+		git__free(head->name);
+		git__free(head);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int parse_header(git_bundle_header *header, const char *data, size_t len)
+{
+	const char *line, *eol, *end = data + len;
+	size_t sig_len = strlen(GIT_BUNDLE_V2_SIGNATURE);
+	int error = 0;
+
+	if (len >= sig_len && !memcmp(data, GIT_BUNDLE_V2_SIGNATURE, sig_len))
+		header->format = 2;
+	else if (len >= sig_len && !memcmp(data, GIT_BUNDLE_V3_SIGNATURE, sig_len))
+		header->format = 3;
+	else
+		return bundle_error("unknown signature");
+
+	for (line = data + sig_len; !error && line < end; line = eol + 1) {
+		eol = memchr(line, '\n', end - line);
+		assert(eol);
+
+		if (*line == '@')
+			error = parse_capability(header, line, eol - line);
+		else if (*line == '-')
+			error = parse_prerequisite(header, line, eol - line);
+		else
+			error = parse_ref(header, line, eol - line);
+	}
+
+	return error;
+}
+
+int git_bundle__read_header(git_bundle_header *out, git_file fd)
+{
+	git_buf buf = GIT_BUF_INIT;
+	const char *end = NULL;
+	size_t searched;
+	ssize_t read;
+	int error;
+
+	memset(out, 0, sizeof(git_bundle_header));
+
+	if ((error = git_vector_init(&out->refs, 0, NULL)) < 0)
+		return error;
+
+	/* The header ends with an empty line */
+	while (!end) {
+		if ((error = git_buf_grow(&buf, buf.size + BUNDLE_HEADER_READ_SIZE + 1)) < 0)
+			goto done;
+
+		if ((read = p_read(fd, buf.ptr + buf.size, BUNDLE_HEADER_READ_SIZE)) < 0) {
+			giterr_set(GITERR_OS, "Failed to read bundle");
+			error = -1;
+			goto done;
+		}
+
+		if (!read) {
+			error = bundle_error("unexpected end of file in the header");
+			goto done;
+		}
+
+		/* Only look at the new data, and the newline that may precede it */
+		searched = buf.size ? buf.size - 1 : 0;
+
+		buf.size += read;
+		buf.ptr[buf.size] = '\0';
+
+		end = strstr(buf.ptr + searched, "\n\n");
+	}
+
+	out->pack_offset = end + 2 - buf.ptr;
+	error = parse_header(out, buf.ptr, end + 1 - buf.ptr);
+
+done:
+	if (error < 0)
+		git_bundle__header_free(out);
+
+	git_buf_free(&buf);
+	return error;
+}
+
+void git_bundle__header_free(git_bundle_header *header)
+{
+	git_remote_head *head;
+	size_t i;
+
+	git_vector_foreach(&header->refs, i, head) {
+		git__free(head->name);
+		git__free(head);
+	}
+
+	git_vector_free(&header->refs);
+	git_array_clear(header->prerequisites);
+}
+
+static int add_prerequisite(
+	git_buf *header, git_revwalk *walk, git_repository *repo, const char *spec)
+{
+	git_object *obj, *commit;
+	char hex[GIT_OID_HEXSZ + 1];
+	int error;
+
+	if ((error = git_revparse_single(&obj, repo, spec)) < 0)
+		return error;
+
+	error = git_object_peel(&commit, obj, GIT_OBJ_COMMIT);
+	git_object_free(obj);
+
+	if (error < 0)
+		return error;
+
+	git_oid_tostr(hex, sizeof(hex), git_object_id(commit));
+
+	if ((error = git_revwalk_hide(walk, git_object_id(commit))) == 0)
+		error = git_buf_printf(header, "-%s %s\n",
+			hex, git_commit_summary((git_commit *)commit));
+
+	git_object_free(commit);
+	return error;
+}
+
+/* Pack what a reference points to, or queue it up for the walk */
+static int add_ref_target(
+	git_packbuilder *pb, git_revwalk *walk, git_repository *repo, const git_oid *id)
+{
+	git_object *obj, *target;
+	int error;
+
+	if ((error = git_object_lookup(&obj, repo, id, GIT_OBJ_ANY)) < 0)
+		return error;
+
+	while (git_object_type(obj) == GIT_OBJ_TAG) {
+		if ((error = git_packbuilder_insert(pb, git_object_id(obj), NULL)) < 0 ||
+			(error = git_tag_target(&target, (git_tag *)obj)) < 0)
+			goto done;
+
+		git_object_free(obj);
+		obj = target;
+	}
+
+	switch (git_object_type(obj)) {
+	case GIT_OBJ_COMMIT:
+		error = git_revwalk_push(walk, git_object_id(obj));
+		break;
+	case GIT_OBJ_TREE:
+		error = git_packbuilder_insert_tree(pb, git_object_id(obj));
+		break;
+	default:
+		error = git_packbuilder_insert(pb, git_object_id(obj), NULL);
+		break;
+	}
+
+done:
+	git_object_free(obj);
+	return error;
+}
+
+static int add_ref(
+	git_buf *header,
+	git_packbuilder *pb,
+	git_revwalk *walk,
+	git_repository *repo,
+	const char *shorthand)
+{
+	git_reference *ref, *resolved = NULL;
+	git_buf line = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+	int error;
+
+	if ((error = git_reference_dwim(&ref, repo, shorthand)) < 0)
+		return error;
+
+	if ((error = git_reference_resolve(&resolved, ref)) < 0)
+		goto done;
+
+	git_oid_tostr(hex, sizeof(hex), git_reference_target(resolved));
+
+	/* Different shorthands may name the same reference */
+	if ((error = git_buf_printf(&line, "\n%s %s\n", hex, git_reference_name(ref))) < 0 ||
+		strstr(header->ptr, line.ptr) != NULL)
+		goto done;
+
+	if ((error = git_buf_puts(header, line.ptr + 1)) == 0)
+		error = add_ref_target(pb, walk, repo, git_reference_target(resolved));
+
+done:
+	git_buf_free(&line);
+	git_reference_free(resolved);
+	git_reference_free(ref);
+	return error;
+}
+
+static int write_cb(void *buf, size_t size, void *payload)
+{
+	git_filebuf *file = payload;
+	return git_filebuf_write(file, buf, size);
+}
+
+int git_bundle_init_options(git_bundle_create_options *opts, unsigned int version)
+{
+	GIT_INIT_STRUCTURE_FROM_TEMPLATE(
+		opts, version, git_bundle_create_options, GIT_BUNDLE_CREATE_OPTIONS_INIT);
+	return 0;
+}
+
+int git_bundle_create(
+	git_repository *repo,
+	const char *path,
+	const git_strarray *refs,
+	const git_bundle_create_options *given_opts)
+{
+	git_bundle_create_options opts = GIT_BUNDLE_CREATE_OPTIONS_INIT;
+	git_buf header = GIT_BUF_INIT;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_packbuilder *pb = NULL;
+	git_revwalk *walk = NULL;
+	git_oid id;
+	size_t i;
+	int error;
+
+	assert(repo && path && refs);
+
+	if (given_opts) {
+		GITERR_CHECK_VERSION(given_opts,
+			GIT_BUNDLE_CREATE_OPTIONS_VERSION, "git_bundle_create_options");
+		memcpy(&opts, given_opts, sizeof(opts));
+	}
+
+	if (opts.format != 2 && opts.format != 3) {
+		giterr_set(GITERR_INVALID, "Unsupported bundle version %u", opts.format);
+		return -1;
+	}
+
+	if (!refs->count) {
+		giterr_set(GITERR_INVALID, "Refusing to create an empty bundle");
+		return -1;
+	}
+
+	if ((error = git_packbuilder_new(&pb, repo)) < 0 ||
+		(error = git_revwalk_new(&walk, repo)) < 0)
+		goto done;
+
+	git_revwalk_sorting(walk, GIT_SORT_TIME);
+
+	if (opts.format == 3)
+		git_buf_puts(&header, GIT_BUNDLE_V3_SIGNATURE "@object-format=sha1\n");
+	else
+		git_buf_puts(&header, GIT_BUNDLE_V2_SIGNATURE);
+
+	for (i = 0; i < opts.prerequisites.count; ++i) {
+		if ((error = add_prerequisite(&header, walk, repo,
+				opts.prerequisites.strings[i])) < 0)
+			goto done;
+	}
+
+	for (i = 0; i < refs->count; ++i) {
+		if ((error = add_ref(&header, pb, walk, repo, refs->strings[i])) < 0)
+			goto done;
+	}
+
+	if ((error = git_buf_putc(&header, '\n')) < 0)
+		goto done;
+
+	/* The prerequisites' history is on the other side already */
+	while ((error = git_revwalk_next(&id, walk)) == 0) {
+		if ((error = git_packbuilder__insert_commit_changes(pb, &id)) < 0)
+			goto done;
+	}
+
+	if (error != GIT_ITEROVER)
+		goto done;
+
+	if ((error = git_filebuf_open(&file, path, 0, GIT_BUNDLE_FILE_MODE)) < 0 ||
+		(error = git_filebuf_write(&file, header.ptr, header.size)) < 0 ||
+		(error = git_packbuilder_foreach(pb, write_cb, &file)) < 0)
+		goto done;
+
+	error = git_filebuf_commit(&file);
+
+done:
+	git_filebuf_cleanup(&file);
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+	git_buf_free(&header);
+	return error;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_bundle_h__
+#define INCLUDE_bundle_h__
+
+#include "common.h"
+#include "array.h"
+#include "vector.h"
+#include "posix.h"
+#include "git2/oid.h"
+#include "git2/bundle.h"
+
+#define GIT_BUNDLE_V2_SIGNATURE "# v2 git bundle\n"
+#define GIT_BUNDLE_V3_SIGNATURE "# v3 git bundle\n"
+#define GIT_BUNDLE_FILE_MODE 0666
+
+/* Everything in a bundle file which comes before its packfile */
+typedef struct {
+	unsigned int format;
+	git_array_t(git_oid) prerequisites;
+	git_vector refs; /* of git_remote_head */
+	git_off_t pack_offset;
+} git_bundle_header;
+
+/* Whether the file at `path` starts out like a bundle */
+extern bool git_bundle__is_bundle(const char *path);
+
+/*
+ * Read the header of the bundle open at `fd`, which is left somewhere
+ * past it. The packfile starts at `pack_offset`.
+ */
+extern int git_bundle__read_header(git_bundle_header *out, git_file fd);
+
+extern void git_bundle__header_free(git_bundle_header *header);
+
+#endif
@@ -259,6 +259,13 @@ static int create_and_configure_origin(
 	if (options->ignore_cert_errors)
 		git_remote_check_cert(origin, 0);
 
+	if (options->depth)
+		git_remote_set_depth(origin, options->depth);
+
+	if (options->filter &&
+		(error = git_remote_set_filter(origin, options->filter)) < 0)
+		goto on_error;
+
 	if ((error = git_remote_set_callbacks(origin, &options->remote_callbacks)) < 0)
 		goto on_error;
 
@@ -120,6 +120,13 @@ static int commit_quick_parse(
 		buffer += parent_len;
 	}
 
+	/* The history of a shallow repository ends at its shallow commits */
+	if (walk->shallow_roots.size > 0 &&
+		git_shallow__contains(&walk->shallow_roots, &commit->oid)) {
+		parents_start = buffer;
+		parents = 0;
+	}
+
 	commit->parents = alloc_parents(walk, commit, parents);
 	GITERR_CHECK_ALLOC(commit->parents);
 
@@ -16,6 +16,7 @@
 #include "git2/types.h"
 #include "strmap.h"
 #include "array.h"
+#include "global.h"
 
 #include <ctype.h>
 #include <sys/types.h>
@@ -259,6 +260,239 @@ static int refcounted_strmap_alloc(refcounted_strmap **out)
 	return error;
 }
 
+/*
+ * The system, xdg and global files are read by every repository, so
+ * their parsed values are kept in a process-wide cache and shared
+ * between the backends which open them.  An entry is only used as long
+ * as none of the files it was read from, includes as well, has changed.
+ */
+
+#define config_cache_level(l) \
+	((l) >= GIT_CONFIG_LEVEL_SYSTEM && (l) <= GIT_CONFIG_LEVEL_GLOBAL)
+
+typedef struct {
+	char *path;
+	time_t mtime;
+	size_t size;
+	unsigned int ino;
+} config_cache_stamp;
+
+typedef struct {
+	git_config_level_t level;
+	refcounted_strmap *values;
+	git_array_t(config_cache_stamp) stamps;
+	char path[GIT_FLEX_ARRAY];
+} config_cache_entry;
+
+#ifdef GIT_THREADS
+static git_mutex config_cache_lock;
+#endif
+static git_strmap *config_cache;
+
+static void config_cache_entry_free(config_cache_entry *entry)
+{
+	size_t i;
+
+	for (i = 0; i < git_array_size(entry->stamps); i++)
+		git__free(git_array_get(entry->stamps, i)->path);
+
+	git_array_clear(entry->stamps);
+	refcounted_strmap_free(entry->values);
+	git__free(entry);
+}
+
+static void config_cache_remove(khiter_t pos)
+{
+	config_cache_entry *entry = git_strmap_value_at(config_cache, pos);
+
+	git_strmap_delete_at(config_cache, pos);
+	config_cache_entry_free(entry);
+}
+
+static void git_config_file_global_shutdown(void)
+{
+	config_cache_entry *entry;
+
+	if (config_cache) {
+		git_strmap_foreach_value(config_cache, entry,
+			config_cache_entry_free(entry));
+		git_strmap_free(config_cache);
+	}
+
+	git_mutex_free(&config_cache_lock);
+}
+
+int git_config_file_global_init(void)
+{
+	if (git_mutex_init(&config_cache_lock) != 0)
+		return -1;
+
+	git__on_shutdown(git_config_file_global_shutdown);
+	return 0;
+}
+
+static bool config_cache_stamp_valid(const config_cache_stamp *stamp)
+{
+	struct stat st;
+
+	return !p_stat(stamp->path, &st) &&
+		st.st_mtime == stamp->mtime &&
+		(size_t)st.st_size == stamp->size &&
+		(unsigned int)st.st_ino == stamp->ino;
+}
+
+/* Take the values and readers for `b` from the cache, if they are fresh */
+static int config_cache_lookup(diskfile_backend *b)
+{
+	config_cache_entry *entry;
+	config_cache_stamp *stamp;
+	struct reader *reader;
+	khiter_t pos;
+	size_t i;
+	int found = 0;
+
+	if (!config_cache_level(b->level) || git_mutex_lock(&config_cache_lock) < 0)
+		return 0;
+
+	if (!config_cache)
+		goto done;
+
+	pos = git_strmap_lookup_index(config_cache, b->file_path);
+	if (!git_strmap_valid_index(config_cache, pos))
+		goto done;
+
+	entry = git_strmap_value_at(config_cache, pos);
+
+	for (i = 0; i < git_array_size(entry->stamps); i++) {
+		if (!config_cache_stamp_valid(git_array_get(entry->stamps, i))) {
+			config_cache_remove(pos);
+			goto done;
+		}
+	}
+
+	if (entry->level != b->level)
+		goto done;
+
+	for (i = 0; i < git_array_size(entry->stamps); i++) {
+		stamp = git_array_get(entry->stamps, i);
+
+		if ((reader = git_array_alloc(b->readers)) == NULL)
+			goto done;
+
+		memset(reader, 0, sizeof(struct reader));
+
+		if ((reader->file_path = git__strdup(stamp->path)) == NULL)
+			goto done;
+
+		reader->file_mtime = stamp->mtime;
+		reader->file_size = stamp->size;
+	}
+
+	git_atomic_inc(&entry->values->refcount);
+	b->header.values = entry->values;
+	found = 1;
+
+done:
+	git_mutex_unlock(&config_cache_lock);
+
+	if (!found) {
+		for (i = 0; i < git_array_size(b->readers); i++)
+			git__free(git_array_get(b->readers, i)->file_path);
+		git_array_clear(b->readers);
+	}
+
+	return found;
+}
+
+/*
+ * Remember what `b` has just parsed.  Files which changed within the
+ * current second are left out, as another change in the same second
+ * might keep their size and time.
+ */
+static void config_cache_store(diskfile_backend *b)
+{
+	config_cache_entry *entry;
+	config_cache_stamp *stamp;
+	struct reader *reader;
+	struct stat st;
+	time_t now = time(NULL);
+	size_t i, path_len;
+	khiter_t pos;
+	int error;
+
+	if (!config_cache_level(b->level))
+		return;
+
+	path_len = strlen(b->file_path);
+
+	if ((entry = git__calloc(1, sizeof(config_cache_entry) + path_len + 1)) == NULL)
+		goto fail;
+
+	memcpy(entry->path, b->file_path, path_len);
+	entry->level = b->level;
+
+	for (i = 0; i < git_array_size(b->readers); i++) {
+		reader = git_array_get(b->readers, i);
+
+		if (p_stat(reader->file_path, &st) < 0 ||
+			st.st_mtime != reader->file_mtime ||
+			(size_t)st.st_size != reader->file_size ||
+			st.st_mtime >= now)
+			goto fail;
+
+		if ((stamp = git_array_alloc(entry->stamps)) == NULL ||
+			(stamp->path = git__strdup(reader->file_path)) == NULL)
+			goto fail;
+
+		stamp->mtime = st.st_mtime;
+		stamp->size = (size_t)st.st_size;
+		stamp->ino = (unsigned int)st.st_ino;
+	}
+
+	git_atomic_inc(&b->header.values->refcount);
+	entry->values = b->header.values;
+
+	if (git_mutex_lock(&config_cache_lock) < 0)
+		goto fail;
+
+	if (!config_cache && git_strmap_alloc(&config_cache) < 0) {
+		git_mutex_unlock(&config_cache_lock);
+		goto fail;
+	}
+
+	pos = git_strmap_lookup_index(config_cache, entry->path);
+	if (git_strmap_valid_index(config_cache, pos))
+		config_cache_remove(pos);
+
+	git_strmap_insert(config_cache, entry->path, entry, error);
+	git_mutex_unlock(&config_cache_lock);
+
+	if (error >= 0)
+		return;
+
+fail:
+	if (entry)
+		config_cache_entry_free(entry);
+	giterr_clear();
+}
+
+/* Drop the cached values of a file we are about to write */
+static void config_cache_forget(const char *path)
+{
+	khiter_t pos;
+
+	if (git_mutex_lock(&config_cache_lock) < 0)
+		return;
+
+	if (config_cache) {
+		pos = git_strmap_lookup_index(config_cache, path);
+		if (git_strmap_valid_index(config_cache, pos))
+			config_cache_remove(pos);
+	}
+
+	git_mutex_unlock(&config_cache_lock);
+}
+
 static int config_open(git_config_backend *cfg, git_config_level_t level)
 {
 	int res;
@@ -267,10 +501,13 @@ static int config_open(git_config_backend *cfg, git_config_level_t level)
 
 	b->level = level;
 
+	git_array_init(b->readers);
+	if (config_cache_lookup(b))
+		return 0;
+
 	if ((res = refcounted_strmap_alloc(&b->header.values)) < 0)
 		return res;
 
-	git_array_init(b->readers);
 	reader = git_array_alloc(b->readers);
 	if (!reader) {
 		refcounted_strmap_free(b->header.values);
@@ -297,6 +534,9 @@ static int config_open(git_config_backend *cfg, git_config_level_t level)
 	reader = git_array_get(b->readers, 0);
 	git_buf_free(&reader->buffer);
 
+	if (!res)
+		config_cache_store(b);
+
 	return res;
 }
 
@@ -1390,6 +1630,8 @@ static int config_write(diskfile_backend *cfg, const char *key, const regex_t *p
 			return result;
 	}
 
+	config_cache_forget(cfg->file_path);
+
 	skip_bom(reader);
 	ldot = strrchr(key, '.');
 	name = ldot + 1;
@@ -8,6 +8,10 @@
 #define INCLUDE_config_file_h__
 
 #include "git2/config.h"
+#include "git2/sys/config.h"
+
+/* Set up the cache of parsed config files shared by the process */
+extern int git_config_file_global_init(void);
 
 GIT_INLINE(int) git_config_file_open(git_config_backend *cfg, unsigned int level)
 {
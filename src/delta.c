@@ -105,6 +105,64 @@ static const unsigned int U[256] = {
 	0x133eb0ac, 0x6d8b90a1, 0x450d4467, 0x3bb8646a
 };
 
+/* Feed one more byte into the rolling rabin fingerprint `v` */
+#define RABIN_STEP(v, p) \
+	((v) = (((v) << 8) | (p)) ^ T[(v) >> RABIN_SHIFT])
+
+/*
+ * Compute the rabin fingerprint of the RABIN_WINDOW bytes following
+ * `data[0]`.  This runs once for every block of the source buffer when
+ * building the index, so the loop is unrolled for a RABIN_WINDOW of 16.
+ */
+#if RABIN_WINDOW != 16
+# error "rabin_window_hash() needs updating for the new RABIN_WINDOW"
+#endif
+
+GIT_INLINE(unsigned int) rabin_window_hash(const unsigned char *data)
+{
+	unsigned int val = 0;
+
+	RABIN_STEP(val, data[1]);  RABIN_STEP(val, data[2]);
+	RABIN_STEP(val, data[3]);  RABIN_STEP(val, data[4]);
+	RABIN_STEP(val, data[5]);  RABIN_STEP(val, data[6]);
+	RABIN_STEP(val, data[7]);  RABIN_STEP(val, data[8]);
+	RABIN_STEP(val, data[9]);  RABIN_STEP(val, data[10]);
+	RABIN_STEP(val, data[11]); RABIN_STEP(val, data[12]);
+	RABIN_STEP(val, data[13]); RABIN_STEP(val, data[14]);
+	RABIN_STEP(val, data[15]); RABIN_STEP(val, data[16]);
+
+	return val;
+}
+
+/*
+ * Return the number of leading bytes (at most `len`) that are equal in
+ * `a` and `b`.  Bytes are compared a machine word at a time and only the
+ * final, mismatching word is compared bytewise; unaligned loads go
+ * through `memcpy` which compilers lower to a single move.
+ */
+GIT_INLINE(unsigned int) match_forward(
+	const unsigned char *a, const unsigned char *b, unsigned int len)
+{
+	const unsigned char *start = a, *end = a + len;
+	size_t wa, wb;
+
+	while ((size_t)(end - a) >= sizeof(size_t)) {
+		memcpy(&wa, a, sizeof(size_t));
+		memcpy(&wb, b, sizeof(size_t));
+		if (wa != wb)
+			break;
+		a += sizeof(size_t);
+		b += sizeof(size_t);
+	}
+
+	while (a < end && *a == *b) {
+		a++;
+		b++;
+	}
+
+	return (unsigned int)(a - start);
+}
+
 struct index_entry {
 	const unsigned char *ptr;
 	unsigned int val;
@@ -179,9 +237,7 @@ git_delta_create_index(const void *buf, unsigned long bufsize)
 	for (data = buffer + entries * RABIN_WINDOW - RABIN_WINDOW;
 	     data >= buffer;
 	     data -= RABIN_WINDOW) {
-		unsigned int val = 0;
-		for (i = 1; i <= RABIN_WINDOW; i++)
-			val = ((val << 8) | data[i]) ^ T[val >> RABIN_SHIFT];
+		unsigned int val = rabin_window_hash(data);
 		if (val == prev_val) {
 			/* keep the lowest of consecutive identical blocks */
 			entry[-1].ptr = data + RABIN_WINDOW;
@@ -295,7 +351,7 @@ git_delta_create(
 	val = 0;
 	for (i = 0; i < RABIN_WINDOW && data < top; i++, data++) {
 		out[outpos++] = *data;
-		val = ((val << 8) | *data) ^ T[val >> RABIN_SHIFT];
+		RABIN_STEP(val, *data);
 	}
 	inscnt = i;
 
@@ -305,24 +361,23 @@ git_delta_create(
 		if (msize < 4096) {
 			struct index_entry *entry;
 			val ^= U[data[-RABIN_WINDOW]];
-			val = ((val << 8) | *data) ^ T[val >> RABIN_SHIFT];
+			RABIN_STEP(val, *data);
 			i = val & index->hash_mask;
 			for (entry = index->hash[i]; entry; entry = entry->next) {
 				const unsigned char *ref = entry->ptr;
-				const unsigned char *src = data;
 				unsigned int ref_size = (unsigned int)(ref_top - ref);
+				unsigned int match;
 				if (entry->val != val)
 					continue;
-				if (ref_size > (unsigned int)(top - src))
-					ref_size = (unsigned int)(top - src);
+				if (ref_size > (unsigned int)(top - data))
+					ref_size = (unsigned int)(top - data);
 				if (ref_size <= msize)
 					break;
-				while (ref_size-- && *src++ == *ref)
-					ref++;
-				if (msize < (unsigned int)(ref - entry->ptr)) {
+				match = match_forward(data, ref, ref_size);
+				if (msize < match) {
 					/* this is our best match so far */
-					msize = (unsigned int)(ref - entry->ptr);
-					moff = (unsigned int)(entry->ptr - ref_data);
+					msize = match;
+					moff = (unsigned int)(ref - ref_data);
 					if (msize >= 4096) /* good enough */
 						break;
 				}
@@ -391,8 +446,7 @@ git_delta_create(
 				int j;
 				val = 0;
 				for (j = -RABIN_WINDOW; j < 0; j++)
-					val = ((val << 8) | data[j])
-					      ^ T[val >> RABIN_SHIFT];
+					RABIN_STEP(val, data[j]);
 			}
 		}
 
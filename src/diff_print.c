@@ -306,7 +306,7 @@ static int print_binary_hunk(diff_print_info *pi, git_blob *old, git_blob *new)
 	inflated_len = (unsigned long)new_data_len;
 
 	if ((error = git_zstream_deflatebuf(
-			out, new_data, (size_t)new_data_len)) < 0)
+			out, new_data, (size_t)new_data_len, Z_DEFAULT_COMPRESSION)) < 0)
 		goto done;
 
 	/* The git_delta function accepts unsigned long only */
@@ -322,8 +322,8 @@ static int print_binary_hunk(diff_print_info *pi, git_blob *old, git_blob *new)
 			&delta_data_len, (unsigned long)deflate.size);
 
 		if (delta_data) {
-			error = git_zstream_deflatebuf(
-				&delta, delta_data, (size_t)delta_data_len);
+			error = git_zstream_deflatebuf(&delta, delta_data,
+				(size_t)delta_data_len, Z_DEFAULT_COMPRESSION);
 
 			git__free(delta_data);
 
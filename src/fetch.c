@@ -9,6 +9,7 @@
 #include "git2/refs.h"
 #include "git2/revwalk.h"
 #include "git2/transport.h"
+#include "git2/sys/odb_backend.h"
 
 #include "common.h"
 #include "remote.h"
@@ -18,6 +19,12 @@
 #include "netops.h"
 #include "repository.h"
 #include "refs.h"
+#include "odb.h"
+#include "pool.h"
+#include "shallow.h"
+#include "commit.h"
+#include "tree.h"
+#include "tag.h"
 
 static int maybe_want(git_remote *remote, git_remote_head *head, git_odb *odb, git_refspec *tagspec)
 {
@@ -41,8 +48,13 @@ static int maybe_want(git_remote *remote, git_remote_head *head, git_odb *odb, g
 	if (!match)
 		return 0;
 
-	/* If we have the object, mark it so we don't ask for it */
-	if (git_odb_exists(odb, &head->oid)) {
+	/*
+	 * If we have the object, mark it so we don't ask for it. A new
+	 * depth applies to the tips we already have too, so we want
+	 * them all when deepening.
+	 */
+	if (!remote->depth && !remote->deepen_since &&
+		git_odb_exists(odb, &head->oid)) {
 		head->local = 1;
 	}
 	else
@@ -127,13 +139,292 @@ int git_fetch_negotiate(git_remote *remote)
 		remote->refs.length);
 }
 
+int git_fetch__received_pack(git_remote *remote, git_odb_writepack *writepack)
+{
+	git_buf path = GIT_BUF_INIT;
+	int error;
+
+	git__free(remote->received_pack);
+	remote->received_pack = NULL;
+
+	/* Without a packfile to look at, there's nothing for us to check */
+	if ((error = git_odb__writepack_index_path(&path, writepack)) == GIT_ENOTFOUND)
+		return 0;
+
+	if (error < 0)
+		return error;
+
+	remote->received_pack = git_buf_detach(&path);
+	return 0;
+}
+
+/*
+ * The connectivity check makes sure that everything the fetched tips
+ * point to made it into the repository. The objects we had before are
+ * connected already, so the walk only goes through the ones in the
+ * pack we received and stops as soon as it reaches any other.
+ */
+typedef struct {
+	git_repository *repo;
+	git_odb *odb;
+	struct git_pack_file *pack;
+	git_shallow_array shallow;
+	git_oidmap *seen;
+	git_pool ids;
+	git_array_t(git_oid) todo;
+} connectivity;
+
+static int connectivity_mark(connectivity *c, const git_oid *id, bool blob)
+{
+	struct git_pack_entry entry;
+	git_oid *key, *next;
+	char hex[GIT_OID_HEXSZ + 1];
+	int error;
+
+	if (kh_get(oid, c->seen, id) != kh_end(c->seen))
+		return 0;
+
+	key = git_pool_malloc(&c->ids, 1);
+	GITERR_CHECK_ALLOC(key);
+	git_oid_cpy(key, id);
+
+	kh_put(oid, c->seen, key, &error);
+	if (error < 0) {
+		giterr_set_oom();
+		return -1;
+	}
+
+	if ((error = git_pack_entry_find(&entry, c->pack, id, GIT_OID_HEXSZ)) == GIT_ENOTFOUND) {
+		giterr_clear();
+
+		if (git_odb_exists(c->odb, id))
+			return 0;
+
+		giterr_set(GITERR_NET, "Connectivity check failed: object %s is missing",
+			git_oid_tostr(hex, sizeof(hex), id));
+		return -1;
+	}
+
+	if (error < 0 || blob)
+		return error;
+
+	next = git_array_alloc(c->todo);
+	GITERR_CHECK_ALLOC(next);
+	git_oid_cpy(next, id);
+
+	return 0;
+}
+
+static int connectivity_walk(connectivity *c, const git_oid *id)
+{
+	git_object *obj;
+	const git_tree_entry *entry;
+	size_t i;
+	int error;
+
+	if ((error = git_object_lookup(&obj, c->repo, id, GIT_OBJ_ANY)) < 0)
+		return error;
+
+	switch (git_object_type(obj)) {
+	case GIT_OBJ_COMMIT: {
+		git_commit *commit = (git_commit *)obj;
+		unsigned int n;
+
+		error = connectivity_mark(c, git_commit_tree_id(commit), false);
+
+		/* The parents of a shallow commit are missing on purpose */
+		if (git_shallow__contains(&c->shallow, id))
+			break;
+
+		for (n = 0; !error && n < git_commit_parentcount(commit); ++n)
+			error = connectivity_mark(c, git_commit_parent_id(commit, n), false);
+		break;
+	}
+
+	case GIT_OBJ_TREE:
+		for (i = 0; !error && i < git_tree_entrycount((git_tree *)obj); ++i) {
+			entry = git_tree_entry_byindex((git_tree *)obj, i);
+
+			/* Submodule commits live in another repository */
+			if (git_tree_entry_filemode(entry) == GIT_FILEMODE_COMMIT)
+				continue;
+
+			error = connectivity_mark(c, git_tree_entry_id(entry),
+				git_tree_entry_type(entry) == GIT_OBJ_BLOB);
+		}
+		break;
+
+	case GIT_OBJ_TAG:
+		error = connectivity_mark(c, git_tag_target_id((git_tag *)obj),
+			git_tag_target_type((git_tag *)obj) == GIT_OBJ_BLOB);
+		break;
+
+	default:
+		break;
+	}
+
+	git_object_free(obj);
+	return error;
+}
+
+static int check_connectivity(git_remote *remote)
+{
+	connectivity c;
+	git_remote_head *head;
+	git_oid *next, id;
+	size_t i;
+	int error;
+
+	/* Objects from a promisor remote may be missing on purpose */
+	if (!remote->received_pack || remote->promisor || remote->filter)
+		return 0;
+
+	memset(&c, 0, sizeof(c));
+	c.repo = remote->repo;
+
+	if ((error = git_repository_odb__weakptr(&c.odb, c.repo)) < 0 ||
+		(error = git_packfile_alloc(&c.pack, remote->received_pack)) < 0 ||
+		(error = git_shallow__roots(&c.shallow, c.repo)) < 0 ||
+		(error = git_pool_init(&c.ids, sizeof(git_oid), 0)) < 0)
+		goto done;
+
+	if ((c.seen = git_oidmap_alloc()) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	git_vector_foreach(&remote->refs, i, head) {
+		if (!head->local &&
+			(error = connectivity_mark(&c, &head->oid, false)) < 0)
+			goto done;
+	}
+
+	while ((next = git_array_pop(c.todo)) != NULL) {
+		/* Walking may grow the array under us */
+		git_oid_cpy(&id, next);
+
+		if ((error = connectivity_walk(&c, &id)) < 0)
+			break;
+	}
+
+done:
+	if (c.seen)
+		git_oidmap_free(c.seen);
+	git_pool_clear(&c.ids);
+	git_array_clear(c.todo);
+	git_array_clear(c.shallow);
+	if (c.pack)
+		git_packfile_free(c.pack);
+	return error;
+}
+
 int git_fetch_download_pack(git_remote *remote)
 {
 	git_transport *t = remote->transport;
+	int error;
+
+	git__free(remote->received_pack);
+	remote->received_pack = NULL;
 
 	if (!remote->need_pack)
 		return 0;
 
-	return t->download_pack(t, remote->repo, &remote->stats,
-			remote->callbacks.transfer_progress, remote->callbacks.payload);
+	if ((error = t->download_pack(t, remote->repo, &remote->stats,
+			remote->callbacks.transfer_progress, remote->callbacks.payload)) < 0)
+		return error;
+
+	return check_connectivity(remote);
+}
+
+static int promisor_remote_cb(const git_config_entry *entry, void *payload)
+{
+	git_buf *name = payload;
+	const char *start = entry->name + strlen("remote.");
+	const char *end = strrchr(entry->name, '.');
+	int promisor;
+
+	if (git_config_parse_bool(&promisor, entry->value) < 0 || !promisor) {
+		giterr_clear();
+		return 0;
+	}
+
+	/* The first promisor remote is the one we ask */
+	if (name->size > 0)
+		return 0;
+
+	return git_buf_set(name, start, end - start);
+}
+
+int git_fetch__promisor_remote(git_buf *name, git_repository *repo)
+{
+	git_config *config;
+	const char *value;
+	int error;
+
+	if ((error = git_repository_config__weakptr(&config, repo)) < 0)
+		return error;
+
+	if ((error = git_config_get_string(&value, config, "extensions.partialclone")) == 0)
+		return git_buf_sets(name, value);
+	else if (error != GIT_ENOTFOUND)
+		return error;
+
+	giterr_clear();
+
+	if ((error = git_config_foreach_match(config,
+			"^remote\\..+\\.promisor$", promisor_remote_cb, name)) < 0)
+		return error;
+
+	return name->size ? 0 : GIT_ENOTFOUND;
+}
+
+int git_fetch__missing_objects(
+	git_odb *odb, const git_oid *ids, size_t count, void *payload)
+{
+	git_repository *repo = payload;
+	git_buf name = GIT_BUF_INIT;
+	git_remote *remote = NULL;
+	git_remote_head *heads = NULL;
+	const git_remote_head **wants = NULL;
+	git_transport *t;
+	size_t i;
+	int error;
+
+	GIT_UNUSED(odb);
+
+	if ((error = git_fetch__promisor_remote(&name, repo)) < 0 ||
+		(error = git_remote_load(&remote, repo, name.ptr)) < 0)
+		goto cleanup;
+
+	/* We want exactly these objects, whatever the clone left out */
+	git__free(remote->filter);
+	remote->filter = NULL;
+
+	heads = git__calloc(count, sizeof(git_remote_head));
+	wants = git__calloc(count, sizeof(git_remote_head *));
+	if (!heads || !wants) {
+		error = -1;
+		goto cleanup;
+	}
+
+	for (i = 0; i < count; ++i) {
+		git_oid_cpy(&heads[i].oid, &ids[i]);
+		wants[i] = &heads[i];
+	}
+
+	if ((error = git_remote_connect(remote, GIT_DIRECTION_FETCH)) < 0)
+		goto cleanup;
+
+	t = remote->transport;
+
+	if ((error = t->negotiate_fetch(t, repo, wants, count)) < 0 ||
+		(error = t->download_pack(t, repo, &remote->stats, NULL, NULL)) < 0)
+		goto cleanup;
+
+cleanup:
+	git_remote_free(remote);
+	git__free(wants);
+	git__free(heads);
+	git_buf_free(&name);
+	return error;
 }
@@ -22,4 +22,25 @@ int git_fetch__download_pack(
 
 int git_fetch_setup_walk(git_revwalk **out, git_repository *repo);
 
+/*
+ * Remember which pack a transport wrote the fetched objects to, so
+ * the connectivity check after the download only has to look at them.
+ */
+int git_fetch__received_pack(
+	git_remote *remote, git_odb_writepack *writepack);
+
+/*
+ * Find the promisor remote that lazily fetched objects come from: the
+ * one named by extensions.partialclone, else the first remote marked
+ * as a promisor. Returns GIT_ENOTFOUND if the repository has none.
+ */
+int git_fetch__promisor_remote(git_buf *name, git_repository *repo);
+
+/*
+ * The missing-object callback of a repository's object database,
+ * fetching the objects from its promisor remote, if it has one.
+ */
+int git_fetch__missing_objects(
+	git_odb *odb, const git_oid *ids, size_t count, void *payload);
+
 #endif
@@ -228,7 +228,7 @@ int git_filebuf_open(git_filebuf *file, const char *path, int flags, mode_t mode
 	compression = flags >> GIT_FILEBUF_DEFLATE_SHIFT;
 
 	/* If we are deflating on-write, */
-	if (compression != 0) {
+	if (flags & GIT_FILEBUF_DEFLATE_CONTENTS) {
 		/* Initialize the ZLib stream */
 		if (deflateInit(&file->zs, compression) != Z_OK) {
 			giterr_set(GITERR_ZLIB, "Failed to initialize zlib");
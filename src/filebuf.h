@@ -20,7 +20,12 @@
 #define GIT_FILEBUF_FORCE				(1 << 3)
 #define GIT_FILEBUF_TEMPORARY			(1 << 4)
 #define GIT_FILEBUF_DO_NOT_BUFFER		(1 << 5)
-#define GIT_FILEBUF_DEFLATE_SHIFT		(6)
+#define GIT_FILEBUF_DEFLATE_CONTENTS	(1 << 6)
+#define GIT_FILEBUF_DEFLATE_SHIFT		(7)
+
+/* Flags to deflate the contents with the given zlib level (0-9) */
+#define GIT_FILEBUF_DEFLATE(level) \
+	(GIT_FILEBUF_DEFLATE_CONTENTS | ((level) << GIT_FILEBUF_DEFLATE_SHIFT))
 
 #define GIT_FILELOCK_EXTENSION ".lock\0"
 #define GIT_FILELOCK_EXTLENGTH 6
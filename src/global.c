@@ -8,6 +8,10 @@
 #include "global.h"
 #include "hash.h"
 #include "sysdir.h"
+#include "netops.h"
+#include "config_file.h"
+#include "repository.h"
+#include "zstream.h"
 #include "git2/threads.h"
 #include "thread-utils.h"
 
@@ -101,6 +105,16 @@ static void init_ssl(void)
 #endif
 }
 
+void git__global_state_clear(git_global_st *st)
+{
+#ifdef GIT_LIBDEFLATE
+	git_zstream__free_decompressor(st->decompressor);
+	st->decompressor = NULL;
+#else
+	GIT_UNUSED(st);
+#endif
+}
+
 /**
  * Handle the global state with TLS
  *
@@ -149,8 +163,11 @@ static int synchronized_threads_init(void)
 		return -1;
 
 	/* Initialize any other subsystems that have global state */
-	if ((error = git_hash_global_init()) >= 0)
-		error = git_sysdir_global_init();
+	if ((error = git_hash_global_init()) >= 0 &&
+		(error = git_sysdir_global_init()) >= 0 &&
+		(error = gitno_global_init()) >= 0 &&
+		(error = git_config_file_global_init()) >= 0)
+		error = git_repository_global_init();
 
 	win32_pthread_initialize();
 
@@ -221,6 +238,7 @@ int init_error = 0;
 
 static void cb__free_status(void *st)
 {
+	git__global_state_clear(st);
 	git__free(st);
 }
 
@@ -232,8 +250,11 @@ static void init_once(void)
 
 
 	/* Initialize any other subsystems that have global state */
-	if ((init_error = git_hash_global_init()) >= 0)
-		init_error = git_sysdir_global_init();
+	if ((init_error = git_hash_global_init()) >= 0 &&
+		(init_error = git_sysdir_global_init()) >= 0 &&
+		(init_error = gitno_global_init()) >= 0 &&
+		(init_error = git_config_file_global_init()) >= 0)
+		init_error = git_repository_global_init();
 
 	/* OpenSSL needs to be initialized from the main thread */
 	init_ssl();
@@ -260,6 +281,8 @@ void git_threads_shutdown(void)
 
 	ptr = pthread_getspecific(_tls_key);
 	pthread_setspecific(_tls_key, NULL);
+	if (ptr)
+		git__global_state_clear(ptr);
 	git__free(ptr);
 
 	pthread_key_delete(_tls_key);
@@ -291,16 +314,26 @@ static git_global_st __state;
 
 int git_threads_init(void)
 {
+	int error = 0;
+
 	init_ssl();
-	git_atomic_inc(&git__n_inits);
-	return 0;
+
+	/* Only do work on a 0 -> 1 transition of the refcount */
+	if (1 == git_atomic_inc(&git__n_inits) &&
+		(error = gitno_global_init()) >= 0 &&
+		(error = git_config_file_global_init()) >= 0)
+		error = git_repository_global_init();
+
+	return error;
 }
 
 void git_threads_shutdown(void)
 {
 	/* Shut down any subsystems that have global state */
-	if (0 == git_atomic_dec(&git__n_inits))
+	if (0 == git_atomic_dec(&git__n_inits)) {
 		git__shutdown();
+		git__global_state_clear(&__state);
+	}
 }
 
 git_global_st *git__global_state(void)
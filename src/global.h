@@ -10,9 +10,16 @@
 #include "mwindow.h"
 #include "hash.h"
 
+#ifdef GIT_LIBDEFLATE
+struct libdeflate_decompressor;
+#endif
+
 typedef struct {
 	git_error *last_error;
 	git_error error_t;
+#ifdef GIT_LIBDEFLATE
+	struct libdeflate_decompressor *decompressor;
+#endif
 } git_global_st;
 
 #ifdef GIT_SSL
@@ -22,6 +29,9 @@ extern SSL_CTX *git__ssl_ctx;
 
 git_global_st *git__global_state(void);
 
+/* Release what a thread's global state holds on to, but not the state */
+void git__global_state_clear(git_global_st *st);
+
 extern git_mutex git__mwindow_mutex;
 
 #define GIT_GLOBAL (git__global_state())
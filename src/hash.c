@@ -20,7 +20,7 @@ int git_hash_buf(git_oid *out, const void *data, size_t len)
 		error = git_hash_final(out, &ctx);
 
 	git_hash_ctx_cleanup(&ctx);
-	
+
 	return error;
 }
 
@@ -45,3 +45,139 @@ done:
 
 	return error;
 }
+
+/* Don't bother spinning up threads for less than this much data */
+#define HASH_BATCH_THREAD_MIN (1024 * 1024)
+
+struct hash_batch {
+	git_oid *out;
+	git_buf_vec *vec;
+	size_t n;
+	size_t parts;
+	int error;
+#ifdef GIT_THREADS
+	git_thread thread;
+	int started;
+#endif
+};
+
+static int hash_batch_run(struct hash_batch *batch)
+{
+	git_hash_ctx ctx;
+	size_t i, j;
+	int error = 0;
+
+	if (git_hash_ctx_init(&ctx) < 0)
+		return -1;
+
+	for (i = 0; i < batch->n && !error; i++) {
+		git_buf_vec *input = &batch->vec[i * batch->parts];
+
+		if (i > 0 && (error = git_hash_init(&ctx)) < 0)
+			break;
+
+		for (j = 0; j < batch->parts && !error; j++)
+			error = git_hash_update(&ctx, input[j].data, input[j].len);
+
+		if (!error)
+			error = git_hash_final(&batch->out[i], &ctx);
+	}
+
+	git_hash_ctx_cleanup(&ctx);
+
+	return error;
+}
+
+#ifdef GIT_THREADS
+
+static void *hash_batch_thread(void *payload)
+{
+	struct hash_batch *batch = payload;
+
+	batch->error = hash_batch_run(batch);
+	return NULL;
+}
+
+static size_t hash_batch_nthreads(git_buf_vec *vec, size_t n, size_t parts)
+{
+	size_t i, total = 0, nthreads = (size_t)git_online_cpus();
+
+	for (i = 0; i < n * parts; i++)
+		total += vec[i].len;
+
+	if (nthreads > total / HASH_BATCH_THREAD_MIN)
+		nthreads = total / HASH_BATCH_THREAD_MIN;
+	if (nthreads > n)
+		nthreads = n;
+
+	return nthreads;
+}
+
+static int hash_batch_threaded(
+	git_oid *out, git_buf_vec *vec, size_t n, size_t parts, size_t nthreads)
+{
+	struct hash_batch *batches;
+	size_t i, offset = 0;
+	int error = 0;
+
+	batches = git__calloc(nthreads, sizeof(struct hash_batch));
+	GITERR_CHECK_ALLOC(batches);
+
+	for (i = 0; i < nthreads; i++) {
+		size_t len = (n - offset) / (nthreads - i);
+
+		batches[i].out = out + offset;
+		batches[i].vec = vec + offset * parts;
+		batches[i].n = len;
+		batches[i].parts = parts;
+
+		offset += len;
+	}
+
+	/* the calling thread takes the first slice itself */
+	for (i = 1; i < nthreads; i++) {
+		if (git_thread_create(&batches[i].thread, NULL,
+				hash_batch_thread, &batches[i]) == 0)
+			batches[i].started = 1;
+		else
+			batches[i].error = hash_batch_run(&batches[i]);
+	}
+
+	error = hash_batch_run(&batches[0]);
+
+	for (i = 1; i < nthreads; i++) {
+		if (batches[i].started)
+			git_thread_join(&batches[i].thread, NULL);
+		if (batches[i].error < 0 && !error)
+			error = batches[i].error;
+	}
+
+	git__free(batches);
+
+	return error;
+}
+
+#endif
+
+int git_hash_batch(git_oid *out, git_buf_vec *vec, size_t n, size_t parts)
+{
+	struct hash_batch batch;
+
+	assert(out && (vec || !n) && parts);
+
+#ifdef GIT_THREADS
+	{
+		size_t nthreads = hash_batch_nthreads(vec, n, parts);
+
+		if (nthreads > 1)
+			return hash_batch_threaded(out, vec, n, parts, nthreads);
+	}
+#endif
+
+	batch.out = out;
+	batch.vec = vec;
+	batch.n = n;
+	batch.parts = parts;
+
+	return hash_batch_run(&batch);
+}
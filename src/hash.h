@@ -36,4 +36,12 @@ int git_hash_final(git_oid *out, git_hash_ctx *c);
 int git_hash_buf(git_oid *out, const void *data, size_t len);
 int git_hash_vec(git_oid *out, git_buf_vec *vec, size_t n);
 
+/*
+ * Hash `n` independent inputs, writing the id of input `i` to `out[i]`.
+ * Each input is made of `parts` consecutive buffers of `vec`, i.e. input
+ * `i` is `vec[i * parts]` through `vec[i * parts + parts - 1]`.  Large
+ * batches are spread over worker threads when threading is enabled.
+ */
+int git_hash_batch(git_oid *out, git_buf_vec *vec, size_t n, size_t parts);
+
 #endif /* INCLUDE_hash_h__ */
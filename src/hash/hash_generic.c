@@ -221,8 +221,158 @@ static void hash__block(git_hash_ctx *ctx, const unsigned int *data)
 	ctx->H[4] += E;
 }
 
+typedef void (*hash_blocks_fn)(
+	git_hash_ctx *ctx, const unsigned char *data, size_t blocks);
+
+static void hash__blocks_generic(
+	git_hash_ctx *ctx, const unsigned char *data, size_t blocks)
+{
+	for (; blocks; blocks--, data += 64)
+		hash__block(ctx, (const unsigned int *)data);
+}
+
+/*
+ * On x86 processors implementing the SHA extensions we can hand the
+ * compression function over to the `sha1rnds4` family of instructions.
+ * The code is built with a per-function target so the rest of the
+ * library keeps targeting the baseline ISA, and is only selected after
+ * checking CPUID at runtime.
+ */
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && \
+	(defined(__clang__) || __GNUC__ > 4 || \
+	 (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+/* Four rounds, consuming `e` and saving the current state into `e_next` */
+#define SHAEXT_ROUNDS(e, e_next, msg, fn) do { \
+	e = _mm_sha1nexte_epu32(e, msg); \
+	e_next = abcd; \
+	abcd = _mm_sha1rnds4_epu32(abcd, e, fn); } while (0)
+
+#define SHAEXT_LOAD(msg, p) do { \
+	msg = _mm_loadu_si128((const __m128i *)(p)); \
+	msg = _mm_shuffle_epi8(msg, bswap); } while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void hash__blocks_shaext(
+	git_hash_ctx *ctx, const unsigned char *data, size_t blocks)
+{
+	const __m128i bswap = _mm_set_epi64x(
+		0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1;
+	__m128i m0, m1, m2, m3;
+
+	abcd = _mm_loadu_si128((const __m128i *)ctx->H);
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	e0 = _mm_set_epi32((int)ctx->H[4], 0, 0, 0);
+
+	for (; blocks; blocks--, data += 64) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		/* Rounds 0-15 load the message schedule from the input */
+		SHAEXT_LOAD(m0, data);
+		e0 = _mm_add_epi32(e0, m0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+		SHAEXT_LOAD(m1, data + 16);
+		SHAEXT_ROUNDS(e1, e0, m1, 0);
+		m0 = _mm_sha1msg1_epu32(m0, m1);
+
+		SHAEXT_LOAD(m2, data + 32);
+		SHAEXT_ROUNDS(e0, e1, m2, 0);
+		m1 = _mm_sha1msg1_epu32(m1, m2);
+		m0 = _mm_xor_si128(m0, m2);
+
+		SHAEXT_LOAD(m3, data + 48);
+		SHAEXT_ROUNDS(e1, e0, m3, 0);
+		m0 = _mm_sha1msg2_epu32(m0, m3);
+		m2 = _mm_sha1msg1_epu32(m2, m3);
+		m1 = _mm_xor_si128(m1, m3);
+
+		/* Rounds 16-67 mix the schedule four words at a time */
+#define SHAEXT_MIX(e, e_next, a, b, c, d, fn) do { \
+	SHAEXT_ROUNDS(e, e_next, a, fn); \
+	b = _mm_sha1msg2_epu32(b, a); \
+	d = _mm_sha1msg1_epu32(d, a); \
+	c = _mm_xor_si128(c, a); } while (0)
+
+		SHAEXT_MIX(e0, e1, m0, m1, m2, m3, 0);
+		SHAEXT_MIX(e1, e0, m1, m2, m3, m0, 1);
+		SHAEXT_MIX(e0, e1, m2, m3, m0, m1, 1);
+		SHAEXT_MIX(e1, e0, m3, m0, m1, m2, 1);
+		SHAEXT_MIX(e0, e1, m0, m1, m2, m3, 1);
+		SHAEXT_MIX(e1, e0, m1, m2, m3, m0, 1);
+		SHAEXT_MIX(e0, e1, m2, m3, m0, m1, 2);
+		SHAEXT_MIX(e1, e0, m3, m0, m1, m2, 2);
+		SHAEXT_MIX(e0, e1, m0, m1, m2, m3, 2);
+		SHAEXT_MIX(e1, e0, m1, m2, m3, m0, 2);
+		SHAEXT_MIX(e0, e1, m2, m3, m0, m1, 2);
+		SHAEXT_MIX(e1, e0, m3, m0, m1, m2, 3);
+		SHAEXT_MIX(e0, e1, m0, m1, m2, m3, 3);
+
+#undef SHAEXT_MIX
+
+		/* Rounds 68-79 drain the remaining schedule */
+		SHAEXT_ROUNDS(e1, e0, m1, 3);
+		m2 = _mm_sha1msg2_epu32(m2, m1);
+		m3 = _mm_xor_si128(m3, m1);
+
+		SHAEXT_ROUNDS(e0, e1, m2, 3);
+		m3 = _mm_sha1msg2_epu32(m3, m2);
+
+		SHAEXT_ROUNDS(e1, e0, m3, 3);
+
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	_mm_storeu_si128((__m128i *)ctx->H, abcd);
+	ctx->H[4] = (unsigned int)_mm_extract_epi32(e0, 3);
+}
+
+static hash_blocks_fn hash__select_blocks(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	/* SSSE3 and SSE4.1 for the shuffles, leaf 7 EBX bit 29 for SHA */
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+		!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+		return hash__blocks_generic;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return hash__blocks_generic;
+
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+	return (ebx & (1u << 29)) ? hash__blocks_shaext : hash__blocks_generic;
+}
+
+#else
+
+/* Other processors, ARMv8 included, use the portable rounds for now */
+static hash_blocks_fn hash__select_blocks(void)
+{
+	return hash__blocks_generic;
+}
+
+#endif
+
+/*
+ * The block function is picked lazily on first use; racing threads
+ * will all store the same pointer.
+ */
+static hash_blocks_fn hash__blocks;
+
 int git_hash_init(git_hash_ctx *ctx)
 {
+	if (!hash__blocks)
+		hash__blocks = hash__select_blocks();
+
 	ctx->size = 0;
 
 	/* Initialize H with the magic constants (see FIPS180 for constants) */
@@ -252,12 +402,12 @@ int git_hash_update(git_hash_ctx *ctx, const void *data, size_t len)
 		data = ((const char *)data + left);
 		if (lenW)
 			return 0;
-		hash__block(ctx, ctx->W);
+		hash__blocks(ctx, (const unsigned char *)ctx->W, 1);
 	}
-	while (len >= 64) {
-		hash__block(ctx, data);
-		data = ((const char *)data + 64);
-		len -= 64;
+	if (len >= 64) {
+		hash__blocks(ctx, data, len / 64);
+		data = ((const char *)data + (len & ~(size_t)63));
+		len &= 63;
 	}
 	if (len)
 		memcpy(ctx->W, data, len);
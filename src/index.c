@@ -2356,6 +2356,106 @@ git_repository *git_index_owner(const git_index *index)
 	return INDEX_OWNER(index);
 }
 
+/*
+ * `git_index_add_all` reads small regular files up front and hashes and
+ * writes them to the ODB in batches of a few megabytes at most; larger
+ * files, symlinks and submodules go through `git_blob_create_fromworkdir`
+ * one at a time.
+ */
+#define INDEX_ADD_BATCH_COUNT 64
+#define INDEX_ADD_BATCH_FILE_MAX (1024 * 1024)
+#define INDEX_ADD_BATCH_BYTES (4 * 1024 * 1024)
+
+typedef struct {
+	git_index_entry *entries[INDEX_ADD_BATCH_COUNT];
+	git_buf contents[INDEX_ADD_BATCH_COUNT];
+	size_t count;
+	size_t bytes;
+} index_add_batch;
+
+static int index_add_all_insert(
+	git_index *index, git_index_entry *entry, const git_oid *blobid)
+{
+	int error;
+	const char *path;
+
+	entry->id = *blobid;
+
+	/* add working directory item to index */
+	if ((error = index_insert(index, &entry, 1)) < 0)
+		return error;
+
+	path = entry->path;
+	git_tree_cache_invalidate_path(index->tree, path);
+
+	/* add implies conflict resolved, move conflict entries to REUC */
+	if ((error = index_conflict_to_reuc(index, path)) < 0) {
+		if (error != GIT_ENOTFOUND)
+			return error;
+		giterr_clear();
+		error = 0;
+	}
+
+	return error;
+}
+
+static void index_add_batch_clear(index_add_batch *batch, size_t from)
+{
+	size_t i;
+
+	for (i = from; i < batch->count; i++) {
+		index_entry_free(batch->entries[i]);
+		git_buf_free(&batch->contents[i]);
+	}
+
+	batch->count = 0;
+	batch->bytes = 0;
+}
+
+static int index_add_batch_flush(git_index *index, index_add_batch *batch)
+{
+	git_odb *odb;
+	git_rawobj objs[INDEX_ADD_BATCH_COUNT];
+	git_oid ids[INDEX_ADD_BATCH_COUNT];
+	size_t i;
+	int error;
+
+	if (!batch->count)
+		return 0;
+
+	if ((error = git_repository_odb__weakptr(&odb, INDEX_OWNER(index))) < 0)
+		goto done;
+
+	for (i = 0; i < batch->count; i++) {
+		objs[i].data = batch->contents[i].ptr;
+		objs[i].len = batch->contents[i].size;
+		objs[i].type = GIT_OBJ_BLOB;
+	}
+
+	if ((error = git_odb__write_batch(ids, odb, objs, batch->count)) < 0)
+		goto done;
+
+	for (i = 0; i < batch->count; i++) {
+		git_index_entry *entry = batch->entries[i];
+
+		git_buf_free(&batch->contents[i]);
+		batch->entries[i] = NULL;
+
+		if ((error = index_add_all_insert(index, entry, &ids[i])) < 0) {
+			i++;
+			break;
+		}
+	}
+
+	/* release whatever was not inserted */
+	index_add_batch_clear(batch, i);
+	return error;
+
+done:
+	index_add_batch_clear(batch, 0);
+	return error;
+}
+
 int git_index_add_all(
 	git_index *index,
 	const git_strarray *paths,
@@ -2374,6 +2474,8 @@ int git_index_add_all(
 	bool no_fnmatch = (flags & GIT_INDEX_ADD_DISABLE_PATHSPEC_MATCH) != 0;
 	int ignorecase;
 	git_oid blobid;
+	index_add_batch batch;
+	int flush_error;
 
 	assert(index);
 
@@ -2392,6 +2494,8 @@ int git_index_add_all(
 	if ((error = git_pathspec__init(&ps, paths)) < 0)
 		return error;
 
+	memset(&batch, 0, sizeof(batch));
+
 	/* optionally check that pathspec doesn't mention any ignored files */
 	if ((flags & GIT_INDEX_ADD_CHECK_PATHSPEC) != 0 &&
 		(flags & GIT_INDEX_ADD_FORCE) == 0 &&
@@ -2430,34 +2534,47 @@ int git_index_add_all(
 		 * match to the file in the index and skip this work if it is?
 		 */
 
+		if (GIT_MODE_TYPE(wd->mode) == GIT_MODE_TYPE(GIT_FILEMODE_BLOB) &&
+			wd->file_size < INDEX_ADD_BATCH_FILE_MAX) {
+			git_buf *contents = &batch.contents[batch.count];
+
+			/* read the file now, hash and write it with the batch */
+			if ((error = git_blob__read_workdir_filtered(
+					contents, repo, wd->path)) < 0 ||
+				(error = index_entry_dup(&entry, wd)) < 0) {
+				git_buf_free(contents);
+				break;
+			}
+
+			batch.entries[batch.count++] = entry;
+			batch.bytes += contents->size;
+
+			if ((batch.count == INDEX_ADD_BATCH_COUNT ||
+				 batch.bytes >= INDEX_ADD_BATCH_BYTES) &&
+				(error = index_add_batch_flush(index, &batch)) < 0)
+				break;
+
+			continue;
+		}
+
 		/* write the blob to disk and get the oid */
 		if ((error = git_blob_create_fromworkdir(&blobid, repo, wd->path)) < 0)
 			break;
 
 		/* make the new entry to insert */
-		if ((error = index_entry_dup(&entry, wd)) < 0)
+		if ((error = index_entry_dup(&entry, wd)) < 0 ||
+			(error = index_add_all_insert(index, entry, &blobid)) < 0)
 			break;
-
-		entry->id = blobid;
-
-		/* add working directory item to index */
-		if ((error = index_insert(index, &entry, 1)) < 0)
-			break;
-
-		git_tree_cache_invalidate_path(index->tree, wd->path);
-
-		/* add implies conflict resolved, move conflict entries to REUC */
-		if ((error = index_conflict_to_reuc(index, wd->path)) < 0) {
-			if (error != GIT_ENOTFOUND)
-				break;
-			giterr_clear();
-		}
 	}
 
+	/* files read before an error or cancellation are still added */
+	flush_error = index_add_batch_flush(index, &batch);
+
 	if (error == GIT_ITEROVER)
-		error = 0;
+		error = flush_error;
 
 cleanup:
+	index_add_batch_clear(&batch, 0);
 	git_iterator_free(wditer);
 	git_pathspec__clear(&ps);
 
@@ -9,6 +9,7 @@
 #include "git2/object.h"
 
 #include "common.h"
+#include "indexer.h"
 #include "pack.h"
 #include "mwindow.h"
 #include "posix.h"
@@ -20,6 +21,8 @@
 
 #define UINT31_MAX (0x7FFFFFFF)
 
+int git_indexer__progress_interval = 0;
+
 struct entry {
 	git_oid oid;
 	uint32_t crc;
@@ -46,6 +49,7 @@ struct git_indexer {
 	git_oid hash;
 	git_transfer_progress_cb progress_cb;
 	void *progress_payload;
+	double start_time, last_progress;
 	char objbuf[8*1024];
 
 	/* Needed to look up objects which we want to inject to fix a thin pack */
@@ -117,6 +121,7 @@ int git_indexer_new(
 	idx->odb = odb;
 	idx->progress_cb = progress_cb;
 	idx->progress_payload = progress_payload;
+	idx->start_time = git__timer();
 	idx->mode = mode ? mode : GIT_PACK_FILE_MODE;
 	git_hash_ctx_init(&idx->trailer);
 
@@ -176,17 +181,25 @@ static void hash_header(git_hash_ctx *ctx, git_off_t len, git_otype type)
 	git_hash_update(ctx, buffer, hdrlen);
 }
 
-static int hash_object_stream(git_indexer*idx, git_packfile_stream *stream)
+static int hash_object_stream(
+	git_indexer *idx, git_packfile_stream *stream, git_transfer_progress *stats)
 {
 	ssize_t read;
+	double start, inflated;
 
 	assert(idx && stream);
 
 	do {
+		start = git__timer();
+
 		if ((read = git_packfile_stream_read(stream, idx->objbuf, sizeof(idx->objbuf))) < 0)
 			break;
 
+		inflated = git__timer();
 		git_hash_update(&idx->hash_ctx, idx->objbuf, read);
+
+		stats->inflate_time += inflated - start;
+		stats->hash_time += git__timer() - inflated;
 	} while (read > 0);
 
 	if (read < 0)
@@ -215,9 +228,11 @@ static int advance_delta_offset(git_indexer *idx, git_otype type)
 }
 
 /* Read from the stream and discard any output */
-static int read_object_stream(git_indexer *idx, git_packfile_stream *stream)
+static int read_object_stream(
+	git_indexer *idx, git_packfile_stream *stream, git_transfer_progress *stats)
 {
 	ssize_t read;
+	double start = git__timer();
 
 	assert(stream);
 
@@ -225,6 +240,8 @@ static int read_object_stream(git_indexer *idx, git_packfile_stream *stream)
 		read = git_packfile_stream_read(stream, idx->objbuf, sizeof(idx->objbuf));
 	} while (read > 0);
 
+	stats->inflate_time += git__timer() - start;
+
 	if (read < 0)
 		return (int)read;
 
@@ -343,20 +360,27 @@ static int save_entry(git_indexer *idx, struct entry *entry, struct git_pack_ent
 	return 0;
 }
 
-static int hash_and_save(git_indexer *idx, git_rawobj *obj, git_off_t entry_start)
+static int hash_and_save(
+	git_indexer *idx,
+	git_rawobj *obj,
+	git_off_t entry_start,
+	git_transfer_progress *stats)
 {
 	git_oid oid;
 	size_t entry_size;
 	struct entry *entry;
 	struct git_pack_entry *pentry = NULL;
+	double start;
 
 	entry = git__calloc(1, sizeof(*entry));
 	GITERR_CHECK_ALLOC(entry);
 
+	start = git__timer();
 	if (git_odb__hashobj(&oid, obj) < 0) {
 		giterr_set(GITERR_INDEXER, "Failed to hash object");
 		goto on_error;
 	}
+	stats->hash_time += git__timer() - start;
 
 	pentry = git__calloc(1, sizeof(struct git_pack_entry));
 	GITERR_CHECK_ALLOC(pentry);
@@ -378,13 +402,40 @@ on_error:
 	return -1;
 }
 
-static int do_progress_callback(git_indexer *idx, git_transfer_progress *stats)
+static void update_rate(git_indexer *idx, git_transfer_progress *stats, double now)
 {
-	if (idx->progress_cb)
-		return giterr_set_after_callback_function(
-			idx->progress_cb(stats, idx->progress_payload),
-			"indexer progress");
-	return 0;
+	double elapsed = now - idx->start_time;
+
+	if (elapsed > 0)
+		stats->objects_per_second = stats->received_objects / elapsed;
+}
+
+/*
+ * Unless `force` is set, updates that come in quicker than the
+ * configured interval are not reported.
+ */
+static int do_progress_callback(
+	git_indexer *idx, git_transfer_progress *stats, bool force)
+{
+	double now;
+
+	if (!idx->progress_cb)
+		return 0;
+
+	now = git__timer();
+	if (!force && git_indexer__progress_interval > 0 &&
+		(now - idx->last_progress) * 1000 < git_indexer__progress_interval)
+		return 0;
+
+	idx->last_progress = now;
+
+	/* Once everything is in, the rate stays what it was at the end */
+	if (stats->received_objects < stats->total_objects)
+		update_rate(idx, stats, now);
+
+	return giterr_set_after_callback_function(
+		idx->progress_cb(stats, idx->progress_payload),
+		"indexer progress");
 }
 
 /* Hash everything but the last 20B of input */
@@ -470,6 +521,8 @@ int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_tran
 	size_t processed;
 	struct git_pack_header *hdr = &idx->hdr;
 	git_mwindow_file *mwf = &idx->pack->mwf;
+	double start;
+	bool done;
 
 	assert(idx && data && stats);
 
@@ -478,7 +531,9 @@ int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_tran
 	if ((error = append_to_pack(idx, data, size)) < 0)
 		return error;
 
+	start = git__timer();
 	hash_partially(idx, data, (int)size);
+	stats->hash_time += git__timer() - start;
 
 	/* Make sure we set the new size of the pack */
 	idx->pack->mwf.size += size;
@@ -520,7 +575,7 @@ int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_tran
 		processed = stats->indexed_objects = 0;
 		stats->total_objects = total_objects;
 
-		if ((error = do_progress_callback(idx, stats)) != 0)
+		if ((error = do_progress_callback(idx, stats, true)) != 0)
 			return error;
 	}
 
@@ -575,9 +630,9 @@ int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_tran
 		}
 
 		if (idx->have_delta) {
-			error = read_object_stream(idx, stream);
+			error = read_object_stream(idx, stream, stats);
 		} else {
-			error = hash_object_stream(idx, stream);
+			error = hash_object_stream(idx, stream, stats);
 		}
 
 		idx->off = stream->curpos;
@@ -604,8 +659,12 @@ int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_tran
 			stats->indexed_objects = (unsigned int)++processed;
 		}
 		stats->received_objects++;
+		done = (stats->received_objects == stats->total_objects);
+
+		if (done)
+			update_rate(idx, stats, git__timer());
 
-		if ((error = do_progress_callback(idx, stats)) != 0)
+		if ((error = do_progress_callback(idx, stats, done)) != 0)
 			goto on_error;
 	}
 
@@ -683,7 +742,8 @@ static int inject_object(git_indexer *idx, git_oid *id)
 	idx->pack->mwf.size += hdr_len;
 	entry->crc = crc32(entry->crc, hdr, (uInt)hdr_len);
 
-	if ((error = git_zstream_deflatebuf(&buf, data, len)) < 0)
+	if ((error = git_zstream_deflatebuf(
+			&buf, data, len, git_zstream__pack_level)) < 0)
 		goto cleanup;
 
 	/* And then the compressed object */
@@ -800,14 +860,15 @@ static int resolve_deltas(git_indexer *idx, git_transfer_progress *stats)
 			if (git_packfile_unpack(&obj, idx->pack, &idx->off) < 0)
 				continue;
 
-			if (hash_and_save(idx, &obj, delta->delta_off) < 0)
+			if (hash_and_save(idx, &obj, delta->delta_off, stats) < 0)
 				continue;
 
 			git__free(obj.data);
 			stats->indexed_objects++;
 			stats->indexed_deltas++;
 			progressed = 1;
-			if ((progress_cb_result = do_progress_callback(idx, stats)) < 0)
+			if ((progress_cb_result = do_progress_callback(idx, stats,
+					stats->indexed_deltas == stats->total_deltas)) < 0)
 				return progress_cb_result;
 
 			/* remove from the list */
@@ -883,6 +944,7 @@ int git_indexer_commit(git_indexer *idx, git_transfer_progress *stats)
 	git_hash_ctx ctx;
 	git_filebuf index_file = {0};
 	void *packfile_trailer;
+	double start, hashed;
 
 	if (git_hash_ctx_init(&ctx) < 0)
 		return -1;
@@ -912,7 +974,14 @@ int git_indexer_commit(git_indexer *idx, git_transfer_progress *stats)
 	/* Freeze the number of deltas */
 	stats->total_deltas = stats->total_objects - stats->indexed_objects;
 
-	if ((error = resolve_deltas(idx, stats)) < 0)
+	/* Hashing the resolved objects is accounted for separately */
+	start = git__timer();
+	hashed = stats->hash_time;
+
+	error = resolve_deltas(idx, stats);
+	stats->resolve_time += git__timer() - start - (stats->hash_time - hashed);
+
+	if (error < 0)
 		return error;
 
 	if (stats->indexed_objects != stats->total_objects) {
@@ -921,9 +990,13 @@ int git_indexer_commit(git_indexer *idx, git_transfer_progress *stats)
 	}
 
 	if (stats->local_objects > 0) {
+		start = git__timer();
+
 		if (update_header_and_rehash(idx, stats) < 0)
 			return -1;
 
+		stats->hash_time += git__timer() - start;
+
 		git_hash_final(&trailer_hash, &idx->trailer);
 		write_at(idx, &trailer_hash, idx->pack->mwf.size - GIT_OID_RAWSZ, GIT_OID_RAWSZ);
 	}
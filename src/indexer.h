@@ -0,0 +1,17 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_indexer_h__
+#define INCLUDE_indexer_h__
+
+/*
+ * The minimal interval between transfer progress callbacks, in
+ * milliseconds, for the indexer and the network side of a fetch alike.
+ * See GIT_OPT_SET_TRANSFER_PROGRESS_INTERVAL.
+ */
+extern int git_indexer__progress_interval;
+
+#endif
@@ -23,6 +23,11 @@
 #define GIT_MAP_TYPE	0xf
 #define GIT_MAP_FIXED	0x10
 
+/* p_madvise() advice values */
+#define GIT_MADV_NORMAL 0
+#define GIT_MADV_RANDOM 1
+#define GIT_MADV_SEQUENTIAL 2
+
 #ifdef __amigaos4__
 #define MAP_FAILED 0
 #endif
@@ -43,4 +48,7 @@ typedef struct { /* memory mapped buffer	*/
 extern int p_mmap(git_map *out, size_t len, int prot, int flags, int fd, git_off_t offset);
 extern int p_munmap(git_map *map);
 
+/* A hint about how the map will be read; failing to take it isn't an error */
+extern void p_madvise(git_map *map, int advice);
+
 #endif /* INCLUDE_map_h__ */
@@ -22,9 +22,29 @@
 
 size_t git_mwindow__window_size = DEFAULT_WINDOW_SIZE;
 size_t git_mwindow__mapped_limit = DEFAULT_MAPPED_LIMIT;
+size_t git_mwindow__file_limit = 0;
 
 /* Whenever you want to read or modify this, grab git__mwindow_mutex */
-static git_mwindow_ctl mem_ctl;
+git_mwindow_ctl git_mwindow__mem_ctl;
+
+/* Unmap all the windows of a file. Called under lock. */
+static void free_windows(git_mwindow_file *mwf)
+{
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
+
+	while (mwf->windows) {
+		git_mwindow *w = mwf->windows;
+		assert(w->inuse_cnt == 0);
+
+		ctl->mapped -= w->window_map.len;
+		ctl->open_windows--;
+
+		git_futils_mmap_free(&w->window_map);
+
+		mwf->windows = w->next;
+		git__free(w);
+	}
+}
 
 /*
  * Free all the windows in a sequence, typically because we're done
@@ -32,7 +52,7 @@ static git_mwindow_ctl mem_ctl;
  */
 void git_mwindow_free_all(git_mwindow_file *mwf)
 {
-	git_mwindow_ctl *ctl = &mem_ctl;
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
 	size_t i;
 
 	if (git_mutex_lock(&git__mwindow_mutex)) {
@@ -55,18 +75,7 @@ void git_mwindow_free_all(git_mwindow_file *mwf)
 		ctl->windowfiles.contents = NULL;
 	}
 
-	while (mwf->windows) {
-		git_mwindow *w = mwf->windows;
-		assert(w->inuse_cnt == 0);
-
-		ctl->mapped -= w->window_map.len;
-		ctl->open_windows--;
-
-		git_futils_mmap_free(&w->window_map);
-
-		mwf->windows = w->next;
-		git__free(w);
-	}
+	free_windows(mwf);
 
 	git_mutex_unlock(&git__mwindow_mutex);
 }
@@ -114,7 +123,7 @@ static void git_mwindow_scan_lru(
  */
 static int git_mwindow_close_lru(git_mwindow_file *mwf)
 {
-	git_mwindow_ctl *ctl = &mem_ctl;
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
 	size_t i;
 	git_mwindow *lru_w = NULL, *lru_l = NULL, **list = &mwf->windows;
 
@@ -149,6 +158,44 @@ static int git_mwindow_close_lru(git_mwindow_file *mwf)
 	return 0;
 }
 
+/*
+ * Close the least recently used file to stay under the file limit. Only
+ * files whose owner can open them again and which have no window in
+ * use qualify. Its windows go with it, and it is deregistered until it
+ * gets opened again. Called under lock from git_mwindow_file_register.
+ */
+static int git_mwindow_close_lru_file(void)
+{
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
+	git_mwindow_file *cur, *lru = NULL;
+	git_mwindow *w;
+	size_t i, lru_pos = 0;
+
+	git_vector_foreach(&ctl->windowfiles, i, cur) {
+		if (!cur->reopenable)
+			continue;
+
+		for (w = cur->windows; w && !w->inuse_cnt; w = w->next)
+			/* look for a window in use */;
+
+		if (!w && (!lru || cur->last_used < lru->last_used)) {
+			lru = cur;
+			lru_pos = i;
+		}
+	}
+
+	if (!lru)
+		return -1;
+
+	git_vector_remove(&ctl->windowfiles, lru_pos);
+	free_windows(lru);
+
+	p_close(lru->fd);
+	lru->fd = -1;
+
+	return 0;
+}
+
 /* This gets called under lock from git_mwindow_open */
 static git_mwindow *new_window(
 	git_mwindow_file *mwf,
@@ -156,7 +203,7 @@ static git_mwindow *new_window(
 	git_off_t size,
 	git_off_t offset)
 {
-	git_mwindow_ctl *ctl = &mem_ctl;
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
 	size_t walign = git_mwindow__window_size / 2;
 	git_off_t len;
 	git_mwindow *w;
@@ -212,7 +259,7 @@ unsigned char *git_mwindow_open(
 	size_t extra,
 	unsigned int *left)
 {
-	git_mwindow_ctl *ctl = &mem_ctl;
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
 	git_mwindow *w = *cursor;
 
 	if (git_mutex_lock(&git__mwindow_mutex)) {
@@ -236,8 +283,16 @@ unsigned char *git_mwindow_open(
 		 * one.
 		 */
 		if (!w) {
+			if (mwf->fd < 0) {
+				giterr_set(GITERR_OS, "Failed to map window; the file was closed");
+				*cursor = NULL;
+				git_mutex_unlock(&git__mwindow_mutex);
+				return NULL;
+			}
+
 			w = new_window(mwf, mwf->fd, mwf->size, offset);
 			if (w == NULL) {
+				*cursor = NULL;
 				git_mutex_unlock(&git__mwindow_mutex);
 				return NULL;
 			}
@@ -251,6 +306,7 @@ unsigned char *git_mwindow_open(
 		w->last_used = ctl->used_ctr++;
 		w->inuse_cnt++;
 		*cursor = w;
+		mwf->last_used = w->last_used;
 	}
 
 	offset -= w->offset;
@@ -264,7 +320,7 @@ unsigned char *git_mwindow_open(
 
 int git_mwindow_file_register(git_mwindow_file *mwf)
 {
-	git_mwindow_ctl *ctl = &mem_ctl;
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
 	int ret;
 
 	if (git_mutex_lock(&git__mwindow_mutex)) {
@@ -278,6 +334,15 @@ int git_mwindow_file_register(git_mwindow_file *mwf)
 		return -1;
 	}
 
+	/*
+	 * Like `mapped_limit`, the file limit is a soft one: when nothing
+	 * can be closed, this file is opened all the same.
+	 */
+	while (git_mwindow__file_limit &&
+		git_mwindow__file_limit <= ctl->windowfiles.length &&
+		git_mwindow_close_lru_file() == 0) /* nop */;
+
+	mwf->last_used = ctl->used_ctr++;
 	ret = git_vector_insert(&ctl->windowfiles, mwf);
 	git_mutex_unlock(&git__mwindow_mutex);
 
@@ -286,7 +351,7 @@ int git_mwindow_file_register(git_mwindow_file *mwf)
 
 void git_mwindow_file_deregister(git_mwindow_file *mwf)
 {
-	git_mwindow_ctl *ctl = &mem_ctl;
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
 	git_mwindow_file *cur;
 	size_t i;
 
@@ -23,6 +23,13 @@ typedef struct git_mwindow_file {
 	git_mwindow *windows;
 	int fd;
 	git_off_t size;
+	size_t last_used;
+
+	/*
+	 * The owner can open `fd` again when it finds it at -1, so it may
+	 * be closed to stay under the file limit.
+	 */
+	unsigned int reopenable:1;
 } git_mwindow_file;
 
 typedef struct git_mwindow_ctl {
@@ -35,6 +42,8 @@ typedef struct git_mwindow_ctl {
 	git_vector windowfiles;
 } git_mwindow_ctl;
 
+extern git_mwindow_ctl git_mwindow__mem_ctl;
+
 int git_mwindow_contains(git_mwindow *win, git_off_t offset);
 void git_mwindow_free_all(git_mwindow_file *mwf);
 unsigned char *git_mwindow_open(git_mwindow_file *mwf, git_mwindow **cursor, git_off_t offset, size_t extra, unsigned int *left);
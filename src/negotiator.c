@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "negotiator.h"
+#include "repository.h"
+#include "revwalk.h"
+#include "refs.h"
+#include "git2/revwalk.h"
+
+/* Set on the commits the skipping negotiator has taken off its queue */
+#define POPPED (1 << 0)
+
+/*
+ * The skipping negotiator queues the commits along with how many of
+ * them to skip before offering one again. Each time it offers one,
+ * the gap to the next grows by half.
+ */
+typedef struct {
+	git_commit_list_node *commit;
+	unsigned int original_ttl;
+	unsigned int ttl;
+} skip_entry;
+
+struct git_negotiator {
+	git_remote_negotiation_t algorithm;
+	git_revwalk *walk;
+	git_pqueue queue;
+};
+
+static int algorithm_from_config(
+	git_remote_negotiation_t *out, git_repository *repo)
+{
+	git_config *config;
+	const char *val;
+	int error;
+
+	*out = GIT_REMOTE_NEGOTIATION_CONSECUTIVE;
+
+	if ((error = git_repository_config__weakptr(&config, repo)) < 0)
+		return error;
+
+	error = git_config_get_string(&val, config, "fetch.negotiationAlgorithm");
+
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		return 0;
+	} else if (error < 0)
+		return error;
+
+	if (!strcmp(val, "skipping"))
+		*out = GIT_REMOTE_NEGOTIATION_SKIPPING;
+	else if (strcmp(val, "consecutive") && strcmp(val, "default")) {
+		giterr_set(GITERR_CONFIG,
+			"Unknown fetch negotiation algorithm '%s'", val);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int entry_time_cmp(const void *a, const void *b)
+{
+	const skip_entry *entry_a = a, *entry_b = b;
+	return git_commit_list_time_cmp(entry_a->commit, entry_b->commit);
+}
+
+static int skipping_push(
+	git_negotiator *negotiator,
+	git_commit_list_node *commit,
+	unsigned int original_ttl,
+	unsigned int ttl)
+{
+	skip_entry *entry;
+	int error;
+
+	if ((error = git_commit_list_parse(negotiator->walk, commit)) < 0)
+		return error;
+
+	commit->seen = 1;
+
+	entry = git__malloc(sizeof(skip_entry));
+	GITERR_CHECK_ALLOC(entry);
+
+	entry->commit = commit;
+	entry->original_ttl = original_ttl;
+	entry->ttl = ttl;
+
+	return git_pqueue_insert(&negotiator->queue, entry);
+}
+
+static int skipping_push_tip(git_negotiator *negotiator, const git_oid *id)
+{
+	git_object *obj, *commit;
+	git_commit_list_node *node;
+	int error;
+
+	if ((error = git_object_lookup(&obj, negotiator->walk->repo, id, GIT_OBJ_ANY)) < 0)
+		return error;
+
+	error = git_object_peel(&commit, obj, GIT_OBJ_COMMIT);
+	git_object_free(obj);
+
+	/* Refs to other kinds of objects don't help the negotiation */
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		return 0;
+	} else if (error < 0)
+		return error;
+
+	node = git_revwalk__commit_lookup(negotiator->walk, git_object_id(commit));
+	git_object_free(commit);
+	GITERR_CHECK_ALLOC(node);
+
+	if (node->seen)
+		return 0;
+
+	return skipping_push(negotiator, node, 0, 0);
+}
+
+static int skipping_push_parent(
+	bool *pushed,
+	git_negotiator *negotiator,
+	skip_entry *child,
+	git_commit_list_node *parent)
+{
+	unsigned int original_ttl, ttl;
+	skip_entry *entry;
+	size_t i;
+
+	/*
+	 * With clock skew, the parent may have come off the queue before
+	 * its child, in which case we pretend it's not there.
+	 */
+	if (parent->flags & POPPED)
+		return 0;
+
+	*pushed = true;
+
+	if (child->ttl) {
+		original_ttl = child->original_ttl;
+		ttl = child->ttl - 1;
+	} else {
+		original_ttl = child->original_ttl * 3 / 2 + 1;
+		ttl = original_ttl;
+	}
+
+	if (!parent->seen)
+		return skipping_push(negotiator, parent, original_ttl, ttl);
+
+	/* Reachable through another child as well; keep the shorter gap */
+	git_vector_foreach(&negotiator->queue, i, entry) {
+		if (entry->commit != parent)
+			continue;
+
+		entry->original_ttl = min(entry->original_ttl, original_ttl);
+		entry->ttl = min(entry->ttl, ttl);
+		break;
+	}
+
+	return 0;
+}
+
+static int skipping_next(git_oid *out, git_negotiator *negotiator)
+{
+	skip_entry *entry;
+	git_commit_list_node *commit;
+	unsigned short i;
+	bool pushed, send;
+	int error = 0;
+
+	while ((entry = git_pqueue_pop(&negotiator->queue)) != NULL) {
+		commit = entry->commit;
+		commit->flags |= POPPED;
+		pushed = false;
+
+		for (i = 0; !error && i < commit->out_degree; ++i)
+			error = skipping_push_parent(
+				&pushed, negotiator, entry, commit->parents[i]);
+
+		/* The end of a line of history is always worth offering */
+		send = !entry->ttl || !pushed;
+		git__free(entry);
+
+		if (error < 0)
+			return error;
+
+		if (send) {
+			git_oid_cpy(out, &commit->oid);
+			return 0;
+		}
+	}
+
+	return GIT_ITEROVER;
+}
+
+static int push_tips(git_negotiator *negotiator, git_repository *repo)
+{
+	git_strarray refs;
+	git_reference *ref;
+	size_t i;
+	int error;
+
+	if ((error = git_reference_list(&refs, repo)) < 0)
+		return error;
+
+	for (i = 0; i < refs.count; ++i) {
+		/* No tags */
+		if (!git__prefixcmp(refs.strings[i], GIT_REFS_TAGS_DIR))
+			continue;
+
+		if ((error = git_reference_lookup(&ref, repo, refs.strings[i])) < 0)
+			break;
+
+		if (git_reference_type(ref) != GIT_REF_SYMBOLIC) {
+			if (negotiator->algorithm == GIT_REMOTE_NEGOTIATION_SKIPPING)
+				error = skipping_push_tip(negotiator, git_reference_target(ref));
+			else
+				error = git_revwalk_push(negotiator->walk, git_reference_target(ref));
+		}
+
+		git_reference_free(ref);
+
+		if (error < 0)
+			break;
+	}
+
+	git_strarray_free(&refs);
+	return error;
+}
+
+int git_negotiator_new(
+	git_negotiator **out,
+	git_repository *repo,
+	git_remote_negotiation_t algorithm)
+{
+	git_negotiator *negotiator;
+	int error;
+
+	negotiator = git__calloc(1, sizeof(git_negotiator));
+	GITERR_CHECK_ALLOC(negotiator);
+
+	negotiator->algorithm = algorithm;
+
+	if (algorithm == GIT_REMOTE_NEGOTIATION_DEFAULT &&
+		(error = algorithm_from_config(&negotiator->algorithm, repo)) < 0)
+		goto on_error;
+
+	if ((error = git_revwalk_new(&negotiator->walk, repo)) < 0)
+		goto on_error;
+
+	if (negotiator->algorithm == GIT_REMOTE_NEGOTIATION_SKIPPING) {
+		if ((error = git_pqueue_init(
+				&negotiator->queue, 0, 8, entry_time_cmp)) < 0)
+			goto on_error;
+	} else
+		git_revwalk_sorting(negotiator->walk, GIT_SORT_TIME);
+
+	if ((error = push_tips(negotiator, repo)) < 0)
+		goto on_error;
+
+	*out = negotiator;
+	return 0;
+
+on_error:
+	git_negotiator_free(negotiator);
+	return error;
+}
+
+int git_negotiator_next(git_oid *out, git_negotiator *negotiator)
+{
+	if (negotiator->algorithm == GIT_REMOTE_NEGOTIATION_SKIPPING)
+		return skipping_next(out, negotiator);
+
+	return git_revwalk_next(out, negotiator->walk);
+}
+
+void git_negotiator_free(git_negotiator *negotiator)
+{
+	skip_entry *entry;
+	size_t i;
+
+	if (!negotiator)
+		return;
+
+	git_vector_foreach(&negotiator->queue, i, entry)
+		git__free(entry);
+
+	git_pqueue_free(&negotiator->queue);
+	git_revwalk_free(negotiator->walk);
+	git__free(negotiator);
+}
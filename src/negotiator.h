@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_negotiator_h__
+#define INCLUDE_negotiator_h__
+
+#include "common.h"
+#include "git2/remote.h"
+
+/*
+ * Picks the local commits we offer as haves when negotiating a fetch,
+ * starting from the tips of our branches.
+ */
+typedef struct git_negotiator git_negotiator;
+
+/*
+ * Set up a negotiator for the repository. With the default algorithm,
+ * `fetch.negotiationAlgorithm` decides which one is used.
+ */
+extern int git_negotiator_new(
+	git_negotiator **out,
+	git_repository *repo,
+	git_remote_negotiation_t algorithm);
+
+/* Get the next commit to offer, or GIT_ITEROVER when we're out of them */
+extern int git_negotiator_next(git_oid *out, git_negotiator *negotiator);
+
+extern void git_negotiator_free(git_negotiator *negotiator);
+
+#endif
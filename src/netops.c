@@ -34,6 +34,38 @@
 #include "buffer.h"
 #include "http_parser.h"
 #include "global.h"
+#include "vector.h"
+
+/* How long an idle connection is kept in the pool, in seconds */
+#define GITNO_POOL_IDLE_TIMEOUT 30
+
+/* The number of TLS sessions we remember for resumption */
+#define GITNO_SSL_SESSIONS_MAX 32
+
+typedef struct {
+	char *host;
+	char *port;
+	int flags;
+	gitno_socket socket;
+	time_t idle_since;
+} pooled_socket;
+
+size_t gitno__pool_size = 8;
+
+#ifdef GIT_THREADS
+static git_mutex pool_lock;
+#endif
+static git_vector pool = GIT_VECTOR_INIT;
+
+#ifdef GIT_SSL
+typedef struct {
+	char *key;
+	SSL_SESSION *session;
+} ssl_session;
+
+/* Protected by the pool lock as well */
+static git_vector ssl_sessions = GIT_VECTOR_INIT;
+#endif
 
 #ifdef GIT_WIN32
 static void net_set_error(const char *str)
@@ -192,10 +224,90 @@ void gitno_consume_n(gitno_buffer *buf, size_t cons)
 
 #ifdef GIT_SSL
 
+/*
+ * Remember the session of a connection so the next one to the same host
+ * and port can resume it instead of going through a full handshake.
+ * With TLS 1.3, the server only sends the tickets after the handshake,
+ * so this is done again when the connection is closed.
+ */
+static void ssl_save_session(gitno_ssl *ssl)
+{
+	SSL_SESSION *session;
+	ssl_session *entry = NULL;
+	size_t i;
+
+	if (!ssl->session_key || (session = SSL_get1_session(ssl->ssl)) == NULL)
+		return;
+
+	if (git_mutex_lock(&pool_lock) < 0) {
+		SSL_SESSION_free(session);
+		return;
+	}
+
+	git_vector_foreach(&ssl_sessions, i, entry) {
+		if (!strcmp(entry->key, ssl->session_key))
+			break;
+	}
+
+	if (i < ssl_sessions.length) {
+		SSL_SESSION_free(entry->session);
+		entry->session = session;
+		session = NULL;
+	} else if ((entry = git__calloc(1, sizeof(ssl_session))) != NULL &&
+		(entry->key = git__strdup(ssl->session_key)) != NULL &&
+		git_vector_insert(&ssl_sessions, entry) == 0) {
+		entry->session = session;
+		session = NULL;
+
+		if (ssl_sessions.length > GITNO_SSL_SESSIONS_MAX) {
+			entry = git_vector_get(&ssl_sessions, 0);
+			git_vector_remove(&ssl_sessions, 0);
+			SSL_SESSION_free(entry->session);
+			git__free(entry->key);
+			git__free(entry);
+		}
+	} else if (entry) {
+		git__free(entry->key);
+		git__free(entry);
+	}
+
+	git_mutex_unlock(&pool_lock);
+
+	/* We're only trying to save some time; failing to is no error */
+	if (session) {
+		SSL_SESSION_free(session);
+		giterr_clear();
+	}
+}
+
+static void ssl_resume_session(gitno_ssl *ssl)
+{
+	ssl_session *entry;
+	size_t i;
+
+	if (git_mutex_lock(&pool_lock) < 0) {
+		giterr_clear();
+		return;
+	}
+
+	git_vector_foreach(&ssl_sessions, i, entry) {
+		if (!strcmp(entry->key, ssl->session_key)) {
+			SSL_set_session(ssl->ssl, entry->session);
+			break;
+		}
+	}
+
+	git_mutex_unlock(&pool_lock);
+}
+
 static int gitno_ssl_teardown(gitno_ssl *ssl)
 {
 	int ret;
 
+	ssl_save_session(ssl);
+	git__free(ssl->session_key);
+	ssl->session_key = NULL;
+
 	ret = SSL_shutdown(ssl->ssl);
 	if (ret < 0)
 		ret = ssl_set_error(ssl, ret);
@@ -386,8 +498,9 @@ cert_fail_name:
 	return -1;
 }
 
-static int ssl_setup(gitno_socket *socket, const char *host, int flags)
+static int ssl_setup(gitno_socket *socket, const char *host, const char *port, int flags)
 {
+	git_buf key = GIT_BUF_INIT;
 	int ret;
 
 	if (git__ssl_ctx == NULL) {
@@ -402,13 +515,28 @@ static int ssl_setup(gitno_socket *socket, const char *host, int flags)
 	if((ret = SSL_set_fd(socket->ssl.ssl, socket->socket)) == 0)
 		return ssl_set_error(&socket->ssl, ret);
 
+	/*
+	 * A session from a connection whose certificate we didn't check
+	 * must not stand in for one we would have checked, so those
+	 * connections neither resume nor leave a session behind.
+	 */
+	if (!(GITNO_CONNECT_SSL_NO_CHECK_CERT & flags)) {
+		if (git_buf_printf(&key, "%s:%s", host, port) < 0)
+			return -1;
+
+		socket->ssl.session_key = git_buf_detach(&key);
+		ssl_resume_session(&socket->ssl);
+	}
+
 	if ((ret = SSL_connect(socket->ssl.ssl)) <= 0)
 		return ssl_set_error(&socket->ssl, ret);
 
-	if (GITNO_CONNECT_SSL_NO_CHECK_CERT & flags)
-		return 0;
+	if (!(GITNO_CONNECT_SSL_NO_CHECK_CERT & flags) &&
+		(ret = verify_server_cert(&socket->ssl, host)) < 0)
+		return ret;
 
-	return verify_server_cert(&socket->ssl, host);
+	ssl_save_session(&socket->ssl);
+	return 0;
 }
 #endif
 
@@ -493,7 +621,7 @@ int gitno_connect(gitno_socket *s_out, const char *host, const char *port, int f
 	p_freeaddrinfo(info);
 
 #ifdef GIT_SSL
-	if ((flags & GITNO_CONNECT_SSL) && ssl_setup(s_out, host, flags) < 0)
+	if ((flags & GITNO_CONNECT_SSL) && ssl_setup(s_out, host, port, flags) < 0)
 		return -1;
 #else
 	/* SSL is not supported */
@@ -576,6 +704,183 @@ int gitno_select_in(gitno_buffer *buf, long int sec, long int usec)
 	return select((int)buf->socket->socket + 1, &fds, NULL, NULL, &tv);
 }
 
+static void pooled_socket_free(pooled_socket *entry)
+{
+	git__free(entry->host);
+	git__free(entry->port);
+	git__free(entry);
+}
+
+/*
+ * An idle connection has nothing to read. If it does, the other end
+ * has closed it or it's in a state we don't understand.
+ */
+static bool socket_is_idle(gitno_socket *s)
+{
+	fd_set fds;
+	struct timeval tv = { 0, 0 };
+
+#ifdef GIT_SSL
+	if (s->ssl.ssl && SSL_pending(s->ssl.ssl) > 0)
+		return false;
+#endif
+
+	FD_ZERO(&fds);
+	FD_SET(s->socket, &fds);
+
+	return select((int)s->socket + 1, &fds, NULL, NULL, &tv) == 0;
+}
+
+static void gitno_global_shutdown(void)
+{
+	pooled_socket *entry;
+	size_t i;
+
+	/*
+	 * The library is going away, so there's no error state left to
+	 * report to; just drop the connections.
+	 */
+	git_vector_foreach(&pool, i, entry) {
+#ifdef GIT_SSL
+		if (entry->socket.ssl.ssl) {
+			SSL_free(entry->socket.ssl.ssl);
+			git__free(entry->socket.ssl.session_key);
+		}
+#endif
+		gitno__close(entry->socket.socket);
+		pooled_socket_free(entry);
+	}
+
+	git_vector_free(&pool);
+
+#ifdef GIT_SSL
+	{
+		ssl_session *session;
+
+		git_vector_foreach(&ssl_sessions, i, session) {
+			SSL_SESSION_free(session->session);
+			git__free(session->key);
+			git__free(session);
+		}
+
+		git_vector_free(&ssl_sessions);
+	}
+#endif
+
+	git_mutex_free(&pool_lock);
+}
+
+int gitno_global_init(void)
+{
+	if (git_mutex_init(&pool_lock) != 0)
+		return -1;
+
+	git__on_shutdown(gitno_global_shutdown);
+	return 0;
+}
+
+/* Take the most recently used connection to the given place off the pool */
+static pooled_socket *pool_take(const char *host, const char *port, int flags)
+{
+	pooled_socket *entry;
+	size_t i;
+
+	for (i = pool.length; i > 0; --i) {
+		entry = git_vector_get(&pool, i - 1);
+
+		if (entry->flags == flags &&
+			!strcmp(entry->host, host) && !strcmp(entry->port, port)) {
+			git_vector_remove(&pool, i - 1);
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+int gitno_pool_get(gitno_socket *socket, const char *host, const char *port, int flags)
+{
+	pooled_socket *entry;
+	time_t now = time(NULL);
+	bool found = false;
+
+	while (!found) {
+		if (git_mutex_lock(&pool_lock) < 0) {
+			giterr_set(GITERR_OS, "Failed to lock the connection pool");
+			return -1;
+		}
+
+		entry = pool_take(host, port, flags);
+		git_mutex_unlock(&pool_lock);
+
+		if (!entry)
+			return GIT_ENOTFOUND;
+
+		if (now - entry->idle_since <= GITNO_POOL_IDLE_TIMEOUT &&
+			socket_is_idle(&entry->socket)) {
+			memcpy(socket, &entry->socket, sizeof(gitno_socket));
+			found = true;
+		} else {
+			gitno_close(&entry->socket);
+			giterr_clear();
+		}
+
+		pooled_socket_free(entry);
+	}
+
+	return 0;
+}
+
+int gitno_pool_put(gitno_socket *socket, const char *host, const char *port, int flags)
+{
+	pooled_socket *entry;
+
+	if (!gitno__pool_size)
+		return gitno_close(socket);
+
+#ifdef GIT_SSL
+	if (socket->ssl.ssl)
+		ssl_save_session(&socket->ssl);
+#endif
+
+	entry = git__calloc(1, sizeof(pooled_socket));
+	GITERR_CHECK_ALLOC(entry);
+
+	entry->host = git__strdup(host);
+	entry->port = git__strdup(port);
+	entry->flags = flags;
+	entry->idle_since = time(NULL);
+	memcpy(&entry->socket, socket, sizeof(gitno_socket));
+
+	if (!entry->host || !entry->port ||
+		git_mutex_lock(&pool_lock) < 0) {
+		pooled_socket_free(entry);
+		return gitno_close(socket);
+	}
+
+	if (git_vector_insert(&pool, entry) < 0) {
+		git_mutex_unlock(&pool_lock);
+		pooled_socket_free(entry);
+		return gitno_close(socket);
+	}
+
+	/* Make room by dropping the connection which has been idle longest */
+	while (pool.length > gitno__pool_size) {
+		entry = git_vector_get(&pool, 0);
+		git_vector_remove(&pool, 0);
+		git_mutex_unlock(&pool_lock);
+
+		gitno_close(&entry->socket);
+		pooled_socket_free(entry);
+
+		if (git_mutex_lock(&pool_lock) < 0)
+			return 0;
+	}
+
+	git_mutex_unlock(&pool_lock);
+	return 0;
+}
+
 static const char *prefix_http = "http://";
 static const char *prefix_https = "https://";
 
@@ -17,6 +17,7 @@
 struct gitno_ssl {
 #ifdef GIT_SSL
 	SSL *ssl;
+	char *session_key;
 #else
 	size_t dummy;
 #endif
@@ -78,6 +79,26 @@ int gitno_send(gitno_socket *socket, const char *msg, size_t len, int flags);
 int gitno_close(gitno_socket *s);
 int gitno_select_in(gitno_buffer *buf, long int sec, long int usec);
 
+/* The number of idle connections kept for reuse; zero disables the pool */
+extern size_t gitno__pool_size;
+
+int gitno_global_init(void);
+
+/*
+ * Take an idle connection to `host` and `port`, set up with the same
+ * `flags`, from the pool. Connections which have been idle for too long
+ * or which the other end has closed are dropped on the way. Returns
+ * GIT_ENOTFOUND if there is none to reuse.
+ */
+int gitno_pool_get(gitno_socket *socket, const char *host, const char *port, int flags);
+
+/*
+ * Give a connection which can take another request to the pool, where
+ * the next transport to connect to the same place can pick it up. The
+ * oldest idle connection is closed if the pool is full.
+ */
+int gitno_pool_put(gitno_socket *socket, const char *host, const char *port, int flags);
+
 typedef struct gitno_connection_data {
 	char *host;
 	char *port;
@@ -15,6 +15,7 @@
 #include "delta-apply.h"
 #include "filter.h"
 #include "repository.h"
+#include "array.h"
 
 #include "git2/odb_backend.h"
 #include "git2/oid.h"
@@ -81,6 +82,56 @@ int git_odb__hashobj(git_oid *id, git_rawobj *obj)
 	return 0;
 }
 
+/* Object headers are short; this bounds `git_odb__format_object_header` */
+#define OBJECT_HEADER_MAX 64
+
+int git_odb__hashobj_batch(git_oid *out, git_rawobj *objs, size_t n)
+{
+	git_buf_vec *vec;
+	char *headers;
+	size_t i;
+	int hdrlen, error;
+
+	assert(out && (objs || !n));
+
+	if (!n)
+		return 0;
+
+	vec = git__calloc(n * 2, sizeof(git_buf_vec));
+	GITERR_CHECK_ALLOC(vec);
+
+	if ((headers = git__malloc(n * OBJECT_HEADER_MAX)) == NULL) {
+		git__free(vec);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		char *header = headers + i * OBJECT_HEADER_MAX;
+
+		if (!git_object_typeisloose(objs[i].type) ||
+			(!objs[i].data && objs[i].len != 0)) {
+			giterr_set(GITERR_INVALID, "Invalid object for hash");
+			error = -1;
+			goto done;
+		}
+
+		hdrlen = git_odb__format_object_header(
+			header, OBJECT_HEADER_MAX, objs[i].len, objs[i].type);
+
+		vec[i * 2].data = header;
+		vec[i * 2].len = hdrlen;
+		vec[i * 2 + 1].data = objs[i].data;
+		vec[i * 2 + 1].len = objs[i].len;
+	}
+
+	error = git_hash_batch(out, vec, n, 2);
+
+done:
+	git__free(headers);
+	git__free(vec);
+	return error;
+}
+
 
 static git_odb_object *odb_object__alloc(const git_oid *oid, git_rawobj *source)
 {
@@ -752,20 +803,10 @@ int git_odb__read_header_or_object(
 	return 0;
 }
 
-int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
+static int odb_read_1(git_rawobj *raw, git_odb *db, const git_oid *id)
 {
 	size_t i, reads = 0;
-	int error;
-	git_rawobj raw;
-	git_odb_object *object;
-
-	assert(out && db && id);
-
-	*out = git_cache_get_raw(odb_cache(db), id);
-	if (*out != NULL)
-		return 0;
-
-	error = GIT_ENOTFOUND;
+	int error = GIT_ENOTFOUND;
 
 	for (i = 0; i < db->backends.length && error < 0; ++i) {
 		backend_internal *internal = git_vector_get(&db->backends, i);
@@ -773,7 +814,7 @@ int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
 
 		if (b->read != NULL) {
 			++reads;
-			error = b->read(&raw.data, &raw.len, &raw.type, b, id);
+			error = b->read(&raw->data, &raw->len, &raw->type, b, id);
 		}
 	}
 
@@ -783,6 +824,60 @@ int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
 		return error;
 	}
 
+	return 0;
+}
+
+/*
+ * Ask the missing-object callback for `ids`. Returns 1 when it has
+ * fetched them, 0 if there's nobody to ask, or an error code. While
+ * the callback runs (and may read from the database itself) missing
+ * objects are not asked for again.
+ */
+static int odb_fetch_missing(git_odb *db, const git_oid *ids, size_t count)
+{
+	int error;
+
+	if (!db->missing_cb || !count || db->fetching_missing.val)
+		return 0;
+
+	git_atomic_inc(&db->fetching_missing);
+	error = db->missing_cb(db, ids, count, db->missing_payload);
+	git_atomic_dec(&db->fetching_missing);
+
+	if (error == GIT_ENOTFOUND || error == GIT_PASSTHROUGH) {
+		giterr_clear();
+		return 0;
+	}
+
+	return error < 0 ? error : 1;
+}
+
+int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
+{
+	int error;
+	git_rawobj raw;
+	git_odb_object *object;
+
+	assert(out && db && id);
+
+	*out = git_cache_get_raw(odb_cache(db), id);
+	if (*out != NULL)
+		return 0;
+
+	error = odb_read_1(&raw, db, id);
+
+	if (error == GIT_ENOTFOUND) {
+		int fetched = odb_fetch_missing(db, id, 1);
+
+		if (fetched < 0)
+			return fetched;
+		else if (fetched > 0)
+			error = odb_read_1(&raw, db, id);
+	}
+
+	if (error < 0)
+		return error;
+
 	giterr_clear();
 	if ((object = odb_object__alloc(id, &raw)) == NULL)
 		return -1;
@@ -871,16 +966,13 @@ int git_odb_foreach(git_odb *db, git_odb_foreach_cb cb, void *payload)
 	return 0;
 }
 
-int git_odb_write(
-	git_oid *oid, git_odb *db, const void *data, size_t len, git_otype type)
+static int odb_write_hashed(
+	git_odb *db, git_oid *oid, const void *data, size_t len, git_otype type)
 {
 	size_t i;
 	int error = GIT_ERROR;
 	git_odb_stream *stream;
 
-	assert(oid && db);
-
-	git_odb_hash(oid, data, len, type);
 	if (git_odb_exists(db, oid))
 		return 0;
 
@@ -913,6 +1005,33 @@ int git_odb_write(
 	return error;
 }
 
+int git_odb_write(
+	git_oid *oid, git_odb *db, const void *data, size_t len, git_otype type)
+{
+	assert(oid && db);
+
+	git_odb_hash(oid, data, len, type);
+
+	return odb_write_hashed(db, oid, data, len, type);
+}
+
+int git_odb__write_batch(git_oid *out, git_odb *db, git_rawobj *objs, size_t n)
+{
+	size_t i;
+	int error;
+
+	assert(out && db && (objs || !n));
+
+	if ((error = git_odb__hashobj_batch(out, objs, n)) < 0)
+		return error;
+
+	for (i = 0; i < n && !error; i++)
+		error = odb_write_hashed(
+			db, &out[i], objs[i].data, objs[i].len, objs[i].type);
+
+	return error;
+}
+
 static void hash_header(git_hash_ctx *ctx, size_t size, git_otype type)
 {
 	char header[64];
@@ -1087,6 +1206,43 @@ void *git_odb_backend_malloc(git_odb_backend *backend, size_t len)
 	return git__malloc(len);
 }
 
+int git_odb_set_missing_cb(git_odb *db, git_odb_missing_cb cb, void *payload)
+{
+	assert(db);
+
+	db->missing_cb = cb;
+	db->missing_payload = payload;
+
+	return 0;
+}
+
+int git_odb_prefetch(git_odb *db, const git_oid *ids, size_t count)
+{
+	git_array_t(git_oid) missing = GIT_ARRAY_INIT;
+	git_oid *id;
+	size_t i;
+	int error;
+
+	assert(db && (ids || !count));
+
+	if (!db->missing_cb)
+		return 0;
+
+	for (i = 0; i < count; ++i) {
+		if (git_odb_exists(db, &ids[i]))
+			continue;
+
+		id = git_array_alloc(missing);
+		GITERR_CHECK_ALLOC(id);
+		git_oid_cpy(id, &ids[i]);
+	}
+
+	error = odb_fetch_missing(db, missing.ptr, missing.size);
+
+	git_array_clear(missing);
+	return error < 0 ? error : 0;
+}
+
 int git_odb_refresh(struct git_odb *db)
 {
 	size_t i;
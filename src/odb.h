@@ -38,6 +38,9 @@ struct git_odb {
 	git_refcount rc;
 	git_vector backends;
 	git_cache own_cache;
+	git_odb_missing_cb missing_cb;
+	void *missing_payload;
+	git_atomic fetching_missing;
 };
 
 /*
@@ -46,6 +49,30 @@ struct git_odb {
  */
 int git_odb__hashobj(git_oid *id, git_rawobj *obj);
 
+/*
+ * Hash `n` raw objects at once, storing the id of `objs[i]` in `out[i]`.
+ */
+int git_odb__hashobj_batch(git_oid *out, git_rawobj *objs, size_t n);
+
+/*
+ * Write `n` raw objects to the ODB, storing the id of `objs[i]` in
+ * `out[i]`.  The ids are computed with a single batched hash pass and
+ * objects already present in the ODB are not written again.
+ */
+int git_odb__write_batch(git_oid *out, git_odb *db, git_rawobj *objs, size_t n);
+
+/*
+ * Mark the pack being written as coming from a promisor remote. Only
+ * the packs written by the pack backend get the marker.
+ */
+int git_odb__writepack_promisor(struct git_odb_writepack *writepack);
+
+/*
+ * Get the path to the index of the pack a writepack has committed.
+ * Returns GIT_ENOTFOUND for writepacks not from the pack backend.
+ */
+int git_odb__writepack_index_path(git_buf *out, struct git_odb_writepack *writepack);
+
 /*
  * Format the object header such as it would appear in the on-disk object
  */
@@ -14,6 +14,7 @@
 #include "odb.h"
 #include "delta-apply.h"
 #include "filebuf.h"
+#include "zstream.h"
 
 #include "git2/odb_backend.h"
 #include "git2/types.h"
@@ -31,7 +32,7 @@ typedef struct {
 typedef struct loose_backend {
 	git_odb_backend parent;
 
-	int object_zlib_level; /** loose object zlib compression level. */
+	int object_zlib_level; /** loose object zlib compression level, or -1. */
 	int fsync_object_files; /** loose object file fsync flag. */
 	mode_t object_file_mode;
 	mode_t object_dir_mode;
@@ -227,35 +228,15 @@ static int is_zlib_compressed_data(unsigned char *data)
 
 static int inflate_buffer(void *in, size_t inlen, void *out, size_t outlen)
 {
-	z_stream zs;
-	int status = Z_OK;
-
-	memset(&zs, 0x0, sizeof(zs));
-
-	zs.next_out = out;
-	zs.avail_out = (uInt)outlen;
-
-	zs.next_in = in;
-	zs.avail_in = (uInt)inlen;
-
-	if (inflateInit(&zs) < Z_OK) {
-		giterr_set(GITERR_ZLIB, "Failed to inflate buffer");
-		return -1;
-	}
-
-	while (status == Z_OK)
-		status = inflate(&zs, Z_FINISH);
-
-	inflateEnd(&zs);
+	int error = git_zstream_inflatebuf(out, outlen, in, inlen, NULL);
 
-	if (status != Z_STREAM_END /* || zs.avail_in != 0 */ ||
-		zs.total_out != outlen)
-	{
+	/* the whole object is in memory, so running out of input is fatal */
+	if (error == GIT_EBUFS) {
 		giterr_set(GITERR_ZLIB, "Failed to inflate buffer. Stream aborted prematurely");
-		return -1;
+		error = -1;
 	}
 
-	return 0;
+	return error;
 }
 
 static void *inflate_tail(z_stream *s, void *hb, size_t used, obj_hdr *hdr)
@@ -360,13 +341,16 @@ static int inflate_disk_obj(git_rawobj *out, git_buf *obj)
 		(used = get_object_header(&hdr, head)) == 0 ||
 		!git_object_typeisloose(hdr.type))
 	{
+		inflateEnd(&zs);
 		giterr_set(GITERR_ODB, "Failed to inflate disk object.");
 		return -1;
 	}
 
 	/*
 	 * allocate a buffer and inflate the object data into it
-	 * (including the initial sequence in the head buffer).
+	 * (including the initial sequence in the head buffer).  The
+	 * stream is already under way, so zlib finishes it rather than
+	 * the one-shot git_zstream_inflatebuf.
 	 */
 	if ((buf = inflate_tail(&zs, head, used, &hdr)) == NULL)
 		return -1;
@@ -824,6 +808,18 @@ static void loose_backend__stream_free(git_odb_stream *_stream)
 	git__free(stream);
 }
 
+/* A negative level follows the library-wide default for loose objects */
+static int loose_zlib_level(loose_backend *backend)
+{
+	int level = backend->object_zlib_level;
+
+	if (level < 0)
+		level = git_zstream__loose_level;
+
+	/* the filebuf wants an explicit level; 6 is what zlib defaults to */
+	return (level < 0) ? 6 : level;
+}
+
 static int loose_backend__stream(git_odb_stream **stream_out, git_odb_backend *_backend, size_t length, git_otype type)
 {
 	loose_backend *backend;
@@ -852,7 +848,7 @@ static int loose_backend__stream(git_odb_stream **stream_out, git_odb_backend *_
 	if (git_buf_joinpath(&tmp_path, backend->objects_dir, "tmp_object") < 0 ||
 		git_filebuf_open(&stream->fbuf, tmp_path.ptr,
 			GIT_FILEBUF_TEMPORARY |
-			(backend->object_zlib_level << GIT_FILEBUF_DEFLATE_SHIFT),
+			GIT_FILEBUF_DEFLATE(loose_zlib_level(backend)),
 			backend->object_file_mode) < 0 ||
 		stream->stream.write((git_odb_stream *)stream, hdr, hdrlen) < 0)
 	{
@@ -882,7 +878,7 @@ static int loose_backend__write(git_odb_backend *_backend, const git_oid *oid, c
 	if (git_buf_joinpath(&final_path, backend->objects_dir, "tmp_object") < 0 ||
 		git_filebuf_open(&fbuf, final_path.ptr,
 			GIT_FILEBUF_TEMPORARY |
-			(backend->object_zlib_level << GIT_FILEBUF_DEFLATE_SHIFT),
+			GIT_FILEBUF_DEFLATE(loose_zlib_level(backend)),
 			backend->object_file_mode) < 0)
 	{
 		error = -1;
@@ -937,9 +933,6 @@ int git_odb_backend_loose(
 	if (backend->objects_dir[backend->objects_dirlen - 1] != '/')
 		backend->objects_dir[backend->objects_dirlen++] = '/';
 
-	if (compression_level < 0)
-		compression_level = Z_BEST_SPEED;
-
 	if (dir_mode == 0)
 		dir_mode = GIT_OBJECT_DIR_MODE;
 
@@ -30,6 +30,7 @@ struct pack_backend {
 struct pack_writepack {
 	struct git_odb_writepack parent;
 	git_indexer *indexer;
+	bool promisor;
 };
 
 /**
@@ -541,13 +542,47 @@ static int pack_backend__writepack_append(struct git_odb_writepack *_writepack,
 	return git_indexer_append(writepack->indexer, data, size, stats);
 }
 
+/*
+ * A pack from a promisor remote gets an empty ".promisor" file next
+ * to it, which tells git that the objects its objects refer to may be
+ * missing on purpose.
+ */
+static int write_promisor_file(struct pack_writepack *writepack)
+{
+	struct pack_backend *backend = (struct pack_backend *)writepack->parent.backend;
+	git_buf path = GIT_BUF_INIT;
+	char hash[GIT_OID_HEXSZ + 1];
+	int fd, error = 0;
+
+	git_oid_tostr(hash, sizeof(hash), git_indexer_hash(writepack->indexer));
+
+	if (git_buf_printf(&path, "%s/pack-%s.promisor", backend->pack_folder, hash) < 0)
+		return -1;
+
+	if ((fd = p_open(path.ptr, O_WRONLY | O_CREAT | O_TRUNC, GIT_OBJECT_FILE_MODE)) < 0) {
+		giterr_set(GITERR_OS, "Failed to create promisor file '%s'", path.ptr);
+		error = -1;
+	} else
+		p_close(fd);
+
+	git_buf_free(&path);
+	return error;
+}
+
 static int pack_backend__writepack_commit(struct git_odb_writepack *_writepack, git_transfer_progress *stats)
 {
 	struct pack_writepack *writepack = (struct pack_writepack *)_writepack;
+	int error;
 
 	assert(writepack);
 
-	return git_indexer_commit(writepack->indexer, stats);
+	if ((error = git_indexer_commit(writepack->indexer, stats)) < 0)
+		return error;
+
+	if (writepack->promisor)
+		error = write_promisor_file(writepack);
+
+	return error;
 }
 
 static void pack_backend__writepack_free(struct git_odb_writepack *_writepack)
@@ -560,6 +595,32 @@ static void pack_backend__writepack_free(struct git_odb_writepack *_writepack)
 	git__free(writepack);
 }
 
+int git_odb__writepack_promisor(struct git_odb_writepack *_writepack)
+{
+	struct pack_writepack *writepack = (struct pack_writepack *)_writepack;
+
+	/* Other backends store the objects in their own ways */
+	if (_writepack->commit == pack_backend__writepack_commit)
+		writepack->promisor = true;
+
+	return 0;
+}
+
+int git_odb__writepack_index_path(git_buf *out, struct git_odb_writepack *_writepack)
+{
+	struct pack_writepack *writepack = (struct pack_writepack *)_writepack;
+	struct pack_backend *backend;
+	char hash[GIT_OID_HEXSZ + 1];
+
+	if (_writepack->commit != pack_backend__writepack_commit)
+		return GIT_ENOTFOUND;
+
+	backend = (struct pack_backend *)_writepack->backend;
+	git_oid_tostr(hash, sizeof(hash), git_indexer_hash(writepack->indexer));
+
+	return git_buf_printf(out, "%s/pack-%s.idx", backend->pack_folder, hash);
+}
+
 static int pack_backend__writepack(struct git_odb_writepack **out,
 	git_odb_backend *_backend,
         git_odb *odb,
@@ -106,11 +106,22 @@ static int packbuilder_config(git_packbuilder *pb)
 	config_get("pack.deltaCacheSize", pb->big_file_threshold,
 		   GIT_PACK_BIG_FILE_THRESHOLD);
 	config_get("pack.windowMemory", pb->window_memory_limit, 0);
+	config_get("core.compression", pb->compression_level,
+		   git_zstream__pack_level);
+	config_get("pack.compression", pb->compression_level,
+		   pb->compression_level);
 
 #undef config_get
 
 	git_config_free(config);
 
+	if (pb->compression_level < Z_DEFAULT_COMPRESSION ||
+		pb->compression_level > Z_BEST_COMPRESSION) {
+		giterr_set(GITERR_INVALID,
+			"Invalid pack compression level %d", pb->compression_level);
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -132,9 +143,9 @@ int git_packbuilder_new(git_packbuilder **out, git_repository *repo)
 	pb->nr_threads = 1; /* do not spawn any thread by default */
 
 	if (git_hash_ctx_init(&pb->ctx) < 0 ||
-		git_zstream_init(&pb->zstream) < 0 ||
 		git_repository_odb(&pb->odb, repo) < 0 ||
-		packbuilder_config(pb) < 0)
+		packbuilder_config(pb) < 0 ||
+		git_zstream_init(&pb->zstream, pb->compression_level) < 0)
 		goto on_error;
 
 #ifdef GIT_THREADS
@@ -953,7 +964,8 @@ static int find_deltas(git_packbuilder *pb, git_pobject **list,
 		 * between writes at that moment.
 		 */
 		if (po->delta_data) {
-			if (git_zstream_deflatebuf(&zbuf, po->delta_data, po->delta_size) < 0)
+			if (git_zstream_deflatebuf(&zbuf, po->delta_data,
+					po->delta_size, pb->compression_level) < 0)
 				goto on_error;
 
 			git__free(po->delta_data);
@@ -1375,6 +1387,134 @@ int git_packbuilder_insert_tree(git_packbuilder *pb, const git_oid *oid)
 	return error;
 }
 
+static int enqueue_object(
+	const git_tree_entry *entry,
+	git_packbuilder *pb)
+{
+	switch (git_tree_entry_type(entry)) {
+		case GIT_OBJ_COMMIT:
+			return 0;
+		case GIT_OBJ_TREE:
+			return git_packbuilder_insert_tree(pb, &entry->oid);
+		default:
+			return git_packbuilder_insert(pb, &entry->oid, entry->filename);
+	}
+}
+
+static int queue_differences(
+	git_tree *base,
+	git_tree *delta,
+	git_packbuilder *pb)
+{
+	git_tree *b_child = NULL, *d_child = NULL;
+	size_t b_length = git_tree_entrycount(base);
+	size_t d_length = git_tree_entrycount(delta);
+	size_t i = 0, j = 0;
+	int error;
+
+	while (i < b_length && j < d_length) {
+		const git_tree_entry *b_entry = git_tree_entry_byindex(base, i);
+		const git_tree_entry *d_entry = git_tree_entry_byindex(delta, j);
+		int cmp = 0;
+
+		if (!git_oid__cmp(&b_entry->oid, &d_entry->oid))
+			goto loop;
+
+		cmp = strcmp(b_entry->filename, d_entry->filename);
+
+		/* If the entries are both trees and they have the same name but are
+		 * different, then we'll recurse after adding the right-hand entry */
+		if (!cmp &&
+			git_tree_entry__is_tree(b_entry) &&
+			git_tree_entry__is_tree(d_entry)) {
+			/* Add the right-hand entry */
+			if ((error = git_packbuilder_insert(pb, &d_entry->oid,
+				d_entry->filename)) < 0)
+				goto on_error;
+
+			/* Acquire the subtrees and recurse */
+			if ((error = git_tree_lookup(&b_child,
+					git_tree_owner(base), &b_entry->oid)) < 0 ||
+				(error = git_tree_lookup(&d_child,
+					git_tree_owner(delta), &d_entry->oid)) < 0 ||
+				(error = queue_differences(b_child, d_child, pb)) < 0)
+				goto on_error;
+
+			git_tree_free(b_child); b_child = NULL;
+			git_tree_free(d_child); d_child = NULL;
+		}
+		/* If the object is new or different in the right-hand tree,
+		 * then enumerate it */
+		else if (cmp >= 0 &&
+			(error = enqueue_object(d_entry, pb)) < 0)
+			goto on_error;
+
+	loop:
+		if (cmp <= 0) i++;
+		if (cmp >= 0) j++;
+	}
+
+	/* Drain the right-hand tree of entries */
+	for (; j < d_length; j++)
+		if ((error = enqueue_object(git_tree_entry_byindex(delta, j), pb)) < 0)
+			goto on_error;
+
+	error = 0;
+
+on_error:
+	if (b_child)
+		git_tree_free(b_child);
+
+	if (d_child)
+		git_tree_free(d_child);
+
+	return error;
+}
+
+int git_packbuilder__insert_commit_changes(git_packbuilder *pb, const git_oid *oid)
+{
+	git_commit *parent = NULL, *commit;
+	git_tree *tree = NULL, *ptree = NULL;
+	unsigned int i, parentcount;
+	int error;
+
+	if ((error = git_commit_lookup(&commit, pb->repo, oid)) < 0)
+		return error;
+
+	/* Insert the commit */
+	if ((error = git_packbuilder_insert(pb, oid, NULL)) < 0)
+		goto cleanup;
+
+	parentcount = git_commit_parentcount(commit);
+
+	if (!parentcount) {
+		error = git_packbuilder_insert_tree(pb, git_commit_tree_id(commit));
+		goto cleanup;
+	}
+
+	if ((error = git_tree_lookup(&tree, pb->repo, git_commit_tree_id(commit))) < 0 ||
+		(error = git_packbuilder_insert(pb, git_commit_tree_id(commit), NULL)) < 0)
+		goto cleanup;
+
+	/* For each parent, add the items which are different */
+	for (i = 0; i < parentcount; i++) {
+		if ((error = git_commit_parent(&parent, commit, i)) < 0 ||
+			(error = git_commit_tree(&ptree, parent)) < 0 ||
+			(error = queue_differences(ptree, tree, pb)) < 0)
+			goto cleanup;
+
+		git_tree_free(ptree); ptree = NULL;
+		git_commit_free(parent); parent = NULL;
+	}
+
+cleanup:
+	git_tree_free(tree);
+	git_tree_free(ptree);
+	git_commit_free(parent);
+	git_commit_free(commit);
+	return error;
+}
+
 uint32_t git_packbuilder_object_count(git_packbuilder *pb)
 {
 	return pb->nr_objects;
@@ -79,6 +79,7 @@ struct git_packbuilder {
 	uint64_t cache_max_small_delta_size;
 	uint64_t big_file_threshold;
 	uint64_t window_memory_limit;
+	int compression_level;
 
 	int nr_threads; /* nr of threads to use */
 
@@ -91,4 +92,10 @@ struct git_packbuilder {
 
 int git_packbuilder_write_buf(git_buf *buf, git_packbuilder *pb);
 
+/*
+ * Insert a commit along with the objects of its tree which aren't in
+ * the trees of its parents, which the other side must already have.
+ */
+int git_packbuilder__insert_commit_changes(git_packbuilder *pb, const git_oid *oid);
+
 #endif /* INCLUDE_pack_objects_h__ */
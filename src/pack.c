@@ -13,9 +13,13 @@
 #include "mwindow.h"
 #include "fileops.h"
 #include "oid.h"
+#include "zstream.h"
 
 #include <zlib.h>
 
+/* Map packs in their entirety rather than in windows */
+int git_packfile__map_whole = 0;
+
 static int packfile_open(struct git_pack_file *p);
 static git_off_t nth_packed_object_offset(const struct git_pack_file *p, uint32_t n);
 int packfile_unpack_compressed(
@@ -340,25 +344,51 @@ static int pack_index_open(struct git_pack_file *p)
 	return error;
 }
 
+GIT_INLINE(bool) packfile_is_open(struct git_pack_file *p)
+{
+	return p->whole != NULL || p->mwf.fd != -1;
+}
+
 static unsigned char *pack_window_open(
 		struct git_pack_file *p,
 		git_mwindow **w_cursor,
 		git_off_t offset,
 		unsigned int *left)
 {
-	if (p->mwf.fd == -1 && packfile_open(p) < 0)
-		return NULL;
+	unsigned char *window;
+	git_map *whole;
 
-	/* Since packfiles end in a hash of their content and it's
-	 * pointless to ask for an offset into the middle of that
-	 * hash, and the pack_window_contains function above wouldn't match
-	 * don't allow an offset too close to the end of the file.
-	 */
-	if (offset > (p->mwf.size - 20))
-		return NULL;
+	for (;;) {
+		if (!packfile_is_open(p) && packfile_open(p) < 0)
+			return NULL;
 
-	return git_mwindow_open(&p->mwf, w_cursor, offset, 20, left);
- }
+		/* Since packfiles end in a hash of their content and it's
+		 * pointless to ask for an offset into the middle of that
+		 * hash, and the pack_window_contains function above wouldn't match
+		 * don't allow an offset too close to the end of the file.
+		 */
+		if (offset > (p->mwf.size - 20))
+			return NULL;
+
+		/* a pack mapped whole needs no window */
+		if ((whole = p->whole) != NULL) {
+			if (left)
+				*left = (unsigned int)min(
+					whole->len - (size_t)offset, (size_t)UINT_MAX);
+			return (unsigned char *)whole->data + offset;
+		}
+
+		/*
+		 * Another thread may close the file to stay under the file
+		 * limit before we get to map a window from it; open it
+		 * again if so.
+		 */
+		if ((window = git_mwindow_open(
+				&p->mwf, w_cursor, offset, 20, left)) != NULL ||
+			p->mwf.fd != -1)
+			return window;
+	}
+}
 
 /*
  * The per-object header is a pretty dense thing, which is
@@ -444,8 +474,12 @@ int git_packfile_unpack_header(
 	 * the maximum deflated object size is 2^137, which is just
 	 * insane, so we know won't exceed what we have been given.
 	 */
-/*	base = pack_window_open(p, w_curs, *curpos, &left); */
-	base = git_mwindow_open(mwf, w_curs, *curpos, 20, &left);
+	if (mwf->reopenable) {
+		/* knows about packs mapped whole or closed to save descriptors */
+		struct git_pack_file *p = (struct git_pack_file *)mwf;
+		base = pack_window_open(p, w_curs, *curpos, &left);
+	} else
+		base = git_mwindow_open(mwf, w_curs, *curpos, 20, &left);
 	if (base == NULL)
 		return GIT_EBUFS;
 
@@ -839,10 +873,36 @@ int packfile_unpack_compressed(
 	int st;
 	z_stream stream;
 	unsigned char *buffer, *in;
+	unsigned int avail;
+	size_t used;
 
 	buffer = git__calloc(1, size + 1);
 	GITERR_CHECK_ALLOC(buffer);
 
+	/*
+	 * Most objects are entirely within the current window; inflate
+	 * those in a single pass and only fall back to streaming across
+	 * windows when the compressed data runs past its end.
+	 */
+	if ((in = pack_window_open(p, w_curs, *curpos, &avail)) != NULL) {
+		st = git_zstream_inflatebuf(buffer, size, in, avail, &used);
+		git_mwindow_close(w_curs);
+
+		if (st == 0) {
+			*curpos += used;
+
+			obj->type = type;
+			obj->len = size;
+			obj->data = buffer;
+			return 0;
+		} else if (st != GIT_EBUFS) {
+			git__free(buffer);
+			return st;
+		}
+
+		giterr_clear();
+	}
+
 	memset(&stream, 0, sizeof(stream));
 	stream.next_out = buffer;
 	stream.avail_out = (uInt)size + 1;
@@ -973,6 +1033,11 @@ void git_packfile_free(struct git_pack_file *p)
 	if (p->mwf.fd >= 0)
 		p_close(p->mwf.fd);
 
+	if (p->whole) {
+		git_futils_mmap_free(p->whole);
+		git__free(p->whole);
+	}
+
 	pack_index_free(p);
 
 	git__free(p->bad_object_sha1);
@@ -982,6 +1047,31 @@ void git_packfile_free(struct git_pack_file *p)
 	git__free(p);
 }
 
+/*
+ * Map an opened pack in its entirety.  Reads from it are scattered all
+ * over, so tell the kernel not to bother reading ahead.  When it can't
+ * be mapped we fall back to windows.
+ */
+static int packfile_map_whole(struct git_pack_file *p)
+{
+	git_map *map;
+
+	if (!git__is_sizet(p->mwf.size))
+		return -1;
+
+	if ((map = git__calloc(1, sizeof(git_map))) == NULL ||
+		git_futils_mmap_ro(map, p->mwf.fd, 0, (size_t)p->mwf.size) < 0) {
+		git__free(map);
+		giterr_clear();
+		return -1;
+	}
+
+	p_madvise(map, GIT_MADV_RANDOM);
+
+	(void)git__swap(p->whole, map);
+	return 0;
+}
+
 static int packfile_open(struct git_pack_file *p)
 {
 	struct stat st;
@@ -996,7 +1086,7 @@ static int packfile_open(struct git_pack_file *p)
 	if (git_mutex_lock(&p->lock) < 0)
 		return packfile_error("failed to get lock for open");
 
-	if (p->mwf.fd >= 0) {
+	if (packfile_is_open(p)) {
 		git_mutex_unlock(&p->lock);
 		return 0;
 	}
@@ -1006,8 +1096,7 @@ static int packfile_open(struct git_pack_file *p)
 	if (p->mwf.fd < 0)
 		goto cleanup;
 
-	if (p_fstat(p->mwf.fd, &st) < 0 ||
-		git_mwindow_file_register(&p->mwf) < 0)
+	if (p_fstat(p->mwf.fd, &st) < 0)
 		goto cleanup;
 
 	/* If we created the struct before we had the pack we lack size. */
@@ -1048,6 +1137,25 @@ static int packfile_open(struct git_pack_file *p)
 	if (git_oid__cmp(&sha1, (git_oid *)idx_sha1) != 0)
 		goto cleanup;
 
+	p->mwf.reopenable = 1;
+
+	/* the map keeps the file around; its descriptor isn't needed */
+	if (git_packfile__map_whole && packfile_map_whole(p) == 0) {
+		p_close(p->mwf.fd);
+		p->mwf.fd = -1;
+
+		git_mutex_unlock(&p->lock);
+		return 0;
+	}
+
+	/*
+	 * Once registered the descriptor may be closed at any time to
+	 * stay under the file limit; we'll come back through here to
+	 * open and check it again.
+	 */
+	if (git_mwindow_file_register(&p->mwf) < 0)
+		goto cleanup;
+
 	git_mutex_unlock(&p->lock);
 	return 0;
 
@@ -1335,7 +1443,7 @@ int git_pack_entry_find(
 	/* we found a unique entry in the index;
 	 * make sure the packfile backing the index
 	 * still exists on disk */
-	if (p->mwf.fd == -1 && (error = packfile_open(p)) < 0)
+	if (!packfile_is_open(p) && (error = packfile_open(p)) < 0)
 		return error;
 
 	e->offset = offset;
@@ -103,6 +103,9 @@ struct git_pack_file {
 
 	git_pack_cache bases; /* delta base cache */
 
+	/* the whole pack, when mapped in one go; set once, under `lock` */
+	git_map *whole;
+
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[GIT_FLEX_ARRAY]; /* more */
 };
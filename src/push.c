@@ -14,6 +14,9 @@
 #include "vector.h"
 #include "push.h"
 #include "tree.h"
+#include "refs.h"
+
+#include "git2/sys/refs.h"
 
 static int push_spec_rref_cmp(const void *a, const void *b)
 {
@@ -194,22 +197,31 @@ int git_push_add_refspec(git_push *push, const char *refspec)
 	return 0;
 }
 
+static int push_spec_rref_lookup(const void *key, const void *spec)
+{
+	return strcmp(key, ((const push_spec *)spec)->rref);
+}
+
 int git_push_update_tips(
 		git_push *push,
 		const git_signature *signature,
 		const char *reflog_message)
 {
 	git_buf remote_ref_name = GIT_BUF_INIT;
+	git_vector tips = GIT_VECTOR_INIT, tip_specs = GIT_VECTOR_INIT,
+		updates = GIT_VECTOR_INIT;
 	size_t i, j;
 	git_refspec *fetch_spec;
 	push_spec *push_spec = NULL;
-	git_reference *remote_ref;
+	git_reference *remote_ref, *tip;
 	push_status *status;
 	int error = 0;
 
+	/*
+	 * Work out all of the remote refs first, so they can be written
+	 * in a single batch rather than one reference at a time.
+	 */
 	git_vector_foreach(&push->status, i, status) {
-		int fire_callback = 1;
-
 		/* Find the corresponding remote ref */
 		fetch_spec = git_remote__matching_refspec(push->remote, status->ref);
 		if (!fetch_spec)
@@ -219,42 +231,49 @@ int git_push_update_tips(
 			goto on_error;
 
 		/* Find matching  push ref spec */
-		git_vector_foreach(&push->specs, j, push_spec) {
-			if (!strcmp(push_spec->rref, status->ref))
-				break;
-		}
+		if (git_vector_bsearch2(&j, &push->specs, push_spec_rref_lookup, status->ref) < 0)
+			continue; /* Could not find the corresponding push ref spec for this push update */
 
-		/* Could not find the corresponding push ref spec for this push update */
-		if (j == push->specs.length)
-			continue;
+		push_spec = git_vector_get(&push->specs, j);
 
 		/* If this ref update was successful (ok, not ng), it will have an empty message */
-		if (status->msg == NULL) {
-			/* Update the remote ref */
-			if (git_oid_iszero(&push_spec->loid)) {
-				error = git_reference_lookup(&remote_ref, push->remote->repo, git_buf_cstr(&remote_ref_name));
-
-				if (error >= 0) {
-					error = git_reference_delete(remote_ref);
-					git_reference_free(remote_ref);
-				}
-			} else {
-				error = git_reference_create(NULL, push->remote->repo,
-							git_buf_cstr(&remote_ref_name), &push_spec->loid, 1, signature,
-							reflog_message ? reflog_message : "update by push");
-			}
-		}
+		if (status->msg == NULL && git_oid_iszero(&push_spec->loid)) {
+			/* There's nothing to delete, nor to report */
+			error = git_reference_lookup(&remote_ref, push->remote->repo, git_buf_cstr(&remote_ref_name));
 
-		if (error < 0) {
-			if (error != GIT_ENOTFOUND)
+			if (error == GIT_ENOTFOUND) {
+				giterr_clear();
+				continue;
+			} else if (error < 0)
 				goto on_error;
 
-			giterr_clear();
-			fire_callback = 0;
+			git_reference_free(remote_ref);
 		}
 
-		if (fire_callback && push->remote->callbacks.update_tips) {
-			error = push->remote->callbacks.update_tips(git_buf_cstr(&remote_ref_name),
+		tip = git_reference__alloc(git_buf_cstr(&remote_ref_name), &push_spec->loid, NULL);
+		GITERR_CHECK_ALLOC(tip);
+
+		if ((error = git_vector_insert(&tips, tip)) < 0) {
+			git_reference_free(tip);
+			goto on_error;
+		}
+
+		if ((error = git_vector_insert(&tip_specs, push_spec)) < 0 ||
+			(status->msg == NULL && (error = git_vector_insert(&updates, tip)) < 0))
+			goto on_error;
+	}
+
+	if (updates.length > 0 &&
+		(error = git_reference__update_batch(push->remote->repo,
+			(git_reference **)updates.contents, updates.length, signature,
+			reflog_message ? reflog_message : "update by push")) < 0)
+		goto on_error;
+
+	if (push->remote->callbacks.update_tips) {
+		git_vector_foreach(&tips, i, tip) {
+			push_spec = git_vector_get(&tip_specs, i);
+
+			error = push->remote->callbacks.update_tips(git_reference_name(tip),
 						&push_spec->roid, &push_spec->loid, push->remote->callbacks.payload);
 
 			if (error < 0)
@@ -265,6 +284,12 @@ int git_push_update_tips(
 	error = 0;
 
 on_error:
+	git_vector_foreach(&tips, i, tip)
+		git_reference_free(tip);
+
+	git_vector_free(&tips);
+	git_vector_free(&tip_specs);
+	git_vector_free(&updates);
 	git_buf_free(&remote_ref_name);
 	return error;
 }
@@ -405,153 +430,18 @@ on_error:
 	return error == GIT_ITEROVER ? 0 : error;
 }
 
-static int enqueue_object(
-	const git_tree_entry *entry,
-	git_packbuilder *pb)
-{
-	switch (git_tree_entry_type(entry)) {
-		case GIT_OBJ_COMMIT:
-			return 0;
-		case GIT_OBJ_TREE:
-			return git_packbuilder_insert_tree(pb, &entry->oid);
-		default:
-			return git_packbuilder_insert(pb, &entry->oid, entry->filename);
-	}
-}
-
-static int queue_differences(
-	git_tree *base,
-	git_tree *delta,
-	git_packbuilder *pb)
-{
-	git_tree *b_child = NULL, *d_child = NULL;
-	size_t b_length = git_tree_entrycount(base);
-	size_t d_length = git_tree_entrycount(delta);
-	size_t i = 0, j = 0;
-	int error;
-
-	while (i < b_length && j < d_length) {
-		const git_tree_entry *b_entry = git_tree_entry_byindex(base, i);
-		const git_tree_entry *d_entry = git_tree_entry_byindex(delta, j);
-		int cmp = 0;
-
-		if (!git_oid__cmp(&b_entry->oid, &d_entry->oid))
-			goto loop;
-
-		cmp = strcmp(b_entry->filename, d_entry->filename);
-
-		/* If the entries are both trees and they have the same name but are
-		 * different, then we'll recurse after adding the right-hand entry */
-		if (!cmp &&
-			git_tree_entry__is_tree(b_entry) &&
-			git_tree_entry__is_tree(d_entry)) {
-			/* Add the right-hand entry */
-			if ((error = git_packbuilder_insert(pb, &d_entry->oid,
-				d_entry->filename)) < 0)
-				goto on_error;
-
-			/* Acquire the subtrees and recurse */
-			if ((error = git_tree_lookup(&b_child,
-					git_tree_owner(base), &b_entry->oid)) < 0 ||
-				(error = git_tree_lookup(&d_child,
-					git_tree_owner(delta), &d_entry->oid)) < 0 ||
-				(error = queue_differences(b_child, d_child, pb)) < 0)
-				goto on_error;
-
-			git_tree_free(b_child); b_child = NULL;
-			git_tree_free(d_child); d_child = NULL;
-		}
-		/* If the object is new or different in the right-hand tree,
-		 * then enumerate it */
-		else if (cmp >= 0 &&
-			(error = enqueue_object(d_entry, pb)) < 0)
-			goto on_error;
-
-	loop:
-		if (cmp <= 0) i++;
-		if (cmp >= 0) j++;
-	}
-
-	/* Drain the right-hand tree of entries */
-	for (; j < d_length; j++)
-		if ((error = enqueue_object(git_tree_entry_byindex(delta, j), pb)) < 0)
-			goto on_error;
-
-	error = 0;
-
-on_error:
-	if (b_child)
-		git_tree_free(b_child);
-
-	if (d_child)
-		git_tree_free(d_child);
-
-	return error;
-}
-
 static int queue_objects(git_push *push)
 {
 	git_vector commits = GIT_VECTOR_INIT;
 	git_oid *oid;
 	size_t i;
-	unsigned j;
 	int error;
 
 	if ((error = revwalk(&commits, push)) < 0)
 		goto on_error;
 
 	git_vector_foreach(&commits, i, oid) {
-		git_commit *parent = NULL, *commit;
-		git_tree *tree = NULL, *ptree = NULL;
-		size_t parentcount;
-
-		if ((error = git_commit_lookup(&commit,	push->repo, oid)) < 0)
-			goto on_error;
-
-		/* Insert the commit */
-		if ((error = git_packbuilder_insert(push->pb, oid, NULL)) < 0)
-			goto loop_error;
-
-		parentcount = git_commit_parentcount(commit);
-
-		if (!parentcount) {
-			if ((error = git_packbuilder_insert_tree(push->pb,
-				git_commit_tree_id(commit))) < 0)
-				goto loop_error;
-		} else {
-			if ((error = git_tree_lookup(&tree, push->repo,
-					git_commit_tree_id(commit))) < 0 ||
-				(error = git_packbuilder_insert(push->pb,
-					git_commit_tree_id(commit), NULL)) < 0)
-				goto loop_error;
-
-			/* For each parent, add the items which are different */
-			for (j = 0; j < parentcount; j++) {
-				if ((error = git_commit_parent(&parent, commit, j)) < 0 ||
-					(error = git_commit_tree(&ptree, parent)) < 0 ||
-					(error = queue_differences(ptree, tree, push->pb)) < 0)
-					goto loop_error;
-
-				git_tree_free(ptree); ptree = NULL;
-				git_commit_free(parent); parent = NULL;
-			}
-		}
-
-		error = 0;
-
-	loop_error:
-		if (tree)
-			git_tree_free(tree);
-
-		if (ptree)
-			git_tree_free(ptree);
-
-		if (parent)
-			git_commit_free(parent);
-
-		git_commit_free(commit);
-
-		if (error < 0)
+		if ((error = git_packbuilder__insert_commit_changes(push->pb, oid)) < 0)
 			goto on_error;
 	}
 
@@ -8,15 +8,21 @@
 #include "common.h"
 #include "posix.h"
 
+#include "git2/config.h"
 #include "git2/object.h"
 #include "git2/refs.h"
 #include "git2/refdb.h"
+#include "git2/signature.h"
 #include "git2/sys/refdb_backend.h"
+#include "git2/sys/refs.h"
 
+#include "array.h"
 #include "hash.h"
+#include "pool.h"
 #include "refdb.h"
 #include "refs.h"
 #include "reflog.h"
+#include "repository.h"
 
 int git_refdb_new(git_refdb **out, git_repository *repo)
 {
@@ -34,6 +40,58 @@ int git_refdb_new(git_refdb **out, git_repository *repo)
 	return 0;
 }
 
+/*
+ * Find out which backend `extensions.refStorage` asks for. As with git,
+ * extensions only count in the repository's own config, and only once
+ * it declares format version 1.
+ */
+static int refdb_storage_backend(git_refdb_backend **out, git_repository *repo)
+{
+	git_config *config, *local = NULL;
+	const char *storage;
+	int version = 0, error;
+
+	if ((error = git_repository_config__weakptr(&config, repo)) < 0)
+		return error;
+
+	if ((error = git_config_open_level(&local, config, GIT_CONFIG_LEVEL_LOCAL)) == GIT_ENOTFOUND) {
+		giterr_clear();
+		return git_refdb_backend_fs(out, repo);
+	} else if (error < 0) {
+		return error;
+	}
+
+	if ((error = git_config_get_string(&storage, local, "extensions.refstorage")) == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = git_refdb_backend_fs(out, repo);
+		goto done;
+	} else if (error < 0) {
+		goto done;
+	}
+
+	if ((error = git_config_get_int32(&version, local, "core.repositoryformatversion")) == GIT_ENOTFOUND)
+		giterr_clear();
+	else if (error < 0)
+		goto done;
+
+	if (version < 1) {
+		giterr_set(GITERR_REPOSITORY,
+			"extensions.refStorage requires repository format version 1");
+		error = -1;
+	} else if (!strcmp(storage, "files")) {
+		error = git_refdb_backend_fs(out, repo);
+	} else if (!strcmp(storage, "reftable")) {
+		error = git_refdb_backend_reftable(out, repo);
+	} else {
+		giterr_set(GITERR_REPOSITORY, "Unsupported reference storage '%s'", storage);
+		error = -1;
+	}
+
+done:
+	git_config_free(local);
+	return error;
+}
+
 int git_refdb_open(git_refdb **out, git_repository *repo)
 {
 	git_refdb *db;
@@ -46,8 +104,8 @@ int git_refdb_open(git_refdb **out, git_repository *repo)
 	if (git_refdb_new(&db, repo) < 0)
 		return -1;
 
-	/* Add the default (filesystem) backend */
-	if (git_refdb_backend_fs(&dir, repo) < 0) {
+	/* Add the backend the configuration asks for, the filesystem by default */
+	if (refdb_storage_backend(&dir, repo) < 0) {
 		git_refdb_free(db);
 		return -1;
 	}
@@ -207,6 +265,325 @@ int git_refdb_delete(struct git_refdb *db, const char *ref_name, const git_oid *
 	return db->backend->del(db->backend, ref_name, old_id, old_target);
 }
 
+struct git_refdb_transaction {
+	git_refdb *db;
+	unsigned int flags;
+	git_pool names;
+	git_array_t(git_refdb_update) updates;
+};
+
+int git_refdb_transaction_new(
+	git_refdb_transaction **out, git_refdb *db, unsigned int flags)
+{
+	git_refdb_transaction *tx;
+
+	assert(out && db);
+
+	tx = git__calloc(1, sizeof(git_refdb_transaction));
+	GITERR_CHECK_ALLOC(tx);
+
+	if (git_pool_init(&tx->names, 1, 0) < 0) {
+		git__free(tx);
+		return -1;
+	}
+
+	GIT_REFCOUNT_INC(db);
+	tx->db = db;
+	tx->flags = flags;
+
+	*out = tx;
+	return 0;
+}
+
+static int transaction_add(
+	git_refdb_transaction *tx,
+	const char *refname,
+	const git_oid *id,
+	const git_oid *old_id)
+{
+	git_refname_t normalized;
+	git_refdb_update *update;
+	int error;
+
+	if ((error = git_reference__normalize_for_repo(
+			normalized, tx->db->repo, refname)) < 0)
+		return error;
+
+	update = git_array_alloc(tx->updates);
+	GITERR_CHECK_ALLOC(update);
+
+	memset(update, 0, sizeof(git_refdb_update));
+
+	if ((update->name = git_pool_strdup(&tx->names, normalized)) == NULL) {
+		tx->updates.size--;
+		return -1;
+	}
+
+	if (id)
+		git_oid_cpy(&update->id, id);
+
+	if (old_id) {
+		git_oid_cpy(&update->old_id, old_id);
+		update->check_old = 1;
+	}
+
+	return 0;
+}
+
+int git_refdb_transaction_set_target(
+	git_refdb_transaction *tx,
+	const char *refname,
+	const git_oid *id,
+	const git_oid *old_id)
+{
+	git_odb *odb;
+	int error;
+
+	assert(tx && refname && id);
+
+	if ((error = git_repository_odb__weakptr(&odb, tx->db->repo)) < 0)
+		return error;
+
+	/* Sanity check the references being created - targets must exist. */
+	if (!git_odb_exists(odb, id)) {
+		giterr_set(GITERR_REFERENCE,
+			"Target OID for the reference doesn't exist on the repository");
+		return -1;
+	}
+
+	return transaction_add(tx, refname, id, old_id);
+}
+
+int git_refdb_transaction_delete(
+	git_refdb_transaction *tx,
+	const char *refname,
+	const git_oid *old_id)
+{
+	assert(tx && refname);
+
+	return transaction_add(tx, refname, NULL, old_id);
+}
+
+static int update_cmp(const void *a, const void *b)
+{
+	const git_refdb_update *update_a = a, *update_b = b;
+	return strcmp(update_a->name, update_b->name);
+}
+
+static int transaction_check_names(git_refdb_transaction *tx)
+{
+	git_vector sorted;
+	git_refdb_update *update, *prev = NULL;
+	size_t i;
+	int error = 0;
+
+	if (git_vector_init(&sorted, git_array_size(tx->updates), update_cmp) < 0)
+		return -1;
+
+	for (i = 0; i < git_array_size(tx->updates) && !error; ++i)
+		error = git_vector_insert(&sorted, git_array_get(tx->updates, i));
+
+	git_vector_sort(&sorted);
+
+	git_vector_foreach(&sorted, i, update) {
+		if (error < 0)
+			break;
+
+		if (prev && !strcmp(prev->name, update->name)) {
+			giterr_set(GITERR_REFERENCE,
+				"Reference '%s' is updated twice in one transaction", update->name);
+			error = -1;
+		}
+
+		prev = update;
+	}
+
+	git_vector_free(&sorted);
+	return error;
+}
+
+static int old_value_mismatch(const char *name)
+{
+	giterr_set(GITERR_REFERENCE,
+		"Old value of reference '%s' does not match", name);
+	return GIT_EMODIFIED;
+}
+
+/* Look up what `update` replaces and check it against the old value */
+static int transaction_check(
+	git_reference **prev, git_refdb_backend *backend, git_refdb_update *update)
+{
+	int error;
+
+	if ((error = backend->lookup(prev, backend, update->name)) == GIT_ENOTFOUND) {
+		giterr_clear();
+		*prev = NULL;
+	} else if (error < 0) {
+		return error;
+	}
+
+	if (!update->check_old)
+		return 0;
+
+	if (git_oid_iszero(&update->old_id))
+		return *prev ? old_value_mismatch(update->name) : 0;
+
+	if (!*prev || (*prev)->type != GIT_REF_OID ||
+		!git_oid_equal(&(*prev)->target.oid, &update->old_id))
+		return old_value_mismatch(update->name);
+
+	return 0;
+}
+
+static int transaction_update(
+	git_refdb_backend *backend,
+	git_refdb_update *update,
+	const git_signature *who,
+	const char *message)
+{
+	git_reference *ref;
+	const git_oid *old_id;
+	bool must_exist, must_not_exist;
+	int error, exists;
+
+	must_not_exist = update->check_old && git_oid_iszero(&update->old_id);
+	must_exist = update->check_old && !must_not_exist;
+	old_id = must_exist ? &update->old_id : NULL;
+
+	if (git_oid_iszero(&update->id) && must_not_exist) {
+		if ((error = backend->exists(&exists, backend, update->name)) == 0 && exists)
+			error = old_value_mismatch(update->name);
+	} else if (git_oid_iszero(&update->id)) {
+		error = backend->del(backend, update->name, old_id, NULL);
+	} else {
+		if ((ref = git_reference__alloc(update->name, &update->id, NULL)) == NULL)
+			return -1;
+
+		error = backend->write(backend, ref, !must_not_exist,
+			who, message, old_id, NULL);
+
+		git_reference_free(ref);
+	}
+
+	/* it's fine for a deleted reference to be gone already */
+	if (error == GIT_ENOTFOUND && !must_exist) {
+		giterr_clear();
+		error = 0;
+	} else if (error == GIT_ENOTFOUND ||
+		(error == GIT_EEXISTS && must_not_exist)) {
+		error = old_value_mismatch(update->name);
+	}
+
+	return error;
+}
+
+/* Put back `prev`, unless somebody else has changed the reference since */
+static void transaction_undo(
+	git_refdb_backend *backend,
+	git_refdb_update *update,
+	git_reference *prev,
+	const git_signature *who,
+	const char *message)
+{
+	bool deleted = git_oid_iszero(&update->id);
+
+	if (prev)
+		backend->write(backend, prev, !deleted,
+			who, message, deleted ? NULL : &update->id, NULL);
+	else if (!deleted)
+		backend->del(backend, update->name, &update->id, NULL);
+
+	giterr_clear();
+}
+
+/*
+ * Without help from the backend, the updates go in one at a time. All
+ * the old values are checked before the first one, and should one of
+ * them still fail, the ones before it are undone.
+ */
+static int transaction_apply(
+	git_refdb_transaction *tx, const git_signature *who, const char *message)
+{
+	git_refdb_backend *backend = tx->db->backend;
+	git_reference **prev;
+	git_error_state error_state;
+	size_t i, applied = 0, count = git_array_size(tx->updates);
+	int error = 0;
+
+	prev = git__calloc(count, sizeof(git_reference *));
+	GITERR_CHECK_ALLOC(prev);
+
+	for (i = 0; i < count && !error; ++i)
+		error = transaction_check(&prev[i], backend, git_array_get(tx->updates, i));
+
+	while (applied < count && !error) {
+		if ((error = transaction_update(backend,
+				git_array_get(tx->updates, applied), who, message)) == 0)
+			applied++;
+	}
+
+	if (error < 0 && applied > 0) {
+		giterr_capture(&error_state, error);
+
+		while (applied-- > 0)
+			transaction_undo(backend, git_array_get(tx->updates, applied),
+				prev[applied], who, message);
+
+		error = giterr_restore(&error_state);
+	}
+
+	for (i = 0; i < count; ++i)
+		git_reference_free(prev[i]);
+	git__free(prev);
+
+	return error;
+}
+
+int git_refdb_transaction_commit(
+	git_refdb_transaction *tx, const git_signature *who, const char *message)
+{
+	git_refdb_backend *backend;
+	git_signature *sig = NULL;
+	int error;
+
+	assert(tx && tx->db->backend);
+
+	backend = tx->db->backend;
+
+	if (!git_array_size(tx->updates))
+		return 0;
+
+	if ((error = transaction_check_names(tx)) < 0)
+		return error;
+
+	if (!who) {
+		if ((error = git_reference__log_signature(&sig, tx->db->repo)) < 0)
+			return error;
+
+		who = sig;
+	}
+
+	if (backend->transaction)
+		error = backend->transaction(backend, tx->updates.ptr,
+			git_array_size(tx->updates), tx->flags, who, message);
+	else
+		error = transaction_apply(tx, who, message);
+
+	git_signature_free(sig);
+	return error;
+}
+
+void git_refdb_transaction_free(git_refdb_transaction *tx)
+{
+	if (tx == NULL)
+		return;
+
+	git_array_clear(tx->updates);
+	git_pool_clear(&tx->names);
+	GIT_REFCOUNT_DEC(tx->db, git_refdb__free);
+	git__free(tx);
+}
+
 int git_refdb_reflog_read(git_reflog **out, git_refdb *db,  const char *name)
 {
 	int error;
@@ -222,6 +599,26 @@ int git_refdb_reflog_read(git_reflog **out, git_refdb *db,  const char *name)
 	return 0;
 }
 
+int git_refdb_reflog_read_recent(git_reflog **out, git_refdb *db, const char *name, size_t count)
+{
+	int error;
+
+	assert(db && db->backend);
+
+	if (db->backend->reflog_read_recent)
+		error = db->backend->reflog_read_recent(out, db->backend, name, count);
+	else if ((error = db->backend->reflog_read(out, db->backend, name)) == 0)
+		git_reflog__keep_recent(*out, count);
+
+	if (error < 0)
+		return error;
+
+	GIT_REFCOUNT_INC(db);
+	(*out)->db = db;
+
+	return 0;
+}
+
 int git_refdb_has_log(git_refdb *db, const char *refname)
 {
 	assert(db && refname);
@@ -46,6 +46,7 @@ int git_refdb_write(git_refdb *refdb, git_reference *ref, int force, const git_s
 int git_refdb_delete(git_refdb *refdb, const char *ref_name, const git_oid *old_id, const char *old_target);
 
 int git_refdb_reflog_read(git_reflog **out, git_refdb *db,  const char *name);
+int git_refdb_reflog_read_recent(git_reflog **out, git_refdb *db, const char *name, size_t count);
 int git_refdb_reflog_write(git_reflog *reflog);
 
 int git_refdb_has_log(git_refdb *db, const char *refname);
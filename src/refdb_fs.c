@@ -51,6 +51,28 @@ struct packref {
 	char name[GIT_FLEX_ARRAY];
 };
 
+/*
+ * A sorted packed-refs file, mapped as it is on disk.  Reads search it
+ * in place instead of loading every reference into the refcache, which
+ * only writes need.
+ */
+typedef struct {
+	git_refcount rc;
+	git_map map;
+	git_buf buf;
+	const char *records;
+	const char *end;
+	unsigned int sorted : 1;
+} packed_map;
+
+/* A record of the packed-refs file, pointing into the mapping */
+typedef struct {
+	const char *name;
+	size_t name_len;
+	git_oid oid;
+	git_oid peel;
+} packed_record;
+
 typedef struct refdb_fs_backend {
 	git_refdb_backend parent;
 
@@ -58,6 +80,9 @@ typedef struct refdb_fs_backend {
 	char *path;
 
 	git_sortedcache *refcache;
+	git_mutex map_lock;
+	packed_map *map;
+	git_futils_filestamp map_stamp;
 	int peeling_mode;
 	git_iterator_flag_t iterator_flags;
 	uint32_t direach_flags;
@@ -192,6 +217,310 @@ parse_failed:
 	return -1;
 }
 
+static void packed_map_free(packed_map *map)
+{
+	if (map->map.len)
+		git_futils_mmap_free(&map->map);
+
+	git_buf_free(&map->buf);
+	git__free(map);
+}
+
+static void packed_map_decref(packed_map *map)
+{
+	if (map)
+		GIT_REFCOUNT_DEC(map, packed_map_free);
+}
+
+static int packed_map_has_trait(const char *header, size_t len, const char *trait)
+{
+	git_buf traits = GIT_BUF_INIT;
+	int found;
+
+	/* keep the space in front of the first trait */
+	if (git_buf_put(&traits, header, len) < 0)
+		return -1;
+
+	found = strstr(traits.ptr, trait) != NULL;
+
+	git_buf_free(&traits);
+	return found;
+}
+
+static int packed_map_parse_header(packed_map *map)
+{
+	static const char *traits_header = "# pack-refs with:";
+	size_t header_len = strlen(traits_header);
+	const char *scan = map->records, *eol;
+	int sorted;
+
+	if ((size_t)(map->end - scan) > header_len &&
+		!memcmp(scan, traits_header, header_len)) {
+		if (!(eol = memchr(scan, '\n', map->end - scan)))
+			goto parse_failed;
+
+		if ((sorted = packed_map_has_trait(scan + header_len,
+				eol - scan - header_len, " sorted ")) < 0)
+			return -1;
+
+		map->sorted = sorted;
+	}
+
+	while (scan < map->end && *scan == '#') {
+		if (!(eol = memchr(scan, '\n', map->end - scan)))
+			goto parse_failed;
+		scan = eol + 1;
+	}
+
+	map->records = scan;
+	return 0;
+
+parse_failed:
+	giterr_set(GITERR_REFERENCE, "Corrupted packed references file");
+	return -1;
+}
+
+static int packed_map_open(packed_map **out, refdb_fs_backend *backend)
+{
+	packed_map *map;
+	git_buf path = GIT_BUF_INIT;
+	git_file fd = -1;
+	struct stat st;
+	int error;
+
+	map = git__calloc(1, sizeof(packed_map));
+	GITERR_CHECK_ALLOC(map);
+	GIT_REFCOUNT_INC(map);
+
+	if ((error = git_buf_joinpath(&path, backend->path, GIT_PACKEDREFS_FILE)) < 0)
+		goto done;
+
+	/* no packed references is as good as an empty, sorted file */
+	if ((fd = git_futils_open_ro(path.ptr)) == GIT_ENOTFOUND) {
+		giterr_clear();
+		git_futils_filestamp_set(&backend->map_stamp, NULL);
+		map->sorted = 1;
+		goto done;
+	}
+
+	if ((error = fd) < 0)
+		goto done;
+
+	if (p_fstat(fd, &st) < 0) {
+		giterr_set(GITERR_OS, "Failed to stat '%s'", path.ptr);
+		error = -1;
+		goto done;
+	}
+
+	git_futils_filestamp_set_from_stat(&backend->map_stamp, &st);
+
+	if (st.st_size > 0) {
+		if (!git__is_sizet(st.st_size)) {
+			giterr_set(GITERR_OS, "File `%s` too large to mmap", path.ptr);
+			error = -1;
+			goto done;
+		}
+
+#ifdef GIT_WIN32
+		/* a mapped file could not be replaced by the next write */
+		if ((error = git_futils_readbuffer_fd(&map->buf, fd, (size_t)st.st_size)) < 0)
+			goto done;
+
+		map->records = map->buf.ptr;
+#else
+		if ((error = git_futils_mmap_ro(&map->map, fd, 0, (size_t)st.st_size)) < 0)
+			goto done;
+
+		map->records = map->map.data;
+#endif
+		map->end = map->records + (size_t)st.st_size;
+	}
+
+	error = packed_map_parse_header(map);
+
+done:
+	if (fd >= 0)
+		p_close(fd);
+
+	if (error < 0) {
+		git_futils_filestamp_set(&backend->map_stamp, NULL);
+		packed_map_free(map);
+		map = NULL;
+	}
+
+	git_buf_free(&path);
+	*out = map;
+	return error;
+}
+
+/* Get the current packed-refs mapping, reopening it if the file changed */
+static int packed_map_get(packed_map **out, refdb_fs_backend *backend)
+{
+	git_buf path = GIT_BUF_INIT;
+	packed_map *map;
+	int changed, error = 0;
+
+	if (git_buf_joinpath(&path, backend->path, GIT_PACKEDREFS_FILE) < 0)
+		return -1;
+
+	if (git_mutex_lock(&backend->map_lock) < 0) {
+		giterr_set(GITERR_OS, "Unable to lock the packed references");
+		git_buf_free(&path);
+		return -1;
+	}
+
+	changed = git_futils_filestamp_check(&backend->map_stamp, path.ptr);
+
+	if (!backend->map || changed > 0 ||
+		(changed == GIT_ENOTFOUND && backend->map->records != NULL)) {
+		if ((error = packed_map_open(&map, backend)) == 0) {
+			packed_map_decref(backend->map);
+			backend->map = map;
+		}
+	}
+
+	if (!error) {
+		GIT_REFCOUNT_INC(backend->map);
+		*out = backend->map;
+	}
+
+	git_mutex_unlock(&backend->map_lock);
+	git_buf_free(&path);
+	return error;
+}
+
+/* Move back to the start of the record `scan` points into */
+static const char *packed_record_start(const packed_map *map, const char *scan)
+{
+	for (;;) {
+		while (scan > map->records && scan[-1] != '\n')
+			scan--;
+
+		/* a peeled line belongs to the reference above it */
+		if (scan == map->records || *scan != '^')
+			return scan;
+
+		scan--;
+	}
+}
+
+static const char *packed_next_line(const packed_map *map, const char *scan)
+{
+	const char *eol = memchr(scan, '\n', map->end - scan);
+	return eol ? eol + 1 : map->end;
+}
+
+static const char *packed_record_end(const packed_map *map, const char *scan)
+{
+	scan = packed_next_line(map, scan);
+
+	if (scan < map->end && *scan == '^')
+		scan = packed_next_line(map, scan);
+
+	return scan;
+}
+
+/* Parse "<OID> <refname>\n" and the optional "^<OID>\n" at `*scan` */
+static int packed_record_parse(
+	packed_record *record, const packed_map *map, const char **scan)
+{
+	const char *line = *scan, *eol, *next;
+
+	next = packed_next_line(map, line);
+	eol = (next > line && next[-1] == '\n') ? next - 1 : next;
+
+	if (eol > line && eol[-1] == '\r')
+		eol--;
+
+	if (eol - line < GIT_OID_HEXSZ + 2 || line[GIT_OID_HEXSZ] != ' ' ||
+		git_oid_fromstrn(&record->oid, line, GIT_OID_HEXSZ) < 0)
+		goto parse_failed;
+
+	record->name = line + GIT_OID_HEXSZ + 1;
+	record->name_len = eol - record->name;
+	memset(&record->peel, 0, sizeof(git_oid));
+
+	if (next < map->end && *next == '^') {
+		if (map->end - next < GIT_OID_HEXSZ + 1 ||
+			git_oid_fromstrn(&record->peel, next + 1, GIT_OID_HEXSZ) < 0)
+			goto parse_failed;
+
+		next = packed_next_line(map, next);
+	}
+
+	*scan = next;
+	return 0;
+
+parse_failed:
+	giterr_set(GITERR_REFERENCE, "Corrupted packed references file");
+	return -1;
+}
+
+static int packed_record_cmp(
+	const packed_map *map, const char *record, const char *key, size_t key_len)
+{
+	const char *name = record + GIT_OID_HEXSZ + 1, *eol;
+	size_t name_len;
+	int cmp;
+
+	eol = packed_next_line(map, record);
+	if (eol > record && eol[-1] == '\n')
+		eol--;
+	if (eol > record && eol[-1] == '\r')
+		eol--;
+
+	/* a malformed record sorts first and fails when it gets parsed */
+	name_len = eol > name ? (size_t)(eol - name) : 0;
+
+	if ((cmp = memcmp(name, key, min(name_len, key_len))) != 0)
+		return cmp;
+
+	return name_len < key_len ? -1 : (name_len > key_len);
+}
+
+/* Find the first record whose name is not before `key` */
+static const char *packed_map_find(
+	const packed_map *map, const char *key, size_t key_len)
+{
+	const char *lo = map->records, *hi = map->end, *record;
+
+	while (lo < hi) {
+		record = packed_record_start(map, lo + (hi - lo) / 2);
+
+		if (record < lo)
+			record = lo;
+
+		if (packed_record_cmp(map, record, key, key_len) < 0)
+			lo = packed_record_end(map, record);
+		else
+			hi = record;
+	}
+
+	return lo;
+}
+
+static int packed_map_lookup(
+	git_reference **out, const packed_map *map, const char *ref_name)
+{
+	size_t len = strlen(ref_name);
+	const char *scan = packed_map_find(map, ref_name, len);
+	packed_record record;
+
+	if (scan == map->end || packed_record_cmp(map, scan, ref_name, len) != 0)
+		return GIT_ENOTFOUND;
+
+	if (packed_record_parse(&record, map, &scan) < 0)
+		return -1;
+
+	if (out == NULL)
+		return 0;
+
+	*out = git_reference__alloc(ref_name, &record.oid, &record.peel);
+	GITERR_CHECK_ALLOC(*out);
+
+	return 0;
+}
+
 static int loose_parse_oid(
 	git_oid *oid, const char *filename, git_buf *file_content)
 {
@@ -317,27 +646,6 @@ static int packed_loadloose(refdb_fs_backend *backend)
 	return error;
 }
 
-static int refdb_fs_backend__exists(
-	int *exists,
-	git_refdb_backend *_backend,
-	const char *ref_name)
-{
-	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
-	git_buf ref_path = GIT_BUF_INIT;
-
-	assert(backend);
-
-	if (packed_reload(backend) < 0 ||
-		git_buf_joinpath(&ref_path, backend->path, ref_name) < 0)
-		return -1;
-
-	*exists = git_path_isfile(ref_path.ptr) ||
-		(git_sortedcache_lookup(backend->refcache, ref_name) != NULL);
-
-	git_buf_free(&ref_path);
-	return 0;
-}
-
 static const char *loose_parse_symbolic(git_buf *file_content)
 {
 	const unsigned int header_len = (unsigned int)strlen(GIT_SYMREF);
@@ -399,6 +707,7 @@ static int ref_error_notfound(const char *name)
 	return GIT_ENOTFOUND;
 }
 
+/* Find a packed reference; with a NULL `out` this only checks it exists */
 static int packed_lookup(
 	git_reference **out,
 	refdb_fs_backend *backend,
@@ -406,6 +715,22 @@ static int packed_lookup(
 {
 	int error = 0;
 	struct packref *entry;
+	packed_map *map;
+
+	if (backend->path) {
+		if (packed_map_get(&map, backend) < 0)
+			return -1;
+
+		if (map->sorted) {
+			if ((error = packed_map_lookup(out, map, ref_name)) == GIT_ENOTFOUND)
+				error = ref_error_notfound(ref_name);
+
+			packed_map_decref(map);
+			return error;
+		}
+
+		packed_map_decref(map);
+	}
 
 	if (packed_reload(backend) < 0)
 		return -1;
@@ -416,7 +741,7 @@ static int packed_lookup(
 	entry = git_sortedcache_lookup(backend->refcache, ref_name);
 	if (!entry) {
 		error = ref_error_notfound(ref_name);
-	} else {
+	} else if (out) {
 		*out = git_reference__alloc(ref_name, &entry->oid, &entry->peel);
 		if (!*out)
 			error = -1;
@@ -450,6 +775,34 @@ static int refdb_fs_backend__lookup(
 	return error;
 }
 
+static int refdb_fs_backend__exists(
+	int *exists,
+	git_refdb_backend *_backend,
+	const char *ref_name)
+{
+	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
+	git_buf ref_path = GIT_BUF_INIT;
+	int error = 0;
+
+	assert(backend);
+
+	if (git_buf_joinpath(&ref_path, backend->path, ref_name) < 0)
+		return -1;
+
+	if (git_path_isfile(ref_path.ptr))
+		*exists = 1;
+	else if ((error = packed_lookup(NULL, backend, ref_name)) == 0)
+		*exists = 1;
+	else if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		*exists = 0;
+		error = 0;
+	}
+
+	git_buf_free(&ref_path);
+	return error;
+}
+
 typedef struct {
 	git_reference_iterator parent;
 
@@ -461,6 +814,15 @@ typedef struct {
 	git_sortedcache *cache;
 	size_t loose_pos;
 	size_t packed_pos;
+
+	/* the literal start of the glob, which every match shares */
+	char *prefix;
+	size_t prefix_len;
+
+	/* with a sorted packed-refs, the records from the prefix on */
+	packed_map *map;
+	const char *map_pos;
+	git_buf name;
 } refdb_fs_iter;
 
 static void refdb_fs_backend__iterator_free(git_reference_iterator *_iter)
@@ -470,34 +832,55 @@ static void refdb_fs_backend__iterator_free(git_reference_iterator *_iter)
 	git_vector_free(&iter->loose);
 	git_pool_clear(&iter->pool);
 	git_sortedcache_free(iter->cache);
+	packed_map_decref(iter->map);
+	git_buf_free(&iter->name);
 	git__free(iter);
 }
 
+/* The deepest directory holding every loose reference the glob matches */
+static int iter_loose_root(git_buf *out, const char *glob)
+{
+	size_t len = glob ? strcspn(glob, "?*[\\") : 0;
+
+	while (len > 0 && glob[len - 1] != '/')
+		len--;
+
+	if (len <= strlen(GIT_REFS_DIR) || git__prefixcmp(glob, GIT_REFS_DIR) != 0)
+		return git_buf_sets(out, GIT_REFS_DIR);
+
+	return git_buf_set(out, glob, len);
+}
+
 static int iter_load_loose_paths(refdb_fs_backend *backend, refdb_fs_iter *iter)
 {
 	int error = 0;
-	git_buf path = GIT_BUF_INIT;
+	git_buf path = GIT_BUF_INIT, root = GIT_BUF_INIT;
 	git_iterator *fsit = NULL;
 	const git_index_entry *entry = NULL;
 
 	if (!backend->path) /* do nothing if no path for loose refs */
 		return 0;
 
-	if ((error = git_buf_printf(&path, "%s/refs", backend->path)) < 0 ||
-		(error = git_iterator_for_filesystem(
-			&fsit, path.ptr, backend->iterator_flags, NULL, NULL)) < 0) {
-		git_buf_free(&path);
-		return error;
-	}
+	/* only descend into the directory the glob is about */
+	if ((error = iter_loose_root(&root, iter->glob)) < 0 ||
+		(error = git_buf_joinpath(&path, backend->path, root.ptr)) < 0)
+		goto done;
+
+	if (!git_path_isdir(path.ptr))
+		goto done;
+
+	if ((error = git_iterator_for_filesystem(
+			&fsit, path.ptr, backend->iterator_flags, NULL, NULL)) < 0)
+		goto done;
 
-	error = git_buf_sets(&path, GIT_REFS_DIR);
+	error = git_buf_sets(&path, root.ptr);
 
 	while (!error && !git_iterator_advance(&entry, fsit)) {
 		const char *ref_name;
 		struct packref *ref;
 		char *ref_dup;
 
-		git_buf_truncate(&path, strlen(GIT_REFS_DIR));
+		git_buf_truncate(&path, root.size);
 		git_buf_puts(&path, entry->path);
 		ref_name = git_buf_cstr(&path);
 
@@ -505,11 +888,13 @@ static int iter_load_loose_paths(refdb_fs_backend *backend, refdb_fs_iter *iter)
 			(iter->glob && p_fnmatch(iter->glob, ref_name, 0) != 0))
 			continue;
 
-		git_sortedcache_rlock(backend->refcache);
-		ref = git_sortedcache_lookup(backend->refcache, ref_name);
-		if (ref)
-			ref->flags |= PACKREF_SHADOWED;
-		git_sortedcache_runlock(backend->refcache);
+		if (!iter->map) {
+			git_sortedcache_rlock(backend->refcache);
+			ref = git_sortedcache_lookup(backend->refcache, ref_name);
+			if (ref)
+				ref->flags |= PACKREF_SHADOWED;
+			git_sortedcache_runlock(backend->refcache);
+		}
 
 		ref_dup = git_pool_strdup(&iter->pool, ref_name);
 		if (!ref_dup)
@@ -518,12 +903,61 @@ static int iter_load_loose_paths(refdb_fs_backend *backend, refdb_fs_iter *iter)
 			error = git_vector_insert(&iter->loose, ref_dup);
 	}
 
+	/* the packed references they shadow are found by name */
+	if (!error && iter->map)
+		git_vector_sort(&iter->loose);
+
+done:
 	git_iterator_free(fsit);
+	git_buf_free(&root);
 	git_buf_free(&path);
 
 	return error;
 }
 
+/* Copy the packed references, skipping the ones before the prefix */
+static int iter_load_cache(refdb_fs_iter *iter, refdb_fs_backend *backend)
+{
+	int error;
+
+	if ((error = git_sortedcache_copy(&iter->cache, backend->refcache, 1, NULL, NULL)) < 0)
+		return error;
+
+	if (iter->prefix_len)
+		git_sortedcache_lookup_index(&iter->packed_pos, iter->cache, iter->prefix);
+
+	return 0;
+}
+
+/* Read the next packed record that is neither shadowed nor filtered out */
+static int iter_next_mapped(packed_record *record, refdb_fs_iter *iter)
+{
+	packed_map *map = iter->map;
+
+	while (iter->map_pos < map->end) {
+		if (packed_record_parse(record, map, &iter->map_pos) < 0)
+			return -1;
+
+		if (record->name_len < iter->prefix_len ||
+			memcmp(record->name, iter->prefix, iter->prefix_len) != 0) {
+			iter->map_pos = map->end;
+			break;
+		}
+
+		if (git_buf_set(&iter->name, record->name, record->name_len) < 0)
+			return -1;
+
+		if (git_vector_bsearch(NULL, &iter->loose, iter->name.ptr) == 0)
+			continue;
+		if (iter->glob && p_fnmatch(iter->glob, iter->name.ptr, 0) != 0)
+			continue;
+
+		return 0;
+	}
+
+	return GIT_ITEROVER;
+}
+
 static int refdb_fs_backend__iterator_next(
 	git_reference **out, git_reference_iterator *_iter)
 {
@@ -541,17 +975,29 @@ static int refdb_fs_backend__iterator_next(
 		giterr_clear();
 	}
 
-	if (!iter->cache) {
-		if ((error = git_sortedcache_copy(&iter->cache, backend->refcache, 1, NULL, NULL)) < 0)
+	if (iter->map) {
+		packed_record record;
+
+		if ((error = iter_next_mapped(&record, iter)) < 0)
 			return error;
+
+		*out = git_reference__alloc(iter->name.ptr, &record.oid, &record.peel);
+		GITERR_CHECK_ALLOC(*out);
+
+		return 0;
 	}
 
+	if (!iter->cache && (error = iter_load_cache(iter, backend)) < 0)
+		return error;
+
 	error = GIT_ITEROVER;
 	while (iter->packed_pos < git_sortedcache_entrycount(iter->cache)) {
 		ref = git_sortedcache_entry(iter->cache, iter->packed_pos++);
 		if (!ref) /* stop now if another thread deleted refs and we past end */
 			break;
 
+		if (git__prefixcmp(ref->name, iter->prefix) != 0)
+			break;
 		if (ref->flags & PACKREF_SHADOWED)
 			continue;
 		if (iter->glob && p_fnmatch(iter->glob, ref->name, 0) != 0)
@@ -584,17 +1030,26 @@ static int refdb_fs_backend__iterator_next_name(
 		giterr_clear();
 	}
 
-	if (!iter->cache) {
-		if ((error = git_sortedcache_copy(&iter->cache, backend->refcache, 1, NULL, NULL)) < 0)
-			return error;
-	}
+	if (iter->map) {
+		packed_record record;
 
-	error = GIT_ITEROVER;
+		if ((error = iter_next_mapped(&record, iter)) == 0)
+			*out = iter->name.ptr;
+
+		return error;
+	}
+
+	if (!iter->cache && (error = iter_load_cache(iter, backend)) < 0)
+		return error;
+
+	error = GIT_ITEROVER;
 	while (iter->packed_pos < git_sortedcache_entrycount(iter->cache)) {
 		ref = git_sortedcache_entry(iter->cache, iter->packed_pos++);
 		if (!ref) /* stop now if another thread deleted refs and we past end */
 			break;
 
+		if (git__prefixcmp(ref->name, iter->prefix) != 0)
+			break;
 		if (ref->flags & PACKREF_SHADOWED)
 			continue;
 		if (iter->glob && p_fnmatch(iter->glob, ref->name, 0) != 0)
@@ -613,23 +1068,49 @@ static int refdb_fs_backend__iterator(
 {
 	refdb_fs_iter *iter;
 	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
+	packed_map *map = NULL;
 
 	assert(backend);
 
-	if (packed_reload(backend) < 0)
+	if (backend->path && packed_map_get(&map, backend) < 0)
+		return -1;
+
+	if (map && !map->sorted) {
+		packed_map_decref(map);
+		map = NULL;
+	}
+
+	if (!map && packed_reload(backend) < 0)
 		return -1;
 
 	iter = git__calloc(1, sizeof(refdb_fs_iter));
-	GITERR_CHECK_ALLOC(iter);
+	if (!iter) {
+		packed_map_decref(map);
+		giterr_set_oom();
+		return -1;
+	}
+
+	iter->map = map;
 
 	if (git_pool_init(&iter->pool, 1, 0) < 0 ||
-		git_vector_init(&iter->loose, 8, NULL) < 0)
+		git_vector_init(&iter->loose, 8, git__strcmp_cb) < 0)
 		goto fail;
 
 	if (glob != NULL &&
 		(iter->glob = git_pool_strdup(&iter->pool, glob)) == NULL)
 		goto fail;
 
+	/* everything matching the glob starts with its literal part */
+	if (glob != NULL)
+		iter->prefix_len = strcspn(glob, "?*[\\");
+
+	iter->prefix = git_pool_strndup(&iter->pool, glob ? glob : "", iter->prefix_len);
+	if (!iter->prefix)
+		goto fail;
+
+	if (map)
+		iter->map_pos = packed_map_find(map, iter->prefix, iter->prefix_len);
+
 	iter->parent.next = refdb_fs_backend__iterator_next;
 	iter->parent.next_name = refdb_fs_backend__iterator_next_name;
 	iter->parent.free = refdb_fs_backend__iterator_free;
@@ -756,10 +1237,26 @@ static int loose_commit(git_filebuf *file, const git_reference *ref)
 static int packed_find_peel(refdb_fs_backend *backend, struct packref *ref)
 {
 	git_object *object;
+	git_odb *odb;
+	git_otype type;
+	size_t len;
 
 	if (ref->flags & PACKREF_HAS_PEEL || ref->flags & PACKREF_CANNOT_PEEL)
 		return 0;
 
+	/*
+	 * Only tags peel, and the header is enough to tell, which saves
+	 * us inflating every commit when writing out many references
+	 */
+	if (git_repository_odb__weakptr(&odb, backend->repo) < 0 ||
+		git_odb_read_header(&len, &type, odb, &ref->oid) < 0)
+		return -1;
+
+	if (type != GIT_OBJ_TAG) {
+		ref->flags |= PACKREF_CANNOT_PEEL;
+		return 0;
+	}
+
 	/*
 	 * Find the tagged object in the repository
 	 */
@@ -874,59 +1371,66 @@ static int packed_remove_loose(refdb_fs_backend *backend)
 }
 
 /*
- * Write all the contents in the in-memory packfile to disk.
+ * Write all the contents in the in-memory packfile to the locked
+ * `pack_file`. The cache must be locked for writing.
  */
-static int packed_write(refdb_fs_backend *backend)
+static int packed_commit(refdb_fs_backend *backend, git_filebuf *pack_file)
 {
 	git_sortedcache *refcache = backend->refcache;
-	git_filebuf pack_file = GIT_FILEBUF_INIT;
 	size_t i;
 
-	/* lock the cache to updates while we do this */
-	if (git_sortedcache_wlock(refcache) < 0)
-		return -1;
-
-	/* Open the file! */
-	if (git_filebuf_open(&pack_file, git_sortedcache_path(refcache), 0, GIT_PACKEDREFS_FILE_MODE) < 0)
-		goto fail;
-
 	/* Packfiles have a header... apparently
 	 * This is in fact not required, but we might as well print it
 	 * just for kicks */
-	if (git_filebuf_printf(&pack_file, "%s\n", GIT_PACKEDREFS_HEADER) < 0)
-		goto fail;
+	if (git_filebuf_printf(pack_file, "%s\n", GIT_PACKEDREFS_HEADER) < 0)
+		return -1;
 
 	for (i = 0; i < git_sortedcache_entrycount(refcache); ++i) {
 		struct packref *ref = git_sortedcache_entry(refcache, i);
 
 		if (packed_find_peel(backend, ref) < 0)
-			goto fail;
+			return -1;
 
-		if (packed_write_ref(ref, &pack_file) < 0)
-			goto fail;
+		if (packed_write_ref(ref, pack_file) < 0)
+			return -1;
 	}
 
 	/* if we've written all the references properly, we can commit
 	 * the packfile to make the changes effective */
-	if (git_filebuf_commit(&pack_file) < 0)
-		goto fail;
+	if (git_filebuf_commit(pack_file) < 0)
+		return -1;
 
 	/* when and only when the packfile has been properly written,
 	 * we can go ahead and remove the loose refs */
 	if (packed_remove_loose(backend) < 0)
-		goto fail;
+		return -1;
 
 	git_sortedcache_updated(refcache);
-	git_sortedcache_wunlock(refcache);
-
-	/* we're good now */
 	return 0;
+}
+
+/*
+ * Write all the contents in the in-memory packfile to disk.
+ */
+static int packed_write(refdb_fs_backend *backend)
+{
+	git_sortedcache *refcache = backend->refcache;
+	git_filebuf pack_file = GIT_FILEBUF_INIT;
+	int error;
+
+	/* lock the cache to updates while we do this */
+	if (git_sortedcache_wlock(refcache) < 0)
+		return -1;
+
+	/* Open the file! */
+	if ((error = git_filebuf_open(&pack_file, git_sortedcache_path(refcache),
+			0, GIT_PACKEDREFS_FILE_MODE)) == 0)
+		error = packed_commit(backend, &pack_file);
 
-fail:
 	git_filebuf_cleanup(&pack_file);
 	git_sortedcache_wunlock(refcache);
 
-	return -1;
+	return error;
 }
 
 static int reflog_append(refdb_fs_backend *backend, const git_reference *ref, const git_oid *old, const git_oid *new, const git_signature *author, const char *message);
@@ -1030,169 +1534,612 @@ static int maybe_append_head(refdb_fs_backend *backend, const git_reference *ref
 	if (git_reference_type(head) == GIT_REF_OID)
 		goto cleanup;
 
-	if ((error = git_reference_lookup(&tmp, backend->repo, GIT_HEAD_FILE)) < 0)
-		goto cleanup;
+	if ((error = git_reference_lookup(&tmp, backend->repo, GIT_HEAD_FILE)) < 0)
+		goto cleanup;
+
+	/* Go down the symref chain until we find the branch */
+	while (git_reference_type(tmp) == GIT_REF_SYMBOLIC) {
+		error = git_reference_lookup(&peeled, backend->repo, git_reference_symbolic_target(tmp));
+		if (error < 0)
+			break;
+
+		git_reference_free(tmp);
+		tmp = peeled;
+	}
+
+	if (error == GIT_ENOTFOUND) {
+		error = 0;
+		name = git_reference_symbolic_target(tmp);
+	} else if (error < 0) {
+		goto cleanup;
+	} else {
+		name = git_reference_name(tmp);
+	}
+
+	if (strcmp(name, ref->name))
+		goto cleanup;
+
+	error = reflog_append(backend, head, &old_id, git_reference_target(ref), who, message);
+
+cleanup:
+	git_reference_free(tmp);
+	git_reference_free(head);
+	return error;
+}
+
+
+static int refdb_fs_backend__write(
+	git_refdb_backend *_backend,
+	const git_reference *ref,
+	int force,
+	const git_signature *who,
+	const char *message,
+	const git_oid *old_id,
+	const char *old_target)
+{
+	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	int error = 0, cmp = 0, should_write;
+	const char *new_target = NULL;
+	const git_oid *new_id = NULL;
+
+	assert(backend);
+
+	error = reference_path_available(backend, ref->name, NULL, force);
+	if (error < 0)
+		return error;
+
+	/* We need to perform the reflog append and old value check under the ref's lock */
+	if ((error = loose_lock(&file, backend, ref->name)) < 0)
+		return error;
+
+	if ((error = cmp_old_ref(&cmp, _backend, ref->name, old_id, old_target)) < 0)
+		goto on_error;
+
+	if (cmp) {
+		giterr_set(GITERR_REFERENCE, "old reference value does not match");
+		error = GIT_EMODIFIED;
+		goto on_error;
+	}
+
+	if (ref->type == GIT_REF_SYMBOLIC)
+		new_target = ref->target.symbolic;
+	else
+		new_id = &ref->target.oid;
+
+	error = cmp_old_ref(&cmp, _backend, ref->name, new_id, new_target);
+	if (error < 0 && error != GIT_ENOTFOUND)
+		goto on_error;
+
+	/* Don't update if we have the same value */
+	if (!error && !cmp) {
+		error = 0;
+		goto on_error; /* not really error */
+	}
+
+	if ((error = should_write_reflog(&should_write, backend->repo, ref->name)) < 0)
+		goto on_error;
+
+	if (should_write) {
+		if ((error = reflog_append(backend, ref, NULL, NULL, who, message)) < 0)
+			goto on_error;
+		if ((error = maybe_append_head(backend, ref, who, message)) < 0)
+			goto on_error;
+	}
+
+	return loose_commit(&file, ref);
+
+on_error:
+        git_filebuf_cleanup(&file);
+        return error;
+}
+
+static int refdb_fs_backend__delete(
+	git_refdb_backend *_backend,
+	const char *ref_name,
+	const git_oid *old_id, const char *old_target)
+{
+	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
+	git_buf loose_path = GIT_BUF_INIT;
+	size_t pack_pos;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	int error = 0, cmp = 0;
+	bool loose_deleted = 0;
+
+	assert(backend && ref_name);
+
+	if ((error = loose_lock(&file, backend, ref_name)) < 0)
+		return error;
+
+	error = cmp_old_ref(&cmp, _backend, ref_name, old_id, old_target);
+	if (error < 0)
+		goto cleanup;
+
+	if (cmp) {
+		giterr_set(GITERR_REFERENCE, "old reference value does not match");
+		error = GIT_EMODIFIED;
+		goto cleanup;
+	}
+
+	/* If a loose reference exists, remove it from the filesystem */
+	if (git_buf_joinpath(&loose_path, backend->path, ref_name) < 0)
+		return -1;
+
+	if (git_path_isfile(loose_path.ptr)) {
+		error = p_unlink(loose_path.ptr);
+		loose_deleted = 1;
+	}
+
+	git_buf_free(&loose_path);
+
+	if (error != 0)
+		goto cleanup;
+
+	if ((error = packed_reload(backend)) < 0)
+		goto cleanup;
+
+	/* If a packed reference exists, remove it from the packfile and repack */
+	if ((error = git_sortedcache_wlock(backend->refcache)) < 0)
+		goto cleanup;
+
+	if (!(error = git_sortedcache_lookup_index(
+			&pack_pos, backend->refcache, ref_name)))
+		error = git_sortedcache_remove(backend->refcache, pack_pos);
+
+	git_sortedcache_wunlock(backend->refcache);
+
+	if (error == GIT_ENOTFOUND) {
+		error = loose_deleted ? 0 : ref_error_notfound(ref_name);
+		goto cleanup;
+	}
+
+	error = packed_write(backend);
+
+cleanup:
+	git_filebuf_cleanup(&file);
+
+	return error;
+}
+
+/*
+ * Find out which id a reference has on disk, with a loose file
+ * shadowing the packfile. Symbolic references count as the zero id.
+ */
+static int batch_old_id(
+	git_oid *out, bool *loose, refdb_fs_backend *backend, const char *name)
+{
+	git_reference *ref;
+	struct packref *packed;
+	int error;
+
+	memset(out, 0, sizeof(git_oid));
+	*loose = false;
+
+	if ((error = loose_lookup(&ref, backend, name)) == 0) {
+		if (ref->type == GIT_REF_OID)
+			git_oid_cpy(out, &ref->target.oid);
+
+		git_reference_free(ref);
+		*loose = true;
+		return 0;
+	}
+
+	if (error != GIT_ENOTFOUND)
+		return error;
+
+	giterr_clear();
+
+	if ((packed = git_sortedcache_lookup(backend->refcache, name)) == NULL)
+		return GIT_ENOTFOUND;
+
+	git_oid_cpy(out, &packed->oid);
+	return 0;
+}
+
+/*
+ * Make sure none of the leading directories of `name` is a reference,
+ * and that it isn't the leading directory of one either, going by the
+ * loose and packed references as well as the rest of the batch.
+ */
+static int batch_path_available(
+	refdb_fs_backend *backend, git_vector *batch, git_buf *path, const char *name)
+{
+	struct packref *packed;
+	const char *other;
+	char *prefix, *slash;
+	size_t base, pos;
+	bool collides = false;
+
+	if (git_buf_joinpath(path, backend->path, name) < 0)
+		return -1;
+
+	base = git_buf_len(path) - strlen(name);
+	prefix = path->ptr + base;
+
+	for (slash = strchr(prefix, '/'); slash && !collides; slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		collides = git_sortedcache_lookup(backend->refcache, prefix) != NULL ||
+			git_vector_bsearch(NULL, batch, prefix) == 0 ||
+			git_path_isfile(path->ptr);
+		*slash = '/';
+	}
+
+	if (!collides) {
+		if (git_buf_putc(path, '/') < 0)
+			return -1;
+
+		prefix = path->ptr + base;
+
+		git_sortedcache_lookup_index(&pos, backend->refcache, prefix);
+		packed = git_sortedcache_entry(backend->refcache, pos);
+
+		git_vector_bsearch(&pos, batch, prefix);
+		other = git_vector_get(batch, pos);
+
+		collides = (packed && !git__prefixcmp(packed->name, prefix)) ||
+			(other && !git__prefixcmp(other, prefix));
+
+		git_buf_truncate(path, git_buf_len(path) - 1);
+	}
+
+	/* Empty directories left behind by deleted references don't count */
+	if (!collides) {
+		if (git_futils_rmdir_r(name, backend->path, GIT_RMDIR_SKIP_NONEMPTY) < 0)
+			return -1;
+
+		collides = git_path_isdir(path->ptr);
+	}
+
+	if (collides) {
+		giterr_set(GITERR_REFERENCE,
+			"Path to reference '%s' collides with existing one", name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Whether any of the references a batch sets has a loose file */
+static int batch_has_loose(
+	refdb_fs_backend *backend,
+	git_buf *path,
+	const git_refdb_update *updates,
+	size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		if (git_oid_iszero(&updates[i].id))
+			continue;
+
+		if (git_buf_joinpath(path, backend->path, updates[i].name) < 0)
+			return -1;
+
+		if (git_path_isfile(path->ptr))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Find the branch HEAD points to, which gets its reflog entries as well */
+static int batch_head_branch(git_buf *out, refdb_fs_backend *backend)
+{
+	git_reference *ref = NULL;
+	int error, nesting = 0;
+
+	git_buf_clear(out);
+
+	error = refdb_fs_backend__lookup(&ref, (git_refdb_backend *)backend, GIT_HEAD_FILE);
+
+	while (!error && ref->type == GIT_REF_SYMBOLIC && nesting++ < MAX_NESTING_LEVEL) {
+		if ((error = git_buf_sets(out, ref->target.symbolic)) < 0)
+			break;
+
+		git_reference_free(ref);
+		ref = NULL;
+
+		error = refdb_fs_backend__lookup(&ref, (git_refdb_backend *)backend, out->ptr);
+	}
+
+	git_reference_free(ref);
+
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = 0;
+	}
+
+	return error;
+}
+
+static int batch_append_reflog(
+	refdb_fs_backend *backend,
+	const git_reference *head,
+	const git_reference *ref,
+	const git_oid *old_id,
+	const git_signature *who,
+	const char *message)
+{
+	int error, should_write;
+
+	if ((error = should_write_reflog(&should_write, backend->repo, ref->name)) < 0 ||
+		!should_write)
+		return error;
+
+	if ((error = reflog_append(backend, ref, old_id, &ref->target.oid, who, message)) < 0)
+		return error;
+
+	if (head && !strcmp(head->target.symbolic, ref->name))
+		error = reflog_append(backend, head, old_id, &ref->target.oid, who, message);
+
+	return error;
+}
+
+/* Check the current value of a reference against what the update expects */
+static int transaction_check_old(
+	refdb_fs_backend *backend, const git_refdb_update *update)
+{
+	git_oid current;
+	bool loose, matches;
+	int error;
+
+	if (!update->check_old)
+		return 0;
+
+	error = batch_old_id(&current, &loose, backend, update->name);
+
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		matches = git_oid_iszero(&update->old_id);
+	} else if (error < 0) {
+		return error;
+	} else {
+		/* a symbolic reference exists, but has no id to match */
+		matches = !git_oid_iszero(&update->old_id) &&
+			git_oid_equal(&current, &update->old_id);
+	}
+
+	if (!matches) {
+		giterr_set(GITERR_REFERENCE,
+			"Old value of reference '%s' does not match", update->name);
+		return GIT_EMODIFIED;
+	}
+
+	return 0;
+}
+
+/*
+ * Apply a transaction while holding the lock on the packfile, and in
+ * the default mode the locks on each of the loose files as well, so the
+ * old values can't change between checking them and committing.
+ *
+ * In the packed mode, the whole transaction is a single rewrite of the
+ * packfile rather than a loose file for each reference. Any loose files
+ * for them are removed afterwards, as they'd shadow the new values. We
+ * don't pack references that are kept loose, though: if any of them
+ * already has a loose file, the transaction is applied in the default
+ * mode instead.
+ */
+static int refdb_fs_backend__transaction(
+	git_refdb_backend *_backend,
+	const git_refdb_update *updates,
+	size_t count,
+	unsigned int flags,
+	const git_signature *who,
+	const char *message)
+{
+	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
+	git_sortedcache *refcache = backend->refcache;
+	git_filebuf pack_file = GIT_FILEBUF_INIT, *files = NULL;
+	git_buf path = GIT_BUF_INIT;
+	git_vector names = GIT_VECTOR_INIT, loose_names = GIT_VECTOR_INIT;
+	git_reference *head = NULL, **refs = NULL;
+	const git_refdb_update *update;
+	struct packref *packed;
+	const char *name;
+	git_oid old_id, *old_ids = NULL;
+	size_t i, pos;
+	bool packed_mode = (flags & GIT_REFDB_TRANSACTION_PACKED) != 0;
+	bool loose, changed = false;
+	int error, failed = 0;
+
+	assert(backend && (updates || !count));
+
+	if ((error = git_vector_init(&names, count, git__strcmp_cb)) < 0 ||
+		(error = git_vector_init(&loose_names, 0, NULL)) < 0)
+		goto done;
+
+	for (i = 0; i < count; ++i) {
+		if (!git_oid_iszero(&updates[i].id) &&
+			(error = git_vector_insert(&names, (char *)updates[i].name)) < 0)
+			goto done;
+	}
+
+	git_vector_sort(&names);
 
-	/* Go down the symref chain until we find the branch */
-	while (git_reference_type(tmp) == GIT_REF_SYMBOLIC) {
-		error = git_reference_lookup(&peeled, backend->repo, git_reference_symbolic_target(tmp));
+	if (packed_mode &&
+		(error = batch_has_loose(backend, &path, updates, count)) != 0) {
 		if (error < 0)
-			break;
+			goto done;
 
-		git_reference_free(tmp);
-		tmp = peeled;
+		packed_mode = false;
 	}
 
-	if (error == GIT_ENOTFOUND) {
-		error = 0;
-		name = git_reference_symbolic_target(tmp);
-	} else if (error < 0) {
-		goto cleanup;
-	} else {
-		name = git_reference_name(tmp);
+	if (!packed_mode &&
+		(files = git__calloc(count, sizeof(git_filebuf))) == NULL) {
+		error = -1;
+		goto done;
 	}
 
-	if (strcmp(name, ref->name))
-		goto cleanup;
-
-	error = reflog_append(backend, head, &old_id, git_reference_target(ref), who, message);
+	/* what the reflogs get once the new values are on disk */
+	refs = git__calloc(count, sizeof(git_reference *));
+	old_ids = git__calloc(count, sizeof(git_oid));
 
-cleanup:
-	git_reference_free(tmp);
-	git_reference_free(head);
-	return error;
-}
+	if (!refs || !old_ids) {
+		error = -1;
+		goto done;
+	}
 
+	if ((error = batch_head_branch(&path, backend)) < 0)
+		goto done;
 
-static int refdb_fs_backend__write(
-	git_refdb_backend *_backend,
-	const git_reference *ref,
-	int force,
-	const git_signature *who,
-	const char *message,
-	const git_oid *old_id,
-	const char *old_target)
-{
-	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
-	git_filebuf file = GIT_FILEBUF_INIT;
-	int error = 0, cmp = 0, should_write;
-	const char *new_target = NULL;
-	const git_oid *new_id = NULL;
+	if (git_buf_len(&path) &&
+		(head = git_reference__alloc_symbolic(GIT_HEAD_FILE, path.ptr)) == NULL) {
+		error = -1;
+		goto done;
+	}
 
-	assert(backend);
+	/* The lock on the packfile covers the whole transaction */
+	if ((error = git_filebuf_open(&pack_file, git_sortedcache_path(refcache),
+			0, GIT_PACKEDREFS_FILE_MODE)) < 0 ||
+		(error = packed_reload(backend)) < 0)
+		goto done;
 
-	error = reference_path_available(backend, ref->name, NULL, force);
-	if (error < 0)
-		return error;
+	if ((error = git_sortedcache_wlock(refcache)) < 0)
+		goto done;
 
-	/* We need to perform the reflog append and old value check under the ref's lock */
-	if ((error = loose_lock(&file, backend, ref->name)) < 0)
-		return error;
+	git_vector_foreach(&names, i, name) {
+		if ((error = batch_path_available(backend, &names, &path, name)) < 0)
+			goto unlock;
+	}
 
-	if ((error = cmp_old_ref(&cmp, _backend, ref->name, old_id, old_target)) < 0)
-		goto on_error;
+	for (i = 0; files && i < count; ++i) {
+		if ((error = loose_lock(&files[i], backend, updates[i].name)) < 0)
+			goto unlock;
+	}
 
-	if (cmp) {
-		giterr_set(GITERR_REFERENCE, "old reference value does not match");
-		error = GIT_EMODIFIED;
-		goto on_error;
+	for (i = 0; i < count; ++i) {
+		if ((error = transaction_check_old(backend, &updates[i])) < 0)
+			goto unlock;
 	}
 
-	if (ref->type == GIT_REF_SYMBOLIC)
-		new_target = ref->target.symbolic;
-	else
-		new_id = &ref->target.oid;
+	/*
+	 * Deletions go first, so looking up their position doesn't have
+	 * to sort the cache again after every new entry.
+	 */
+	for (i = 0; i < count; ++i) {
+		update = &updates[i];
 
-	error = cmp_old_ref(&cmp, _backend, ref->name, new_id, new_target);
-	if (error < 0 && error != GIT_ENOTFOUND)
-		goto on_error;
+		if (!git_oid_iszero(&update->id))
+			continue;
 
-	/* Don't update if we have the same value */
-	if (!error && !cmp) {
-		error = 0;
-		goto on_error; /* not really error */
-	}
+		if ((error = batch_old_id(&old_id, &loose, backend, update->name)) == GIT_ENOTFOUND)
+			continue;
+		else if (error < 0)
+			goto unlock;
 
-	if ((error = should_write_reflog(&should_write, backend->repo, ref->name)) < 0)
-		goto on_error;
+		if (loose && (error = git_vector_insert(&loose_names, (char *)update->name)) < 0)
+			goto unlock;
 
-	if (should_write) {
-		if ((error = reflog_append(backend, ref, NULL, NULL, who, message)) < 0)
-			goto on_error;
-		if ((error = maybe_append_head(backend, ref, who, message)) < 0)
-			goto on_error;
+		if (git_sortedcache_lookup_index(&pos, refcache, update->name) < 0)
+			continue;
+
+		if ((error = git_sortedcache_remove(refcache, pos)) < 0)
+			goto unlock;
+
+		changed = true;
 	}
 
-	return loose_commit(&file, ref);
+	for (i = 0; i < count; ++i) {
+		update = &updates[i];
 
-on_error:
-        git_filebuf_cleanup(&file);
-        return error;
-}
+		if (git_oid_iszero(&update->id))
+			continue;
 
-static int refdb_fs_backend__delete(
-	git_refdb_backend *_backend,
-	const char *ref_name,
-	const git_oid *old_id, const char *old_target)
-{
-	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
-	git_buf loose_path = GIT_BUF_INIT;
-	size_t pack_pos;
-	git_filebuf file = GIT_FILEBUF_INIT;
-	int error = 0, cmp = 0;
-	bool loose_deleted = 0;
+		error = batch_old_id(&old_id, &loose, backend, update->name);
 
-	assert(backend && ref_name);
+		if (error == GIT_ENOTFOUND)
+			error = 0;
+		else if (error < 0)
+			goto unlock;
+		else if (git_oid_equal(&old_id, &update->id))
+			continue; /* Don't update if we have the same value */
 
-	if ((error = loose_lock(&file, backend, ref_name)) < 0)
-		return error;
+		if ((refs[i] = git_reference__alloc(update->name, &update->id, NULL)) == NULL) {
+			error = -1;
+			goto unlock;
+		}
 
-	error = cmp_old_ref(&cmp, _backend, ref_name, old_id, old_target);
-	if (error < 0)
-		goto cleanup;
+		git_oid_cpy(&old_ids[i], &old_id);
 
-	if (cmp) {
-		giterr_set(GITERR_REFERENCE, "old reference value does not match");
-		error = GIT_EMODIFIED;
-		goto cleanup;
-	}
+		/* the loose file gets written once everything is checked */
+		if (!packed_mode)
+			continue;
 
-	/* If a loose reference exists, remove it from the filesystem */
-	if (git_buf_joinpath(&loose_path, backend->path, ref_name) < 0)
-		return -1;
+		if ((error = git_sortedcache_upsert((void **)&packed, refcache, update->name)) < 0)
+			goto unlock;
 
-	if (git_path_isfile(loose_path.ptr)) {
-		error = p_unlink(loose_path.ptr);
-		loose_deleted = 1;
+		git_oid_cpy(&packed->oid, &update->id);
+		memset(&packed->peel, 0, sizeof(git_oid));
+		packed->flags = 0;
+		changed = true;
+
+		if (loose && (error = git_vector_insert(&loose_names, (char *)update->name)) < 0)
+			goto unlock;
 	}
 
-	git_buf_free(&loose_path);
+	if (changed && (error = packed_commit(backend, &pack_file)) < 0)
+		goto unlock;
 
-	if (error != 0)
-		goto cleanup;
+	changed = false;
 
-	if ((error = packed_reload(backend)) < 0)
-		goto cleanup;
+	for (i = 0; files && i < count; ++i) {
+		if (refs[i] && (error = loose_commit(&files[i], refs[i])) < 0)
+			goto unlock;
+	}
 
-	/* If a packed reference exists, remove it from the packfile and repack */
-	if ((error = git_sortedcache_wlock(backend->refcache)) < 0)
-		goto cleanup;
+	/* Only log what has made it to disk */
+	for (i = 0; i < count; ++i) {
+		if (refs[i] && (error = batch_append_reflog(
+				backend, head, refs[i], &old_ids[i], who, message)) < 0)
+			goto unlock;
+	}
 
-	if (!(error = git_sortedcache_lookup_index(
-			&pack_pos, backend->refcache, ref_name)))
-		error = git_sortedcache_remove(backend->refcache, pack_pos);
+	/*
+	 * As with packing, we try to remove as many of the loose files as
+	 * we can, and then report if any of them are still around.
+	 */
+	git_vector_foreach(&loose_names, i, name) {
+		if (git_buf_joinpath(&path, backend->path, name) < 0) {
+			error = -1;
+			goto unlock;
+		}
 
-	git_sortedcache_wunlock(backend->refcache);
+		if (p_unlink(path.ptr) < 0 && errno != ENOENT && !failed) {
+			giterr_set(GITERR_REFERENCE,
+				"Failed to remove loose reference '%s' after packing: %s",
+				path.ptr, strerror(errno));
+			failed = 1;
+		}
+	}
 
-	if (error == GIT_ENOTFOUND) {
-		error = loose_deleted ? 0 : ref_error_notfound(ref_name);
-		goto cleanup;
+	error = failed ? -1 : 0;
+
+unlock:
+	/* What we have in memory didn't make it to disk, so read it again */
+	if (changed) {
+		git_sortedcache_clear(refcache, false);
+		git_sortedcache_invalidate(refcache);
 	}
 
-	error = packed_write(backend);
+	git_sortedcache_wunlock(refcache);
 
-cleanup:
-	git_filebuf_cleanup(&file);
+done:
+	for (i = 0; i < count; ++i) {
+		if (files)
+			git_filebuf_cleanup(&files[i]);
+		if (refs)
+			git_reference_free(refs[i]);
+	}
+
+	git__free(files);
+	git__free(refs);
+	git__free(old_ids);
+	git_filebuf_cleanup(&pack_file);
+	git_reference_free(head);
+	git_vector_free(&loose_names);
+	git_vector_free(&names);
+	git_buf_free(&path);
 
 	return error;
 }
@@ -1282,6 +2229,8 @@ static void refdb_fs_backend__free(git_refdb_backend *_backend)
 	assert(backend);
 
 	git_sortedcache_free(backend->refcache);
+	packed_map_decref(backend->map);
+	git_mutex_free(&backend->map_lock);
 	git__free(backend->path);
 	git__free(backend);
 }
@@ -1531,6 +2480,120 @@ success:
 	return error;
 }
 
+/*
+ * Find where the newest `count` entries of the reflog in `data` start,
+ * scanning backwards from its end.  Returns how many entries there are
+ * from that point on, which is less than `count` only when the whole
+ * reflog was scanned.
+ */
+static size_t reflog_tail(size_t *out, const char *data, size_t len, size_t count)
+{
+	size_t pos = len, found = 0;
+
+	*out = len;
+
+	if (!count)
+		return 0;
+
+	/* skip the empty lines at the end */
+	while (pos > 0 && data[pos - 1] == '\n')
+		pos--;
+
+	if (!pos)
+		return 0;
+
+	for (; pos > 0; pos--) {
+		if (data[pos - 1] != '\n' || data[pos] == '\n')
+			continue;
+
+		if (++found == count) {
+			*out = pos;
+			return found;
+		}
+	}
+
+	/* the oldest entry starts the file */
+	*out = 0;
+	return found + 1;
+}
+
+/* Map the reflog at `path`; an empty reflog leaves `map` empty */
+static int reflog_map(git_map *map, const char *path)
+{
+	git_file fd;
+	git_off_t len;
+	int error = 0;
+
+	memset(map, 0, sizeof(git_map));
+
+	if ((fd = git_futils_open_ro(path)) < 0)
+		return fd;
+
+	len = git_futils_filesize(fd);
+
+	if (!git__is_sizet(len)) {
+		giterr_set(GITERR_OS, "Failed to map reflog '%s'", path);
+		error = -1;
+	} else if (len > 0)
+		error = git_futils_mmap_ro(map, fd, 0, (size_t)len);
+
+	p_close(fd);
+	return error;
+}
+
+static void reflog_unmap(git_map *map)
+{
+	if (map->len)
+		git_futils_mmap_free(map);
+}
+
+static int refdb_reflog_fs__read_recent(
+	git_reflog **out, git_refdb_backend *_backend, const char *name, size_t count)
+{
+	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
+	git_buf path = GIT_BUF_INIT, tail = GIT_BUF_INIT;
+	git_reflog *log;
+	git_map map;
+	size_t offset;
+	int error;
+
+	assert(out && backend && name);
+
+	if ((error = reflog_alloc(&log, name)) < 0)
+		return error;
+
+	log->partial = 1;
+
+	if ((error = retrieve_reflog_path(&path, backend->repo, name)) < 0)
+		goto done;
+
+	if ((error = reflog_map(&map, git_buf_cstr(&path))) < 0) {
+		if (error == GIT_ENOTFOUND) {
+			giterr_clear();
+			error = 0;
+		}
+		goto done;
+	}
+
+	/* Only the tail gets parsed, from a copy as the parser wants a NUL */
+	reflog_tail(&offset, map.data, map.len, count);
+	error = git_buf_put(&tail, (const char *)map.data + offset, map.len - offset);
+	reflog_unmap(&map);
+
+	if (!error)
+		error = reflog_parse(log, git_buf_cstr(&tail), git_buf_len(&tail));
+
+done:
+	if (error < 0)
+		git_reflog_free(log);
+	else
+		*out = log;
+
+	git_buf_free(&tail);
+	git_buf_free(&path);
+	return error;
+}
+
 static int serialize_reflog_entry(
 	git_buf *buf,
 	const git_oid *oid_old,
@@ -1627,6 +2690,54 @@ success:
 	return error;
 }
 
+/*
+ * Cut a reflog which has grown half again as long as `core.logMaxEntries`
+ * allows back to its newest entries.  The slack keeps every append past
+ * the limit from rewriting the file.  Must be called under reference lock.
+ */
+static int reflog_expire(refdb_fs_backend *backend, const char *path)
+{
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_map map;
+	struct stat st;
+	size_t max, slack, offset;
+	int limit, error;
+
+	if ((error = git_repository__cvar(
+			&limit, backend->repo, GIT_CVAR_LOGMAXENTRIES)) < 0 || limit <= 0)
+		return error;
+
+	max = (size_t)limit;
+	slack = max + max / 2;
+
+	/* Every entry holds two ids, so a short file is never over the limit */
+	if (p_stat(path, &st) < 0 ||
+		(size_t)st.st_size / (2 * GIT_OID_HEXSZ + 2) <= slack)
+		return 0;
+
+	if ((error = reflog_map(&map, path)) < 0)
+		return error;
+
+	if (reflog_tail(&offset, map.data, map.len, slack) < slack || !offset)
+		goto done;
+
+	reflog_tail(&offset, map.data, map.len, max);
+
+	if ((error = git_filebuf_open(&file, path, 0, GIT_REFLOG_FILE_MODE)) < 0 ||
+		(error = git_filebuf_write(
+			&file, (const char *)map.data + offset, map.len - offset)) < 0) {
+		git_filebuf_cleanup(&file);
+		goto done;
+	}
+
+	reflog_unmap(&map);
+	return git_filebuf_commit(&file);
+
+done:
+	reflog_unmap(&map);
+	return error;
+}
+
 /* Append to the reflog, must be called under reference lock */
 static int reflog_append(refdb_fs_backend *backend, const git_reference *ref, const git_oid *old, const git_oid *new, const git_signature *who, const char *message)
 {
@@ -1681,7 +2792,10 @@ static int reflog_append(refdb_fs_backend *backend, const git_reference *ref, co
 		goto cleanup;
 	}
 
-	error = git_futils_writebuffer(&buf, git_buf_cstr(&path), O_WRONLY|O_CREAT|O_APPEND, GIT_REFLOG_FILE_MODE);
+	if ((error = git_futils_writebuffer(&buf, git_buf_cstr(&path), O_WRONLY|O_CREAT|O_APPEND, GIT_REFLOG_FILE_MODE)) < 0)
+		goto cleanup;
+
+	error = reflog_expire(backend, git_buf_cstr(&path));
 
 cleanup:
 	git_buf_free(&buf);
@@ -1813,6 +2927,11 @@ int git_refdb_backend_fs(
 
 	backend->path = git_buf_detach(&path);
 
+	if (git_mutex_init(&backend->map_lock) < 0) {
+		giterr_set(GITERR_OS, "Failed to initialize the packed references lock");
+		goto fail;
+	}
+
 	if (git_buf_joinpath(&path, backend->path, GIT_PACKEDREFS_FILE) < 0 ||
 		git_sortedcache_new(
 			&backend->refcache, offsetof(struct packref, name),
@@ -1841,9 +2960,11 @@ int git_refdb_backend_fs(
 	backend->parent.ensure_log = &refdb_reflog_fs__ensure_log;
 	backend->parent.free = &refdb_fs_backend__free;
 	backend->parent.reflog_read = &refdb_reflog_fs__read;
+	backend->parent.reflog_read_recent = &refdb_reflog_fs__read_recent;
 	backend->parent.reflog_write = &refdb_reflog_fs__write;
 	backend->parent.reflog_rename = &refdb_reflog_fs__rename;
 	backend->parent.reflog_delete = &refdb_reflog_fs__delete;
+	backend->parent.transaction = &refdb_fs_backend__transaction;
 
 	*backend_out = (git_refdb_backend *)backend;
 	return 0;
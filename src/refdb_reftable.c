@@ -0,0 +1,2194 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "refs.h"
+#include "repository.h"
+#include "fileops.h"
+#include "filebuf.h"
+#include "fnmatch.h"
+#include "pool.h"
+#include "reflog.h"
+#include "refdb.h"
+#include "reftable.h"
+#include "vector.h"
+
+#include <git2/refdb.h>
+#include <git2/sys/refdb_backend.h>
+#include <git2/sys/refs.h>
+#include <git2/sys/reflog.h>
+
+#define MAX_NESTING_LEVEL 10
+
+#define REFTABLE_DIR "reftable/"
+#define REFTABLE_LIST_FILE "tables.list"
+#define REFTABLE_FILE_MODE 0666
+
+/* The number of times we go back to the list when a table vanishes under us */
+#define REFTABLE_RELOAD_RETRIES 3
+
+/*
+ * The tables of a repository, from the oldest to the newest.  A stack
+ * is never changed once loaded, so readers can keep using one while
+ * a writer replaces it.
+ */
+typedef struct {
+	git_refcount rc;
+	git_vector tables;
+} reftable_stack;
+
+typedef struct {
+	git_refdb_backend parent;
+
+	git_repository *repo;
+	char *path;
+	char *list_path;
+
+	git_mutex lock;
+	git_buf list;
+	git_futils_filestamp stamp;
+	reftable_stack *stack;
+} refdb_reftable_backend;
+
+static void stack_free(reftable_stack *stack)
+{
+	git_reftable *table;
+	size_t i;
+
+	git_vector_foreach(&stack->tables, i, table)
+		git_reftable_free(table);
+
+	git_vector_free(&stack->tables);
+	git__free(stack);
+}
+
+static void stack_decref(reftable_stack *stack)
+{
+	if (stack == NULL)
+		return;
+
+	GIT_REFCOUNT_DEC(stack, stack_free);
+}
+
+static int stack_alloc(reftable_stack **out, size_t count)
+{
+	reftable_stack *stack = git__calloc(1, sizeof(reftable_stack));
+	GITERR_CHECK_ALLOC(stack);
+
+	if (git_vector_init(&stack->tables, count, NULL) < 0) {
+		git__free(stack);
+		return -1;
+	}
+
+	GIT_REFCOUNT_INC(stack);
+	*out = stack;
+	return 0;
+}
+
+static git_reftable *stack_find(reftable_stack *stack, const char *name)
+{
+	git_reftable *table;
+	size_t i;
+
+	if (stack == NULL)
+		return NULL;
+
+	git_vector_foreach(&stack->tables, i, table) {
+		if (!strcmp(git_reftable_name(table), name))
+			return table;
+	}
+
+	return NULL;
+}
+
+static uint64_t stack_next_update_index(reftable_stack *stack)
+{
+	size_t count = git_vector_length(&stack->tables);
+
+	if (!count)
+		return 1;
+
+	return git_reftable_max_update_index(git_vector_get(&stack->tables, count - 1)) + 1;
+}
+
+/* Open the tables named in `list`, sharing the ones `old` has open already */
+static int stack_open(
+	reftable_stack **out,
+	refdb_reftable_backend *backend,
+	reftable_stack *old,
+	const char *list)
+{
+	reftable_stack *stack;
+	git_reftable *table;
+	git_buf name = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	const char *line, *eol;
+	int error;
+
+	if ((error = stack_alloc(&stack, 8)) < 0)
+		return error;
+
+	for (line = list; *line; line = *eol ? eol + 1 : eol) {
+		if ((eol = strchr(line, '\n')) == NULL)
+			eol = line + strlen(line);
+
+		if (eol == line)
+			continue;
+
+		if ((error = git_buf_set(&name, line, eol - line)) < 0)
+			break;
+
+		if ((table = stack_find(old, name.ptr)) != NULL) {
+			git_reftable_incref(table);
+		} else if (strchr(name.ptr, '/') != NULL) {
+			giterr_set(GITERR_REFERENCE, "Invalid reftable name '%s'", name.ptr);
+			error = -1;
+			break;
+		} else if ((error = git_buf_joinpath(&path, backend->path, name.ptr)) < 0 ||
+			(error = git_reftable_open(&table, path.ptr)) < 0) {
+			break;
+		}
+
+		if ((error = git_vector_insert(&stack->tables, table)) < 0) {
+			git_reftable_free(table);
+			break;
+		}
+	}
+
+	git_buf_free(&name);
+	git_buf_free(&path);
+
+	if (error < 0) {
+		stack_decref(stack);
+		return error;
+	}
+
+	*out = stack;
+	return 0;
+}
+
+/* Must be called with the backend's lock held */
+static int stack_reload(refdb_reftable_backend *backend, bool force)
+{
+	reftable_stack *stack;
+	git_buf list = GIT_BUF_INIT;
+	int error, retries;
+
+	if (!force && backend->stack &&
+		!git_futils_filestamp_check(&backend->stamp, backend->list_path))
+		return 0;
+
+	for (retries = 0; ; ++retries) {
+		git_futils_filestamp_check(&backend->stamp, backend->list_path);
+
+		error = git_futils_readbuffer(&list, backend->list_path);
+
+		if (error == GIT_ENOTFOUND) {
+			giterr_clear();
+			git_buf_clear(&list);
+		} else if (error < 0) {
+			break;
+		}
+
+		if (backend->stack && !git__strcmp(list.ptr, backend->list.ptr)) {
+			error = 0;
+			break;
+		}
+
+		/* A table which went away was compacted into a new list */
+		error = stack_open(&stack, backend, backend->stack, list.ptr);
+
+		if (error == GIT_ENOTFOUND && retries < REFTABLE_RELOAD_RETRIES) {
+			giterr_clear();
+			continue;
+		}
+
+		if (error < 0)
+			break;
+
+		stack_decref(backend->stack);
+		backend->stack = stack;
+		git_buf_swap(&backend->list, &list);
+		break;
+	}
+
+	if (error < 0)
+		git_futils_filestamp_set(&backend->stamp, NULL);
+
+	git_buf_free(&list);
+	return error;
+}
+
+static int stack_get(reftable_stack **out, refdb_reftable_backend *backend)
+{
+	int error;
+
+	if (git_mutex_lock(&backend->lock) < 0) {
+		giterr_set(GITERR_OS, "Unable to lock the reftable stack");
+		return -1;
+	}
+
+	if ((error = stack_reload(backend, false)) == 0) {
+		GIT_REFCOUNT_INC(backend->stack);
+		*out = backend->stack;
+	}
+
+	git_mutex_unlock(&backend->lock);
+	return error;
+}
+
+static int ref_error_notfound(const char *name)
+{
+	giterr_set(GITERR_REFERENCE, "Reference '%s' not found", name);
+	return GIT_ENOTFOUND;
+}
+
+static int stack_merged_init(git_reftable_merged *merged, reftable_stack *stack, int section)
+{
+	return git_reftable_merged_init(merged,
+		(git_reftable **)stack->tables.contents,
+		git_vector_length(&stack->tables), section);
+}
+
+/*
+ * Find the newest record for `name`, a deletion being as good as any.
+ * On success, `iter` holds the record and must be freed by the caller.
+ */
+static int stack_lookup_record(
+	git_reftable_iter *iter, reftable_stack *stack, const char *name)
+{
+	size_t i = git_vector_length(&stack->tables), len = strlen(name);
+	int error;
+
+	while (i-- > 0) {
+		git_reftable_iter_init(iter, git_vector_get(&stack->tables, i), GIT_REFTABLE_BLOCK_REF);
+
+		if ((error = git_reftable_iter_seek(iter, name, len)) < 0 ||
+			(error = git_reftable_iter_next(iter)) < 0) {
+			git_reftable_iter_free(iter);
+
+			if (error == GIT_ITEROVER)
+				continue;
+
+			return error;
+		}
+
+		if (iter->key.size == len && !memcmp(iter->key.ptr, name, len))
+			return 0;
+
+		git_reftable_iter_free(iter);
+	}
+
+	return GIT_ENOTFOUND;
+}
+
+static git_reference *ref_from_record(const git_reftable_ref *record)
+{
+	switch (record->type) {
+	case GIT_REFTABLE_REF_SYMREF:
+		return git_reference__alloc_symbolic(record->name, record->target);
+	case GIT_REFTABLE_REF_VAL2:
+		return git_reference__alloc(record->name, &record->id, &record->peeled);
+	default:
+		return git_reference__alloc(record->name, &record->id, NULL);
+	}
+}
+
+static int stack_lookup(git_reference **out, reftable_stack *stack, const char *name)
+{
+	git_reftable_iter iter;
+	int error;
+
+	if ((error = stack_lookup_record(&iter, stack, name)) < 0)
+		return error == GIT_ENOTFOUND ? ref_error_notfound(name) : error;
+
+	if (iter.record.ref.type == GIT_REFTABLE_REF_DELETION) {
+		error = ref_error_notfound(name);
+	} else if (out && (*out = ref_from_record(&iter.record.ref)) == NULL) {
+		error = -1;
+	}
+
+	git_reftable_iter_free(&iter);
+	return error;
+}
+
+/* Follow symbolic references down to an id */
+static int stack_resolve(git_oid *out, reftable_stack *stack, const char *name)
+{
+	git_reference *ref, *target;
+	int error, nesting = 0;
+
+	memset(out, 0, sizeof(git_oid));
+
+	if ((error = stack_lookup(&ref, stack, name)) < 0)
+		return error;
+
+	while (ref->type == GIT_REF_SYMBOLIC) {
+		if (++nesting > MAX_NESTING_LEVEL) {
+			giterr_set(GITERR_REFERENCE, "Reference chain too deep (%d)", nesting);
+			error = -1;
+			break;
+		}
+
+		if ((error = stack_lookup(&target, stack, ref->target.symbolic)) < 0)
+			break;
+
+		git_reference_free(ref);
+		ref = target;
+	}
+
+	if (!error)
+		git_oid_cpy(out, &ref->target.oid);
+
+	git_reference_free(ref);
+	return error;
+}
+
+/* Call `cb` with each reflog record of `name`, from the newest */
+static int stack_foreach_log(
+	reftable_stack *stack,
+	const char *name,
+	int (*cb)(const git_reftable_log *log, void *payload),
+	void *payload)
+{
+	git_reftable_merged merged;
+	git_reftable_iter *iter;
+	int error;
+
+	if ((error = stack_merged_init(&merged, stack, GIT_REFTABLE_BLOCK_LOG)) < 0)
+		return error;
+
+	if ((error = git_reftable_merged_seek(&merged, name, strlen(name) + 1)) < 0)
+		goto done;
+
+	while ((error = git_reftable_merged_next(&iter, &merged)) == 0) {
+		if (strcmp(iter->record.log.name, name))
+			break;
+
+		if ((error = cb(&iter->record.log, payload)) != 0)
+			break;
+	}
+
+	if (error == GIT_ITEROVER)
+		error = 0;
+
+done:
+	git_reftable_merged_free(&merged);
+	return error;
+}
+
+static int has_log_cb(const git_reftable_log *log, void *payload)
+{
+	GIT_UNUSED(payload);
+	return log->type != GIT_REFTABLE_LOG_DELETION;
+}
+
+static int stack_has_log(reftable_stack *stack, const char *name)
+{
+	return stack_foreach_log(stack, name, has_log_cb, NULL);
+}
+
+/*
+ * Updates
+ */
+
+typedef struct {
+	git_pool strings;
+	git_vector refs;
+	git_vector logs;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+} reftable_update;
+
+static int update_ref_cmp(const void *a, const void *b)
+{
+	return strcmp(((const git_reftable_ref *)a)->name, ((const git_reftable_ref *)b)->name);
+}
+
+/* The newest entries of a reflog come first */
+static int update_log_cmp(const void *a, const void *b)
+{
+	const git_reftable_log *log_a = a, *log_b = b;
+	int cmp = strcmp(log_a->name, log_b->name);
+
+	if (cmp)
+		return cmp;
+
+	return (log_a->update_index < log_b->update_index) -
+		(log_a->update_index > log_b->update_index);
+}
+
+static int update_init(reftable_update *update, reftable_stack *stack)
+{
+	memset(update, 0, sizeof(reftable_update));
+
+	update->min_update_index = update->max_update_index =
+		stack_next_update_index(stack);
+
+	if (git_pool_init(&update->strings, 1, 0) < 0 ||
+		git_vector_init(&update->refs, 0, update_ref_cmp) < 0 ||
+		git_vector_init(&update->logs, 0, update_log_cmp) < 0)
+		return -1;
+
+	return 0;
+}
+
+static void update_free(reftable_update *update)
+{
+	void *record;
+	size_t i;
+
+	git_vector_foreach(&update->refs, i, record)
+		git__free(record);
+
+	git_vector_foreach(&update->logs, i, record)
+		git__free(record);
+
+	git_vector_free(&update->refs);
+	git_vector_free(&update->logs);
+	git_pool_clear(&update->strings);
+}
+
+/* Queue a change to a reference; a later change to the same one wins */
+static int update_add_ref(reftable_update *update, const git_reference *ref)
+{
+	git_reftable_ref *record = git__calloc(1, sizeof(git_reftable_ref));
+	GITERR_CHECK_ALLOC(record);
+
+	if ((record->name = git_pool_strdup(&update->strings, ref->name)) == NULL)
+		goto on_error;
+
+	record->update_index = update->min_update_index;
+
+	if (ref->type == GIT_REF_SYMBOLIC) {
+		record->type = GIT_REFTABLE_REF_SYMREF;
+
+		if ((record->target = git_pool_strdup(&update->strings, ref->target.symbolic)) == NULL)
+			goto on_error;
+	} else {
+		record->type = git_oid_iszero(&ref->peel) ?
+			GIT_REFTABLE_REF_VAL1 : GIT_REFTABLE_REF_VAL2;
+		git_oid_cpy(&record->id, &ref->target.oid);
+		git_oid_cpy(&record->peeled, &ref->peel);
+	}
+
+	if (git_vector_insert(&update->refs, record) < 0)
+		goto on_error;
+
+	return 0;
+
+on_error:
+	git__free(record);
+	return -1;
+}
+
+static int update_delete_ref(reftable_update *update, const char *name)
+{
+	git_reftable_ref *record = git__calloc(1, sizeof(git_reftable_ref));
+	GITERR_CHECK_ALLOC(record);
+
+	record->type = GIT_REFTABLE_REF_DELETION;
+	record->update_index = update->min_update_index;
+
+	if ((record->name = git_pool_strdup(&update->strings, name)) == NULL ||
+		git_vector_insert(&update->refs, record) < 0) {
+		git__free(record);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Queue a reflog record, copying its strings */
+static int update_add_log(
+	reftable_update *update, const git_reftable_log *log, const char *name)
+{
+	git_reftable_log *record = git__malloc(sizeof(git_reftable_log));
+	GITERR_CHECK_ALLOC(record);
+
+	memcpy(record, log, sizeof(git_reftable_log));
+
+	if ((record->name = git_pool_strdup(&update->strings, name ? name : log->name)) == NULL ||
+		(log->type == GIT_REFTABLE_LOG_UPDATE &&
+		 ((record->committer_name = git_pool_strdup_safe(&update->strings, log->committer_name)) == NULL ||
+		  (record->committer_email = git_pool_strdup_safe(&update->strings, log->committer_email)) == NULL ||
+		  (record->message = git_pool_strdup_safe(&update->strings, log->message)) == NULL)) ||
+		git_vector_insert(&update->logs, record) < 0) {
+		git__free(record);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int update_append_log(
+	reftable_update *update,
+	const char *name,
+	const git_oid *old_id,
+	const git_oid *new_id,
+	const git_signature *who,
+	const char *message)
+{
+	git_reftable_log log;
+
+	memset(&log, 0, sizeof(git_reftable_log));
+
+	log.name = name;
+	log.update_index = update->min_update_index;
+	log.type = GIT_REFTABLE_LOG_UPDATE;
+	log.committer_name = who ? who->name : "";
+	log.committer_email = who ? who->email : "";
+	log.message = message ? message : "";
+
+	if (old_id)
+		git_oid_cpy(&log.old_id, old_id);
+	if (new_id)
+		git_oid_cpy(&log.new_id, new_id);
+
+	if (who) {
+		log.time = who->when.time;
+		log.offset = who->when.offset;
+	}
+
+	return update_add_log(update, &log, NULL);
+}
+
+static int delete_log_cb(const git_reftable_log *log, void *payload)
+{
+	git_reftable_log deletion;
+
+	if (log->type == GIT_REFTABLE_LOG_DELETION)
+		return 0;
+
+	memset(&deletion, 0, sizeof(git_reftable_log));
+	deletion.name = log->name;
+	deletion.update_index = log->update_index;
+	deletion.type = GIT_REFTABLE_LOG_DELETION;
+
+	return update_add_log(payload, &deletion, NULL);
+}
+
+static int update_delete_log(reftable_update *update, reftable_stack *stack, const char *name)
+{
+	return stack_foreach_log(stack, name, delete_log_cb, update);
+}
+
+typedef struct {
+	reftable_update *update;
+	const char *new_name;
+} move_log_data;
+
+static int move_log_cb(const git_reftable_log *log, void *payload)
+{
+	move_log_data *data = payload;
+	int error;
+
+	if (log->type == GIT_REFTABLE_LOG_DELETION)
+		return 0;
+
+	if ((error = delete_log_cb(log, data->update)) < 0)
+		return error;
+
+	return update_add_log(data->update, log, data->new_name);
+}
+
+/* Move the reflog of `old_name` over whatever reflog `new_name` had */
+static int update_move_log(
+	reftable_update *update,
+	reftable_stack *stack,
+	const char *old_name,
+	const char *new_name)
+{
+	move_log_data data;
+	int error;
+
+	data.update = update;
+	data.new_name = new_name;
+
+	if ((error = update_delete_log(update, stack, new_name)) < 0)
+		return error;
+
+	return stack_foreach_log(stack, old_name, move_log_cb, &data);
+}
+
+typedef struct {
+	git_filebuf file;
+	uint32_t crc;
+	size_t size;
+} table_file;
+
+static int table_write_cb(const void *data, size_t len, void *payload)
+{
+	table_file *out = payload;
+
+	out->crc = crc32(out->crc, data, (uInt)len);
+	out->size += len;
+
+	return git_filebuf_write(&out->file, data, len);
+}
+
+/* Write the records `add` gives into a new table, and open it */
+static int table_write(
+	git_reftable **out,
+	refdb_reftable_backend *backend,
+	uint64_t min_update_index,
+	uint64_t max_update_index,
+	int (*add)(git_reftable_writer *writer, void *payload),
+	void *payload)
+{
+	git_reftable_writer *writer = NULL;
+	git_buf path = GIT_BUF_INIT;
+	table_file table;
+	int error;
+
+	memset(&table, 0, sizeof(table_file));
+
+	if ((error = git_buf_joinpath(&path, backend->path, "tmp_reftable")) < 0 ||
+		(error = git_filebuf_open(&table.file, path.ptr,
+			GIT_FILEBUF_TEMPORARY, REFTABLE_FILE_MODE)) < 0 ||
+		(error = git_reftable_writer_new(&writer,
+			min_update_index, max_update_index, table_write_cb, &table)) < 0 ||
+		(error = add(writer, payload)) < 0 ||
+		(error = git_reftable_writer_finish(writer)) < 0)
+		goto done;
+
+	git_buf_clear(&path);
+	git_buf_printf(&path, "%s0x%012llx-0x%012llx-%08x.ref", backend->path,
+		(unsigned long long)min_update_index,
+		(unsigned long long)max_update_index, (unsigned int)table.crc);
+
+	if ((error = git_buf_oom(&path) ? -1 : 0) < 0 ||
+		(error = git_filebuf_commit_at(&table.file, path.ptr)) < 0)
+		goto done;
+
+	error = git_reftable_open(out, path.ptr);
+
+done:
+	git_reftable_writer_free(writer);
+	git_filebuf_cleanup(&table.file);
+	git_buf_free(&path);
+	return error;
+}
+
+static int update_write_records(git_reftable_writer *writer, void *payload)
+{
+	reftable_update *update = payload;
+	void *record;
+	size_t i;
+	int error;
+
+	git_vector_foreach(&update->refs, i, record) {
+		if ((error = git_reftable_writer_add_ref(writer, record)) < 0)
+			return error;
+	}
+
+	git_vector_foreach(&update->logs, i, record) {
+		if ((error = git_reftable_writer_add_log(writer, record)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+typedef struct {
+	git_reftable **tables;
+	size_t count;
+	bool drop_deletions;
+} compaction;
+
+static int compaction_write_records(git_reftable_writer *writer, void *payload)
+{
+	compaction *c = payload;
+	git_reftable_merged merged;
+	git_reftable_iter *iter;
+	int error;
+
+	if ((error = git_reftable_merged_init(&merged, c->tables, c->count, GIT_REFTABLE_BLOCK_REF)) < 0)
+		return error;
+
+	if ((error = git_reftable_merged_seek(&merged, "", 0)) < 0)
+		goto done;
+
+	while ((error = git_reftable_merged_next(&iter, &merged)) == 0) {
+		if (c->drop_deletions && iter->record.ref.type == GIT_REFTABLE_REF_DELETION)
+			continue;
+
+		if ((error = git_reftable_writer_add_ref(writer, &iter->record.ref)) < 0)
+			goto done;
+	}
+
+	if (error != GIT_ITEROVER)
+		goto done;
+
+	git_reftable_merged_free(&merged);
+
+	if ((error = git_reftable_merged_init(&merged, c->tables, c->count, GIT_REFTABLE_BLOCK_LOG)) < 0)
+		return error;
+
+	if ((error = git_reftable_merged_seek(&merged, "", 0)) < 0)
+		goto done;
+
+	while ((error = git_reftable_merged_next(&iter, &merged)) == 0) {
+		if (c->drop_deletions && iter->record.log.type == GIT_REFTABLE_LOG_DELETION)
+			continue;
+
+		if ((error = git_reftable_writer_add_log(writer, &iter->record.log)) < 0)
+			goto done;
+	}
+
+	if (error == GIT_ITEROVER)
+		error = 0;
+
+done:
+	git_reftable_merged_free(&merged);
+	return error;
+}
+
+/* Merge the tables from `first` on into a single one */
+static int stack_compact(
+	git_reftable **out, refdb_reftable_backend *backend, git_vector *tables, size_t first)
+{
+	compaction c;
+	size_t last = git_vector_length(tables) - 1;
+
+	c.tables = (git_reftable **)tables->contents + first;
+	c.count = last - first + 1;
+
+	/* Nothing older is left for a deletion to hide */
+	c.drop_deletions = (first == 0);
+
+	return table_write(out, backend,
+		git_reftable_min_update_index(git_vector_get(tables, first)),
+		git_reftable_max_update_index(git_vector_get(tables, last)),
+		compaction_write_records, &c);
+}
+
+/*
+ * Find the oldest table from which on the tables need merging to keep
+ * every table at least twice the size of all the ones above it.  This
+ * keeps the stack logarithmic in the number of updates.
+ */
+static size_t stack_compaction_start(git_vector *tables)
+{
+	size_t i = git_vector_length(tables) - 1;
+	size_t newer = git_reftable_size(git_vector_get(tables, i));
+
+	while (i > 0) {
+		size_t size = git_reftable_size(git_vector_get(tables, i - 1));
+
+		if (size > 2 * newer)
+			break;
+
+		newer += size;
+		i--;
+	}
+
+	return i;
+}
+
+/*
+ * Write `tables` out as the new list, which the list lock holds the
+ * changes for.  The tables which didn't make it are removed.
+ */
+static int stack_commit(
+	refdb_reftable_backend *backend, git_filebuf *list_file, reftable_stack *stack)
+{
+	reftable_stack *old;
+	git_buf list = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	git_reftable *table;
+	size_t i;
+	int error;
+
+	git_vector_foreach(&stack->tables, i, table)
+		git_buf_printf(&list, "%s\n", git_reftable_name(table));
+
+	if (git_buf_oom(&list) ||
+		(error = git_filebuf_write(list_file, list.ptr, list.size)) < 0 ||
+		(error = git_filebuf_commit(list_file)) < 0) {
+		error = -1;
+		goto done;
+	}
+
+	if ((error = git_mutex_lock(&backend->lock)) < 0) {
+		giterr_set(GITERR_OS, "Unable to lock the reftable stack");
+		goto done;
+	}
+
+	old = backend->stack;
+
+	GIT_REFCOUNT_INC(stack);
+	backend->stack = stack;
+	git_buf_swap(&backend->list, &list);
+	git_futils_filestamp_check(&backend->stamp, backend->list_path);
+
+	git_mutex_unlock(&backend->lock);
+
+	/* Readers which have them mapped carry on with their copy */
+	if (old) {
+		git_vector_foreach(&old->tables, i, table) {
+			if (stack_find(stack, git_reftable_name(table)) != NULL ||
+				git_buf_joinpath(&path, backend->path, git_reftable_name(table)) < 0)
+				continue;
+
+			p_unlink(path.ptr);
+		}
+
+		stack_decref(old);
+	}
+
+done:
+	git_buf_free(&path);
+	git_buf_free(&list);
+	return error;
+}
+
+typedef int (*reftable_update_cb)(
+	reftable_update *update, reftable_stack *stack, void *payload);
+
+/*
+ * Lock the stack, let `cb` fill in an update going by the newest state
+ * of it and write that out as a new table on top.  The smaller tables
+ * at the top are then merged as needed.
+ */
+static int stack_update(
+	refdb_reftable_backend *backend,
+	reftable_update_cb cb,
+	void *payload,
+	bool compact_all)
+{
+	git_filebuf list_file = GIT_FILEBUF_INIT;
+	reftable_stack *stack = NULL, *updated = NULL;
+	reftable_update update;
+	git_reftable *table = NULL;
+	size_t i, first;
+	int error;
+
+	memset(&update, 0, sizeof(reftable_update));
+
+	if ((error = git_filebuf_open(&list_file, backend->list_path, 0, REFTABLE_FILE_MODE)) < 0)
+		return error;
+
+	if ((error = git_mutex_lock(&backend->lock)) < 0) {
+		giterr_set(GITERR_OS, "Unable to lock the reftable stack");
+		goto done;
+	}
+
+	if ((error = stack_reload(backend, true)) == 0) {
+		stack = backend->stack;
+		GIT_REFCOUNT_INC(stack);
+	}
+
+	git_mutex_unlock(&backend->lock);
+
+	if (error < 0 ||
+		(error = update_init(&update, stack)) < 0 ||
+		(cb && (error = cb(&update, stack, payload)) < 0))
+		goto done;
+
+	if (!update.refs.length && !update.logs.length && !compact_all)
+		goto done;
+
+	if ((error = stack_alloc(&updated, git_vector_length(&stack->tables) + 1)) < 0)
+		goto done;
+
+	git_vector_foreach(&stack->tables, i, table) {
+		git_reftable_incref(table);
+
+		if ((error = git_vector_insert(&updated->tables, table)) < 0) {
+			git_reftable_free(table);
+			goto done;
+		}
+	}
+
+	if (update.refs.length || update.logs.length) {
+		git_vector_sort(&update.refs);
+		git_vector_uniq(&update.refs, git__free);
+		git_vector_sort(&update.logs);
+		git_vector_uniq(&update.logs, git__free);
+
+		if ((error = table_write(&table, backend, update.min_update_index,
+				update.max_update_index, update_write_records, &update)) < 0)
+			goto done;
+
+		if ((error = git_vector_insert(&updated->tables, table)) < 0) {
+			git_reftable_free(table);
+			goto done;
+		}
+	}
+
+	if (!git_vector_length(&updated->tables))
+		goto done;
+
+	first = compact_all ? 0 : stack_compaction_start(&updated->tables);
+
+	/* Packing everything drops the deletions, even from a single table */
+	if (first + 1 < git_vector_length(&updated->tables) || compact_all) {
+		if ((error = stack_compact(&table, backend, &updated->tables, first)) < 0)
+			goto done;
+
+		/* The merged tables may have been written just now */
+		for (i = first; i < git_vector_length(&updated->tables); ++i) {
+			git_reftable *merged = git_vector_get(&updated->tables, i);
+
+			if (!stack_find(stack, git_reftable_name(merged)) &&
+				strcmp(git_reftable_name(merged), git_reftable_name(table))) {
+				git_buf path = GIT_BUF_INIT;
+
+				if (!git_buf_joinpath(&path, backend->path, git_reftable_name(merged)))
+					p_unlink(path.ptr);
+
+				git_buf_free(&path);
+			}
+
+			git_reftable_free(merged);
+		}
+
+		updated->tables.length = first;
+
+		if ((error = git_vector_insert(&updated->tables, table)) < 0) {
+			git_reftable_free(table);
+			goto done;
+		}
+	}
+
+	error = stack_commit(backend, &list_file, updated);
+
+done:
+	git_filebuf_cleanup(&list_file);
+	update_free(&update);
+	stack_decref(updated);
+	stack_decref(stack);
+	return error;
+}
+
+/*
+ * Checks before a write
+ */
+
+static int should_write_reflog(
+	int *write, git_repository *repo, reftable_stack *stack, const char *name)
+{
+	int error, logall;
+
+	error = git_repository__cvar(&logall, repo, GIT_CVAR_LOGALLREFUPDATES);
+	if (error < 0)
+		return error;
+
+	/* Defaults to the opposite of the repo being bare */
+	if (logall == GIT_LOGALLREFUPDATES_UNSET)
+		logall = !git_repository_is_bare(repo);
+
+	if (!logall) {
+		*write = 0;
+	} else if ((error = stack_has_log(stack, name)) != 0) {
+		*write = 1;
+		return error < 0 ? error : 0;
+	} else {
+		*write = !git__prefixcmp(name, GIT_REFS_HEADS_DIR) ||
+			!git__strcmp(name, GIT_HEAD_FILE) ||
+			!git__prefixcmp(name, GIT_REFS_REMOTES_DIR) ||
+			!git__prefixcmp(name, GIT_REFS_NOTES_DIR);
+	}
+
+	return 0;
+}
+
+static int cmp_old_ref(
+	int *cmp, reftable_stack *stack, const char *name,
+	const git_oid *old_id, const char *old_target)
+{
+	git_reference *old_ref = NULL;
+	int error;
+
+	*cmp = 0;
+
+	/* It "matches" if there is no old value to compare against */
+	if (!old_id && !old_target)
+		return 0;
+
+	if ((error = stack_lookup(&old_ref, stack, name)) < 0)
+		return error;
+
+	/* If the types don't match, there's no way the values do */
+	if (old_id && old_ref->type != GIT_REF_OID)
+		*cmp = -1;
+	else if (old_target && old_ref->type != GIT_REF_SYMBOLIC)
+		*cmp = 1;
+	else if (old_id)
+		*cmp = git_oid_cmp(old_id, &old_ref->target.oid);
+	else
+		*cmp = git__strcmp(old_target, old_ref->target.symbolic);
+
+	git_reference_free(old_ref);
+	return 0;
+}
+
+static int ref_exists(reftable_stack *stack, const char *name)
+{
+	int error = stack_lookup(NULL, stack, name);
+
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		return 0;
+	}
+
+	return error < 0 ? error : 1;
+}
+
+/*
+ * Make sure none of the leading directories of `name` is a reference,
+ * and that it isn't the leading directory of one either, not counting
+ * `old_name`, which is about to go away.
+ */
+static int path_available(reftable_stack *stack, const char *name, const char *old_name)
+{
+	git_reftable_merged merged;
+	git_reftable_iter *iter;
+	git_buf prefix = GIT_BUF_INIT;
+	const char *slash;
+	int error = 0;
+	bool collides = false;
+
+	for (slash = strchr(name, '/'); !error && !collides && slash; slash = strchr(slash + 1, '/')) {
+		if ((error = git_buf_set(&prefix, name, slash - name)) < 0)
+			break;
+
+		if (old_name && !strcmp(prefix.ptr, old_name))
+			continue;
+
+		if ((error = ref_exists(stack, prefix.ptr)) > 0) {
+			collides = true;
+			error = 0;
+		}
+	}
+
+	if (error < 0 || collides)
+		goto done;
+
+	if ((error = git_buf_sets(&prefix, name)) < 0 ||
+		(error = git_buf_putc(&prefix, '/')) < 0 ||
+		(error = stack_merged_init(&merged, stack, GIT_REFTABLE_BLOCK_REF)) < 0)
+		goto done;
+
+	if ((error = git_reftable_merged_seek(&merged, prefix.ptr, prefix.size)) == 0) {
+		while ((error = git_reftable_merged_next(&iter, &merged)) == 0 &&
+			!git__prefixcmp(iter->record.ref.name, prefix.ptr)) {
+			if (iter->record.ref.type == GIT_REFTABLE_REF_DELETION ||
+				(old_name && !strcmp(iter->record.ref.name, old_name)))
+				continue;
+
+			collides = true;
+			break;
+		}
+
+		if (error == GIT_ITEROVER || error == 0)
+			error = 0;
+	}
+
+	git_reftable_merged_free(&merged);
+
+done:
+	if (!error && collides) {
+		giterr_set(GITERR_REFERENCE,
+			"Path to reference '%s' collides with existing one", name);
+		error = -1;
+	}
+
+	git_buf_free(&prefix);
+	return error;
+}
+
+/* Find the branch HEAD points to, which gets its reflog entries as well */
+static int head_branch(git_buf *out, reftable_stack *stack)
+{
+	git_reference *ref = NULL;
+	int error, nesting = 0;
+
+	git_buf_clear(out);
+
+	error = stack_lookup(&ref, stack, GIT_HEAD_FILE);
+
+	while (!error && ref->type == GIT_REF_SYMBOLIC && nesting++ < MAX_NESTING_LEVEL) {
+		if ((error = git_buf_sets(out, ref->target.symbolic)) < 0)
+			break;
+
+		git_reference_free(ref);
+		ref = NULL;
+
+		error = stack_lookup(&ref, stack, out->ptr);
+	}
+
+	git_reference_free(ref);
+
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = 0;
+	}
+
+	return error;
+}
+
+/* Log an update of `ref`; a symbolic one only gets an entry for HEAD */
+static int update_reflog_append(
+	reftable_update *update,
+	reftable_stack *stack,
+	const git_reference *ref,
+	const git_oid *old,
+	const git_oid *new,
+	const git_signature *who,
+	const char *message)
+{
+	git_oid old_id = {{0}}, new_id = {{0}};
+	int error;
+
+	/* "normal" symbolic updates do not write */
+	if (ref->type == GIT_REF_SYMBOLIC &&
+		strcmp(ref->name, GIT_HEAD_FILE) && !(old && new))
+		return 0;
+
+	if (old) {
+		git_oid_cpy(&old_id, old);
+	} else if ((error = stack_resolve(&old_id, stack, ref->name)) < 0) {
+		if (error != GIT_ENOTFOUND)
+			return error;
+
+		giterr_clear();
+	}
+
+	if (new) {
+		git_oid_cpy(&new_id, new);
+	} else if (ref->type == GIT_REF_OID) {
+		git_oid_cpy(&new_id, &ref->target.oid);
+	} else if ((error = stack_resolve(&new_id, stack, ref->target.symbolic)) < 0) {
+		/* detaching HEAD does not create an entry */
+		if (error == GIT_ENOTFOUND)
+			giterr_clear();
+
+		return error == GIT_ENOTFOUND ? 0 : error;
+	}
+
+	return update_append_log(update, ref->name, &old_id, &new_id, who, message);
+}
+
+/*
+ * Operations
+ */
+
+static int refdb_reftable_backend__exists(
+	int *exists, git_refdb_backend *_backend, const char *ref_name)
+{
+	refdb_reftable_backend *backend = (refdb_reftable_backend *)_backend;
+	reftable_stack *stack;
+	int error;
+
+	assert(backend);
+
+	if ((error = stack_get(&stack, backend)) < 0)
+		return error;
+
+	error = ref_exists(stack, ref_name);
+	stack_decref(stack);
+
+	if (error < 0)
+		return error;
+
+	*exists = error;
+	return 0;
+}
+
+static int refdb_reftable_backend__lookup(
+	git_reference **out, git_refdb_backend *_backend, const char *ref_name)
+{
+	refdb_reftable_backend *backend = (refdb_reftable_backend *)_backend;
+	reftable_stack *stack;
+	int error;
+
+	assert(backend);
+
+	if ((error = stack_get(&stack, backend)) < 0)
+		return error;
+
+	error = stack_lookup(out, stack, ref_name);
+	stack_decref(stack);
+
+	return error;
+}
+
+typedef struct {
+	git_reference_iterator parent;
+
+	char *glob;
+	git_buf prefix;
+	git_buf name;
+	reftable_stack *stack;
+	git_reftable_merged merged;
+	bool done;
+} refdb_reftable_iter;
+
+static void refdb_reftable_backend__iterator_free(git_reference_iterator *_iter)
+{
+	refdb_reftable_iter *iter = (refdb_reftable_iter *)_iter;
+
+	git_reftable_merged_free(&iter->merged);
+	stack_decref(iter->stack);
+	git_buf_free(&iter->prefix);
+	git_buf_free(&iter->name);
+	git__free(iter->glob);
+	git__free(iter);
+}
+
+static int iter_next_record(const git_reftable_ref **out, refdb_reftable_iter *iter)
+{
+	git_reftable_iter *table_iter;
+	const git_reftable_ref *record;
+	int error;
+
+	while (!iter->done) {
+		if ((error = git_reftable_merged_next(&table_iter, &iter->merged)) < 0) {
+			if (error == GIT_ITEROVER)
+				break;
+
+			return error;
+		}
+
+		record = &table_iter->record.ref;
+
+		/* The records are sorted, so the first one outside the prefix ends it */
+		if (git__prefixcmp(record->name, iter->prefix.ptr)) {
+			iter->done = true;
+			break;
+		}
+
+		if (record->type == GIT_REFTABLE_REF_DELETION ||
+			(iter->glob && p_fnmatch(iter->glob, record->name, 0) != 0))
+			continue;
+
+		*out = record;
+		return 0;
+	}
+
+	return GIT_ITEROVER;
+}
+
+static int refdb_reftable_backend__iterator_next(
+	git_reference **out, git_reference_iterator *_iter)
+{
+	refdb_reftable_iter *iter = (refdb_reftable_iter *)_iter;
+	const git_reftable_ref *record;
+	int error;
+
+	if ((error = iter_next_record(&record, iter)) < 0)
+		return error;
+
+	*out = ref_from_record(record);
+	GITERR_CHECK_ALLOC(*out);
+
+	return 0;
+}
+
+static int refdb_reftable_backend__iterator_next_name(
+	const char **out, git_reference_iterator *_iter)
+{
+	refdb_reftable_iter *iter = (refdb_reftable_iter *)_iter;
+	const git_reftable_ref *record;
+	int error;
+
+	if ((error = iter_next_record(&record, iter)) < 0)
+		return error;
+
+	/* The record goes away with the next one */
+	if ((error = git_buf_sets(&iter->name, record->name)) < 0)
+		return error;
+
+	*out = iter->name.ptr;
+	return 0;
+}
+
+static int refdb_reftable_backend__iterator(
+	git_reference_iterator **out, git_refdb_backend *_backend, const char *glob)
+{
+	refdb_reftable_backend *backend = (refdb_reftable_backend *)_backend;
+	refdb_reftable_iter *iter;
+	size_t literal;
+
+	assert(backend);
+
+	iter = git__calloc(1, sizeof(refdb_reftable_iter));
+	GITERR_CHECK_ALLOC(iter);
+
+	iter->parent.next = refdb_reftable_backend__iterator_next;
+	iter->parent.next_name = refdb_reftable_backend__iterator_next_name;
+	iter->parent.free = refdb_reftable_backend__iterator_free;
+
+	if (glob != NULL && (iter->glob = git__strdup(glob)) == NULL)
+		goto fail;
+
+	/* Only the part of the glob before any wildcard narrows down the search */
+	literal = glob ? strcspn(glob, "?*[\\") : 0;
+
+	if (literal > strlen(GIT_REFS_DIR) && !git__prefixcmp(glob, GIT_REFS_DIR))
+		git_buf_set(&iter->prefix, glob, literal);
+	else
+		git_buf_sets(&iter->prefix, GIT_REFS_DIR);
+
+	if (git_buf_oom(&iter->prefix) ||
+		stack_get(&iter->stack, backend) < 0 ||
+		stack_merged_init(&iter->merged, iter->stack, GIT_REFTABLE_BLOCK_REF) < 0 ||
+		git_reftable_merged_seek(&iter->merged, iter->prefix.ptr, iter->prefix.size) < 0)
+		goto fail;
+
+	*out = (git_reference_iterator *)iter;
+	return 0;
+
+fail:
+	refdb_reftable_backend__iterator_free((git_reference_iterator *)iter);
+	return -1;
+}
+
+typedef struct {
+	refdb_reftable_backend *backend;
+	const char *name;
+	const git_reference *ref;
+	int force;
+	const git_signature *who;
+	const char *message;
+	const git_oid *old_id;
+	const char *old_target;
+} write_data;
+
+static int write_cb(reftable_update *update, reftable_stack *stack, void *payload)
+{
+	write_data *data = payload;
+	const git_reference *ref = data->ref;
+	git_buf head = GIT_BUF_INIT;
+	git_oid old_id;
+	int error, cmp, should_write;
+
+	if (!data->force && (error = ref_exists(stack, ref->name)) != 0) {
+		if (error < 0)
+			return error;
+
+		giterr_set(GITERR_REFERENCE,
+			"Failed to write reference '%s': a reference with "
+			"that name already exists.", ref->name);
+		return GIT_EEXISTS;
+	}
+
+	if ((error = path_available(stack, ref->name, NULL)) < 0 ||
+		(error = cmp_old_ref(&cmp, stack, ref->name, data->old_id, data->old_target)) < 0)
+		return error;
+
+	if (cmp) {
+		giterr_set(GITERR_REFERENCE, "old reference value does not match");
+		return GIT_EMODIFIED;
+	}
+
+	error = cmp_old_ref(&cmp, stack, ref->name,
+		ref->type == GIT_REF_OID ? &ref->target.oid : NULL,
+		ref->type == GIT_REF_SYMBOLIC ? ref->target.symbolic : NULL);
+
+	/* Don't update if we have the same value */
+	if (!error && !cmp)
+		return 0;
+
+	if (error < 0 && error != GIT_ENOTFOUND)
+		return error;
+
+	giterr_clear();
+
+	if ((error = update_add_ref(update, ref)) < 0 ||
+		(error = should_write_reflog(&should_write, data->backend->repo, stack, ref->name)) < 0 ||
+		!should_write)
+		return error;
+
+	if ((error = update_reflog_append(update, stack, ref, NULL, NULL,
+			data->who, data->message)) < 0 || ref->type == GIT_REF_SYMBOLIC)
+		return error;
+
+	/* A direct update of the branch HEAD is on shows in HEAD's log as well */
+	if ((error = head_branch(&head, stack)) == 0 && !strcmp(head.ptr, ref->name)) {
+		if ((error = stack_resolve(&old_id, stack, ref->name)) < 0 && error != GIT_ENOTFOUND)
+			goto done;
+
+		giterr_clear();
+		error = update_append_log(update, GIT_HEAD_FILE,
+			&old_id, &ref->target.oid, data->who, data->message);
+	}
+
+done:
+	git_buf_free(&head);
+	return error;
+}
+
+static int refdb_reftable_backend__write(
+	git_refdb_backend *_backend,
+	const git_reference *ref,
+	int force,
+	const git_signature *who,
+	const char *message,
+	const git_oid *old_id,
+	const char *old_target)
+{
+	write_data data;
+
+	assert(_backend && ref);
+
+	data.backend = (refdb_reftable_backend *)_backend;
+	data.name = ref->name;
+	data.ref = ref;
+	data.force = force;
+	data.who = who;
+	data.message = message;
+	data.old_id = old_id;
+	data.old_target = old_target;
+
+	return stack_update(data.backend, write_cb, &data, false);
+}
+
+static int delete_cb(reftable_update *update, reftable_stack *stack, void *payload)
+{
+	write_data *data = payload;
+	const char *name = data->name;
+	int error, cmp;
+
+	if ((error = ref_exists(stack, name)) <= 0)
+		return error < 0 ? error : ref_error_notfound(name);
+
+	if ((error = cmp_old_ref(&cmp, stack, name, data->old_id, data->old_target)) < 0)
+		return error;
+
+	if (cmp) {
+		giterr_set(GITERR_REFERENCE, "old reference value does not match");
+		return GIT_EMODIFIED;
+	}
+
+	return update_delete_ref(update, name);
+}
+
+static int refdb_reftable_backend__delete(
+	git_refdb_backend *_backend,
+	const char *ref_name,
+	const git_oid *old_id, const char *old_target)
+{
+	write_data data;
+
+	assert(_backend && ref_name);
+
+	memset(&data, 0, sizeof(write_data));
+	data.name = ref_name;
+	data.old_id = old_id;
+	data.old_target = old_target;
+
+	return stack_update((refdb_reftable_backend *)_backend, delete_cb, &data, false);
+}
+
+typedef struct {
+	const git_refdb_update *updates;
+	size_t count;
+	const git_signature *who;
+	const char *message;
+	refdb_reftable_backend *backend;
+} transaction_data;
+
+static int transaction_cb(reftable_update *update, reftable_stack *stack, void *payload)
+{
+	transaction_data *data = payload;
+	const git_refdb_update *tx;
+	git_vector names = GIT_VECTOR_INIT;
+	git_buf head = GIT_BUF_INIT, prefix = GIT_BUF_INIT;
+	git_reference *ref = NULL, *old;
+	const char *name, *other;
+	git_oid old_id;
+	size_t i, pos;
+	int error, should_write;
+
+	if ((error = git_vector_init(&names, data->count, git__strcmp_cb)) < 0)
+		goto done;
+
+	for (i = 0; i < data->count; ++i) {
+		if (!git_oid_iszero(&data->updates[i].id) &&
+			(error = git_vector_insert(&names, (char *)data->updates[i].name)) < 0)
+			goto done;
+	}
+
+	git_vector_sort(&names);
+
+	/* The transaction can't have a reference inside of another one either */
+	git_vector_foreach(&names, i, name) {
+		if ((error = path_available(stack, name, NULL)) < 0 ||
+			(error = git_buf_sets(&prefix, name)) < 0 ||
+			(error = git_buf_putc(&prefix, '/')) < 0)
+			goto done;
+
+		git_vector_bsearch(&pos, &names, prefix.ptr);
+
+		if ((other = git_vector_get(&names, pos)) != NULL &&
+			!git__prefixcmp(other, prefix.ptr)) {
+			giterr_set(GITERR_REFERENCE,
+				"Path to reference '%s' collides with existing one", other);
+			error = -1;
+			goto done;
+		}
+	}
+
+	if ((error = head_branch(&head, stack)) < 0)
+		goto done;
+
+	for (i = 0; i < data->count; ++i) {
+		tx = &data->updates[i];
+		old = NULL;
+
+		if ((error = stack_lookup(&old, stack, tx->name)) < 0) {
+			if (error != GIT_ENOTFOUND)
+				goto done;
+
+			giterr_clear();
+		}
+
+		/* Symbolic references count as the zero id */
+		memset(&old_id, 0, sizeof(git_oid));
+
+		if (old && old->type == GIT_REF_OID)
+			git_oid_cpy(&old_id, &old->target.oid);
+
+		if (tx->check_old && (old ?
+				git_oid_iszero(&tx->old_id) || !git_oid_equal(&old_id, &tx->old_id) :
+				!git_oid_iszero(&tx->old_id))) {
+			giterr_set(GITERR_REFERENCE,
+				"Old value of reference '%s' does not match", tx->name);
+			error = GIT_EMODIFIED;
+		} else if (git_oid_iszero(&tx->id)) {
+			error = old ? update_delete_ref(update, tx->name) : 0;
+		} else if (old && git_oid_equal(&old_id, &tx->id)) {
+			error = 0; /* Don't update if we have the same value */
+		} else if ((ref = git_reference__alloc(tx->name, &tx->id, NULL)) == NULL) {
+			error = -1;
+		} else if ((error = update_add_ref(update, ref)) == 0 &&
+			(error = should_write_reflog(&should_write,
+				data->backend->repo, stack, tx->name)) == 0 &&
+			should_write) {
+			error = update_append_log(update, tx->name,
+				&old_id, &tx->id, data->who, data->message);
+
+			if (!error && head.size && !strcmp(head.ptr, tx->name))
+				error = update_append_log(update, GIT_HEAD_FILE,
+					&old_id, &tx->id, data->who, data->message);
+		}
+
+		git_reference_free(old);
+		git_reference_free(ref);
+		ref = NULL;
+
+		if (error < 0)
+			goto done;
+	}
+
+done:
+	git_vector_free(&names);
+	git_buf_free(&head);
+	git_buf_free(&prefix);
+	return error;
+}
+
+/*
+ * The whole transaction goes into a single table, which is as
+ * compact as the packed mode gets, so the flags don't matter.
+ */
+static int refdb_reftable_backend__transaction(
+	git_refdb_backend *_backend,
+	const git_refdb_update *updates,
+	size_t count,
+	unsigned int flags,
+	const git_signature *who,
+	const char *message)
+{
+	transaction_data data;
+
+	assert(_backend && (updates || !count));
+
+	GIT_UNUSED(flags);
+
+	data.updates = updates;
+	data.count = count;
+	data.who = who;
+	data.message = message;
+	data.backend = (refdb_reftable_backend *)_backend;
+
+	return stack_update(data.backend, transaction_cb, &data, false);
+}
+
+typedef struct {
+	const char *old_name;
+	const char *new_name;
+	int force;
+	const git_signature *who;
+	const char *message;
+	git_reference *renamed;
+} rename_data;
+
+static int rename_cb(reftable_update *update, reftable_stack *stack, void *payload)
+{
+	rename_data *data = payload;
+	git_reference *old = NULL, *renamed;
+	git_oid old_id = {{0}};
+	int error;
+
+	if (!data->force && strcmp(data->old_name, data->new_name) &&
+		(error = ref_exists(stack, data->new_name)) != 0) {
+		if (error < 0)
+			return error;
+
+		giterr_set(GITERR_REFERENCE,
+			"Failed to write reference '%s': a reference with "
+			"that name already exists.", data->new_name);
+		return GIT_EEXISTS;
+	}
+
+	if ((error = path_available(stack, data->new_name, data->old_name)) < 0 ||
+		(error = stack_lookup(&old, stack, data->old_name)) < 0)
+		return error;
+
+	if ((error = stack_resolve(&old_id, stack, data->new_name)) < 0) {
+		if (error != GIT_ENOTFOUND)
+			goto on_error;
+
+		giterr_clear();
+	}
+
+	if ((renamed = git_reference__set_name(old, data->new_name)) == NULL) {
+		error = -1;
+		goto on_error;
+	}
+
+	old = renamed;
+
+	if ((error = update_delete_ref(update, data->old_name)) < 0 ||
+		(error = update_add_ref(update, renamed)) < 0 ||
+		(error = update_move_log(update, stack, data->old_name, data->new_name)) < 0 ||
+		(error = update_reflog_append(update, stack, renamed,
+			&old_id, renamed->type == GIT_REF_OID ? &renamed->target.oid : NULL,
+			data->who, data->message)) < 0)
+		goto on_error;
+
+	data->renamed = renamed;
+	return 0;
+
+on_error:
+	git_reference_free(old);
+	return error;
+}
+
+static int refdb_reftable_backend__rename(
+	git_reference **out,
+	git_refdb_backend *_backend,
+	const char *old_name,
+	const char *new_name,
+	int force,
+	const git_signature *who,
+	const char *message)
+{
+	rename_data data;
+	int error;
+
+	assert(_backend && old_name && new_name);
+
+	memset(&data, 0, sizeof(rename_data));
+	data.old_name = old_name;
+	data.new_name = new_name;
+	data.force = force;
+	data.who = who;
+	data.message = message;
+
+	error = stack_update((refdb_reftable_backend *)_backend, rename_cb, &data, false);
+
+	if (error < 0 || out == NULL) {
+		git_reference_free(data.renamed);
+		return error;
+	}
+
+	*out = data.renamed;
+	return 0;
+}
+
+static int refdb_reftable_backend__compress(git_refdb_backend *_backend)
+{
+	assert(_backend);
+
+	return stack_update((refdb_reftable_backend *)_backend, NULL, NULL, true);
+}
+
+static void refdb_reftable_backend__free(git_refdb_backend *_backend)
+{
+	refdb_reftable_backend *backend = (refdb_reftable_backend *)_backend;
+
+	assert(backend);
+
+	stack_decref(backend->stack);
+	git_mutex_free(&backend->lock);
+	git_buf_free(&backend->list);
+	git__free(backend->list_path);
+	git__free(backend->path);
+	git__free(backend);
+}
+
+/*
+ * Reflogs
+ */
+
+static int refdb_reftable_reflog__has_log(git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable_backend *backend = (refdb_reftable_backend *)_backend;
+	reftable_stack *stack;
+	int error;
+
+	assert(backend && name);
+
+	if ((error = stack_get(&stack, backend)) < 0)
+		return error;
+
+	error = stack_has_log(stack, name);
+	stack_decref(stack);
+
+	return error;
+}
+
+/* Without any entries yet, a reflog is kept by one which logs nothing */
+static int update_ensure_log(reftable_update *update, reftable_stack *stack, const char *name)
+{
+	int error;
+
+	if ((error = stack_has_log(stack, name)) != 0)
+		return error < 0 ? error : 0;
+
+	return update_append_log(update, name, NULL, NULL, NULL, NULL);
+}
+
+static int ensure_log_cb(reftable_update *update, reftable_stack *stack, void *payload)
+{
+	return update_ensure_log(update, stack, payload);
+}
+
+static int refdb_reftable_reflog__ensure_log(git_refdb_backend *_backend, const char *name)
+{
+	assert(_backend && name);
+
+	return stack_update((refdb_reftable_backend *)_backend,
+		ensure_log_cb, (void *)name, false);
+}
+
+static int reflog_alloc(git_reflog **reflog, const char *name)
+{
+	git_reflog *log;
+
+	*reflog = NULL;
+
+	log = git__calloc(1, sizeof(git_reflog));
+	GITERR_CHECK_ALLOC(log);
+
+	log->ref_name = git__strdup(name);
+	GITERR_CHECK_ALLOC(log->ref_name);
+
+	if (git_vector_init(&log->entries, 0, NULL) < 0) {
+		git__free(log->ref_name);
+		git__free(log);
+		return -1;
+	}
+
+	*reflog = log;
+
+	return 0;
+}
+
+typedef struct {
+	git_vector *entries;
+	size_t count;
+} read_log_data;
+
+static int read_log_cb(const git_reftable_log *log, void *payload)
+{
+	read_log_data *data = payload;
+	git_vector *entries = data->entries;
+	git_reflog_entry *entry;
+
+	if (git_vector_length(entries) == data->count)
+		return GIT_ITEROVER;
+
+	if (log->type == GIT_REFTABLE_LOG_DELETION ||
+		(git_oid_iszero(&log->old_id) && git_oid_iszero(&log->new_id)))
+		return 0;
+
+	entry = git__calloc(1, sizeof(git_reflog_entry));
+	GITERR_CHECK_ALLOC(entry);
+
+	git_oid_cpy(&entry->oid_old, &log->old_id);
+	git_oid_cpy(&entry->oid_cur, &log->new_id);
+
+	if ((entry->committer = git__calloc(1, sizeof(git_signature))) == NULL ||
+		(entry->committer->name = git__strdup(log->committer_name)) == NULL ||
+		(entry->committer->email = git__strdup(log->committer_email)) == NULL ||
+		(*log->message && (entry->msg = git__strdup(log->message)) == NULL) ||
+		git_vector_insert(entries, entry) < 0) {
+		git_reflog_entry__free(entry);
+		return -1;
+	}
+
+	entry->committer->when.time = log->time;
+	entry->committer->when.offset = log->offset;
+
+	return 0;
+}
+
+/* Read the newest `max` entries of the reflog of `name` */
+static int reflog_read(
+	git_reflog **out, refdb_reftable_backend *backend, const char *name, size_t max)
+{
+	reftable_stack *stack;
+	git_reflog *log;
+	read_log_data data;
+	size_t i, count;
+	int error;
+
+	if ((error = reflog_alloc(&log, name)) < 0)
+		return error;
+
+	data.entries = &log->entries;
+	data.count = max;
+
+	if ((error = stack_get(&stack, backend)) == 0) {
+		error = stack_foreach_log(stack, name, read_log_cb, &data);
+		stack_decref(stack);
+	}
+
+	if (error == GIT_ITEROVER)
+		error = 0;
+
+	if (error < 0) {
+		git_reflog_free(log);
+		return error;
+	}
+
+	/* The tables have the newest entry first, the reflog the oldest */
+	count = git_vector_length(&log->entries);
+
+	for (i = 0; i < count / 2; ++i) {
+		void *tmp = log->entries.contents[i];
+		log->entries.contents[i] = log->entries.contents[count - 1 - i];
+		log->entries.contents[count - 1 - i] = tmp;
+	}
+
+	*out = log;
+	return 0;
+}
+
+static int refdb_reftable_reflog__read(
+	git_reflog **out, git_refdb_backend *_backend, const char *name)
+{
+	assert(out && _backend && name);
+
+	return reflog_read(out, (refdb_reftable_backend *)_backend, name, SIZE_MAX);
+}
+
+static int refdb_reftable_reflog__read_recent(
+	git_reflog **out, git_refdb_backend *_backend, const char *name, size_t count)
+{
+	int error;
+
+	assert(out && _backend && name);
+
+	if ((error = reflog_read(out, (refdb_reftable_backend *)_backend, name, count)) == 0)
+		(*out)->partial = 1;
+
+	return error;
+}
+
+static int reflog_write_cb(reftable_update *update, reftable_stack *stack, void *payload)
+{
+	git_reflog *reflog = payload;
+	git_reflog_entry *entry;
+	git_reftable_log log;
+	size_t i;
+	int error;
+
+	if ((error = stack_has_log(stack, reflog->ref_name)) <= 0) {
+		if (error < 0)
+			return error;
+
+		giterr_set(GITERR_INVALID,
+			"Log file for reference '%s' doesn't exist.", reflog->ref_name);
+		return -1;
+	}
+
+	if ((error = update_delete_log(update, stack, reflog->ref_name)) < 0)
+		return error;
+
+	if (!git_vector_length(&reflog->entries))
+		return update_append_log(update, reflog->ref_name, NULL, NULL, NULL, NULL);
+
+	/* Every entry needs an update index of its own to keep them apart */
+	git_vector_foreach(&reflog->entries, i, entry) {
+		memset(&log, 0, sizeof(git_reftable_log));
+
+		log.name = reflog->ref_name;
+		log.update_index = update->min_update_index + i;
+		log.type = GIT_REFTABLE_LOG_UPDATE;
+		git_oid_cpy(&log.old_id, &entry->oid_old);
+		git_oid_cpy(&log.new_id, &entry->oid_cur);
+		log.committer_name = entry->committer->name;
+		log.committer_email = entry->committer->email;
+		log.time = entry->committer->when.time;
+		log.offset = entry->committer->when.offset;
+		log.message = entry->msg ? entry->msg : "";
+
+		if ((error = update_add_log(update, &log, NULL)) < 0)
+			return error;
+
+		update->max_update_index = log.update_index;
+	}
+
+	return 0;
+}
+
+static int refdb_reftable_reflog__write(git_refdb_backend *_backend, git_reflog *reflog)
+{
+	assert(_backend && reflog);
+
+	return stack_update((refdb_reftable_backend *)_backend, reflog_write_cb, reflog, false);
+}
+
+static int reflog_rename_cb(reftable_update *update, reftable_stack *stack, void *payload)
+{
+	const char **names = payload;
+	int error;
+
+	if ((error = stack_has_log(stack, names[0])) <= 0)
+		return error < 0 ? error : GIT_ENOTFOUND;
+
+	return update_move_log(update, stack, names[0], names[1]);
+}
+
+static int refdb_reftable_reflog__rename(
+	git_refdb_backend *_backend, const char *old_name, const char *new_name)
+{
+	git_buf normalized = GIT_BUF_INIT;
+	const char *names[2];
+	int error;
+
+	assert(_backend && old_name && new_name);
+
+	if ((error = git_reference__normalize_name(
+			&normalized, new_name, GIT_REF_FORMAT_ALLOW_ONELEVEL)) < 0)
+		return error;
+
+	names[0] = old_name;
+	names[1] = normalized.ptr;
+
+	error = stack_update((refdb_reftable_backend *)_backend,
+		reflog_rename_cb, (void *)names, false);
+
+	git_buf_free(&normalized);
+	return error;
+}
+
+static int reflog_delete_cb(reftable_update *update, reftable_stack *stack, void *payload)
+{
+	return update_delete_log(update, stack, payload);
+}
+
+static int refdb_reftable_reflog__delete(git_refdb_backend *_backend, const char *name)
+{
+	assert(_backend && name);
+
+	return stack_update((refdb_reftable_backend *)_backend,
+		reflog_delete_cb, (void *)name, false);
+}
+
+/*
+ * Moving over from the files
+ */
+
+static int import_reflog(
+	reftable_update *update, git_refdb_backend *fs, const char *name)
+{
+	git_reflog *reflog;
+	git_reflog_entry *entry;
+	git_reftable_log log;
+	size_t i;
+	int error;
+
+	if (!fs->has_log(fs, name))
+		return 0;
+
+	if ((error = fs->reflog_read(&reflog, fs, name)) < 0)
+		return error;
+
+	if (!git_vector_length(&reflog->entries))
+		error = update_append_log(update, name, NULL, NULL, NULL, NULL);
+
+	git_vector_foreach(&reflog->entries, i, entry) {
+		memset(&log, 0, sizeof(git_reftable_log));
+
+		log.name = name;
+		log.update_index = i + 1;
+		log.type = GIT_REFTABLE_LOG_UPDATE;
+		git_oid_cpy(&log.old_id, &entry->oid_old);
+		git_oid_cpy(&log.new_id, &entry->oid_cur);
+		log.committer_name = entry->committer->name;
+		log.committer_email = entry->committer->email;
+		log.time = entry->committer->when.time;
+		log.offset = entry->committer->when.offset;
+		log.message = entry->msg ? entry->msg : "";
+
+		if ((error = update_add_log(update, &log, NULL)) < 0)
+			break;
+
+		if (log.update_index > update->max_update_index)
+			update->max_update_index = log.update_index;
+	}
+
+	git_reflog_free(reflog);
+	return error;
+}
+
+static int import_ref(reftable_update *update, git_refdb_backend *fs, git_reference *ref)
+{
+	int error;
+
+	if ((error = update_add_ref(update, ref)) == 0)
+		error = import_reflog(update, fs, ref->name);
+
+	git_reference_free(ref);
+	return error;
+}
+
+static int import_cb(reftable_update *update, reftable_stack *stack, void *payload)
+{
+	refdb_reftable_backend *backend = payload;
+	git_refdb *refdb = NULL;
+	git_refdb_backend *fs = NULL;
+	git_reference_iterator *iter = NULL;
+	git_reference *ref;
+	int error;
+
+	/* Someone else got here first */
+	if (git_vector_length(&stack->tables))
+		return 0;
+
+	if ((error = git_refdb_new(&refdb, backend->repo)) < 0 ||
+		(error = git_refdb_backend_fs(&fs, backend->repo)) < 0 ||
+		(error = git_refdb_set_backend(refdb, fs)) < 0)
+		goto done;
+
+	if ((error = fs->lookup(&ref, fs, GIT_HEAD_FILE)) == 0)
+		error = import_ref(update, fs, ref);
+	else if (error == GIT_ENOTFOUND)
+		giterr_clear();
+
+	if ((error = git_refdb_iterator(&iter, refdb, NULL)) < 0)
+		goto done;
+
+	while ((error = git_refdb_iterator_next(&ref, iter)) == 0) {
+		if ((error = import_ref(update, fs, ref)) < 0)
+			goto done;
+	}
+
+	if (error == GIT_ITEROVER)
+		error = 0;
+
+done:
+	git_refdb_iterator_free(iter);
+	git_refdb_free(refdb);
+	return error;
+}
+
+/*
+ * Once the references have moved, other openers have to know to look
+ * for them here, and tools which don't know about reftables to stay out.
+ */
+static int import_set_storage(git_repository *repo)
+{
+	git_config *config, *local;
+	int error;
+
+	if ((error = git_repository_config__weakptr(&config, repo)) < 0 ||
+		(error = git_config_open_level(&local, config, GIT_CONFIG_LEVEL_LOCAL)) < 0)
+		return error;
+
+	if ((error = git_config_set_int32(local, "core.repositoryformatversion", 1)) == 0)
+		error = git_config_set_string(local, "extensions.refstorage", "reftable");
+
+	git_config_free(local);
+	return error;
+}
+
+int git_refdb_backend_reftable(
+	git_refdb_backend **backend_out,
+	git_repository *repository)
+{
+	git_buf path = GIT_BUF_INIT;
+	refdb_reftable_backend *backend;
+	bool import;
+
+	if (repository->namespace) {
+		giterr_set(GITERR_REFERENCE,
+			"Namespaces are not supported with the reftable backend");
+		return -1;
+	}
+
+	backend = git__calloc(1, sizeof(refdb_reftable_backend));
+	GITERR_CHECK_ALLOC(backend);
+
+	backend->repo = repository;
+	git_buf_init(&backend->list, 0);
+
+	if (git_mutex_init(&backend->lock) < 0) {
+		giterr_set(GITERR_OS, "Failed to initialize the reftable lock");
+		git__free(backend);
+		return -1;
+	}
+
+	if (git_buf_joinpath(&path, repository->path_repository, REFTABLE_DIR) < 0)
+		goto fail;
+
+	backend->path = git_buf_detach(&path);
+
+	if (git_buf_joinpath(&path, backend->path, REFTABLE_LIST_FILE) < 0)
+		goto fail;
+
+	backend->list_path = git_buf_detach(&path);
+
+	backend->parent.exists = &refdb_reftable_backend__exists;
+	backend->parent.lookup = &refdb_reftable_backend__lookup;
+	backend->parent.iterator = &refdb_reftable_backend__iterator;
+	backend->parent.write = &refdb_reftable_backend__write;
+	backend->parent.del = &refdb_reftable_backend__delete;
+	backend->parent.rename = &refdb_reftable_backend__rename;
+	backend->parent.compress = &refdb_reftable_backend__compress;
+	backend->parent.has_log = &refdb_reftable_reflog__has_log;
+	backend->parent.ensure_log = &refdb_reftable_reflog__ensure_log;
+	backend->parent.free = &refdb_reftable_backend__free;
+	backend->parent.reflog_read = &refdb_reftable_reflog__read;
+	backend->parent.reflog_read_recent = &refdb_reftable_reflog__read_recent;
+	backend->parent.reflog_write = &refdb_reftable_reflog__write;
+	backend->parent.reflog_rename = &refdb_reftable_reflog__rename;
+	backend->parent.reflog_delete = &refdb_reftable_reflog__delete;
+	backend->parent.transaction = &refdb_reftable_backend__transaction;
+
+	/* The references start out in the files the first time around */
+	import = !git_path_isfile(backend->list_path);
+
+	if (import &&
+		(git_futils_mkdir(backend->path, NULL, GIT_REFLOG_DIR_MODE, GIT_MKDIR_PATH) < 0 ||
+		 stack_update(backend, import_cb, backend, false) < 0 ||
+		 import_set_storage(repository) < 0))
+		goto fail;
+
+	*backend_out = (git_refdb_backend *)backend;
+	return 0;
+
+fail:
+	git_buf_free(&path);
+	refdb_reftable_backend__free((git_refdb_backend *)backend);
+	return -1;
+}
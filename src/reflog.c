@@ -48,6 +48,25 @@ void git_reflog_free(git_reflog *reflog)
 	git__free(reflog);
 }
 
+void git_reflog__keep_recent(git_reflog *reflog, size_t count)
+{
+	size_t i, skip;
+
+	reflog->partial = 1;
+
+	if (reflog->entries.length <= count)
+		return;
+
+	skip = reflog->entries.length - count;
+
+	for (i = 0; i < skip; i++)
+		git_reflog_entry__free(git_vector_get(&reflog->entries, i));
+
+	memmove(reflog->entries.contents, reflog->entries.contents + skip,
+		count * sizeof(void *));
+	reflog->entries.length = count;
+}
+
 int git_reflog_read(git_reflog **reflog, git_repository *repo,  const char *name)
 {
 	git_refdb *refdb;
@@ -61,12 +80,33 @@ int git_reflog_read(git_reflog **reflog, git_repository *repo,  const char *name
 	return git_refdb_reflog_read(reflog, refdb, name);
 }
 
+int git_reflog_read_recent(
+	git_reflog **reflog, git_repository *repo, const char *name, size_t count)
+{
+	git_refdb *refdb;
+	int error;
+
+	assert(reflog && repo && name);
+
+	if ((error = git_repository_refdb__weakptr(&refdb, repo)) < 0)
+		return error;
+
+	return git_refdb_reflog_read_recent(reflog, refdb, name, count);
+}
+
 int git_reflog_write(git_reflog *reflog)
 {
 	git_refdb *db;
 
 	assert(reflog && reflog->db);
 
+	if (reflog->partial) {
+		giterr_set(GITERR_REFERENCE,
+			"Cannot write back the partially read reflog for '%s'",
+			reflog->ref_name);
+		return -1;
+	}
+
 	db = reflog->db;
 	return db->backend->reflog_write(db->backend, reflog);
 }
@@ -30,8 +30,14 @@ struct git_reflog {
 	git_refdb *db;
 	char *ref_name;
 	git_vector entries;
+
+	/* only the newest entries were read */
+	unsigned int partial : 1;
 };
 
+/* Drop all but the `count` newest entries, leaving a partial reflog */
+extern void git_reflog__keep_recent(git_reflog *reflog, size_t count);
+
 GIT_INLINE(size_t) reflog_inverse_index(size_t idx, size_t total)
 {
 	return (total - 1) - idx;
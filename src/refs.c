@@ -28,6 +28,9 @@ GIT__USE_STRMAP;
 #define DEFAULT_NESTING_LEVEL	5
 #define MAX_NESTING_LEVEL		10
 
+/* Below this many updates, a loose file per reference is cheap enough */
+#define BATCH_PACKED_MIN		64
+
 enum {
 	GIT_PACKREF_HAS_PEEL = 1,
 	GIT_PACKREF_WAS_LOOSE = 2
@@ -158,7 +161,7 @@ int git_reference_name_to_id(
 	return 0;
 }
 
-static int reference_normalize_for_repo(
+int git_reference__normalize_for_repo(
 	git_refname_t out,
 	git_repository *repo,
 	const char *name)
@@ -196,7 +199,7 @@ int git_reference_lookup_resolved(
 
 	scan_type = GIT_REF_SYMBOLIC;
 
-	if ((error = reference_normalize_for_repo(scan_name, repo, name)) < 0)
+	if ((error = git_reference__normalize_for_repo(scan_name, repo, name)) < 0)
 		return error;
 
 	if ((error = git_repository_refdb__weakptr(&refdb, repo)) < 0)
@@ -363,7 +366,7 @@ static int reference__create(
 	if (ref_out)
 		*ref_out = NULL;
 
-	error = reference_normalize_for_repo(normalized, repo, name);
+	error = git_reference__normalize_for_repo(normalized, repo, name);
 	if (error < 0)
 		return error;
 
@@ -390,7 +393,7 @@ static int reference__create(
 	} else {
 		git_refname_t normalized_target;
 
-		if ((error = reference_normalize_for_repo(normalized_target, repo, symbolic)) < 0)
+		if ((error = git_reference__normalize_for_repo(normalized_target, repo, symbolic)) < 0)
 			return error;
 
 		ref = git_reference__alloc_symbolic(normalized, normalized_target);
@@ -411,7 +414,7 @@ static int reference__create(
 	return 0;
 }
 
-static int log_signature(git_signature **out, git_repository *repo)
+int git_reference__log_signature(git_signature **out, git_repository *repo)
 {
 	int error;
 	git_signature *who;
@@ -441,7 +444,7 @@ int git_reference_create_matching(
 	assert(id);
 
 	if (!signature) {
-		if ((error = log_signature(&who, repo)) < 0)
+		if ((error = git_reference__log_signature(&who, repo)) < 0)
 			return error;
 		else
 			signature = who;
@@ -466,6 +469,43 @@ int git_reference_create(
         return git_reference_create_matching(ref_out, repo, name, id, force, NULL, signature, log_message);
 }
 
+int git_reference__update_batch(
+	git_repository *repo,
+	git_reference **refs,
+	size_t count,
+	const git_signature *signature,
+	const char *log_message)
+{
+	git_refdb_transaction *tx;
+	git_refdb *refdb;
+	unsigned int flags = GIT_REFDB_TRANSACTION_DEFAULT;
+	size_t i;
+	int error;
+
+	assert(repo && (refs || !count));
+
+	if (count >= BATCH_PACKED_MIN)
+		flags |= GIT_REFDB_TRANSACTION_PACKED;
+
+	if ((error = git_repository_refdb__weakptr(&refdb, repo)) < 0 ||
+		(error = git_refdb_transaction_new(&tx, refdb, flags)) < 0)
+		return error;
+
+	for (i = 0; i < count && !error; ++i) {
+		if (git_oid_iszero(&refs[i]->target.oid))
+			error = git_refdb_transaction_delete(tx, refs[i]->name, NULL);
+		else
+			error = git_refdb_transaction_set_target(
+				tx, refs[i]->name, &refs[i]->target.oid, NULL);
+	}
+
+	if (!error)
+		error = git_refdb_transaction_commit(tx, signature, log_message);
+
+	git_refdb_transaction_free(tx);
+	return error;
+}
+
 int git_reference_symbolic_create_matching(
 	git_reference **ref_out,
 	git_repository *repo,
@@ -482,7 +522,7 @@ int git_reference_symbolic_create_matching(
 	assert(target);
 
 	if (!signature) {
-		if ((error = log_signature(&who, repo)) < 0)
+		if ((error = git_reference__log_signature(&who, repo)) < 0)
 			return error;
 		else
 			signature = who;
@@ -572,7 +612,7 @@ static int reference__rename(git_reference **out, git_reference *ref, const char
 
 	assert(ref && new_name && signature);
 
-	if ((error = reference_normalize_for_repo(
+	if ((error = git_reference__normalize_for_repo(
 			normalized, git_reference_owner(ref), new_name)) < 0)
 		return error;
 
@@ -27,7 +27,7 @@
 
 #define GIT_SYMREF "ref: "
 #define GIT_PACKEDREFS_FILE "packed-refs"
-#define GIT_PACKEDREFS_HEADER "# pack-refs with: peeled fully-peeled "
+#define GIT_PACKEDREFS_HEADER "# pack-refs with: peeled fully-peeled sorted "
 #define GIT_PACKEDREFS_FILE_MODE 0666
 
 #define GIT_HEAD_FILE "HEAD"
@@ -69,8 +69,18 @@ struct git_reference {
 git_reference *git_reference__set_name(git_reference *ref, const char *name);
 
 int git_reference__normalize_name(git_buf *buf, const char *name, unsigned int flags);
+int git_reference__normalize_for_repo(git_refname_t out, git_repository *repo, const char *name);
 int git_reference__update_terminal(git_repository *repo, const char *ref_name, const git_oid *oid, const git_signature *signature, const char *log_message);
 int git_reference__is_valid_name(const char *refname, unsigned int flags);
+
+/*
+ * Forcibly update the given direct references all at once, deleting
+ * the ones which point to the zero id.
+ */
+int git_reference__update_batch(git_repository *repo, git_reference **refs, size_t count, const git_signature *signature, const char *log_message);
+
+/* The repository's default signature for reflog entries */
+int git_reference__log_signature(git_signature **out, git_repository *repo);
 int git_reference__is_branch(const char *ref_name);
 int git_reference__is_remote(const char *ref_name);
 int git_reference__is_tag(const char *ref_name);
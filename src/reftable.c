@@ -0,0 +1,1327 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "reftable.h"
+#include "array.h"
+#include "fileops.h"
+#include "path.h"
+#include "posix.h"
+#include "zstream.h"
+
+#define REFTABLE_MAGIC "REFT"
+#define REFTABLE_VERSION 1
+#define REFTABLE_HEADER_SIZE 24
+#define REFTABLE_FOOTER_SIZE 68
+#define REFTABLE_BLOCK_HEADER_SIZE 4
+
+/* Every this many records, a key is stored in full so it can be searched */
+#define REFTABLE_RESTART_INTERVAL 16
+
+/* Sections with fewer blocks than this are scanned rather than indexed */
+#define REFTABLE_INDEX_THRESHOLD 4
+
+#define REFTABLE_MAX_BLOCK_LEN 0xffffff
+
+struct git_reftable {
+	git_refcount rc;
+	char *name;
+	git_map map;
+	uint32_t block_size;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+	size_t ref_end;
+	uint64_t ref_index;
+	bool has_logs;
+	uint64_t log_start;
+	uint64_t log_index;
+	size_t log_end;
+	size_t footer;
+};
+
+GIT_INLINE(uint32_t) get_be16(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 8) | p[1];
+}
+
+GIT_INLINE(uint32_t) get_be24(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+GIT_INLINE(uint32_t) get_be32(const unsigned char *p)
+{
+	return ((uint32_t)get_be16(p) << 16) | get_be16(p + 2);
+}
+
+GIT_INLINE(uint64_t) get_be64(const unsigned char *p)
+{
+	return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+GIT_INLINE(void) put_be16(unsigned char *p, uint32_t val)
+{
+	p[0] = (val >> 8) & 0xff;
+	p[1] = val & 0xff;
+}
+
+GIT_INLINE(void) put_be24(unsigned char *p, uint32_t val)
+{
+	p[0] = (val >> 16) & 0xff;
+	put_be16(p + 1, val);
+}
+
+GIT_INLINE(void) put_be32(unsigned char *p, uint32_t val)
+{
+	put_be16(p, val >> 16);
+	put_be16(p + 2, val);
+}
+
+GIT_INLINE(void) put_be64(unsigned char *p, uint64_t val)
+{
+	put_be32(p, (uint32_t)(val >> 32));
+	put_be32(p + 4, (uint32_t)val);
+}
+
+GIT_INLINE(int) key_cmp(const void *a, size_t a_len, const void *b, size_t b_len)
+{
+	int cmp = memcmp(a, b, min(a_len, b_len));
+
+	if (cmp)
+		return cmp;
+
+	return (a_len > b_len) - (a_len < b_len);
+}
+
+static int reftable_error(const git_reftable *table)
+{
+	giterr_set(GITERR_REFERENCE, "Corrupted reftable '%s'", table->name);
+	return -1;
+}
+
+/*
+ * Reading
+ */
+
+typedef struct {
+	const unsigned char *p;
+	const unsigned char *end;
+} cursor;
+
+static int get_varint(uint64_t *out, cursor *c)
+{
+	unsigned char byte;
+	uint64_t val;
+
+	if (c->p >= c->end)
+		return -1;
+
+	byte = *c->p++;
+	val = byte & 127;
+
+	while (byte & 128) {
+		if (c->p >= c->end || val >= (UINT64_MAX >> 7))
+			return -1;
+
+		byte = *c->p++;
+		val = ((val + 1) << 7) | (byte & 127);
+	}
+
+	*out = val;
+	return 0;
+}
+
+static int get_bytes(const unsigned char **out, uint64_t len, cursor *c)
+{
+	if (len > (uint64_t)(c->end - c->p))
+		return -1;
+
+	*out = c->p;
+	c->p += len;
+	return 0;
+}
+
+static int get_string(git_buf *out, cursor *c)
+{
+	const unsigned char *str;
+	uint64_t len;
+
+	if (get_varint(&len, c) < 0 || get_bytes(&str, len, c) < 0)
+		return -1;
+
+	git_buf_put(out, (const char *)str, (size_t)len);
+	return git_buf_putc(out, '\0');
+}
+
+int git_reftable_open(git_reftable **out, const char *path)
+{
+	git_reftable *table;
+	const unsigned char *data, *footer;
+	uint64_t positions[5];
+	struct stat st;
+	git_file fd;
+	size_t i;
+	bool logs_first;
+	int error = -1;
+
+	if ((fd = git_futils_open_ro(path)) < 0)
+		return fd;
+
+	table = git__calloc(1, sizeof(git_reftable));
+	GITERR_CHECK_ALLOC(table);
+
+	if ((table->name = git_path_basename(path)) == NULL)
+		goto done;
+
+	if (p_fstat(fd, &st) < 0) {
+		giterr_set(GITERR_OS, "Failed to stat reftable '%s'", path);
+		goto done;
+	}
+
+	if (st.st_size < REFTABLE_HEADER_SIZE + REFTABLE_FOOTER_SIZE ||
+		(git_off_t)(size_t)st.st_size != st.st_size) {
+		reftable_error(table);
+		goto done;
+	}
+
+	if (git_futils_mmap_ro(&table->map, fd, 0, (size_t)st.st_size) < 0)
+		goto done;
+
+	data = table->map.data;
+	table->footer = table->map.len - REFTABLE_FOOTER_SIZE;
+	footer = data + table->footer;
+
+	if (memcmp(data, REFTABLE_MAGIC, 4) != 0 ||
+		memcmp(data, footer, REFTABLE_HEADER_SIZE) != 0 ||
+		crc32(0L, footer, REFTABLE_FOOTER_SIZE - 4) !=
+			get_be32(footer + REFTABLE_FOOTER_SIZE - 4)) {
+		reftable_error(table);
+		goto done;
+	}
+
+	if (data[4] != REFTABLE_VERSION) {
+		giterr_set(GITERR_REFERENCE,
+			"Unsupported version %d of reftable '%s'", data[4], path);
+		goto done;
+	}
+
+	table->block_size = get_be24(data + 5);
+	table->min_update_index = get_be64(data + 8);
+	table->max_update_index = get_be64(data + 16);
+
+	/* The ref index, objects, object index, logs and log index, in file order */
+	for (i = 0; i < 5; ++i)
+		positions[i] = get_be64(footer + REFTABLE_HEADER_SIZE + 8 * i);
+
+	/* The low bits of the object position hold the id length */
+	positions[1] >>= 5;
+
+	for (i = 0; i < 5; ++i) {
+		if (positions[i] > table->footer) {
+			reftable_error(table);
+			goto done;
+		}
+	}
+
+	/* A table without references starts right away with its logs */
+	logs_first = table->footer > REFTABLE_HEADER_SIZE &&
+		data[REFTABLE_HEADER_SIZE] == GIT_REFTABLE_BLOCK_LOG;
+
+	table->ref_index = positions[0];
+	table->has_logs = positions[3] || logs_first;
+	table->log_start = positions[3];
+	table->log_index = positions[4];
+
+	table->ref_end = table->footer;
+	for (i = 5; i > 0; --i) {
+		if (positions[i - 1])
+			table->ref_end = (size_t)positions[i - 1];
+	}
+
+	if (logs_first)
+		table->ref_end = 0;
+
+	table->log_end = table->log_index ? (size_t)table->log_index : table->footer;
+
+	GIT_REFCOUNT_INC(table);
+	*out = table;
+	error = 0;
+
+done:
+	p_close(fd);
+
+	if (error < 0)
+		git_reftable_free(table);
+
+	return error;
+}
+
+void git_reftable_incref(git_reftable *table)
+{
+	GIT_REFCOUNT_INC(table);
+}
+
+static void reftable_free(git_reftable *table)
+{
+	if (table->map.data)
+		git_futils_mmap_free(&table->map);
+
+	git__free(table->name);
+	git__free(table);
+}
+
+void git_reftable_free(git_reftable *table)
+{
+	if (table == NULL)
+		return;
+
+	/* A table which failed to open never got a reference */
+	if (!GIT_REFCOUNT_VAL(table)) {
+		reftable_free(table);
+		return;
+	}
+
+	GIT_REFCOUNT_DEC(table, reftable_free);
+}
+
+const char *git_reftable_name(const git_reftable *table)
+{
+	return table->name;
+}
+
+size_t git_reftable_size(const git_reftable *table)
+{
+	return table->map.len;
+}
+
+uint64_t git_reftable_min_update_index(const git_reftable *table)
+{
+	return table->min_update_index;
+}
+
+uint64_t git_reftable_max_update_index(const git_reftable *table)
+{
+	return table->max_update_index;
+}
+
+void git_reftable_iter_init(
+	git_reftable_iter *iter, git_reftable *table, int section)
+{
+	memset(iter, 0, sizeof(git_reftable_iter));
+
+	iter->table = table;
+	iter->section = section;
+	iter->done = 1;
+
+	git_buf_init(&iter->inflated, 0);
+	git_buf_init(&iter->key, 0);
+	git_buf_init(&iter->strings, 0);
+}
+
+void git_reftable_iter_free(git_reftable_iter *iter)
+{
+	git_buf_free(&iter->inflated);
+	git_buf_free(&iter->key);
+	git_buf_free(&iter->strings);
+}
+
+static size_t section_start(git_reftable_iter *iter)
+{
+	if (iter->section == GIT_REFTABLE_BLOCK_LOG)
+		return (size_t)iter->table->log_start;
+
+	return iter->table->ref_end > REFTABLE_HEADER_SIZE ? 0 : iter->table->footer;
+}
+
+static size_t section_end(git_reftable_iter *iter)
+{
+	if (iter->section == GIT_REFTABLE_BLOCK_LOG)
+		return iter->table->has_logs ? iter->table->log_end : 0;
+
+	return iter->table->ref_end;
+}
+
+static uint64_t section_index(git_reftable_iter *iter)
+{
+	if (iter->section == GIT_REFTABLE_BLOCK_LOG)
+		return iter->table->log_index;
+
+	return iter->table->ref_index;
+}
+
+static int load_block(git_reftable_iter *iter, size_t off)
+{
+	git_reftable *table = iter->table;
+	const unsigned char *data = table->map.data;
+	size_t header = off ? 0 : REFTABLE_HEADER_SIZE;
+	size_t len, used, restarts;
+
+	if (off + header + REFTABLE_BLOCK_HEADER_SIZE > table->footer)
+		return reftable_error(table);
+
+	iter->block_type = data[off + header];
+	len = get_be24(data + off + header + 1);
+
+	if (len < header + REFTABLE_BLOCK_HEADER_SIZE + 2)
+		return reftable_error(table);
+
+	if (iter->block_type == GIT_REFTABLE_BLOCK_LOG) {
+		/* Only the records of a log block are compressed, not the headers */
+		size_t plain = header + REFTABLE_BLOCK_HEADER_SIZE;
+
+		git_buf_clear(&iter->inflated);
+
+		if (git_buf_grow(&iter->inflated, len) < 0)
+			return -1;
+
+		memcpy(iter->inflated.ptr, data + off, plain);
+
+		if (git_zstream_inflatebuf(
+				iter->inflated.ptr + plain, len - plain,
+				data + off + plain, table->footer - off - plain,
+				&used) < 0)
+			return reftable_error(table);
+
+		iter->inflated.size = len;
+		iter->block = (const unsigned char *)iter->inflated.ptr;
+		iter->next_block_off = off + plain + used;
+	} else {
+		if (len > table->footer - off)
+			return reftable_error(table);
+
+		iter->block = data + off;
+		iter->next_block_off = off + len;
+
+		/* Skip the padding up to the next block */
+		while (iter->next_block_off < table->footer &&
+			data[iter->next_block_off] == '\0')
+			iter->next_block_off++;
+	}
+
+	restarts = get_be16(iter->block + len - 2);
+
+	if (!restarts || header + REFTABLE_BLOCK_HEADER_SIZE + 3 * restarts + 2 > len)
+		return reftable_error(table);
+
+	iter->block_off = off;
+	iter->block_len = len;
+	iter->records_end = len - 2 - 3 * restarts;
+	iter->pos = header + REFTABLE_BLOCK_HEADER_SIZE;
+	iter->peeked = 0;
+	git_buf_clear(&iter->key);
+
+	return 0;
+}
+
+static int read_ref(git_reftable_iter *iter, cursor *c, unsigned int type)
+{
+	git_reftable_ref *ref = &iter->record.ref;
+	const unsigned char *raw;
+	uint64_t delta;
+	size_t target = 0;
+
+	memset(ref, 0, sizeof(git_reftable_ref));
+	ref->type = type;
+
+	git_buf_clear(&iter->strings);
+	git_buf_put(&iter->strings, iter->key.ptr, iter->key.size);
+	git_buf_putc(&iter->strings, '\0');
+
+	if (get_varint(&delta, c) < 0)
+		return -1;
+
+	ref->update_index = iter->table->min_update_index + delta;
+
+	switch (type) {
+	case GIT_REFTABLE_REF_DELETION:
+		break;
+	case GIT_REFTABLE_REF_VAL1:
+	case GIT_REFTABLE_REF_VAL2:
+		if (get_bytes(&raw, GIT_OID_RAWSZ, c) < 0)
+			return -1;
+
+		git_oid_fromraw(&ref->id, raw);
+
+		if (type == GIT_REFTABLE_REF_VAL2) {
+			if (get_bytes(&raw, GIT_OID_RAWSZ, c) < 0)
+				return -1;
+
+			git_oid_fromraw(&ref->peeled, raw);
+		}
+		break;
+	case GIT_REFTABLE_REF_SYMREF:
+		target = iter->strings.size;
+
+		if (get_string(&iter->strings, c) < 0)
+			return -1;
+		break;
+	default:
+		return -1;
+	}
+
+	if (git_buf_oom(&iter->strings))
+		return -1;
+
+	ref->name = iter->strings.ptr;
+
+	if (type == GIT_REFTABLE_REF_SYMREF)
+		ref->target = iter->strings.ptr + target;
+
+	return 0;
+}
+
+static int read_log(git_reftable_iter *iter, cursor *c, unsigned int type)
+{
+	git_reftable_log *log = &iter->record.log;
+	const unsigned char *raw;
+	size_t name_len, strings[3], i;
+	uint64_t time;
+
+	memset(log, 0, sizeof(git_reftable_log));
+	log->type = type;
+
+	/* The key is the name, a NUL and the inverted update index */
+	if (iter->key.size < 9 || iter->key.ptr[iter->key.size - 9] != '\0')
+		return -1;
+
+	name_len = iter->key.size - 9;
+	log->update_index = UINT64_MAX -
+		get_be64((const unsigned char *)iter->key.ptr + name_len + 1);
+
+	git_buf_clear(&iter->strings);
+	git_buf_put(&iter->strings, iter->key.ptr, name_len + 1);
+
+	if (type == GIT_REFTABLE_LOG_UPDATE) {
+		if (get_bytes(&raw, GIT_OID_RAWSZ, c) < 0)
+			return -1;
+
+		git_oid_fromraw(&log->old_id, raw);
+
+		if (get_bytes(&raw, GIT_OID_RAWSZ, c) < 0)
+			return -1;
+
+		git_oid_fromraw(&log->new_id, raw);
+
+		for (i = 0; i < 2; ++i) {
+			strings[i] = iter->strings.size;
+
+			if (get_string(&iter->strings, c) < 0)
+				return -1;
+		}
+
+		if (get_varint(&time, c) < 0 || get_bytes(&raw, 2, c) < 0)
+			return -1;
+
+		log->time = (git_time_t)time;
+		log->offset = (int16_t)get_be16(raw);
+
+		strings[2] = iter->strings.size;
+
+		if (get_string(&iter->strings, c) < 0)
+			return -1;
+
+		/* Messages may come with a trailing newline */
+		if (iter->strings.size - strings[2] > 1 &&
+			iter->strings.ptr[iter->strings.size - 2] == '\n')
+			iter->strings.ptr[iter->strings.size - 2] = '\0';
+	} else if (type != GIT_REFTABLE_LOG_DELETION) {
+		return -1;
+	}
+
+	if (git_buf_oom(&iter->strings))
+		return -1;
+
+	log->name = iter->strings.ptr;
+
+	if (type == GIT_REFTABLE_LOG_UPDATE) {
+		log->committer_name = iter->strings.ptr + strings[0];
+		log->committer_email = iter->strings.ptr + strings[1];
+		log->message = iter->strings.ptr + strings[2];
+	}
+
+	return 0;
+}
+
+static int read_record(git_reftable_iter *iter)
+{
+	cursor c;
+	const unsigned char *suffix;
+	uint64_t prefix, suffix_type, suffix_len;
+	unsigned int type;
+	int error;
+
+	c.p = iter->block + iter->pos;
+	c.end = iter->block + iter->records_end;
+
+	if (get_varint(&prefix, &c) < 0 ||
+		get_varint(&suffix_type, &c) < 0 ||
+		prefix > iter->key.size)
+		return reftable_error(iter->table);
+
+	suffix_len = suffix_type >> 3;
+	type = suffix_type & 7;
+
+	if (get_bytes(&suffix, suffix_len, &c) < 0)
+		return reftable_error(iter->table);
+
+	git_buf_truncate(&iter->key, (size_t)prefix);
+
+	if (git_buf_put(&iter->key, (const char *)suffix, (size_t)suffix_len) < 0)
+		return -1;
+
+	switch (iter->block_type) {
+	case GIT_REFTABLE_BLOCK_REF:
+		error = read_ref(iter, &c, type);
+		break;
+	case GIT_REFTABLE_BLOCK_LOG:
+		error = read_log(iter, &c, type);
+		break;
+	case GIT_REFTABLE_BLOCK_INDEX:
+		error = get_varint(&iter->child, &c);
+		break;
+	default:
+		error = -1;
+	}
+
+	if (error < 0)
+		return git_buf_oom(&iter->key) || git_buf_oom(&iter->strings) ?
+			-1 : reftable_error(iter->table);
+
+	iter->pos = c.p - iter->block;
+	return 0;
+}
+
+/* Compare `key` with the key stored in full at a restart point */
+static int restart_cmp(
+	int *cmp, git_reftable_iter *iter, size_t restart, const void *key, size_t key_len)
+{
+	cursor c;
+	const unsigned char *suffix;
+	uint64_t prefix, suffix_type;
+
+	c.p = iter->block + restart;
+	c.end = iter->block + iter->records_end;
+
+	if (restart >= iter->records_end ||
+		get_varint(&prefix, &c) < 0 || prefix != 0 ||
+		get_varint(&suffix_type, &c) < 0 ||
+		get_bytes(&suffix, suffix_type >> 3, &c) < 0)
+		return reftable_error(iter->table);
+
+	*cmp = key_cmp(suffix, (size_t)(suffix_type >> 3), key, key_len);
+	return 0;
+}
+
+/*
+ * Read up to the first record in the block whose key is >= `key`, and
+ * leave it for the next call to `git_reftable_iter_next`.  Returns 1
+ * when there is one, 0 when the whole block sorts before `key`.
+ */
+static int seek_in_block(git_reftable_iter *iter, const void *key, size_t key_len)
+{
+	const unsigned char *restarts = iter->block + iter->records_end;
+	size_t lo = 0, hi = get_be16(iter->block + iter->block_len - 2), mid;
+	int cmp, error;
+
+	/* Find the last restart point whose key is <= `key` */
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+
+		if ((error = restart_cmp(&cmp, iter, get_be24(restarts + 3 * mid), key, key_len)) < 0)
+			return error;
+
+		if (cmp <= 0)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	iter->pos = get_be24(restarts + 3 * lo);
+	git_buf_clear(&iter->key);
+
+	while (iter->pos < iter->records_end) {
+		if ((error = read_record(iter)) < 0)
+			return error;
+
+		if (key_cmp(iter->key.ptr, iter->key.size, key, key_len) >= 0) {
+			iter->peeked = 1;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int git_reftable_iter_seek(git_reftable_iter *iter, const void *key, size_t key_len)
+{
+	size_t off = section_start(iter), end = section_end(iter);
+	uint64_t index = section_index(iter);
+	int error;
+
+	iter->done = 1;
+	iter->peeked = 0;
+
+	if (off >= end)
+		return 0;
+
+	/* Walk down the index to the block which holds the key */
+	if (index) {
+		off = (size_t)index;
+
+		for (;;) {
+			if ((error = load_block(iter, off)) < 0)
+				return error;
+
+			if (iter->block_type != GIT_REFTABLE_BLOCK_INDEX)
+				break;
+
+			if ((error = seek_in_block(iter, key, key_len)) <= 0)
+				return error;
+
+			/* Children come before their index, which rules out loops */
+			if (iter->child >= end || iter->child >= off)
+				return reftable_error(iter->table);
+
+			off = (size_t)iter->child;
+		}
+	} else if ((error = load_block(iter, off)) < 0) {
+		return error;
+	}
+
+	for (;;) {
+		if (iter->block_type != iter->section)
+			return reftable_error(iter->table);
+
+		if ((error = seek_in_block(iter, key, key_len)) < 0)
+			return error;
+
+		if (error > 0)
+			break;
+
+		if (iter->next_block_off >= end)
+			return 0;
+
+		if ((error = load_block(iter, iter->next_block_off)) < 0)
+			return error;
+	}
+
+	iter->done = 0;
+	return 0;
+}
+
+int git_reftable_iter_next(git_reftable_iter *iter)
+{
+	int error;
+
+	if (iter->done)
+		return GIT_ITEROVER;
+
+	if (iter->peeked) {
+		iter->peeked = 0;
+		return 0;
+	}
+
+	while (iter->pos >= iter->records_end) {
+		if (iter->next_block_off >= section_end(iter)) {
+			iter->done = 1;
+			return GIT_ITEROVER;
+		}
+
+		if ((error = load_block(iter, iter->next_block_off)) < 0)
+			return error;
+
+		if (iter->block_type != iter->section)
+			return reftable_error(iter->table);
+	}
+
+	return read_record(iter);
+}
+
+int git_reftable_log_key(git_buf *out, const char *name, uint64_t update_index)
+{
+	unsigned char inverted[8];
+
+	put_be64(inverted, UINT64_MAX - update_index);
+
+	git_buf_clear(out);
+	git_buf_put(out, name, strlen(name) + 1);
+	return git_buf_put(out, (const char *)inverted, sizeof(inverted));
+}
+
+/*
+ * Merging
+ */
+
+int git_reftable_merged_init(
+	git_reftable_merged *merged,
+	git_reftable **tables,
+	size_t count,
+	int section)
+{
+	size_t i;
+
+	memset(merged, 0, sizeof(git_reftable_merged));
+
+	if (!count)
+		return 0;
+
+	merged->iters = git__calloc(count, sizeof(git_reftable_iter));
+	GITERR_CHECK_ALLOC(merged->iters);
+
+	merged->valid = git__calloc(count, sizeof(int));
+	GITERR_CHECK_ALLOC(merged->valid);
+
+	for (i = 0; i < count; ++i)
+		git_reftable_iter_init(&merged->iters[i], tables[i], section);
+
+	merged->count = count;
+	return 0;
+}
+
+static int merged_advance(git_reftable_merged *merged, size_t i)
+{
+	int error = git_reftable_iter_next(&merged->iters[i]);
+
+	merged->valid[i] = !error;
+	return error == GIT_ITEROVER ? 0 : error;
+}
+
+int git_reftable_merged_seek(
+	git_reftable_merged *merged, const void *key, size_t key_len)
+{
+	size_t i;
+	int error;
+
+	merged->pending = 0;
+
+	for (i = 0; i < merged->count; ++i) {
+		if ((error = git_reftable_iter_seek(&merged->iters[i], key, key_len)) < 0 ||
+			(error = merged_advance(merged, i)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+int git_reftable_merged_next(git_reftable_iter **out, git_reftable_merged *merged)
+{
+	git_reftable_iter *iters = merged->iters;
+	size_t i, best = SIZE_MAX;
+	int cmp, error;
+
+	if (merged->pending) {
+		merged->pending = 0;
+
+		if ((error = merged_advance(merged, merged->current)) < 0)
+			return error;
+	}
+
+	for (i = 0; i < merged->count; ++i) {
+		if (!merged->valid[i])
+			continue;
+
+		if (best == SIZE_MAX) {
+			best = i;
+			continue;
+		}
+
+		cmp = key_cmp(iters[i].key.ptr, iters[i].key.size,
+			iters[best].key.ptr, iters[best].key.size);
+
+		if (cmp > 0)
+			continue;
+
+		/* The newer table shadows the record in the older one */
+		if (cmp == 0 && (error = merged_advance(merged, best)) < 0)
+			return error;
+
+		best = i;
+	}
+
+	if (best == SIZE_MAX)
+		return GIT_ITEROVER;
+
+	merged->current = best;
+	merged->pending = 1;
+
+	*out = &iters[best];
+	return 0;
+}
+
+void git_reftable_merged_free(git_reftable_merged *merged)
+{
+	size_t i;
+
+	for (i = 0; i < merged->count; ++i)
+		git_reftable_iter_free(&merged->iters[i]);
+
+	git__free(merged->iters);
+	git__free(merged->valid);
+	memset(merged, 0, sizeof(git_reftable_merged));
+}
+
+/*
+ * Writing
+ */
+
+typedef struct {
+	size_t key_off;
+	size_t key_len;
+	uint64_t position;
+} index_entry;
+
+struct git_reftable_writer {
+	git_reftable_write_cb write_cb;
+	void *payload;
+
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+	uint32_t block_size;
+	uint64_t offset;
+
+	int section;
+	int block_type;
+	size_t block_header;
+	git_buf block;
+	git_array_t(uint32_t) restarts;
+	size_t entries;
+	git_buf last_key;
+
+	git_buf key;
+	git_buf value;
+	git_buf record;
+	git_buf compressed;
+
+	git_array_t(index_entry) index;
+	git_buf index_keys;
+
+	uint64_t ref_index_position;
+	uint64_t log_position;
+	uint64_t log_index_position;
+};
+
+static void put_varint(git_buf *out, uint64_t val)
+{
+	unsigned char varint[10];
+	size_t pos = sizeof(varint) - 1;
+
+	varint[pos] = val & 127;
+
+	while (val >>= 7)
+		varint[--pos] = 128 | (--val & 127);
+
+	git_buf_put(out, (const char *)varint + pos, sizeof(varint) - pos);
+}
+
+static void put_string(git_buf *out, const char *str)
+{
+	size_t len = str ? strlen(str) : 0;
+
+	put_varint(out, len);
+	git_buf_put(out, str, len);
+}
+
+static void write_header(unsigned char *out, git_reftable_writer *writer)
+{
+	memcpy(out, REFTABLE_MAGIC, 4);
+	out[4] = REFTABLE_VERSION;
+	put_be24(out + 5, writer->block_size);
+	put_be64(out + 8, writer->min_update_index);
+	put_be64(out + 16, writer->max_update_index);
+}
+
+static int writer_emit(git_reftable_writer *writer, const void *data, size_t len)
+{
+	int error;
+
+	if ((error = writer->write_cb(data, len, writer->payload)) < 0)
+		return error;
+
+	writer->offset += len;
+	return 0;
+}
+
+int git_reftable_writer_new(
+	git_reftable_writer **out,
+	uint64_t min_update_index,
+	uint64_t max_update_index,
+	git_reftable_write_cb write_cb,
+	void *payload)
+{
+	git_reftable_writer *writer;
+
+	assert(out && write_cb && min_update_index <= max_update_index);
+
+	writer = git__calloc(1, sizeof(git_reftable_writer));
+	GITERR_CHECK_ALLOC(writer);
+
+	writer->write_cb = write_cb;
+	writer->payload = payload;
+	writer->min_update_index = min_update_index;
+	writer->max_update_index = max_update_index;
+	writer->block_size = GIT_REFTABLE_BLOCK_SIZE;
+	writer->section = GIT_REFTABLE_BLOCK_REF;
+
+	*out = writer;
+	return 0;
+}
+
+static int writer_start_block(git_reftable_writer *writer, int type)
+{
+	unsigned char header[REFTABLE_HEADER_SIZE];
+
+	git_buf_clear(&writer->block);
+	writer->block_header = 0;
+
+	write_header(header, writer);
+
+	/* The first block shares its space with the file header */
+	if (!writer->offset) {
+		git_buf_put(&writer->block, (const char *)header, sizeof(header));
+		writer->block_header = sizeof(header);
+	}
+
+	git_buf_putc(&writer->block, (char)type);
+	git_buf_put(&writer->block, "\0\0\0", 3);
+
+	git_array_clear(writer->restarts);
+	writer->block_type = type;
+	writer->entries = 0;
+
+	return git_buf_oom(&writer->block) ? -1 : 0;
+}
+
+static int writer_flush_block(git_reftable_writer *writer, bool pad)
+{
+	unsigned char raw[3];
+	index_entry *entry;
+	uint64_t position = writer->offset;
+	size_t i, len;
+	int error;
+
+	for (i = 0; i < git_array_size(writer->restarts); ++i) {
+		put_be24(raw, *git_array_get(writer->restarts, i));
+		git_buf_put(&writer->block, (const char *)raw, 3);
+	}
+
+	put_be16(raw, (uint32_t)git_array_size(writer->restarts));
+	git_buf_put(&writer->block, (const char *)raw, 2);
+
+	if (git_buf_oom(&writer->block))
+		return -1;
+
+	if ((len = git_buf_len(&writer->block)) > REFTABLE_MAX_BLOCK_LEN) {
+		giterr_set(GITERR_REFERENCE, "Reftable block is too large");
+		return -1;
+	}
+
+	put_be24((unsigned char *)writer->block.ptr + writer->block_header + 1, (uint32_t)len);
+
+	if (writer->block_type == GIT_REFTABLE_BLOCK_LOG) {
+		size_t plain = writer->block_header + REFTABLE_BLOCK_HEADER_SIZE;
+
+		git_buf_clear(&writer->compressed);
+
+		if ((error = git_zstream_deflatebuf(&writer->compressed,
+				writer->block.ptr + plain, len - plain, Z_DEFAULT_COMPRESSION)) < 0 ||
+			(error = writer_emit(writer, writer->block.ptr, plain)) < 0 ||
+			(error = writer_emit(writer, writer->compressed.ptr, writer->compressed.size)) < 0)
+			return error;
+	} else {
+		/* Full reference blocks are aligned; the last one needn't be */
+		if (pad && writer->block_type == GIT_REFTABLE_BLOCK_REF && len < writer->block_size) {
+			if (git_buf_grow(&writer->block, writer->block_size) < 0)
+				return -1;
+
+			memset(writer->block.ptr + len, 0, writer->block_size - len);
+			writer->block.size = writer->block_size;
+		}
+
+		if ((error = writer_emit(writer, writer->block.ptr, writer->block.size)) < 0)
+			return error;
+	}
+
+	entry = git_array_alloc(writer->index);
+	GITERR_CHECK_ALLOC(entry);
+
+	entry->key_off = writer->index_keys.size;
+	entry->key_len = writer->last_key.size;
+	entry->position = position;
+
+	writer->block_type = 0;
+	return git_buf_put(&writer->index_keys, writer->last_key.ptr, writer->last_key.size);
+}
+
+static int writer_encode(git_reftable_writer *writer, bool restart, unsigned int type)
+{
+	const git_buf *key = &writer->key, *last = &writer->last_key;
+	size_t prefix = 0;
+
+	if (!restart) {
+		while (prefix < last->size && prefix < key->size &&
+			last->ptr[prefix] == key->ptr[prefix])
+			prefix++;
+	}
+
+	git_buf_clear(&writer->record);
+	put_varint(&writer->record, prefix);
+	put_varint(&writer->record, ((uint64_t)(key->size - prefix) << 3) | type);
+	git_buf_put(&writer->record, key->ptr + prefix, key->size - prefix);
+	git_buf_put(&writer->record, writer->value.ptr, writer->value.size);
+
+	return git_buf_oom(&writer->record) ? -1 : 0;
+}
+
+/* Add the record made of `writer->key` and `writer->value` */
+static int writer_add(git_reftable_writer *writer, int block_type, unsigned int type)
+{
+	uint32_t *restart;
+	size_t needed;
+	bool is_restart;
+	int error;
+
+	if (git_buf_oom(&writer->key) || git_buf_oom(&writer->value))
+		return -1;
+
+	if (writer->block_type != block_type) {
+		if ((writer->block_type && (error = writer_flush_block(writer, false)) < 0) ||
+			(error = writer_start_block(writer, block_type)) < 0)
+			return error;
+	}
+
+	is_restart = (writer->entries % REFTABLE_RESTART_INTERVAL) == 0;
+
+	if ((error = writer_encode(writer, is_restart, type)) < 0)
+		return error;
+
+	needed = writer->block.size + writer->record.size + 2 +
+		3 * (git_array_size(writer->restarts) + is_restart);
+
+	/* A record which doesn't even fit into an empty block gets a larger one */
+	if (needed > writer->block_size && writer->entries) {
+		if ((error = writer_flush_block(writer, true)) < 0 ||
+			(error = writer_start_block(writer, block_type)) < 0 ||
+			(error = writer_encode(writer, true, type)) < 0)
+			return error;
+
+		is_restart = true;
+	}
+
+	if (is_restart) {
+		restart = git_array_alloc(writer->restarts);
+		GITERR_CHECK_ALLOC(restart);
+		*restart = (uint32_t)writer->block.size;
+	}
+
+	writer->entries++;
+
+	git_buf_put(&writer->block, writer->record.ptr, writer->record.size);
+	git_buf_set(&writer->last_key, writer->key.ptr, writer->key.size);
+
+	return (git_buf_oom(&writer->block) || git_buf_oom(&writer->last_key)) ? -1 : 0;
+}
+
+static int writer_check_order(git_reftable_writer *writer)
+{
+	if (writer->last_key.size &&
+		key_cmp(writer->last_key.ptr, writer->last_key.size,
+			writer->key.ptr, writer->key.size) >= 0) {
+		giterr_set(GITERR_REFERENCE, "Reftable records must be added in order");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Write out the last block of a section, and an index for it if it needs one */
+static int writer_finish_section(git_reftable_writer *writer, uint64_t *index_position)
+{
+	git_array_t(index_entry) level;
+	git_buf keys;
+	index_entry *entry;
+	size_t i;
+	int error = 0;
+
+	*index_position = 0;
+
+	if (writer->block_type && (error = writer_flush_block(writer, false)) < 0)
+		return error;
+
+	git_buf_clear(&writer->last_key);
+
+	if (git_array_size(writer->index) >= REFTABLE_INDEX_THRESHOLD) {
+		/* Index the index until it fits into a single block */
+		while (git_array_size(writer->index) > 1) {
+			memcpy(&level, &writer->index, sizeof(level));
+			memcpy(&keys, &writer->index_keys, sizeof(keys));
+			git_array_init(writer->index);
+			git_buf_init(&writer->index_keys, 0);
+
+			for (i = 0; !error && i < git_array_size(level); ++i) {
+				entry = git_array_get(level, i);
+
+				git_buf_set(&writer->key, keys.ptr + entry->key_off, entry->key_len);
+				git_buf_clear(&writer->value);
+				put_varint(&writer->value, entry->position);
+
+				error = writer_add(writer, GIT_REFTABLE_BLOCK_INDEX, 0);
+			}
+
+			if (!error)
+				error = writer_flush_block(writer, false);
+
+			git_array_clear(level);
+			git_buf_free(&keys);
+			git_buf_clear(&writer->last_key);
+
+			if (error < 0)
+				return error;
+		}
+
+		*index_position = git_array_get(writer->index, 0)->position;
+	}
+
+	git_array_clear(writer->index);
+	git_buf_clear(&writer->index_keys);
+
+	return 0;
+}
+
+int git_reftable_writer_add_ref(git_reftable_writer *writer, const git_reftable_ref *ref)
+{
+	int error;
+
+	assert(writer && ref);
+
+	if (writer->section != GIT_REFTABLE_BLOCK_REF) {
+		giterr_set(GITERR_REFERENCE, "Reftable references must come before the reflog");
+		return -1;
+	}
+
+	if (ref->update_index < writer->min_update_index ||
+		ref->update_index > writer->max_update_index) {
+		giterr_set(GITERR_REFERENCE,
+			"Update index of '%s' is out of the reftable's range", ref->name);
+		return -1;
+	}
+
+	git_buf_sets(&writer->key, ref->name);
+
+	if ((error = writer_check_order(writer)) < 0)
+		return error;
+
+	git_buf_clear(&writer->value);
+	put_varint(&writer->value, ref->update_index - writer->min_update_index);
+
+	switch (ref->type) {
+	case GIT_REFTABLE_REF_DELETION:
+		break;
+	case GIT_REFTABLE_REF_VAL2:
+		git_buf_put(&writer->value, (const char *)ref->id.id, GIT_OID_RAWSZ);
+		git_buf_put(&writer->value, (const char *)ref->peeled.id, GIT_OID_RAWSZ);
+		break;
+	case GIT_REFTABLE_REF_VAL1:
+		git_buf_put(&writer->value, (const char *)ref->id.id, GIT_OID_RAWSZ);
+		break;
+	case GIT_REFTABLE_REF_SYMREF:
+		put_string(&writer->value, ref->target);
+		break;
+	default:
+		giterr_set(GITERR_INVALID, "Invalid reftable reference type %u", ref->type);
+		return -1;
+	}
+
+	return writer_add(writer, GIT_REFTABLE_BLOCK_REF, ref->type);
+}
+
+int git_reftable_writer_add_log(git_reftable_writer *writer, const git_reftable_log *log)
+{
+	unsigned char offset[2];
+	int error;
+
+	assert(writer && log);
+
+	if (writer->section == GIT_REFTABLE_BLOCK_REF) {
+		if ((error = writer_finish_section(writer, &writer->ref_index_position)) < 0)
+			return error;
+
+		writer->section = GIT_REFTABLE_BLOCK_LOG;
+		writer->log_position = writer->offset;
+	}
+
+	if ((error = git_reftable_log_key(&writer->key, log->name, log->update_index)) < 0 ||
+		(error = writer_check_order(writer)) < 0)
+		return error;
+
+	git_buf_clear(&writer->value);
+
+	switch (log->type) {
+	case GIT_REFTABLE_LOG_DELETION:
+		break;
+	case GIT_REFTABLE_LOG_UPDATE:
+		git_buf_put(&writer->value, (const char *)log->old_id.id, GIT_OID_RAWSZ);
+		git_buf_put(&writer->value, (const char *)log->new_id.id, GIT_OID_RAWSZ);
+		put_string(&writer->value, log->committer_name);
+		put_string(&writer->value, log->committer_email);
+		put_varint(&writer->value, (uint64_t)log->time);
+		put_be16(offset, (uint32_t)(int16_t)log->offset);
+		git_buf_put(&writer->value, (const char *)offset, 2);
+		put_string(&writer->value, log->message);
+		break;
+	default:
+		giterr_set(GITERR_INVALID, "Invalid reftable reflog type %u", log->type);
+		return -1;
+	}
+
+	return writer_add(writer, GIT_REFTABLE_BLOCK_LOG, log->type);
+}
+
+int git_reftable_writer_finish(git_reftable_writer *writer)
+{
+	unsigned char footer[REFTABLE_FOOTER_SIZE];
+	int error;
+
+	if (writer->section == GIT_REFTABLE_BLOCK_REF)
+		error = writer_finish_section(writer, &writer->ref_index_position);
+	else
+		error = writer_finish_section(writer, &writer->log_index_position);
+
+	if (error < 0)
+		return error;
+
+	write_header(footer, writer);
+
+	/* A table without any records still has its header */
+	if (!writer->offset && (error = writer_emit(writer, footer, REFTABLE_HEADER_SIZE)) < 0)
+		return error;
+
+	put_be64(footer + 24, writer->ref_index_position);
+	put_be64(footer + 32, 0);
+	put_be64(footer + 40, 0);
+	put_be64(footer + 48, writer->log_position);
+	put_be64(footer + 56, writer->log_index_position);
+	put_be32(footer + 64, crc32(0L, footer, REFTABLE_FOOTER_SIZE - 4));
+
+	return writer_emit(writer, footer, sizeof(footer));
+}
+
+void git_reftable_writer_free(git_reftable_writer *writer)
+{
+	if (writer == NULL)
+		return;
+
+	git_buf_free(&writer->block);
+	git_array_clear(writer->restarts);
+	git_buf_free(&writer->last_key);
+	git_buf_free(&writer->key);
+	git_buf_free(&writer->value);
+	git_buf_free(&writer->record);
+	git_buf_free(&writer->compressed);
+	git_array_clear(writer->index);
+	git_buf_free(&writer->index_keys);
+	git__free(writer);
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_reftable_h__
+#define INCLUDE_reftable_h__
+
+#include "common.h"
+#include "buffer.h"
+#include "map.h"
+#include "git2/oid.h"
+
+/*
+ * Reading and writing single reftables.  A reftable is an immutable file
+ * holding references in sorted, prefix-compressed blocks, followed by
+ * the reflog entries in compressed blocks.  Each section can have an
+ * index on top of its blocks, so finding a key takes a handful of block
+ * reads no matter how many references the table holds.
+ */
+
+#define GIT_REFTABLE_BLOCK_SIZE 4096
+
+#define GIT_REFTABLE_BLOCK_REF 'r'
+#define GIT_REFTABLE_BLOCK_LOG 'g'
+#define GIT_REFTABLE_BLOCK_INDEX 'i'
+
+/* Value types of references */
+enum {
+	GIT_REFTABLE_REF_DELETION = 0,
+	GIT_REFTABLE_REF_VAL1 = 1,
+	GIT_REFTABLE_REF_VAL2 = 2,
+	GIT_REFTABLE_REF_SYMREF = 3,
+};
+
+/* Value types of reflog entries */
+enum {
+	GIT_REFTABLE_LOG_DELETION = 0,
+	GIT_REFTABLE_LOG_UPDATE = 1,
+};
+
+typedef struct {
+	const char *name;
+	uint64_t update_index;
+	unsigned int type;
+	git_oid id;
+	git_oid peeled; /* with GIT_REFTABLE_REF_VAL2 */
+	const char *target; /* with GIT_REFTABLE_REF_SYMREF */
+} git_reftable_ref;
+
+typedef struct {
+	const char *name;
+	uint64_t update_index;
+	unsigned int type;
+	git_oid old_id;
+	git_oid new_id;
+	const char *committer_name;
+	const char *committer_email;
+	git_time_t time;
+	int offset; /* in minutes */
+	const char *message;
+} git_reftable_log;
+
+typedef struct git_reftable git_reftable;
+
+/* Map the reftable at `path`, checking its header and footer */
+extern int git_reftable_open(git_reftable **out, const char *path);
+
+extern void git_reftable_incref(git_reftable *table);
+extern void git_reftable_free(git_reftable *table);
+
+extern const char *git_reftable_name(const git_reftable *table);
+extern size_t git_reftable_size(const git_reftable *table);
+extern uint64_t git_reftable_min_update_index(const git_reftable *table);
+extern uint64_t git_reftable_max_update_index(const git_reftable *table);
+
+/*
+ * An iterator over the references or the reflog entries of one table.
+ * `key` holds the raw key of the current record, which is the name for
+ * references, and the name, a NUL and the inverted update index for
+ * reflog entries, so that the newest entries of a reference come first.
+ */
+typedef struct {
+	git_reftable *table;
+	int section;
+
+	size_t block_off;
+	size_t next_block_off;
+	int block_type;
+	const unsigned char *block;
+	size_t block_len;
+	size_t records_end;
+	size_t pos;
+	git_buf inflated;
+
+	git_buf key;
+	git_buf strings;
+	union {
+		git_reftable_ref ref;
+		git_reftable_log log;
+	} record;
+	uint64_t child; /* the block an index record points to */
+
+	unsigned int done : 1,
+		peeked : 1;
+} git_reftable_iter;
+
+#define GIT_REFTABLE_ITER_INIT {0}
+
+extern void git_reftable_iter_init(
+	git_reftable_iter *iter, git_reftable *table, int section);
+
+/* Position the iterator before the first record whose key is >= `key` */
+extern int git_reftable_iter_seek(
+	git_reftable_iter *iter, const void *key, size_t key_len);
+
+/* Read the next record, or return GIT_ITEROVER */
+extern int git_reftable_iter_next(git_reftable_iter *iter);
+
+extern void git_reftable_iter_free(git_reftable_iter *iter);
+
+/* Build the key of a reflog entry into `out` */
+extern int git_reftable_log_key(
+	git_buf *out, const char *name, uint64_t update_index);
+
+/*
+ * Iterates over the same section of a stack of tables, given from the
+ * oldest to the newest.  Only the newest record for each key is
+ * returned, deletions included.
+ */
+typedef struct {
+	git_reftable_iter *iters;
+	size_t count;
+	int *valid;
+	size_t current;
+	unsigned int pending : 1;
+} git_reftable_merged;
+
+extern int git_reftable_merged_init(
+	git_reftable_merged *merged,
+	git_reftable **tables,
+	size_t count,
+	int section);
+
+extern int git_reftable_merged_seek(
+	git_reftable_merged *merged, const void *key, size_t key_len);
+
+/* Point `out` at the iterator holding the next record */
+extern int git_reftable_merged_next(
+	git_reftable_iter **out, git_reftable_merged *merged);
+
+extern void git_reftable_merged_free(git_reftable_merged *merged);
+
+/*
+ * Writes a table.  References must be added in the order of their
+ * names, then reflog entries in the order of their keys.
+ */
+typedef int (*git_reftable_write_cb)(const void *data, size_t len, void *payload);
+
+typedef struct git_reftable_writer git_reftable_writer;
+
+extern int git_reftable_writer_new(
+	git_reftable_writer **out,
+	uint64_t min_update_index,
+	uint64_t max_update_index,
+	git_reftable_write_cb write_cb,
+	void *payload);
+
+extern int git_reftable_writer_add_ref(
+	git_reftable_writer *writer, const git_reftable_ref *ref);
+
+extern int git_reftable_writer_add_log(
+	git_reftable_writer *writer, const git_reftable_log *log);
+
+/* Write out the indexes and the footer */
+extern int git_reftable_writer_finish(git_reftable_writer *writer);
+
+extern void git_reftable_writer_free(git_reftable_writer *writer);
+
+#endif
@@ -274,6 +274,15 @@ int git_remote_dup(git_remote **dest, git_remote *source)
 	remote->download_tags = source->download_tags;
 	remote->check_cert = source->check_cert;
 	remote->update_fetchhead = source->update_fetchhead;
+	remote->depth = source->depth;
+	remote->deepen_since = source->deepen_since;
+	remote->promisor = source->promisor;
+	remote->negotiation = source->negotiation;
+
+	if (source->filter != NULL) {
+		remote->filter = git__strdup(source->filter);
+		GITERR_CHECK_ALLOC(remote->filter);
+	}
 
 	if (git_vector_init(&remote->refs, 32, NULL) < 0 ||
 	    git_vector_init(&remote->refspecs, 2, NULL) < 0 ||
@@ -431,6 +440,33 @@ int git_remote_load(git_remote **out, git_repository *repo, const char *name)
 	if (download_tags_value(remote, config) < 0)
 		goto cleanup;
 
+	/* Fetches from a promisor remote keep using the clone's filter */
+	git_buf_clear(&buf);
+	git_buf_printf(&buf, "remote.%s.promisor", name);
+
+	if (git_buf_oom(&buf)) {
+		error = -1;
+		goto cleanup;
+	}
+
+	if ((error = git_config_get_bool(&remote->promisor, config, buf.ptr)) == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = 0;
+	} else if (error < 0)
+		goto cleanup;
+
+	val = NULL;
+	git_buf_clear(&buf);
+	git_buf_printf(&buf, "remote.%s.partialclonefilter", name);
+
+	if ((error = get_optional_config(&found, config, &buf, NULL, (void *)&val)) < 0)
+		goto cleanup;
+
+	if (found && strlen(val) > 0) {
+		remote->filter = git__strdup(val);
+		GITERR_CHECK_ALLOC(remote->filter);
+	}
+
 	/* Move the data over to where the matching functions can find them */
 	if (dwim_refspecs(&remote->active_refspecs, &remote->refspecs, &remote->refs) < 0)
 		goto cleanup;
@@ -538,6 +574,23 @@ int git_remote_save(const git_remote *remote)
 	if ((error = update_config_refspec(remote, cfg, GIT_DIRECTION_PUSH)) < 0)
 		goto cleanup;
 
+	if (remote->promisor) {
+		git_buf_clear(&buf);
+		if ((error = git_buf_printf(&buf, "remote.%s.promisor", remote->name)) < 0 ||
+			(error = git_config_set_bool(cfg, git_buf_cstr(&buf), true)) < 0)
+			goto cleanup;
+
+		git_repository__enable_lazy_fetch(remote->repo);
+	}
+
+	git_buf_clear(&buf);
+	if ((error = git_buf_printf(&buf, "remote.%s.partialclonefilter", remote->name)) < 0)
+		goto cleanup;
+
+	if ((error = git_config__update_entry(
+			cfg, git_buf_cstr(&buf), remote->filter, true, false)) < 0)
+		goto cleanup;
+
 	/*
 	 * What action to take depends on the old and new values. This
 	 * is describes by the table below. tagopt means whether the
@@ -1182,6 +1235,8 @@ void git_remote_free(git_remote *remote)
 	git__free(remote->url);
 	git__free(remote->pushurl);
 	git__free(remote->name);
+	git__free(remote->filter);
+	git__free(remote->received_pack);
 	git__free(remote);
 }
 
@@ -1293,6 +1348,81 @@ void git_remote_set_autotag(git_remote *remote, git_remote_autotag_option_t valu
 	remote->download_tags = value;
 }
 
+void git_remote_set_depth(git_remote *remote, int depth)
+{
+	assert(remote && depth >= 0);
+	remote->depth = depth;
+}
+
+void git_remote_set_deepen_since(git_remote *remote, git_time_t since)
+{
+	assert(remote);
+	remote->deepen_since = since;
+}
+
+void git_remote_set_negotiation(
+	git_remote *remote, git_remote_negotiation_t algorithm)
+{
+	assert(remote);
+	remote->negotiation = algorithm;
+}
+
+static bool is_number_with_suffix(const char *str, const char *suffixes)
+{
+	if (!git__isdigit(*str))
+		return false;
+
+	while (git__isdigit(*str))
+		str++;
+
+	return !*str || (strchr(suffixes, *str) && !str[1]);
+}
+
+static bool is_valid_filter(const char *filter)
+{
+	if (!strcmp(filter, "blob:none"))
+		return true;
+
+	if (!git__prefixcmp(filter, "blob:limit="))
+		return is_number_with_suffix(filter + strlen("blob:limit="), "kKmMgG");
+
+	if (!git__prefixcmp(filter, "tree:"))
+		return is_number_with_suffix(filter + strlen("tree:"), "");
+
+	return false;
+}
+
+int git_remote_set_filter(git_remote *remote, const char *filter)
+{
+	char *dup = NULL;
+
+	assert(remote);
+
+	if (filter) {
+		if (!is_valid_filter(filter)) {
+			giterr_set(GITERR_INVALID, "'%s' is not a valid object filter", filter);
+			return GIT_EINVALIDSPEC;
+		}
+
+		dup = git__strdup(filter);
+		GITERR_CHECK_ALLOC(dup);
+
+		/* The remote now has to provide what we left out */
+		remote->promisor = 1;
+	}
+
+	git__free(remote->filter);
+	remote->filter = dup;
+
+	return 0;
+}
+
+const char *git_remote_filter(const git_remote *remote)
+{
+	assert(remote);
+	return remote->filter;
+}
+
 static int rename_remote_config_section(
 	git_repository *repo,
 	const char *old_name,
@@ -1835,7 +1965,7 @@ static int remove_refs(git_repository *repo, const git_refspec *spec)
 	if ((error = git_vector_init(&refs, 8, NULL)) < 0)
 		return error;
 
-	if ((error = git_reference_iterator_new(&iter, repo)) < 0)
+	if ((error = git_reference_iterator_glob_new(&iter, repo, spec->dst)) < 0)
 		goto cleanup;
 
 	while ((error = git_reference_next_name(&name, iter)) == 0) {
@@ -30,6 +30,12 @@ struct git_remote {
 	git_remote_autotag_option_t download_tags;
 	int check_cert;
 	int update_fetchhead;
+	int depth;
+	git_time_t deepen_since;
+	char *filter;
+	int promisor;
+	git_remote_negotiation_t negotiation;
+	char *received_pack;
 };
 
 const char* git_remote__urlfordirection(struct git_remote *remote, int direction);
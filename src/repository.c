@@ -23,9 +23,12 @@
 #include "refs.h"
 #include "filter.h"
 #include "odb.h"
+#include "fetch.h"
 #include "remote.h"
 #include "merge.h"
 #include "diff_driver.h"
+#include "global.h"
+#include "strmap.h"
 
 #ifdef GIT_WIN32
 # include "win32/w32_util.h"
@@ -36,6 +39,10 @@
 #define GIT_BRANCH_MASTER "master"
 
 #define GIT_REPO_VERSION 0
+/* Version 1 adds extensions; refStorage and partialClone are known */
+#define GIT_REPO_MAX_VERSION 1
+
+GIT__USE_STRMAP;
 
 static void set_odb(git_repository *repo, git_odb *odb)
 {
@@ -45,6 +52,10 @@ static void set_odb(git_repository *repo, git_odb *odb)
 	}
 
 	if ((odb = git__swap(repo->_odb, odb)) != NULL) {
+		/* The database can outlive us, but our lazy fetching can't */
+		if (odb->missing_payload == repo)
+			git_odb_set_missing_cb(odb, NULL, NULL);
+
 		GIT_REFCOUNT_OWN(odb, NULL);
 		git_odb_free(odb);
 	}
@@ -105,6 +116,11 @@ void git_repository__cleanup(git_repository *repo)
 	set_refdb(repo, NULL);
 }
 
+void git_repository__reload_odb(git_repository *repo)
+{
+	set_odb(repo, NULL);
+}
+
 void git_repository_free(git_repository *repo)
 {
 	if (repo == NULL)
@@ -120,6 +136,7 @@ void git_repository_free(git_repository *repo)
 	git__free(repo->path_repository);
 	git__free(repo->workdir);
 	git__free(repo->namespace);
+	git__free(repo->pool_entry);
 
 	git__memzero(repo, sizeof(*repo));
 	git__free(repo);
@@ -307,6 +324,167 @@ static int read_gitfile(git_buf *path_out, const char *file_path)
 	return error;
 }
 
+/*
+ * Discovery cache
+ *
+ * Remembers where searching from a path led, so servers opening the same
+ * repositories over and over don't walk up the directories every time.
+ */
+
+typedef struct {
+	char *repo_path;
+	char *parent_path;
+	char key[GIT_FLEX_ARRAY];
+} discovery_entry;
+
+size_t git_repository__discovery_cache_size = 0;
+
+#ifdef GIT_THREADS
+static git_mutex discovery_lock;
+#endif
+static git_strmap *discovery_cache;
+
+static void discovery_cache_clear(void)
+{
+	discovery_entry *entry;
+
+	if (!discovery_cache)
+		return;
+
+	git_strmap_foreach_value(discovery_cache, entry, {
+		git__free(entry->repo_path);
+		git__free(entry->parent_path);
+		git__free(entry);
+	});
+
+	git_strmap_clear(discovery_cache);
+}
+
+static void git_repository_global_shutdown(void)
+{
+	discovery_cache_clear();
+	git_strmap_free(discovery_cache);
+	git_mutex_free(&discovery_lock);
+}
+
+int git_repository_global_init(void)
+{
+	if (git_mutex_init(&discovery_lock) != 0)
+		return -1;
+
+	git__on_shutdown(git_repository_global_shutdown);
+	return 0;
+}
+
+int git_repository__set_discovery_cache_size(size_t entries)
+{
+	if (git_mutex_lock(&discovery_lock) < 0) {
+		giterr_set(GITERR_OS, "Unable to lock the discovery cache");
+		return -1;
+	}
+
+	git_repository__discovery_cache_size = entries;
+	discovery_cache_clear();
+
+	git_mutex_unlock(&discovery_lock);
+	return 0;
+}
+
+/* The start path goes first with its length, as it may hold anything */
+static int discovery_key(
+	git_buf *key, const char *path, uint32_t flags, const char *ceiling_dirs)
+{
+	flags &= GIT_REPOSITORY_OPEN_NO_SEARCH |
+		GIT_REPOSITORY_OPEN_CROSS_FS | GIT_REPOSITORY_OPEN_BARE;
+
+	return git_buf_printf(key, "%x:%"PRIuZ":%s%s", flags, strlen(path), path,
+		ceiling_dirs ? ceiling_dirs : "");
+}
+
+static bool discovery_cache_lookup(
+	git_buf *repo_path, git_buf *parent_path, const char *key)
+{
+	discovery_entry *entry;
+	khiter_t pos;
+	bool found = false;
+
+	if (!git_repository__discovery_cache_size ||
+		git_mutex_lock(&discovery_lock) < 0)
+		return false;
+
+	if (discovery_cache) {
+		pos = git_strmap_lookup_index(discovery_cache, key);
+
+		if (git_strmap_valid_index(discovery_cache, pos)) {
+			entry = git_strmap_value_at(discovery_cache, pos);
+
+			found = !git_buf_sets(repo_path, entry->repo_path) &&
+				!git_buf_sets(parent_path, entry->parent_path);
+		}
+	}
+
+	git_mutex_unlock(&discovery_lock);
+
+	/* The repository must still be there */
+	if (found && !valid_repository_path(repo_path)) {
+		git_buf_clear(repo_path);
+		git_buf_clear(parent_path);
+		found = false;
+	}
+
+	return found;
+}
+
+static void discovery_cache_store(
+	const char *key, const char *repo_path, const char *parent_path)
+{
+	discovery_entry *entry, *old;
+	size_t key_len = strlen(key);
+	int error;
+
+	if (!git_repository__discovery_cache_size)
+		return;
+
+	if ((entry = git__calloc(1, sizeof(discovery_entry) + key_len + 1)) == NULL ||
+		(entry->repo_path = git__strdup(repo_path)) == NULL ||
+		(entry->parent_path = git__strdup(parent_path)) == NULL)
+		goto fail;
+
+	memcpy(entry->key, key, key_len);
+
+	if (git_mutex_lock(&discovery_lock) < 0)
+		goto fail;
+
+	if (!discovery_cache && git_strmap_alloc(&discovery_cache) < 0) {
+		git_mutex_unlock(&discovery_lock);
+		goto fail;
+	}
+
+	if (git_strmap_num_entries(discovery_cache) >= git_repository__discovery_cache_size)
+		discovery_cache_clear();
+
+	old = NULL;
+	git_strmap_insert2(discovery_cache, entry->key, entry, old, error);
+	git_mutex_unlock(&discovery_lock);
+
+	if (old) {
+		git__free(old->repo_path);
+		git__free(old->parent_path);
+		git__free(old);
+	}
+
+	if (error >= 0)
+		return;
+
+fail:
+	if (entry) {
+		git__free(entry->repo_path);
+		git__free(entry->parent_path);
+		git__free(entry);
+	}
+	giterr_clear();
+}
+
 static int find_repo(
 	git_buf *repo_path,
 	git_buf *parent_path,
@@ -315,7 +493,7 @@ static int find_repo(
 	const char *ceiling_dirs)
 {
 	int error;
-	git_buf path = GIT_BUF_INIT;
+	git_buf path = GIT_BUF_INIT, parent = GIT_BUF_INIT, key = GIT_BUF_INIT;
 	struct stat st;
 	dev_t initial_device = 0;
 	bool try_with_dot_git = ((flags & GIT_REPOSITORY_OPEN_BARE) != 0);
@@ -326,6 +504,11 @@ static int find_repo(
 	if ((error = git_path_prettify(&path, start_path, NULL)) < 0)
 		return error;
 
+	if (git_repository__discovery_cache_size &&
+		!discovery_key(&key, path.ptr, flags, ceiling_dirs) &&
+		discovery_cache_lookup(repo_path, &parent, key.ptr))
+		goto done;
+
 	ceiling_offset = find_ceiling_dir_offset(path.ptr, ceiling_dirs);
 
 	if (!try_with_dot_git &&
@@ -381,17 +564,23 @@ static int find_repo(
 		try_with_dot_git = !try_with_dot_git;
 	}
 
-	if (!error && parent_path && !(flags & GIT_REPOSITORY_OPEN_BARE)) {
-		if (!git_buf_len(repo_path))
-			git_buf_clear(parent_path);
-		else {
-			git_path_dirname_r(parent_path, path.ptr);
-			git_path_to_dir(parent_path);
-		}
-		if (git_buf_oom(parent_path))
-			return -1;
+	if (!error && git_buf_len(repo_path) && !(flags & GIT_REPOSITORY_OPEN_BARE)) {
+		git_path_dirname_r(&parent, path.ptr);
+		git_path_to_dir(&parent);
+
+		if (git_buf_oom(&parent))
+			error = -1;
 	}
 
+	if (!error && git_buf_len(repo_path) && git_buf_len(&key))
+		discovery_cache_store(key.ptr, repo_path->ptr, parent.ptr);
+
+done:
+	if (!error && parent_path && !(flags & GIT_REPOSITORY_OPEN_BARE))
+		git_buf_swap(parent_path, &parent);
+
+	git_buf_free(&parent);
+	git_buf_free(&key);
 	git_buf_free(&path);
 
 	if (!git_buf_len(repo_path) && !error) {
@@ -434,6 +623,51 @@ int git_repository_open_bare(
 	return 0;
 }
 
+/* Open `gitdir` as it is, without searching */
+static int find_gitdir(git_buf *repo_path, const char *gitdir)
+{
+	int error;
+
+	if ((error = git_path_prettify_dir(repo_path, gitdir, NULL)) < 0)
+		return error;
+
+	if (!valid_repository_path(repo_path)) {
+		giterr_set(GITERR_REPOSITORY, "Path is not a repository: %s", gitdir);
+		return GIT_ENOTFOUND;
+	}
+
+	return 0;
+}
+
+/*
+ * Work out whether a repository opened with GIT_REPOSITORY_OPEN_DEFER_CONFIG
+ * is bare and where its working directory is.  When the config can't be
+ * read, it is left bare so nothing goes looking in a wrong directory.
+ */
+static void load_deferred_workdir(git_repository *repo)
+{
+	git_config *config = NULL;
+	git_buf parent = GIT_BUF_INIT;
+
+	if (!repo->workdir_deferred)
+		return;
+
+	repo->workdir_deferred = 0;
+
+	if (repo->workdir) {
+		git_buf_attach(&parent, repo->workdir, 0);
+		repo->workdir = NULL;
+	}
+
+	if (git_repository_config_snapshot(&config, repo) < 0 ||
+		load_config_data(repo, config) < 0 ||
+		load_workdir(repo, config, &parent) < 0)
+		repo->is_bare = 1;
+
+	git_config_free(config);
+	git_buf_free(&parent);
+}
+
 int git_repository_open_ext(
 	git_repository **repo_ptr,
 	const char *start_path,
@@ -447,9 +681,16 @@ int git_repository_open_ext(
 	if (repo_ptr)
 		*repo_ptr = NULL;
 
-	error = find_repo(&path, &parent, start_path, flags, ceiling_dirs);
-	if (error < 0 || !repo_ptr)
+	if ((flags & GIT_REPOSITORY_OPEN_GITDIR) != 0)
+		error = find_gitdir(&path, start_path);
+	else
+		error = find_repo(&path, &parent, start_path, flags, ceiling_dirs);
+
+	if (error < 0 || !repo_ptr) {
+		git_buf_free(&path);
+		git_buf_free(&parent);
 		return error;
+	}
 
 	repo = repository_alloc();
 	GITERR_CHECK_ALLOC(repo);
@@ -459,7 +700,12 @@ int git_repository_open_ext(
 
 	if ((flags & GIT_REPOSITORY_OPEN_BARE) != 0)
 		repo->is_bare = 1;
-	else {
+	else if ((flags & GIT_REPOSITORY_OPEN_DEFER_CONFIG) != 0) {
+		repo->workdir_deferred = 1;
+
+		if (git_buf_len(&parent))
+			repo->workdir = git_buf_detach(&parent);
+	} else {
 		git_config *config = NULL;
 
 		if ((error = git_repository_config_snapshot(&config, repo)) < 0 ||
@@ -642,6 +888,28 @@ void git_repository_set_config(git_repository *repo, git_config *config)
 	set_config(repo, config);
 }
 
+/*
+ * Only a partial clone is missing objects on purpose; anybody else
+ * would just pay for a config lookup on every miss.
+ */
+static void enable_lazy_fetch(git_odb *odb, git_repository *repo)
+{
+	git_buf name = GIT_BUF_INIT;
+
+	if (git_fetch__promisor_remote(&name, repo) == 0)
+		git_odb_set_missing_cb(odb, git_fetch__missing_objects, repo);
+	else
+		giterr_clear();
+
+	git_buf_free(&name);
+}
+
+void git_repository__enable_lazy_fetch(git_repository *repo)
+{
+	if (repo->_odb != NULL && repo->_odb->missing_cb == NULL)
+		enable_lazy_fetch(repo->_odb, repo);
+}
+
 int git_repository_odb__weakptr(git_odb **out, git_repository *repo)
 {
 	int error = 0;
@@ -657,6 +925,7 @@ int git_repository_odb__weakptr(git_odb **out, git_repository *repo)
 		error = git_odb_open(&odb, odb_path.ptr);
 		if (!error) {
 			GIT_REFCOUNT_OWN(odb, repo);
+			enable_lazy_fetch(odb, repo);
 
 			odb = git__compare_and_swap(&repo->_odb, NULL, odb);
 			if (odb != NULL) {
@@ -791,20 +1060,43 @@ const char *git_repository_get_namespace(git_repository *repo)
 	return repo->namespace;
 }
 
-static int check_repositoryformatversion(git_config *config)
+static int check_extension_cb(const git_config_entry *entry, void *payload)
+{
+	const char *name = entry->name + strlen("extensions.");
+
+	GIT_UNUSED(payload);
+
+	if (!strcasecmp(name, "refstorage") || !strcasecmp(name, "partialclone"))
+		return 0;
+
+	giterr_set(GITERR_REPOSITORY,
+		"Unsupported repository extension '%s'", name);
+	return -1;
+}
+
+static int check_repositoryformatversion(int *out, git_config *config)
 {
 	int version;
 
 	if (git_config_get_int32(&version, config, "core.repositoryformatversion") < 0)
 		return -1;
 
-	if (GIT_REPO_VERSION < version) {
+	if (GIT_REPO_MAX_VERSION < version) {
 		giterr_set(GITERR_REPOSITORY,
 			"Unsupported repository version %d. Only versions up to %d are supported.",
-			version, GIT_REPO_VERSION);
+			version, GIT_REPO_MAX_VERSION);
 		return -1;
 	}
 
+	/* Version 0 ignores extensions; version 1 must know all of them */
+	if (version > 0 && git_config_foreach_match(
+			config, "^extensions\\.", check_extension_cb, NULL) < 0)
+		return -1;
+
+	/* reinitializing doesn't take away the extensions in use */
+	if (version > *out)
+		*out = version;
+
 	return 0;
 }
 
@@ -998,11 +1290,12 @@ static int repo_init_config(
 	git_config *config = NULL;
 	bool is_bare = ((flags & GIT_REPOSITORY_INIT_BARE) != 0);
 	bool is_reinit = ((flags & GIT_REPOSITORY_INIT__IS_REINIT) != 0);
+	int version = GIT_REPO_VERSION;
 
 	if ((error = repo_local_config(&config, &cfg_path, NULL, repo_dir)) < 0)
 		goto cleanup;
 
-	if (is_reinit && (error = check_repositoryformatversion(config)) < 0)
+	if (is_reinit && (error = check_repositoryformatversion(&version, config)) < 0)
 		goto cleanup;
 
 #define SET_REPO_CONFIG(TYPE, NAME, VAL) do { \
@@ -1010,7 +1303,7 @@ static int repo_init_config(
 		goto cleanup; } while (0)
 
 	SET_REPO_CONFIG(bool, "core.bare", is_bare);
-	SET_REPO_CONFIG(int32, "core.repositoryformatversion", GIT_REPO_VERSION);
+	SET_REPO_CONFIG(int32, "core.repositoryformatversion", version);
 
 	if ((error = repo_init_fs_configs(
 			config, cfg_path.ptr, repo_dir, work_dir, !is_reinit)) < 0)
@@ -1072,7 +1365,7 @@ int git_repository_reinit_filesystem(git_repository *repo, int recurse)
 
 	git_repository__cvar_cache_clear(repo);
 
-	if (!repo->is_bare && recurse)
+	if (!git_repository_is_bare(repo) && recurse)
 		(void)git_submodule_foreach(repo, repo_reinit_submodule_fs, NULL);
 
 	return error;
@@ -1609,6 +1902,8 @@ const char *git_repository_workdir(git_repository *repo)
 {
 	assert(repo);
 
+	load_deferred_workdir(repo);
+
 	if (repo->is_bare)
 		return NULL;
 
@@ -1623,6 +1918,8 @@ int git_repository_set_workdir(
 
 	assert(repo && workdir);
 
+	load_deferred_workdir(repo);
+
 	if (git_path_prettify_dir(&path, workdir, NULL) < 0)
 		return -1;
 
@@ -1662,6 +1959,9 @@ int git_repository_set_workdir(
 int git_repository_is_bare(git_repository *repo)
 {
 	assert(repo);
+
+	load_deferred_workdir(repo);
+
 	return repo->is_bare;
 }
 
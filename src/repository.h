@@ -40,6 +40,7 @@ typedef enum {
 	GIT_CVAR_PRECOMPOSE,    /* core.precomposeunicode */
 	GIT_CVAR_SAFE_CRLF,		/* core.safecrlf */
 	GIT_CVAR_LOGALLREFUPDATES, /* core.logallrefupdates */
+	GIT_CVAR_LOGMAXENTRIES, /* core.logmaxentries */
 	GIT_CVAR_CACHE_MAX
 } git_cvar_cached;
 
@@ -96,6 +97,8 @@ typedef enum {
 	/* core.logallrefupdates */
 	GIT_LOGALLREFUPDATES_UNSET = 2,
 	GIT_LOGALLREFUPDATES_DEFAULT = GIT_LOGALLREFUPDATES_UNSET,
+	/* core.logmaxentries: unlimited by default */
+	GIT_LOGMAXENTRIES_DEFAULT = 0,
 } git_cvar_value;
 
 /* internal repository init flags */
@@ -122,8 +125,18 @@ struct git_repository {
 	char *namespace;
 
 	unsigned is_bare:1;
+
+	/*
+	 * Opened with GIT_REPOSITORY_OPEN_DEFER_CONFIG: `is_bare` and
+	 * `workdir` are not known yet, and `workdir` holds the directory
+	 * the repository was found in until they are.
+	 */
+	unsigned workdir_deferred:1;
 	unsigned int lru_counter;
 
+	/* Set when handed out by a git_repository_pool; freed with the repo */
+	struct git_repository_pool_entry *pool_entry;
+
 	git_cvar_value cvar_cache[GIT_CVAR_CACHE_MAX];
 };
 
@@ -146,6 +159,14 @@ int git_repository_odb__weakptr(git_odb **out, git_repository *repo);
 int git_repository_refdb__weakptr(git_refdb **out, git_repository *repo);
 int git_repository_index__weakptr(git_index **out, git_repository *repo);
 
+/*
+ * Results of searching for repositories, remembered by the process when
+ * GIT_OPT_SET_DISCOVERY_CACHE_SIZE allows.
+ */
+extern size_t git_repository__discovery_cache_size;
+extern int git_repository__set_discovery_cache_size(size_t entries);
+extern int git_repository_global_init(void);
+
 /*
  * CVAR cache
  *
@@ -155,6 +176,12 @@ int git_repository_index__weakptr(git_index **out, git_repository *repo);
 int git_repository__cvar(int *out, git_repository *repo, git_cvar_cached cvar);
 void git_repository__cvar_cache_clear(git_repository *repo);
 
+/* Drop the loaded odb, so it is loaded again from disk on next use */
+void git_repository__reload_odb(git_repository *repo);
+
+/* Start fetching missing objects once a promisor remote is configured */
+void git_repository__enable_lazy_fetch(git_repository *repo);
+
 GIT_INLINE(int) git_repository__ensure_not_bare(
 	git_repository *repo,
 	const char *operation_name)
@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "repository.h"
+#include "config.h"
+#include "odb.h"
+#include "fileops.h"
+#include "strmap.h"
+
+GIT__USE_STRMAP;
+
+typedef struct git_repository_pool_entry pool_entry;
+
+struct git_repository_pool_entry {
+	git_repository_pool *pool;
+	git_repository *repo;
+	git_futils_filestamp config_stamp;
+	git_futils_filestamp packs_stamp;
+
+	/* idle entries, most recently released first */
+	pool_entry *lru_prev, *lru_next;
+	/* the next idle entry opened from the same path */
+	pool_entry *next;
+
+	char path[GIT_FLEX_ARRAY];
+};
+
+struct git_repository_pool {
+	git_mutex lock;
+	git_strmap *idle;
+	pool_entry *lru_head, *lru_tail;
+	size_t idle_count, max_idle;
+};
+
+/* The entry belongs to its repository and goes away with it */
+static void pool_entry_free(pool_entry *entry)
+{
+	if (entry)
+		git_repository_free(entry->repo);
+}
+
+static int pool_entry_stamp(
+	git_futils_filestamp *stamp, git_repository *repo, const char *name)
+{
+	git_buf path = GIT_BUF_INIT;
+	int error;
+
+	if (git_buf_joinpath(&path, repo->path_repository, name) < 0)
+		return -1;
+
+	/* A missing file gets a stamp of its own, all zeroes */
+	if ((error = git_futils_filestamp_check(stamp, path.ptr)) == GIT_ENOTFOUND) {
+		error = (stamp->mtime || stamp->size || stamp->ino) ? 1 : 0;
+		git_futils_filestamp_set(stamp, NULL);
+	}
+
+	git_buf_free(&path);
+	return error;
+}
+
+/*
+ * Bring an idle repository up to date with what is on disk.  Files that
+ * are already checked on every use (the refs, the index) are left to
+ * their own stamps; here we only drop what would otherwise be held
+ * forever: the list of packs, which the odb never shrinks on its own.
+ *
+ * A changed config may change what the repository is (bare or not,
+ * where its workdir is, which refdb it uses), so rather than reload
+ * it we return 1 to have the repository opened anew.
+ */
+static int pool_entry_refresh(pool_entry *entry)
+{
+	git_repository *repo = entry->repo;
+	int error;
+
+	if ((error = pool_entry_stamp(&entry->config_stamp, repo, GIT_CONFIG_FILENAME_INREPO)) != 0)
+		return error;
+
+	if ((error = pool_entry_stamp(&entry->packs_stamp, repo, GIT_OBJECTS_DIR "pack")) < 0)
+		return error;
+
+	if (error > 0)
+		git_repository__reload_odb(repo);
+
+	return 0;
+}
+
+static void lru_unlink(git_repository_pool *pool, pool_entry *entry)
+{
+	if (entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		pool->lru_head = entry->lru_next;
+
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		pool->lru_tail = entry->lru_prev;
+
+	entry->lru_prev = entry->lru_next = NULL;
+	pool->idle_count--;
+}
+
+static void lru_push(git_repository_pool *pool, pool_entry *entry)
+{
+	entry->lru_prev = NULL;
+	entry->lru_next = pool->lru_head;
+
+	if (pool->lru_head)
+		pool->lru_head->lru_prev = entry;
+	else
+		pool->lru_tail = entry;
+
+	pool->lru_head = entry;
+	pool->idle_count++;
+}
+
+/* Take `entry` out of the idle set; the pool must be locked */
+static void idle_remove(git_repository_pool *pool, pool_entry *entry)
+{
+	khiter_t pos = git_strmap_lookup_index(pool->idle, entry->path);
+	pool_entry *head, *scan;
+
+	assert(git_strmap_valid_index(pool->idle, pos));
+
+	head = git_strmap_value_at(pool->idle, pos);
+	if (head == entry)
+		head = entry->next;
+	else {
+		for (scan = head; scan->next != entry; scan = scan->next)
+			/* find the one before */;
+		scan->next = entry->next;
+	}
+	entry->next = NULL;
+
+	if (head == NULL)
+		git_strmap_delete_at(pool->idle, pos);
+	else {
+		git_strmap_key(pool->idle, pos) = head->path;
+		git_strmap_set_value_at(pool->idle, pos, head);
+	}
+
+	lru_unlink(pool, entry);
+}
+
+/* Add `entry` to the idle set; the pool must be locked */
+static int idle_insert(git_repository_pool *pool, pool_entry *entry)
+{
+	khiter_t pos = git_strmap_lookup_index(pool->idle, entry->path);
+	int error;
+
+	if (git_strmap_valid_index(pool->idle, pos)) {
+		entry->next = git_strmap_value_at(pool->idle, pos);
+		git_strmap_key(pool->idle, pos) = entry->path;
+		git_strmap_set_value_at(pool->idle, pos, entry);
+	} else {
+		git_strmap_insert(pool->idle, entry->path, entry, error);
+		if (error < 0)
+			return -1;
+	}
+
+	lru_push(pool, entry);
+	return 0;
+}
+
+int git_repository_pool_new(git_repository_pool **out, size_t max_idle)
+{
+	git_repository_pool *pool;
+
+	assert(out);
+
+	pool = git__calloc(1, sizeof(git_repository_pool));
+	GITERR_CHECK_ALLOC(pool);
+
+	if (git_mutex_init(&pool->lock) < 0) {
+		giterr_set(GITERR_OS, "Failed to initialize repository pool lock");
+		git__free(pool);
+		return -1;
+	}
+
+	if (git_strmap_alloc(&pool->idle) < 0) {
+		git_mutex_free(&pool->lock);
+		git__free(pool);
+		return -1;
+	}
+
+	pool->max_idle = max_idle;
+
+	*out = pool;
+	return 0;
+}
+
+int git_repository_pool_open(
+	git_repository **out, git_repository_pool *pool, const char *path)
+{
+	pool_entry *entry = NULL;
+	khiter_t pos;
+	size_t path_len;
+	int error;
+
+	assert(out && pool && path);
+
+	*out = NULL;
+
+	if (git_mutex_lock(&pool->lock) < 0) {
+		giterr_set(GITERR_OS, "Unable to lock repository pool");
+		return -1;
+	}
+
+	pos = git_strmap_lookup_index(pool->idle, path);
+	if (git_strmap_valid_index(pool->idle, pos)) {
+		entry = git_strmap_value_at(pool->idle, pos);
+		idle_remove(pool, entry);
+	}
+
+	git_mutex_unlock(&pool->lock);
+
+	if (entry && pool_entry_refresh(entry) != 0) {
+		pool_entry_free(entry);
+		entry = NULL;
+	}
+
+	if (!entry) {
+		path_len = strlen(path);
+
+		entry = git__calloc(1, sizeof(pool_entry) + path_len + 1);
+		GITERR_CHECK_ALLOC(entry);
+		memcpy(entry->path, path, path_len);
+
+		if ((error = git_repository_open_ext(&entry->repo,
+				path, GIT_REPOSITORY_OPEN_NO_SEARCH, NULL)) < 0) {
+			git__free(entry);
+			return error;
+		}
+
+		entry->pool = pool;
+		entry->repo->pool_entry = entry;
+
+		/*
+		 * Should a stamp fail, it is left out of date and the next
+		 * refresh reopens; the repository is usable either way.
+		 */
+		pool_entry_stamp(&entry->config_stamp,
+			entry->repo, GIT_CONFIG_FILENAME_INREPO);
+		pool_entry_stamp(&entry->packs_stamp,
+			entry->repo, GIT_OBJECTS_DIR "pack");
+	}
+
+	*out = entry->repo;
+	return 0;
+}
+
+void git_repository_pool_release(git_repository_pool *pool, git_repository *repo)
+{
+	pool_entry *entry, *evict = NULL;
+
+	if (repo == NULL)
+		return;
+
+	assert(pool);
+
+	if ((entry = repo->pool_entry) == NULL) {
+		git_repository_free(repo);
+		return;
+	}
+
+	assert(entry->pool == pool);
+
+	/* don't let one tenant's namespace leak into the next */
+	git_repository_set_namespace(repo, NULL);
+
+	if (pool->max_idle == 0 || git_mutex_lock(&pool->lock) < 0) {
+		pool_entry_free(entry);
+		return;
+	}
+
+	if (idle_insert(pool, entry) < 0)
+		evict = entry;
+	else if (pool->idle_count > pool->max_idle)
+		idle_remove(pool, (evict = pool->lru_tail));
+
+	git_mutex_unlock(&pool->lock);
+
+	pool_entry_free(evict);
+}
+
+void git_repository_pool_clear(git_repository_pool *pool)
+{
+	pool_entry *entry, *next;
+
+	assert(pool);
+
+	if (git_mutex_lock(&pool->lock) < 0)
+		return;
+
+	entry = pool->lru_head;
+
+	git_strmap_clear(pool->idle);
+	pool->lru_head = pool->lru_tail = NULL;
+	pool->idle_count = 0;
+
+	git_mutex_unlock(&pool->lock);
+
+	for (; entry; entry = next) {
+		next = entry->lru_next;
+		pool_entry_free(entry);
+	}
+}
+
+void git_repository_pool_free(git_repository_pool *pool)
+{
+	if (pool == NULL)
+		return;
+
+	git_repository_pool_clear(pool);
+
+	git_strmap_free(pool->idle);
+	git_mutex_free(&pool->lock);
+	git__free(pool);
+}
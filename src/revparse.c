@@ -210,7 +210,15 @@ static int retrieve_oid_from_reflog(git_oid *oid, git_reference *ref, size_t ide
 	const git_reflog_entry *entry;
 	bool search_by_pos = (identifier <= 100000000);
 
-	if (git_reflog_read(&reflog, git_reference_owner(ref), git_reference_name(ref)) < 0)
+	/* Looking up by position only needs the newest entries */
+	if (search_by_pos)
+		error = git_reflog_read_recent(&reflog,
+			git_reference_owner(ref), git_reference_name(ref), identifier + 1);
+	else
+		error = git_reflog_read(&reflog,
+			git_reference_owner(ref), git_reference_name(ref));
+
+	if (error < 0)
 		return -1;
 
 	numentries = git_reflog_entrycount(reflog);
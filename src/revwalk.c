@@ -453,7 +453,8 @@ int git_revwalk_new(git_revwalk **revwalk_out, git_repository *repo)
 
 	walk->repo = repo;
 
-	if (git_repository_odb(&walk->odb, repo) < 0) {
+	if (git_repository_odb(&walk->odb, repo) < 0 ||
+		git_shallow__roots(&walk->shallow_roots, repo) < 0) {
 		git_revwalk_free(walk);
 		return -1;
 	}
@@ -474,6 +475,7 @@ void git_revwalk_free(git_revwalk *walk)
 	git_pool_clear(&walk->commit_pool);
 	git_pqueue_free(&walk->iterator_time);
 	git_vector_free(&walk->twos);
+	git_array_clear(walk->shallow_roots);
 	git__free(walk);
 }
 
@@ -13,6 +13,7 @@
 #include "pqueue.h"
 #include "pool.h"
 #include "vector.h"
+#include "shallow.h"
 
 GIT__USE_OIDMAP;
 
@@ -42,6 +43,9 @@ struct git_revwalk {
 	/* hide callback */
 	git_revwalk_hide_cb hide_cb;
 	void *hide_cb_payload;
+
+	/* commits of a shallow repository whose parents we don't have */
+	git_shallow_array shallow_roots;
 };
 
 git_commit_list_node *git_revwalk__commit_lookup(git_revwalk *walk, const git_oid *oid);
@@ -9,6 +9,10 @@
 #include "common.h"
 #include "sysdir.h"
 #include "cache.h"
+#include "zstream.h"
+#include "netops.h"
+#include "repository.h"
+#include "indexer.h"
 
 void git_libgit2_version(int *major, int *minor, int *rev)
 {
@@ -35,6 +39,8 @@ int git_libgit2_features()
 /* Declarations for tuneable settings */
 extern size_t git_mwindow__window_size;
 extern size_t git_mwindow__mapped_limit;
+extern size_t git_mwindow__file_limit;
+extern int git_packfile__map_whole;
 
 static int config_level_to_sysdir(int config_level)
 {
@@ -52,6 +58,17 @@ static int config_level_to_sysdir(int config_level)
 	return val;
 }
 
+static int set_compression_level(int *out, int level)
+{
+	if (level < -1 || level > 9) {
+		giterr_set(GITERR_INVALID, "Invalid compression level %d", level);
+		return -1;
+	}
+
+	*out = level;
+	return 0;
+}
+
 int git_libgit2_opts(int key, ...)
 {
 	int error = 0;
@@ -76,6 +93,29 @@ int git_libgit2_opts(int key, ...)
 		*(va_arg(ap, size_t *)) = git_mwindow__mapped_limit;
 		break;
 
+	case GIT_OPT_SET_MWINDOW_FILE_LIMIT:
+		git_mwindow__file_limit = va_arg(ap, size_t);
+		break;
+
+	case GIT_OPT_GET_MWINDOW_FILE_LIMIT:
+		*(va_arg(ap, size_t *)) = git_mwindow__file_limit;
+		break;
+
+	case GIT_OPT_ENABLE_WHOLE_PACK_MMAP:
+		{
+			int enabled = (va_arg(ap, int) != 0);
+
+			if (enabled && sizeof(void *) < 8) {
+				giterr_set(GITERR_INVALID,
+					"Mapping whole packs needs a 64-bit address space");
+				error = -1;
+				break;
+			}
+
+			git_packfile__map_whole = enabled;
+			break;
+		}
+
 	case GIT_OPT_GET_SEARCH_PATH:
 		if ((error = config_level_to_sysdir(va_arg(ap, int))) >= 0) {
 			git_buf *out = va_arg(ap, git_buf *);
@@ -131,6 +171,59 @@ int git_libgit2_opts(int key, ...)
 	case GIT_OPT_SET_TEMPLATE_PATH:
 		error = git_sysdir_set(GIT_SYSDIR_TEMPLATE, va_arg(ap, const char *));
 		break;
+
+	case GIT_OPT_GET_LOOSE_COMPRESSION_LEVEL:
+		*(va_arg(ap, int *)) = git_zstream__loose_level;
+		break;
+
+	case GIT_OPT_SET_LOOSE_COMPRESSION_LEVEL:
+		error = set_compression_level(
+			&git_zstream__loose_level, va_arg(ap, int));
+		break;
+
+	case GIT_OPT_GET_PACK_COMPRESSION_LEVEL:
+		*(va_arg(ap, int *)) = git_zstream__pack_level;
+		break;
+
+	case GIT_OPT_SET_PACK_COMPRESSION_LEVEL:
+		error = set_compression_level(
+			&git_zstream__pack_level, va_arg(ap, int));
+		break;
+
+	case GIT_OPT_GET_CONNECTION_POOL_SIZE:
+		*(va_arg(ap, size_t *)) = gitno__pool_size;
+		break;
+
+	case GIT_OPT_SET_CONNECTION_POOL_SIZE:
+		gitno__pool_size = va_arg(ap, size_t);
+		break;
+
+	case GIT_OPT_GET_TRANSFER_PROGRESS_INTERVAL:
+		*(va_arg(ap, int *)) = git_indexer__progress_interval;
+		break;
+
+	case GIT_OPT_SET_TRANSFER_PROGRESS_INTERVAL:
+		{
+			int msecs = va_arg(ap, int);
+
+			if (msecs < 0) {
+				giterr_set(GITERR_INVALID,
+					"Invalid progress interval %d", msecs);
+				error = -1;
+				break;
+			}
+
+			git_indexer__progress_interval = msecs;
+			break;
+		}
+
+	case GIT_OPT_GET_DISCOVERY_CACHE_SIZE:
+		*(va_arg(ap, size_t *)) = git_repository__discovery_cache_size;
+		break;
+
+	case GIT_OPT_SET_DISCOVERY_CACHE_SIZE:
+		error = git_repository__set_discovery_cache_size(va_arg(ap, size_t));
+		break;
 	}
 
 	va_end(ap);
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "shallow.h"
+#include "repository.h"
+#include "filebuf.h"
+#include "fileops.h"
+
+static int oid_cmp(const void *a, const void *b)
+{
+	return git_oid_cmp((const git_oid *)a, (const git_oid *)b);
+}
+
+void git_shallow__sort(git_shallow_array *roots)
+{
+	uint32_t i, n = 0;
+
+	if (!roots->size)
+		return;
+
+	qsort(roots->ptr, roots->size, sizeof(git_oid), oid_cmp);
+
+	for (i = 1; i < roots->size; ++i) {
+		if (git_oid_cmp(&roots->ptr[n], &roots->ptr[i]) != 0)
+			git_oid_cpy(&roots->ptr[++n], &roots->ptr[i]);
+	}
+
+	roots->size = n + 1;
+}
+
+int git_shallow__roots(git_shallow_array *out, git_repository *repo)
+{
+	git_buf path = GIT_BUF_INIT, contents = GIT_BUF_INIT;
+	const char *line, *end;
+	git_oid *id;
+	int error;
+
+	git_array_init(*out);
+
+	if (git_buf_joinpath(&path, repo->path_repository, GIT_SHALLOW_FILE) < 0)
+		return -1;
+
+	if ((error = git_futils_readbuffer(&contents, path.ptr)) < 0) {
+		if (error == GIT_ENOTFOUND) {
+			giterr_clear();
+			error = 0;
+		}
+
+		goto done;
+	}
+
+	for (line = contents.ptr; *line; line = end) {
+		if ((end = strchr(line, '\n')) == NULL)
+			end = line + strlen(line);
+
+		if (end == line) {
+			end++;
+			continue;
+		}
+
+		if (end - line != GIT_OID_HEXSZ ||
+			(id = git_array_alloc(*out)) == NULL ||
+			git_oid_fromstrn(id, line, GIT_OID_HEXSZ) < 0) {
+			if (!giterr_last() || giterr_last()->klass != GITERR_NOMEMORY)
+				giterr_set(GITERR_REPOSITORY,
+					"Invalid entry in shallow file '%s'", path.ptr);
+			error = -1;
+			goto done;
+		}
+
+		if (*end)
+			end++;
+	}
+
+	git_shallow__sort(out);
+
+done:
+	if (error < 0)
+		git_array_clear(*out);
+
+	git_buf_free(&path);
+	git_buf_free(&contents);
+	return error;
+}
+
+bool git_shallow__contains(const git_shallow_array *roots, const git_oid *id)
+{
+	size_t lo = 0, hi = roots->size;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = git_oid_cmp(id, &roots->ptr[mid]);
+
+		if (!cmp)
+			return true;
+		else if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return false;
+}
+
+int git_shallow__update(
+	git_repository *repo,
+	const git_shallow_array *added,
+	git_shallow_array *removed)
+{
+	git_shallow_array roots;
+	git_buf path = GIT_BUF_INIT;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_oid *id;
+	char hex[GIT_OID_HEXSZ + 1];
+	uint32_t i, written = 0;
+	int error;
+
+	if ((error = git_shallow__roots(&roots, repo)) < 0)
+		return error;
+
+	for (i = 0; i < added->size; ++i) {
+		if ((id = git_array_alloc(roots)) == NULL) {
+			error = -1;
+			goto done;
+		}
+
+		git_oid_cpy(id, &added->ptr[i]);
+	}
+
+	git_shallow__sort(&roots);
+	git_shallow__sort(removed);
+
+	if ((error = git_buf_joinpath(
+			&path, repo->path_repository, GIT_SHALLOW_FILE)) < 0 ||
+		(error = git_filebuf_open(
+			&file, path.ptr, GIT_FILEBUF_FORCE, GIT_SHALLOW_FILE_MODE)) < 0)
+		goto done;
+
+	for (i = 0; i < roots.size; ++i) {
+		if (git_shallow__contains(removed, &roots.ptr[i]))
+			continue;
+
+		git_oid_tostr(hex, sizeof(hex), &roots.ptr[i]);
+		if ((error = git_filebuf_printf(&file, "%s\n", hex)) < 0)
+			goto done;
+
+		written++;
+	}
+
+	if (written) {
+		error = git_filebuf_commit(&file);
+	} else {
+		/* The history is complete, so we're not shallow anymore */
+		git_filebuf_cleanup(&file);
+
+		if (p_unlink(path.ptr) < 0 && errno != ENOENT) {
+			giterr_set(GITERR_OS, "Failed to remove '%s'", path.ptr);
+			error = -1;
+		}
+	}
+
+done:
+	git_filebuf_cleanup(&file);
+	git_array_clear(roots);
+	git_buf_free(&path);
+	return error;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_shallow_h__
+#define INCLUDE_shallow_h__
+
+#include "common.h"
+#include "array.h"
+#include "git2/oid.h"
+
+#define GIT_SHALLOW_FILE "shallow"
+#define GIT_SHALLOW_FILE_MODE 0666
+
+typedef git_array_t(git_oid) git_shallow_array;
+
+/*
+ * Read the commits listed in the repository's `shallow` file, whose
+ * parents are missing, sorted. A repository without the file gets an
+ * empty array.
+ */
+extern int git_shallow__roots(git_shallow_array *out, git_repository *repo);
+
+/* Sort the array and drop any duplicates */
+extern void git_shallow__sort(git_shallow_array *roots);
+
+/* Whether `id` is one of the (sorted) shallow roots */
+extern bool git_shallow__contains(const git_shallow_array *roots, const git_oid *id);
+
+/*
+ * Add and remove shallow roots, as told by the server at the end of a
+ * fetch. The file is removed once the history is complete. `removed`
+ * is sorted in place.
+ */
+extern int git_shallow__update(
+	git_repository *repo,
+	const git_shallow_array *added,
+	git_shallow_array *removed);
+
+#endif
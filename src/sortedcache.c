@@ -236,6 +236,12 @@ void git_sortedcache_updated(git_sortedcache *sc)
 	git_futils_filestamp_check(&sc->stamp, sc->path);
 }
 
+void git_sortedcache_invalidate(git_sortedcache *sc)
+{
+	/* forget the filestamp so the next load has to read the file */
+	git_futils_filestamp_set(&sc->stamp, NULL);
+}
+
 /* release all items in sorted cache */
 int git_sortedcache_clear(git_sortedcache *sc, bool wlock)
 {
@@ -125,6 +125,12 @@ int git_sortedcache_lockandload(git_sortedcache *sc, git_buf *buf);
  */
 void git_sortedcache_updated(git_sortedcache *sc);
 
+/* Make the next load read the backing file even if it hasn't changed,
+ * e.g. after making changes to the cache which couldn't be written out.
+ * You should already be holding the write lock when you call this.
+ */
+void git_sortedcache_invalidate(git_sortedcache *sc);
+
 /* Release all items in sorted cache
  *
  * If `wlock` is true, grabs write lock and releases when done, otherwise
@@ -10,6 +10,7 @@
 #include "git2/net.h"
 #include "git2/transport.h"
 #include "path.h"
+#include "bundle.h"
 
 typedef struct transport_definition {
 	char *prefix;
@@ -25,6 +26,7 @@ static git_smart_subtransport_definition ssh_subtransport_definition = { git_sma
 #endif
 
 static transport_definition local_transport_definition = { "file://", 1, git_transport_local, NULL };
+static transport_definition bundle_transport_definition = { NULL, 1, git_transport_bundle, NULL };
 #ifdef GIT_SSH
 static transport_definition ssh_transport_definition = { "ssh://", 1, git_transport_smart, &ssh_subtransport_definition };
 #else
@@ -51,6 +53,20 @@ static int transport_find_fn(const char *url, git_transport_cb *callback, void *
 	size_t i = 0;
 	unsigned priority = 0;
 	transport_definition *definition = NULL, *definition_iter;
+	git_buf path = GIT_BUF_INIT;
+
+	/* Bundles are files, so tell them apart from repositories by content */
+	if (git_path_from_url_or_path(&path, url) < 0) {
+		/* Not a local path; the transports below may still take it */
+		giterr_clear();
+	} else if (git_bundle__is_bundle(git_buf_cstr(&path))) {
+		git_buf_free(&path);
+		*callback = bundle_transport_definition.fn;
+		*param = bundle_transport_definition.param;
+		return 0;
+	}
+
+	git_buf_free(&path);
 
 	// First, check to see if it's an obvious URL, which a URL scheme
 	for (i = 0; i < GIT_TRANSPORT_COUNT; ++i) {
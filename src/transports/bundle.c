@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#include "common.h"
+#include "git2/types.h"
+#include "git2/net.h"
+#include "git2/repository.h"
+#include "git2/transport.h"
+#include "git2/odb_backend.h"
+#include "bundle.h"
+#include "fileops.h"
+#include "posix.h"
+#include "path.h"
+#include "buffer.h"
+#include "repository.h"
+#include "odb.h"
+#include "fetch.h"
+
+#define BUNDLE_READ_SIZE (64 * 1024)
+
+typedef struct {
+	git_transport parent;
+	git_remote *owner;
+	int flags;
+	git_atomic cancelled;
+	git_file fd;
+	git_bundle_header header;
+	unsigned connected : 1,
+		have_refs : 1;
+} transport_bundle;
+
+static int bundle_connect(
+	git_transport *transport,
+	const char *url,
+	git_cred_acquire_cb cred_acquire_cb,
+	void *cred_acquire_payload,
+	int direction, int flags)
+{
+	transport_bundle *t = (transport_bundle *)transport;
+	git_buf path = GIT_BUF_INIT;
+	int error;
+
+	GIT_UNUSED(cred_acquire_cb);
+	GIT_UNUSED(cred_acquire_payload);
+
+	if (t->connected)
+		return 0;
+
+	if (direction != GIT_DIRECTION_FETCH) {
+		giterr_set(GITERR_NET, "Cannot push to a bundle");
+		return -1;
+	}
+
+	/* 'url' may be a url or path; convert to a path */
+	if ((error = git_path_from_url_or_path(&path, url)) < 0)
+		goto done;
+
+	if ((t->fd = git_futils_open_ro(git_buf_cstr(&path))) < 0) {
+		error = t->fd;
+		goto done;
+	}
+
+	if (t->have_refs) {
+		git_bundle__header_free(&t->header);
+		t->have_refs = 0;
+	}
+
+	if ((error = git_bundle__read_header(&t->header, t->fd)) < 0) {
+		p_close(t->fd);
+		t->fd = -1;
+		goto done;
+	}
+
+	t->flags = flags;
+	t->have_refs = 1;
+	t->connected = 1;
+
+done:
+	git_buf_free(&path);
+	return error;
+}
+
+static int bundle_ls(const git_remote_head ***out, size_t *size, git_transport *transport)
+{
+	transport_bundle *t = (transport_bundle *)transport;
+
+	if (!t->have_refs) {
+		giterr_set(GITERR_NET, "The transport has not yet loaded the refs");
+		return -1;
+	}
+
+	*out = (const git_remote_head **)t->header.refs.contents;
+	*size = t->header.refs.length;
+
+	return 0;
+}
+
+static int bundle_negotiate_fetch(
+	git_transport *transport,
+	git_repository *repo,
+	const git_remote_head * const *refs,
+	size_t count)
+{
+	transport_bundle *t = (transport_bundle *)transport;
+	char hex[GIT_OID_HEXSZ + 1];
+	git_odb *odb;
+	git_oid *id;
+	size_t i;
+	int error;
+
+	GIT_UNUSED(refs);
+	GIT_UNUSED(count);
+
+	if ((error = git_repository_odb__weakptr(&odb, repo)) < 0)
+		return error;
+
+	/* The pack has no way of getting us what we're missing */
+	for (i = 0; i < git_array_size(t->header.prerequisites); ++i) {
+		id = git_array_get(t->header.prerequisites, i);
+
+		if (!git_odb_exists(odb, id)) {
+			git_oid_tostr(hex, sizeof(hex), id);
+			giterr_set(GITERR_NET,
+				"The bundle needs commit %s, which is missing", hex);
+			return GIT_ENOTFOUND;
+		}
+	}
+
+	return 0;
+}
+
+static int bundle_push(git_transport *transport, git_push *push)
+{
+	GIT_UNUSED(transport);
+	GIT_UNUSED(push);
+
+	giterr_set(GITERR_NET, "Cannot push to a bundle");
+	return -1;
+}
+
+static int bundle_download_pack(
+	git_transport *transport,
+	git_repository *repo,
+	git_transfer_progress *stats,
+	git_transfer_progress_cb progress_cb,
+	void *progress_payload)
+{
+	transport_bundle *t = (transport_bundle *)transport;
+	git_odb_writepack *writepack = NULL;
+	git_odb *odb;
+	char *buf;
+	ssize_t read;
+	int error;
+
+	memset(stats, 0, sizeof(git_transfer_progress));
+
+	buf = git__malloc(BUNDLE_READ_SIZE);
+	GITERR_CHECK_ALLOC(buf);
+
+	if ((error = git_repository_odb__weakptr(&odb, repo)) < 0 ||
+		(error = git_odb_write_pack(&writepack, odb, progress_cb, progress_payload)) < 0)
+		goto cleanup;
+
+	if (p_lseek(t->fd, t->header.pack_offset, SEEK_SET) < 0) {
+		giterr_set(GITERR_OS, "Failed to seek to the packfile in the bundle");
+		error = -1;
+		goto cleanup;
+	}
+
+	while ((read = p_read(t->fd, buf, BUNDLE_READ_SIZE)) > 0) {
+		if (git_atomic_get(&t->cancelled)) {
+			giterr_set(GITERR_NET, "The fetch was cancelled by the user");
+			error = GIT_EUSER;
+			goto cleanup;
+		}
+
+		stats->received_bytes += read;
+
+		if ((error = writepack->append(writepack, buf, read, stats)) < 0)
+			goto cleanup;
+	}
+
+	if (read < 0) {
+		giterr_set(GITERR_OS, "Failed to read the bundle");
+		error = -1;
+		goto cleanup;
+	}
+
+	if ((error = writepack->commit(writepack, stats)) < 0)
+		goto cleanup;
+
+	if (t->owner)
+		error = git_fetch__received_pack(t->owner, writepack);
+
+cleanup:
+	if (writepack) writepack->free(writepack);
+	git__free(buf);
+	return error;
+}
+
+static int bundle_is_connected(git_transport *transport)
+{
+	transport_bundle *t = (transport_bundle *)transport;
+
+	return t->connected;
+}
+
+static int bundle_read_flags(git_transport *transport, int *flags)
+{
+	transport_bundle *t = (transport_bundle *)transport;
+
+	*flags = t->flags;
+
+	return 0;
+}
+
+static void bundle_cancel(git_transport *transport)
+{
+	transport_bundle *t = (transport_bundle *)transport;
+
+	git_atomic_set(&t->cancelled, 1);
+}
+
+static int bundle_close(git_transport *transport)
+{
+	transport_bundle *t = (transport_bundle *)transport;
+
+	t->connected = 0;
+
+	if (t->fd >= 0) {
+		p_close(t->fd);
+		t->fd = -1;
+	}
+
+	return 0;
+}
+
+static void bundle_free(git_transport *transport)
+{
+	transport_bundle *t = (transport_bundle *)transport;
+
+	/* The refs outlive the connection, like with the local transport */
+	if (t->have_refs)
+		git_bundle__header_free(&t->header);
+
+	bundle_close(transport);
+	git__free(t);
+}
+
+/**************
+ * Public API *
+ **************/
+
+int git_transport_bundle(git_transport **out, git_remote *owner, void *param)
+{
+	transport_bundle *t;
+
+	GIT_UNUSED(param);
+
+	t = git__calloc(1, sizeof(transport_bundle));
+	GITERR_CHECK_ALLOC(t);
+
+	t->parent.version = GIT_TRANSPORT_VERSION;
+	t->parent.connect = bundle_connect;
+	t->parent.negotiate_fetch = bundle_negotiate_fetch;
+	t->parent.download_pack = bundle_download_pack;
+	t->parent.push = bundle_push;
+	t->parent.close = bundle_close;
+	t->parent.free = bundle_free;
+	t->parent.ls = bundle_ls;
+	t->parent.is_connected = bundle_is_connected;
+	t->parent.read_flags = bundle_read_flags;
+	t->parent.cancel = bundle_cancel;
+
+	t->owner = owner;
+	t->fd = -1;
+
+	*out = (git_transport *) t;
+
+	return 0;
+}
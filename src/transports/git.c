@@ -8,6 +8,7 @@
 #include "git2.h"
 #include "buffer.h"
 #include "netops.h"
+#include "smart.h"
 
 #define OWNING_SUBTRANSPORT(s) ((git_subtransport *)(s)->parent.subtransport)
 
@@ -25,16 +26,23 @@ typedef struct {
 
 typedef struct {
 	git_smart_subtransport parent;
-	git_transport *owner;
+	transport_smart *owner;
 	git_stream *current_stream;
 } git_subtransport;
 
+static const char extra_v2[] = "version=2";
+
 /*
  * Create a git protocol request.
  *
  * For example: 0035git-upload-pack /libgit2/libgit2\0host=github.com\0
+ *
+ * Protocol v2 is requested with an extra parameter after a second NUL,
+ * which older daemons ignore:
+ *
+ *	git-upload-pack /libgit2/libgit2\0host=github.com\0\0version=2\0
  */
-static int gen_proto(git_buf *request, const char *cmd, const char *url)
+static int gen_proto(git_buf *request, const char *cmd, const char *url, int version)
 {
 	char *delim, *repo;
 	char host[] = "host=";
@@ -54,12 +62,20 @@ static int gen_proto(git_buf *request, const char *cmd, const char *url)
 
 	len = 4 + strlen(cmd) + 1 + strlen(repo) + 1 + strlen(host) + (delim - url) + 1;
 
+	if (version == 2)
+		len += 1 + strlen(extra_v2) + 1;
+
 	git_buf_grow(request, len);
 	git_buf_printf(request, "%04x%s %s%c%s",
 		(unsigned int)(len & 0x0FFFF), cmd, repo, 0, host);
 	git_buf_put(request, url, delim - url);
 	git_buf_putc(request, '\0');
 
+	if (version == 2) {
+		git_buf_putc(request, '\0');
+		git_buf_put(request, extra_v2, sizeof(extra_v2));
+	}
+
 	if (git_buf_oom(request))
 		return -1;
 
@@ -68,10 +84,13 @@ static int gen_proto(git_buf *request, const char *cmd, const char *url)
 
 static int send_command(git_stream *s)
 {
-	int error;
+	int error, version = 0;
 	git_buf request = GIT_BUF_INIT;
 
-	error = gen_proto(&request, s->cmd, s->url);
+	if (s->cmd == cmd_uploadpack)
+		version = OWNING_SUBTRANSPORT(s)->owner->requested_version;
+
+	error = gen_proto(&request, s->cmd, s->url, version);
 	if (error < 0)
 		goto cleanup;
 
@@ -335,7 +354,7 @@ int git_smart_subtransport_git(git_smart_subtransport **out, git_transport *owne
 	t = git__calloc(sizeof(git_subtransport), 1);
 	GITERR_CHECK_ALLOC(t);
 
-	t->owner = owner;
+	t->owner = (transport_smart *)owner;
 	t->parent.action = _git_action;
 	t->parent.close = _git_close;
 	t->parent.free = _git_free;
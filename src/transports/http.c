@@ -47,6 +47,8 @@ typedef struct {
 	const char *verb;
 	char *chunk_buffer;
 	unsigned chunk_buffer_len;
+	/* the body of a single write, kept to send the request again */
+	git_buf body;
 	unsigned sent_request : 1,
 		received_response : 1,
 		chunked : 1,
@@ -61,7 +63,9 @@ typedef struct {
 	git_cred *cred;
 	git_cred *url_cred;
 	http_authmechanism_t auth_mechanism;
+	int connect_flags;
 	bool connected;
+	bool reused;
 
 	/* Parser structures */
 	http_parser parser;
@@ -75,7 +79,8 @@ typedef struct {
 	git_vector www_authenticate;
 	enum last_cb last_cb;
 	int parse_error;
-	unsigned parse_finished : 1;
+	unsigned parse_finished : 1,
+		parse_started : 1;
 } http_subtransport;
 
 typedef struct {
@@ -125,6 +130,10 @@ static int gen_request(
 	git_buf_puts(buf, "User-Agent: git/1.0 (libgit2 " LIBGIT2_VERSION ")\r\n");
 	git_buf_printf(buf, "Host: %s\r\n", t->connection_data.host);
 
+	/* Ask for protocol v2; servers which don't know it ignore this */
+	if (s->service == upload_pack_service && t->owner->requested_version == 2)
+		git_buf_puts(buf, "Git-Protocol: version=2\r\n");
+
 	if (s->chunked || content_length > 0) {
 		git_buf_printf(buf, "Accept: application/x-git-%s-result\r\n", s->service);
 		git_buf_printf(buf, "Content-Type: application/x-git-%s-request\r\n", s->service);
@@ -406,6 +415,7 @@ static void clear_parser_state(http_subtransport *t)
 	t->last_cb = NONE;
 	t->parse_error = 0;
 	t->parse_finished = 0;
+	t->parse_started = 0;
 
 	git_buf_free(&t->parse_header_name);
 	git_buf_init(&t->parse_header_name, 0);
@@ -450,37 +460,86 @@ static int write_chunk(gitno_socket *socket, const char *buffer, size_t len)
 	return 0;
 }
 
-static int http_connect(http_subtransport *t)
+/* Whether the connection can take another request */
+static bool http_can_reuse(http_subtransport *t)
 {
-	int flags = 0;
+	return t->connected && t->socket.socket &&
+		t->parse_finished && !t->parse_error &&
+		http_should_keep_alive(&t->parser);
+}
 
-	if (t->connected &&
-		http_should_keep_alive(&t->parser) &&
-		http_body_is_final(&t->parser))
+static void http_disconnect(http_subtransport *t)
+{
+	if (t->socket.socket) {
+		gitno_close(&t->socket);
+		memset(&t->socket, 0x0, sizeof(gitno_socket));
+	}
+
+	t->connected = 0;
+}
+
+static int http_connect_flags(int *out, http_subtransport *t)
+{
+	int tflags;
+
+	*out = 0;
+
+	if (!t->connection_data.use_ssl)
 		return 0;
 
-	if (t->socket.socket)
-		gitno_close(&t->socket);
+	if (t->owner->parent.read_flags(&t->owner->parent, &tflags) < 0)
+		return -1;
 
-	if (t->connection_data.use_ssl) {
-		int tflags;
+	*out |= GITNO_CONNECT_SSL;
 
-		if (t->owner->parent.read_flags(&t->owner->parent, &tflags) < 0)
-			return -1;
+	if (GIT_TRANSPORTFLAGS_NO_CHECK_CERT & tflags)
+		*out |= GITNO_CONNECT_SSL_NO_CHECK_CERT;
+
+	return 0;
+}
 
-		flags |= GITNO_CONNECT_SSL;
+/*
+ * Connect to the server, unless the previous response left us with a
+ * connection we can keep using. An idle connection some other transport
+ * left in the pool is as good as a new one, unless `fresh` is set.
+ */
+static int http_reconnect(http_subtransport *t, bool fresh)
+{
+	int flags, error = GIT_ENOTFOUND;
 
-		if (GIT_TRANSPORTFLAGS_NO_CHECK_CERT & tflags)
-			flags |= GITNO_CONNECT_SSL_NO_CHECK_CERT;
+	if (!fresh && http_can_reuse(t)) {
+		t->reused = 1;
+		return 0;
 	}
 
-	if (gitno_connect(&t->socket, t->connection_data.host, t->connection_data.port, flags) < 0)
+	http_disconnect(t);
+
+	if (http_connect_flags(&flags, t) < 0)
+		return -1;
+
+	if (!fresh)
+		error = gitno_pool_get(&t->socket,
+			t->connection_data.host, t->connection_data.port, flags);
+
+	t->reused = (error == 0);
+
+	if (error == GIT_ENOTFOUND)
+		error = gitno_connect(&t->socket,
+			t->connection_data.host, t->connection_data.port, flags);
+
+	if (error < 0)
 		return -1;
 
+	t->connect_flags = flags;
 	t->connected = 1;
 	return 0;
 }
 
+static int http_connect(http_subtransport *t)
+{
+	return http_reconnect(t, false);
+}
+
 static int http_stream_read(
 	git_smart_subtransport_stream *stream,
 	char *buffer,
@@ -502,12 +561,14 @@ replay:
 
 		clear_parser_state(t);
 
-		if (gen_request(&request, s, 0) < 0) {
+		if (gen_request(&request, s, s->body.size) < 0) {
 			giterr_set(GITERR_NET, "Failed to generate request");
 			return -1;
 		}
 
-		if (gitno_send(&t->socket, request.ptr, request.size, 0) < 0) {
+		if (gitno_send(&t->socket, request.ptr, request.size, 0) < 0 ||
+			(s->body.size > 0 &&
+			 gitno_send(&t->socket, s->body.ptr, s->body.size, 0) < 0)) {
 			git_buf_free(&request);
 			return -1;
 		}
@@ -537,11 +598,40 @@ replay:
 	}
 
 	while (!*bytes_read && !t->parse_finished) {
-		t->parse_buffer.offset = 0;
+		size_t data_offset;
+		int recvd;
+
+		/*
+		 * Make the parse_buffer think it's as full of data as the
+		 * caller's buffer, so we never receive more than we can hand
+		 * back. The data we do receive starts at data_offset.
+		 */
+		if (buf_size >= t->parse_buffer.len)
+			t->parse_buffer.offset = 0;
+		else
+			t->parse_buffer.offset = t->parse_buffer.len - buf_size;
+
+		data_offset = t->parse_buffer.offset;
 
-		if (gitno_recv(&t->parse_buffer) < 0)
+		if ((recvd = gitno_recv(&t->parse_buffer)) < 0)
 			return -1;
 
+		/*
+		 * The server may have closed a connection we reused just as
+		 * we sent the request. Unless the body went out in chunks we
+		 * no longer have, we can simply retry on a new one.
+		 */
+		if (!recvd && !t->parse_started && t->reused && !s->chunked) {
+			s->sent_request = 0;
+
+			if (http_reconnect(t, true) < 0)
+				return -1;
+
+			goto replay;
+		}
+
+		t->parse_started = 1;
+
 		/* This call to http_parser_execute will result in invocations of the
 		 * on_* family of callbacks. The most interesting of these is
 		 * on_body_fill_buffer, which is called when data is ready to be copied
@@ -558,8 +648,8 @@ replay:
 
 		bytes_parsed = http_parser_execute(&t->parser,
 			&t->settings,
-			t->parse_buffer.data,
-			t->parse_buffer.offset);
+			t->parse_buffer.data + data_offset,
+			t->parse_buffer.offset - data_offset);
 
 		t->parser.data = NULL;
 
@@ -577,12 +667,17 @@ replay:
 		if (t->parse_error < 0)
 			return -1;
 
-		if (bytes_parsed != t->parse_buffer.offset) {
+		if (bytes_parsed != t->parse_buffer.offset - data_offset) {
 			giterr_set(GITERR_NET,
 				"HTTP parser error: %s",
 				http_errno_description((enum http_errno)t->parser.http_errno));
 			return -1;
 		}
+
+		if (!recvd && !t->parse_finished) {
+			giterr_set(GITERR_NET, "Connection closed before the end of the response");
+			return -1;
+		}
 	}
 
 	return 0;
@@ -679,6 +774,9 @@ static int http_stream_write_single(
 
 	clear_parser_state(t);
 
+	if (git_buf_set(&s->body, buffer, len) < 0)
+		return -1;
+
 	if (gen_request(&request, s, len) < 0) {
 		giterr_set(GITERR_NET, "Failed to generate request");
 		return -1;
@@ -710,6 +808,7 @@ static void http_stream_free(git_smart_subtransport_stream *stream)
 	if (s->redirect_url)
 		git__free(s->redirect_url);
 
+	git_buf_free(&s->body);
 	git__free(s);
 }
 
@@ -729,6 +828,8 @@ static int http_stream_alloc(http_subtransport *t,
 	s->parent.write = http_stream_write_single;
 	s->parent.free = http_stream_free;
 
+	git_buf_init(&s->body, 0);
+
 	*stream = (git_smart_subtransport_stream *)s;
 	return 0;
 }
@@ -850,13 +951,18 @@ static int http_close(git_smart_subtransport *subtransport)
 {
 	http_subtransport *t = (http_subtransport *) subtransport;
 
-	clear_parser_state(t);
-
-	if (t->socket.socket) {
-		gitno_close(&t->socket);
+	/* Let the next transport to talk to this server pick it up */
+	if (http_can_reuse(t)) {
+		gitno_pool_put(&t->socket,
+			t->connection_data.host, t->connection_data.port,
+			t->connect_flags);
 		memset(&t->socket, 0x0, sizeof(gitno_socket));
+		t->connected = 0;
 	}
 
+	http_disconnect(t);
+	clear_parser_state(t);
+
 	if (t->cred) {
 		t->cred->free(t->cred);
 		t->cred = NULL;
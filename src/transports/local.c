@@ -26,6 +26,7 @@
 #include "odb.h"
 #include "push.h"
 #include "remote.h"
+#include "fetch.h"
 
 typedef struct {
 	git_transport parent;
@@ -384,7 +385,7 @@ static int local_push(
 	/* We don't currently support pushing locally to non-bare repos. Proper
 	   non-bare repo push support would require checking configs to see if
 	   we should override the default 'don't let this happen' behavior */
-	if (!remote_repo->is_bare) {
+	if (!git_repository_is_bare(remote_repo)) {
 		error = GIT_EBAREREPO;
 		giterr_set(GITERR_INVALID, "Local push doesn't (yet) support pushing to non-bare repos.");
 		goto on_error;
@@ -570,7 +571,11 @@ static int local_download_pack(
 		if ((error = git_packbuilder_foreach(pack, foreach_cb, &data)) != 0)
 			goto cleanup;
 	}
-	error = writepack->commit(writepack, stats);
+	if ((error = writepack->commit(writepack, stats)) < 0)
+		goto cleanup;
+
+	if (t->owner)
+		error = git_fetch__received_pack(t->owner, writepack);
 
 cleanup:
 	if (writepack) writepack->free(writepack);
@@ -8,16 +8,20 @@
 #include "smart.h"
 #include "refs.h"
 #include "refspec.h"
+#include "remote.h"
+#include "repository.h"
 
 static int git_smart__recv_cb(gitno_buffer *buf)
 {
 	transport_smart *t = (transport_smart *) buf->cb_data;
 	size_t old_len, bytes_read;
+	double start;
 	int error;
 
 	assert(t->current_stream);
 
 	old_len = buf->offset;
+	start = git__timer();
 
 	if ((error = t->current_stream->read(t->current_stream, buf->data + buf->offset, buf->len - buf->offset, &bytes_read)) < 0)
 		return error;
@@ -25,7 +29,8 @@ static int git_smart__recv_cb(gitno_buffer *buf)
 	buf->offset += bytes_read;
 
 	if (t->packetsize_cb && !t->cancelled.val) {
-		error = t->packetsize_cb(bytes_read, t->packetsize_payload);
+		error = t->packetsize_cb(
+			bytes_read, git__timer() - start, t->packetsize_payload);
 		if (error) {
 			git_atomic_set(&t->cancelled, 1);
 			return GIT_EUSER;
@@ -114,6 +119,125 @@ static void free_symrefs(git_vector *symrefs)
 	git_vector_free(symrefs);
 }
 
+/*
+ * Fetches ask for protocol v2 unless the repository's `protocol.version`
+ * says otherwise. There is no v2 for push.
+ */
+static int requested_version(int *out, transport_smart *t)
+{
+	git_remote *remote = t->owner;
+	git_config *cfg;
+	int32_t version = 2;
+	int error;
+
+	*out = 0;
+
+	if (t->direction != GIT_DIRECTION_FETCH)
+		return 0;
+
+	if (remote && remote->repo) {
+		if ((error = git_repository_config__weakptr(&cfg, remote->repo)) < 0)
+			return error;
+
+		error = git_config_get_int32(&version, cfg, "protocol.version");
+
+		if (error == GIT_ENOTFOUND) {
+			giterr_clear();
+			version = 2;
+		} else if (error < 0)
+			return error;
+	}
+
+	*out = (version == 2) ? 2 : 0;
+	return 0;
+}
+
+static void free_prefixes(git_vector *prefixes)
+{
+	char *prefix;
+	size_t i;
+
+	git_vector_foreach(prefixes, i, prefix)
+		git__free(prefix);
+
+	git_vector_free(prefixes);
+}
+
+/*
+ * Limit the v2 ref listing to what the remote's fetch refspecs can match,
+ * plus HEAD and tags. Without any fetch refspecs, or with one which isn't
+ * a full reference name, we ask for everything.
+ */
+static int ls_refs_prefixes(git_vector *prefixes, git_remote *remote)
+{
+	git_refspec *spec;
+	const char *src, *glob;
+	char *prefix;
+	size_t i;
+
+	if (!remote)
+		return 0;
+
+	git_vector_foreach(&remote->refspecs, i, spec) {
+		if (spec->push)
+			continue;
+
+		src = git_refspec_src(spec);
+
+		if (git__prefixcmp(src, GIT_REFS_DIR) && strcmp(src, GIT_HEAD_FILE)) {
+			free_prefixes(prefixes);
+			return 0;
+		}
+
+		if ((glob = strchr(src, '*')) != NULL)
+			prefix = git__strndup(src, glob - src);
+		else
+			prefix = git__strdup(src);
+
+		if (!prefix || git_vector_insert(prefixes, prefix) < 0) {
+			git__free(prefix);
+			return -1;
+		}
+	}
+
+	if (!prefixes->length)
+		return 0;
+
+	if ((prefix = git__strdup(GIT_HEAD_FILE)) == NULL ||
+		git_vector_insert(prefixes, prefix) < 0) {
+		git__free(prefix);
+		return -1;
+	}
+
+	if (remote->download_tags != GIT_REMOTE_DOWNLOAD_TAGS_NONE &&
+		((prefix = git__strdup(GIT_REFS_TAGS_DIR)) == NULL ||
+		 git_vector_insert(prefixes, prefix) < 0)) {
+		git__free(prefix);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int ls_refs(transport_smart *t)
+{
+	git_vector prefixes = GIT_VECTOR_INIT;
+	git_strarray array;
+	int error;
+
+	if ((error = ls_refs_prefixes(&prefixes, t->owner)) < 0)
+		goto done;
+
+	array.strings = (char **)prefixes.contents;
+	array.count = prefixes.length;
+
+	error = git_smart__ls_refs(t, &array);
+
+done:
+	free_prefixes(&prefixes);
+	return error;
+}
+
 static int git_smart__connect(
 	git_transport *transport,
 	const char *url,
@@ -141,6 +265,12 @@ static int git_smart__connect(
 	t->cred_acquire_cb = cred_acquire_cb;
 	t->cred_acquire_payload = cred_acquire_payload;
 
+	t->version = 0;
+	memset(&t->caps, 0x0, sizeof(t->caps));
+
+	if ((error = requested_version(&t->requested_version, t)) < 0)
+		return error;
+
 	if (GIT_DIRECTION_FETCH == t->direction)
 		service = GIT_SERVICE_UPLOADPACK_LS;
 	else if (GIT_DIRECTION_PUSH == t->direction)
@@ -176,6 +306,10 @@ static int git_smart__connect(
 		}
 	}
 
+	/* A v2 server only told us its capabilities, so ask for the refs */
+	if (t->version == 2 && (error = ls_refs(t)) < 0)
+		return error;
+
 	/* We now have loaded the refs. */
 	t->have_refs = 1;
 
@@ -360,6 +494,10 @@ static void git_smart__free(git_transport *transport)
 
 	git_vector_free(refs);
 
+	git_array_clear(t->shallow_roots);
+	git_array_clear(t->shallow_added);
+	git_array_clear(t->shallow_removed);
+
 	git__free(t);
 }
 
@@ -9,6 +9,7 @@
 #include "netops.h"
 #include "buffer.h"
 #include "push.h"
+#include "shallow.h"
 
 #define GIT_SIDE_BAND_DATA     1
 #define GIT_SIDE_BAND_PROGRESS 2
@@ -24,6 +25,14 @@
 #define GIT_CAP_REPORT_STATUS "report-status"
 #define GIT_CAP_THIN_PACK "thin-pack"
 #define GIT_CAP_SYMREF "symref"
+#define GIT_CAP_SHALLOW "shallow"
+#define GIT_CAP_DEEPEN_SINCE "deepen-since"
+#define GIT_CAP_FILTER "filter"
+
+/* Protocol v2 capabilities */
+#define GIT_CAP_LS_REFS "ls-refs"
+#define GIT_CAP_FETCH "fetch"
+#define GIT_CAP_OBJECT_FORMAT "object-format"
 
 enum git_pkt_type {
 	GIT_PKT_CMD,
@@ -40,6 +49,11 @@ enum git_pkt_type {
 	GIT_PKT_OK,
 	GIT_PKT_NG,
 	GIT_PKT_UNPACK,
+	GIT_PKT_VERSION,
+	GIT_PKT_DELIM,
+	GIT_PKT_LINE,
+	GIT_PKT_SHALLOW,
+	GIT_PKT_UNSHALLOW,
 };
 
 /* Used for multi_ack and mutli_ack_detailed */
@@ -89,6 +103,16 @@ typedef struct {
 
 typedef git_pkt_data git_pkt_progress;
 
+/*
+ * A side-band pkt-line borrowed from the receive buffer rather than
+ * copied out of it. `data` is only valid until the line is consumed.
+ */
+typedef struct {
+	enum git_pkt_type type;
+	const char *data;
+	size_t len;
+} git_pkt_view;
+
 typedef struct {
 	enum git_pkt_type type;
 	int len;
@@ -111,6 +135,16 @@ typedef struct {
 	int unpack_ok;
 } git_pkt_unpack;
 
+typedef struct {
+	enum git_pkt_type type;
+	int version;
+} git_pkt_version;
+
+typedef struct {
+	enum git_pkt_type type;
+	git_oid oid;
+} git_pkt_shallow;
+
 typedef struct transport_smart_caps {
 	int common:1,
 		ofs_delta:1,
@@ -121,10 +155,16 @@ typedef struct transport_smart_caps {
 		include_tag:1,
 		delete_refs:1,
 		report_status:1,
-		thin_pack:1;
+		thin_pack:1,
+		ls_refs:1,
+		fetch:1,
+		shallow:1,
+		deepen_since:1,
+		filter:1;
 } transport_smart_caps;
 
-typedef int (*packetsize_cb)(size_t received, void *payload);
+/* Told how much was read from the network, and how long that took */
+typedef int (*packetsize_cb)(size_t received, double elapsed, void *payload);
 
 typedef struct {
 	git_transport parent;
@@ -139,10 +179,15 @@ typedef struct {
 	void *message_cb_payload;
 	git_smart_subtransport *wrapped;
 	git_smart_subtransport_stream *current_stream;
+	int requested_version;
+	int version;
 	transport_smart_caps caps;
 	git_vector refs;
 	git_vector heads;
 	git_vector common;
+	git_shallow_array shallow_roots;
+	git_shallow_array shallow_added;
+	git_shallow_array shallow_removed;
 	git_atomic cancelled;
 	packetsize_cb packetsize_cb;
 	void *packetsize_payload;
@@ -157,6 +202,7 @@ typedef struct {
 int git_smart__store_refs(transport_smart *t, int flushes);
 int git_smart__detect_caps(git_pkt_ref *pkt, transport_smart_caps *caps, git_vector *symrefs);
 int git_smart__push(git_transport *transport, git_push *push);
+int git_smart__ls_refs(transport_smart *t, const git_strarray *prefixes);
 
 int git_smart__negotiate_fetch(
 	git_transport *transport,
@@ -179,7 +225,11 @@ int git_smart__update_heads(transport_smart *t, git_vector *symrefs);
 
 /* smart_pkt.c */
 int git_pkt_parse_line(git_pkt **head, const char *line, const char **out, size_t len);
+int git_pkt_split_line(enum git_pkt_type *type, const char **payload, size_t *payload_len, const char *line, const char **out, size_t len);
+int git_pkt_parse_sideband(git_pkt_view *view, const char *line, const char **out, size_t len);
 int git_pkt_buffer_flush(git_buf *buf);
+int git_pkt_buffer_delim(git_buf *buf);
+int git_pkt_buffer_line(git_buf *buf, const char *line);
 int git_pkt_send_flush(GIT_SOCKET s);
 int git_pkt_buffer_done(git_buf *buf);
 int git_pkt_buffer_wants(const git_remote_head * const *refs, size_t count, transport_smart_caps *caps, git_buf *buf);
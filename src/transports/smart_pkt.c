@@ -23,6 +23,7 @@
 #define PKT_LEN_SIZE 4
 static const char pkt_done_str[] = "0009done\n";
 static const char pkt_flush_str[] = "0000";
+static const char pkt_delim_str[] = "0001";
 static const char pkt_have_prefix[] = "0032have ";
 static const char pkt_want_prefix[] = "0032want ";
 
@@ -86,6 +87,19 @@ static int nak_pkt(git_pkt **out)
 	return 0;
 }
 
+static int delim_pkt(git_pkt **out)
+{
+	git_pkt *pkt;
+
+	pkt = git__malloc(sizeof(git_pkt));
+	GITERR_CHECK_ALLOC(pkt);
+
+	pkt->type = GIT_PKT_DELIM;
+	*out = pkt;
+
+	return 0;
+}
+
 static int pack_pkt(git_pkt **out)
 {
 	git_pkt *pkt;
@@ -315,6 +329,55 @@ static int unpack_pkt(git_pkt **out, const char *line, size_t len)
 	return 0;
 }
 
+static int version_pkt(git_pkt **out, const char *line, size_t len)
+{
+	git_pkt_version *pkt;
+	int32_t version;
+
+	GIT_UNUSED(len);
+
+	line += strlen("version ");
+	if (git__strtol32(&version, line, NULL, 10) < 0)
+		return -1;
+
+	pkt = git__malloc(sizeof(*pkt));
+	GITERR_CHECK_ALLOC(pkt);
+
+	pkt->type = GIT_PKT_VERSION;
+	pkt->version = version;
+
+	*out = (git_pkt *)pkt;
+	return 0;
+}
+
+/* "shallow <oid>" and "unshallow <oid>", telling us where history ends */
+static int shallow_pkt(git_pkt **out, const char *line, size_t len)
+{
+	git_pkt_shallow *pkt;
+	enum git_pkt_type type = GIT_PKT_SHALLOW;
+	size_t prefix_len = strlen("shallow ");
+
+	if (!git__prefixcmp(line, "unshallow ")) {
+		type = GIT_PKT_UNSHALLOW;
+		prefix_len = strlen("unshallow ");
+	}
+
+	pkt = git__malloc(sizeof(*pkt));
+	GITERR_CHECK_ALLOC(pkt);
+
+	if (len < prefix_len + GIT_OID_HEXSZ ||
+		git_oid_fromstrn(&pkt->oid, line + prefix_len, GIT_OID_HEXSZ) < 0) {
+		giterr_set(GITERR_NET, "Error parsing %s line",
+			type == GIT_PKT_SHALLOW ? "shallow" : "unshallow");
+		git__free(pkt);
+		return -1;
+	}
+
+	pkt->type = type;
+	*out = (git_pkt *)pkt;
+	return 0;
+}
+
 static int32_t parse_len(const char *line)
 {
 	char num[PKT_LEN_SIZE + 1];
@@ -398,6 +461,16 @@ int git_pkt_parse_line(
 		return flush_pkt(head);
 	}
 
+	if (len == 1) { /* Delim pkt */
+		*out = line;
+		return delim_pkt(head);
+	}
+
+	if (len < PKT_LEN_SIZE) {
+		giterr_set(GITERR_NET, "Invalid pkt-line length %d", (int)len);
+		return -1;
+	}
+
 	len -= PKT_LEN_SIZE; /* the encoded length includes its own size */
 
 	if (*line == GIT_SIDE_BAND_DATA)
@@ -420,6 +493,11 @@ int git_pkt_parse_line(
 		ret = ng_pkt(head, line, len);
 	else if (!git__prefixcmp(line, "unpack"))
 		ret = unpack_pkt(head, line, len);
+	else if (!git__prefixcmp(line, "version "))
+		ret = version_pkt(head, line, len);
+	else if (!git__prefixcmp(line, "shallow ") ||
+		!git__prefixcmp(line, "unshallow "))
+		ret = shallow_pkt(head, line, len);
 	else
 		ret = ref_pkt(head, line, len);
 
@@ -428,6 +506,91 @@ int git_pkt_parse_line(
 	return ret;
 }
 
+/*
+ * Split a single pkt-line off the buffer without interpreting its
+ * contents, as protocol v2 responses need to be read in context. The
+ * payload points into `line` and is only valid until the buffer is
+ * consumed.
+ */
+int git_pkt_split_line(
+	enum git_pkt_type *type,
+	const char **payload,
+	size_t *payload_len,
+	const char *line,
+	const char **out,
+	size_t bufflen)
+{
+	int32_t len;
+
+	if (bufflen < PKT_LEN_SIZE)
+		return GIT_EBUFS;
+
+	if ((len = parse_len(line)) < 0)
+		return (int)len;
+
+	*payload = line + PKT_LEN_SIZE;
+	*payload_len = 0;
+
+	if (len == 0 || len == 1) {
+		*type = (len == 0) ? GIT_PKT_FLUSH : GIT_PKT_DELIM;
+		*out = *payload;
+		return 0;
+	}
+
+	if (len < PKT_LEN_SIZE) {
+		giterr_set(GITERR_NET, "Invalid pkt-line length %d", (int)len);
+		return -1;
+	}
+
+	if (bufflen < (size_t)len)
+		return GIT_EBUFS;
+
+	*type = GIT_PKT_LINE;
+	*payload_len = len - PKT_LEN_SIZE;
+	*out = line + len;
+
+	return 0;
+}
+
+/*
+ * Demultiplex a single side-band pkt-line without copying its payload.
+ * Lines which don't carry a band are handed back as GIT_PKT_LINE.
+ */
+int git_pkt_parse_sideband(
+	git_pkt_view *view,
+	const char *line,
+	const char **out,
+	size_t bufflen)
+{
+	int error;
+
+	if ((error = git_pkt_split_line(&view->type,
+		&view->data, &view->len, line, out, bufflen)) < 0)
+		return error;
+
+	if (view->type != GIT_PKT_LINE || view->len == 0)
+		return 0;
+
+	switch (*view->data) {
+	case GIT_SIDE_BAND_DATA:
+		view->type = GIT_PKT_DATA;
+		break;
+	case GIT_SIDE_BAND_PROGRESS:
+		view->type = GIT_PKT_PROGRESS;
+		break;
+	case GIT_SIDE_BAND_ERROR:
+		view->type = GIT_PKT_ERR;
+		break;
+	default:
+		return 0;
+	}
+
+	view->data++;
+	view->len--;
+
+	return 0;
+}
+
 void git_pkt_free(git_pkt *pkt)
 {
 	if (pkt->type == GIT_PKT_REF) {
@@ -455,6 +618,18 @@ int git_pkt_buffer_flush(git_buf *buf)
 	return git_buf_put(buf, pkt_flush_str, strlen(pkt_flush_str));
 }
 
+int git_pkt_buffer_delim(git_buf *buf)
+{
+	return git_buf_put(buf, pkt_delim_str, strlen(pkt_delim_str));
+}
+
+/* Append `line` as a pkt-line, terminated with a LF */
+int git_pkt_buffer_line(git_buf *buf, const char *line)
+{
+	return git_buf_printf(buf, "%04x%s\n",
+		(unsigned int)(PKT_LEN_SIZE + strlen(line) + 1), line);
+}
+
 static int buffer_want_with_caps(const git_remote_head *head, transport_smart_caps *caps, git_buf *buf)
 {
 	git_buf str = GIT_BUF_INIT;
@@ -482,6 +657,12 @@ static int buffer_want_with_caps(const git_remote_head *head, transport_smart_ca
 	if (caps->ofs_delta)
 		git_buf_puts(&str, GIT_CAP_OFS_DELTA " ");
 
+	if (caps->deepen_since)
+		git_buf_puts(&str, GIT_CAP_DEEPEN_SINCE " ");
+
+	if (caps->filter)
+		git_buf_puts(&str, GIT_CAP_FILTER " ");
+
 	if (git_buf_oom(&str))
 		return -1;
 
@@ -538,7 +719,7 @@ int git_pkt_buffer_wants(
 			return -1;
 	}
 
-	return git_pkt_buffer_flush(buf);
+	return 0;
 }
 
 int git_pkt_buffer_have(git_oid *oid, git_buf *buf)
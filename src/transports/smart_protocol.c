@@ -13,12 +13,25 @@
 #include "push.h"
 #include "pack-objects.h"
 #include "remote.h"
+#include "odb.h"
 #include "util.h"
+#include "negotiator.h"
+#include "fetch.h"
+#include "indexer.h"
 
 #define NETWORK_XFER_THRESHOLD (100*1024)
 /* The minimal interval between progress updates (in seconds). */
 #define MIN_PROGRESS_UPDATE_INTERVAL 0.5
 
+/* The number of new haves to send in each protocol v2 fetch round */
+#define FETCH_V2_HAVES_PER_ROUND 32
+/* The number of haves after which we stop negotiating */
+#define FETCH_MAX_HAVES 256
+/* How much of the push command list we buffer before sending it on */
+#define PUSH_COMMANDS_BUFSIZE (64*1024)
+
+static int store_caps_v2(transport_smart *t);
+
 int git_smart__store_refs(transport_smart *t, int flushes)
 {
 	gitno_buffer *buf = &t->buffer;
@@ -65,6 +78,24 @@ int git_smart__store_refs(transport_smart *t, int flushes)
 			return -1;
 		}
 
+		if (pkt->type == GIT_PKT_VERSION) {
+			t->version = ((git_pkt_version *)pkt)->version;
+			git__free(pkt);
+
+			/*
+			 * A v2 server advertises its capabilities instead of
+			 * its refs; those are asked for separately.
+			 */
+			if (t->version == 2) {
+				if ((error = store_caps_v2(t)) < 0)
+					return error;
+
+				flush++;
+			}
+
+			continue;
+		}
+
 		if (pkt->type != GIT_PKT_FLUSH && git_vector_insert(refs, pkt) < 0)
 			return -1;
 
@@ -185,6 +216,24 @@ int git_smart__detect_caps(git_pkt_ref *pkt, transport_smart_caps *caps, git_vec
 			continue;
 		}
 
+		if (!git__prefixcmp(ptr, GIT_CAP_SHALLOW)) {
+			caps->shallow = 1;
+			ptr += strlen(GIT_CAP_SHALLOW);
+			continue;
+		}
+
+		if (!git__prefixcmp(ptr, GIT_CAP_DEEPEN_SINCE)) {
+			caps->common = caps->deepen_since = 1;
+			ptr += strlen(GIT_CAP_DEEPEN_SINCE);
+			continue;
+		}
+
+		if (!git__prefixcmp(ptr, GIT_CAP_FILTER)) {
+			caps->common = caps->filter = 1;
+			ptr += strlen(GIT_CAP_FILTER);
+			continue;
+		}
+
 		if (!git__prefixcmp(ptr, GIT_CAP_SYMREF)) {
 			int error;
 
@@ -201,6 +250,278 @@ int git_smart__detect_caps(git_pkt_ref *pkt, transport_smart_caps *caps, git_vec
 	return 0;
 }
 
+/*
+ * Read one pkt-line of a protocol v2 exchange. For GIT_PKT_LINE,
+ * `line` receives the payload without its trailing LF.
+ */
+static int recv_line_v2(
+	enum git_pkt_type *type, git_buf *line, gitno_buffer *buf)
+{
+	const char *payload, *line_end;
+	size_t len;
+	int error, recvd;
+
+	while (1) {
+		if (buf->offset > 0)
+			error = git_pkt_split_line(
+				type, &payload, &len, buf->data, &line_end, buf->offset);
+		else
+			error = GIT_EBUFS;
+
+		if (error != GIT_EBUFS)
+			break;
+
+		if ((recvd = gitno_recv(buf)) < 0)
+			return recvd;
+
+		if (recvd == 0) {
+			giterr_set(GITERR_NET, "Early EOF");
+			return -1;
+		}
+	}
+
+	if (error < 0)
+		return error;
+
+	git_buf_clear(line);
+
+	if (*type == GIT_PKT_LINE) {
+		if (len > 0 && payload[len - 1] == '\n')
+			len--;
+
+		if (git_buf_put(line, payload, len) < 0)
+			return -1;
+	}
+
+	gitno_consume(buf, line_end);
+
+	if (*type == GIT_PKT_LINE && !git__prefixcmp(line->ptr, "ERR ")) {
+		giterr_set(GITERR_NET, "Remote error: %s", line->ptr + 4);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Whether the v2 capability `line` is `name` or `name=<value>` */
+static bool cap_v2_matches(const char *line, const char *name, const char **value)
+{
+	size_t len = strlen(name);
+
+	if (strncmp(line, name, len) != 0 ||
+		(line[len] != '\0' && line[len] != '='))
+		return false;
+
+	if (value)
+		*value = line[len] ? line + len + 1 : NULL;
+
+	return true;
+}
+
+/* Whether the space-separated `features` of a v2 capability include `name` */
+static bool cap_v2_has_feature(const char *features, const char *name)
+{
+	size_t len = strlen(name);
+
+	while (features && *features) {
+		if (!strncmp(features, name, len) &&
+			(features[len] == '\0' || features[len] == ' '))
+			return true;
+
+		if ((features = strchr(features, ' ')) != NULL)
+			features++;
+	}
+
+	return false;
+}
+
+static int store_caps_v2(transport_smart *t)
+{
+	git_buf line = GIT_BUF_INIT;
+	enum git_pkt_type type;
+	const char *value;
+	int error;
+
+	while ((error = recv_line_v2(&type, &line, &t->buffer)) == 0 &&
+		type != GIT_PKT_FLUSH) {
+		if (type != GIT_PKT_LINE)
+			continue;
+
+		if (cap_v2_matches(line.ptr, GIT_CAP_LS_REFS, NULL))
+			t->caps.ls_refs = 1;
+		else if (cap_v2_matches(line.ptr, GIT_CAP_FETCH, &value)) {
+			t->caps.fetch = 1;
+
+			/* v2 "shallow" covers all the ways of deepening */
+			if (cap_v2_has_feature(value, GIT_CAP_SHALLOW))
+				t->caps.shallow = t->caps.deepen_since = 1;
+
+			if (cap_v2_has_feature(value, GIT_CAP_FILTER))
+				t->caps.filter = 1;
+		}
+		else if (cap_v2_matches(line.ptr, GIT_CAP_OBJECT_FORMAT, &value) &&
+			value && strcmp(value, "sha1") != 0) {
+			giterr_set(GITERR_NET,
+				"Remote uses unsupported object format '%s'", value);
+			error = -1;
+			break;
+		}
+	}
+
+	/* Everything a v2 fetch can ask for */
+	if (!error && t->caps.fetch)
+		t->caps.ofs_delta = t->caps.include_tag =
+			t->caps.thin_pack = t->caps.side_band_64k = 1;
+
+	if (!error && (!t->caps.ls_refs || !t->caps.fetch)) {
+		giterr_set(GITERR_NET,
+			"Remote does not support the ls-refs and fetch commands");
+		error = -1;
+	}
+
+	git_buf_free(&line);
+	return error;
+}
+
+/*
+ * Parse a line of ls-refs output:
+ *
+ *	<oid> SP <refname> *(SP <attribute>)
+ *
+ * A peeled tag is stored as an extra "<refname>^{}" entry, as it would
+ * appear in a v0 advertisement.
+ */
+static int store_ref_v2(transport_smart *t, const char *line)
+{
+	git_pkt_ref *pkt = NULL, *peeled = NULL;
+	const char *name, *end, *attr, *refname;
+	git_oid peeled_oid;
+	bool is_peeled = false;
+
+	pkt = git__calloc(1, sizeof(git_pkt_ref));
+	GITERR_CHECK_ALLOC(pkt);
+
+	pkt->type = GIT_PKT_REF;
+
+	if (strlen(line) < GIT_OID_HEXSZ + 2 || line[GIT_OID_HEXSZ] != ' ' ||
+		git_oid_fromstrn(&pkt->head.oid, line, GIT_OID_HEXSZ) < 0)
+		goto on_invalid;
+
+	name = line + GIT_OID_HEXSZ + 1;
+	if ((end = strchr(name, ' ')) == NULL)
+		end = name + strlen(name);
+
+	if ((pkt->head.name = git__strndup(name, end - name)) == NULL)
+		goto on_error;
+
+	for (attr = end; *attr == ' '; attr = end) {
+		attr++;
+		if ((end = strchr(attr, ' ')) == NULL)
+			end = attr + strlen(attr);
+
+		if (!git__prefixcmp(attr, "symref-target:")) {
+			attr += strlen("symref-target:");
+			git__free(pkt->head.symref_target);
+			if ((pkt->head.symref_target =
+				git__strndup(attr, end - attr)) == NULL)
+				goto on_error;
+		} else if (!git__prefixcmp(attr, "peeled:")) {
+			attr += strlen("peeled:");
+			if (end - attr != GIT_OID_HEXSZ ||
+				git_oid_fromstrn(&peeled_oid, attr, GIT_OID_HEXSZ) < 0)
+				goto on_invalid;
+
+			is_peeled = true;
+		}
+	}
+
+	if (git_vector_insert(&t->refs, pkt) < 0)
+		goto on_error;
+
+	if (!is_peeled)
+		return 0;
+
+	refname = pkt->head.name;
+	pkt = NULL;
+
+	peeled = git__calloc(1, sizeof(git_pkt_ref));
+	GITERR_CHECK_ALLOC(peeled);
+
+	peeled->type = GIT_PKT_REF;
+	git_oid_cpy(&peeled->head.oid, &peeled_oid);
+
+	if ((peeled->head.name = git__malloc(strlen(refname) + 4)) == NULL)
+		goto on_error;
+
+	sprintf(peeled->head.name, "%s^{}", refname);
+
+	if (git_vector_insert(&t->refs, peeled) < 0)
+		goto on_error;
+
+	return 0;
+
+on_invalid:
+	giterr_set(GITERR_NET, "Invalid ls-refs response: '%s'", line);
+
+on_error:
+	if (pkt)
+		git_pkt_free((git_pkt *)pkt);
+	if (peeled)
+		git_pkt_free((git_pkt *)peeled);
+	return -1;
+}
+
+int git_smart__ls_refs(transport_smart *t, const git_strarray *prefixes)
+{
+	git_buf request = GIT_BUF_INIT, line = GIT_BUF_INIT;
+	enum git_pkt_type type;
+	size_t i;
+	int error;
+
+	git_pkt_buffer_line(&request, "command=ls-refs");
+	git_pkt_buffer_delim(&request);
+	git_pkt_buffer_line(&request, "symrefs");
+	git_pkt_buffer_line(&request, "peel");
+
+	for (i = 0; prefixes && i < prefixes->count; ++i) {
+		git_buf_clear(&line);
+		git_buf_printf(&line, "ref-prefix %s", prefixes->strings[i]);
+
+		if (git_buf_oom(&line))
+			break;
+
+		git_pkt_buffer_line(&request, line.ptr);
+	}
+
+	git_pkt_buffer_flush(&request);
+
+	if (git_buf_oom(&request) || git_buf_oom(&line)) {
+		error = -1;
+		goto done;
+	}
+
+	if ((error = git_smart__negotiation_step(
+			&t->parent, request.ptr, request.size)) < 0)
+		goto done;
+
+	while ((error = recv_line_v2(&type, &line, &t->buffer)) == 0 &&
+		type != GIT_PKT_FLUSH) {
+		if (type != GIT_PKT_LINE) {
+			giterr_set(GITERR_NET, "Unexpected pkt in ls-refs response");
+			error = -1;
+			break;
+		}
+
+		if ((error = store_ref_v2(t, line.ptr)) < 0)
+			break;
+	}
+
+done:
+	git_buf_free(&request);
+	git_buf_free(&line);
+	return error;
+}
+
 static int recv_pkt(git_pkt **out, gitno_buffer *buf)
 {
 	const char *ptr = buf->data, *line_end = ptr;
@@ -233,6 +554,35 @@ static int recv_pkt(git_pkt **out, gitno_buffer *buf)
 	return pkt_type;
 }
 
+/*
+ * Read the next side-band pkt-line without copying it out of the
+ * buffer. The view stays valid until `line_end` is consumed.
+ */
+static int recv_sideband(
+	git_pkt_view *view, const char **line_end, gitno_buffer *buf)
+{
+	int error, recvd;
+
+	while (1) {
+		if (buf->offset > 0)
+			error = git_pkt_parse_sideband(
+				view, buf->data, line_end, buf->offset);
+		else
+			error = GIT_EBUFS;
+
+		if (error != GIT_EBUFS)
+			return error;
+
+		if ((recvd = gitno_recv(buf)) < 0)
+			return recvd;
+
+		if (recvd == 0) {
+			giterr_set(GITERR_NET, "Early EOF");
+			return -1;
+		}
+	}
+}
+
 static int store_common(transport_smart *t)
 {
 	git_pkt *pkt = NULL;
@@ -256,47 +606,11 @@ static int store_common(transport_smart *t)
 	return 0;
 }
 
-static int fetch_setup_walk(git_revwalk **out, git_repository *repo)
+static int fetch_negotiator(
+	git_negotiator **out, transport_smart *t, git_repository *repo)
 {
-	git_revwalk *walk;
-	git_strarray refs;
-	unsigned int i;
-	git_reference *ref;
-	int error;
-
-	if ((error = git_reference_list(&refs, repo)) < 0)
-		return error;
-
-	if ((error = git_revwalk_new(&walk, repo)) < 0)
-		return error;
-
-	git_revwalk_sorting(walk, GIT_SORT_TIME);
-
-	for (i = 0; i < refs.count; ++i) {
-		/* No tags */
-		if (!git__prefixcmp(refs.strings[i], GIT_REFS_TAGS_DIR))
-			continue;
-
-		if ((error = git_reference_lookup(&ref, repo, refs.strings[i])) < 0)
-			goto on_error;
-
-		if (git_reference_type(ref) == GIT_REF_SYMBOLIC)
-			continue;
-
-		if ((error = git_revwalk_push(walk, git_reference_target(ref))) < 0)
-			goto on_error;
-
-		git_reference_free(ref);
-	}
-
-	git_strarray_free(&refs);
-	*out = walk;
-	return 0;
-
-on_error:
-	git_reference_free(ref);
-	git_strarray_free(&refs);
-	return error;
+	return git_negotiator_new(out, repo,
+		t->owner ? t->owner->negotiation : GIT_REMOTE_NEGOTIATION_DEFAULT);
 }
 
 static int wait_while_ack(gitno_buffer *buf)
@@ -325,70 +639,421 @@ static int wait_while_ack(gitno_buffer *buf)
 	return 0;
 }
 
-int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, const git_remote_head * const *wants, size_t count)
+static int buffer_oid_line(git_buf *buf, const char *cmd, const git_oid *oid)
 {
-	transport_smart *t = (transport_smart *)transport;
-	gitno_buffer *buf = &t->buffer;
-	git_buf data = GIT_BUF_INIT;
-	git_revwalk *walk = NULL;
-	int error = -1, pkt_type;
-	unsigned int i;
-	git_oid oid;
+	char line[GIT_OID_HEXSZ + 9];
 
-	if ((error = git_pkt_buffer_wants(wants, count, &t->caps, &data)) < 0)
-		return error;
+	p_snprintf(line, sizeof(line), "%s ", cmd);
+	git_oid_tostr(line + strlen(line), GIT_OID_HEXSZ + 1, oid);
 
-	if ((error = fetch_setup_walk(&walk, repo)) < 0)
-		goto on_error;
+	return git_pkt_buffer_line(buf, line);
+}
 
-	/*
-	 * Our support for ACK extensions is simply to parse them. On
-	 * the first ACK we will accept that as enough common
-	 * objects. We give up if we haven't found an answer in the
-	 * first 256 we send.
-	 */
-	i = 0;
-	while (i < 256) {
-		error = git_revwalk_next(&oid, walk);
+/* Whether this fetch limits the history it downloads */
+static bool fetch_deepens(transport_smart *t)
+{
+	return t->owner &&
+		(t->owner->depth > 0 || t->owner->deepen_since > 0);
+}
 
-		if (error < 0) {
-			if (GIT_ITEROVER == error)
-				break;
+/*
+ * Load the shallow commits we need to tell the server about, and
+ * check that it can deal with them and with the depth and filter we
+ * ask for.
+ */
+static int fetch_setup(transport_smart *t, git_repository *repo)
+{
+	int error;
 
-			goto on_error;
-		}
+	git_array_clear(t->shallow_roots);
+	git_array_clear(t->shallow_added);
+	git_array_clear(t->shallow_removed);
 
-		git_pkt_buffer_have(&oid, &data);
-		i++;
-		if (i % 20 == 0) {
-			if (t->cancelled.val) {
-				giterr_set(GITERR_NET, "The fetch was cancelled by the user");
-				error = GIT_EUSER;
-				goto on_error;
-			}
+	if ((error = git_shallow__roots(&t->shallow_roots, repo)) < 0)
+		return error;
 
-			git_pkt_buffer_flush(&data);
-			if (git_buf_oom(&data)) {
-				error = -1;
-				goto on_error;
-			}
+	if ((t->shallow_roots.size > 0 || fetch_deepens(t)) && !t->caps.shallow) {
+		giterr_set(GITERR_NET, "Remote does not support shallow fetches");
+		return -1;
+	}
 
-			if ((error = git_smart__negotiation_step(&t->parent, data.ptr, data.size)) < 0)
-				goto on_error;
+	if (fetch_deepens(t) && !t->owner->depth && !t->caps.deepen_since) {
+		giterr_set(GITERR_NET, "Remote does not support deepening by date");
+		return -1;
+	}
 
-			git_buf_clear(&data);
-			if (t->caps.multi_ack || t->caps.multi_ack_detailed) {
-				if ((error = store_common(t)) < 0)
-					goto on_error;
-			} else {
-				pkt_type = recv_pkt(NULL, buf);
+	if (t->owner && t->owner->filter && !t->caps.filter) {
+		giterr_set(GITERR_NET, "Remote does not support object filters");
+		return -1;
+	}
 
-				if (pkt_type == GIT_PKT_ACK) {
-					break;
-				} else if (pkt_type == GIT_PKT_NAK) {
-					continue;
-				} else if (pkt_type < 0) {
-					/* recv_pkt returned an error */
+	return 0;
+}
+
+/* Our shallow commits, the depth and the filter, which follow the wants */
+static int buffer_fetch_limits(transport_smart *t, git_buf *buf)
+{
+	char line[64];
+	uint32_t i;
+
+	for (i = 0; i < t->shallow_roots.size; ++i)
+		buffer_oid_line(buf, "shallow", &t->shallow_roots.ptr[i]);
+
+	if (fetch_deepens(t)) {
+		if (t->owner->depth > 0)
+			p_snprintf(line, sizeof(line), "deepen %d", t->owner->depth);
+		else
+			p_snprintf(line, sizeof(line), "deepen-since %" PRId64,
+				(int64_t)t->owner->deepen_since);
+
+		git_pkt_buffer_line(buf, line);
+	}
+
+	if (t->owner && t->owner->filter) {
+		git_buf filter = GIT_BUF_INIT;
+
+		if (git_buf_printf(&filter, GIT_CAP_FILTER " %s", t->owner->filter) < 0)
+			return -1;
+
+		git_pkt_buffer_line(buf, filter.ptr);
+		git_buf_free(&filter);
+	}
+
+	return git_buf_oom(buf) ? -1 : 0;
+}
+
+static int buffer_wants(
+	transport_smart *t,
+	const git_remote_head * const *wants,
+	size_t count,
+	git_buf *buf)
+{
+	int error;
+
+	if ((error = git_pkt_buffer_wants(wants, count, &t->caps, buf)) < 0 ||
+		(error = buffer_fetch_limits(t, buf)) < 0)
+		return error;
+
+	return git_pkt_buffer_flush(buf);
+}
+
+static int store_shallow(transport_smart *t, const git_oid *oid, bool shallow)
+{
+	git_oid *id = shallow ?
+		git_array_alloc(t->shallow_added) :
+		git_array_alloc(t->shallow_removed);
+
+	GITERR_CHECK_ALLOC(id);
+	git_oid_cpy(id, oid);
+
+	return 0;
+}
+
+/*
+ * When we deepen, the server answers our wants with the commits which
+ * become shallow or stop being so, up to a flush. A stateless server
+ * starts every response with it.
+ */
+static int recv_shallow_list(transport_smart *t, bool *received)
+{
+	git_pkt *pkt = NULL;
+	int error;
+
+	if (!fetch_deepens(t) || (*received && !t->rpc))
+		return 0;
+
+	*received = true;
+
+	while ((error = recv_pkt(&pkt, &t->buffer)) >= 0) {
+		if (pkt->type == GIT_PKT_FLUSH)
+			break;
+
+		if (pkt->type != GIT_PKT_SHALLOW && pkt->type != GIT_PKT_UNSHALLOW) {
+			giterr_set(GITERR_NET, "Unexpected pkt type in shallow list");
+			error = -1;
+			break;
+		}
+
+		if ((error = store_shallow(t, &((git_pkt_shallow *)pkt)->oid,
+				pkt->type == GIT_PKT_SHALLOW)) < 0)
+			break;
+
+		git__free(pkt);
+		pkt = NULL;
+	}
+
+	git__free(pkt);
+	return error < 0 ? error : 0;
+}
+
+static bool is_common(transport_smart *t, const git_oid *oid)
+{
+	git_pkt_ack *pkt;
+	size_t i;
+
+	git_vector_foreach(&t->common, i, pkt) {
+		if (git_oid_equal(&pkt->oid, oid))
+			return true;
+	}
+
+	return false;
+}
+
+static int store_ack_v2(transport_smart *t, const char *line)
+{
+	git_pkt_ack *pkt;
+	git_oid oid;
+
+	if (strlen(line) < GIT_OID_HEXSZ ||
+		git_oid_fromstrn(&oid, line, GIT_OID_HEXSZ) < 0) {
+		giterr_set(GITERR_NET, "Invalid ACK in fetch response");
+		return -1;
+	}
+
+	if (is_common(t, &oid))
+		return 0;
+
+	pkt = git__calloc(1, sizeof(git_pkt_ack));
+	GITERR_CHECK_ALLOC(pkt);
+
+	pkt->type = GIT_PKT_ACK;
+	pkt->status = GIT_ACK_COMMON;
+	git_oid_cpy(&pkt->oid, &oid);
+
+	return git_vector_insert(&t->common, pkt);
+}
+
+/*
+ * Read the response to a v2 fetch request, up to the start of the
+ * packfile section. Returns 1 when the packfile follows, or 0 if the
+ * server has only acknowledged our haves and wants another round.
+ */
+static int store_shallow_v2(transport_smart *t, const char *line)
+{
+	git_oid oid;
+	bool shallow = !git__prefixcmp(line, "shallow ");
+
+	if (!shallow && git__prefixcmp(line, "unshallow ")) {
+		giterr_set(GITERR_NET, "Invalid shallow-info line in fetch response");
+		return -1;
+	}
+
+	line = strchr(line, ' ') + 1;
+	if (strlen(line) < GIT_OID_HEXSZ ||
+		git_oid_fromstrn(&oid, line, GIT_OID_HEXSZ) < 0) {
+		giterr_set(GITERR_NET, "Invalid shallow-info line in fetch response");
+		return -1;
+	}
+
+	return store_shallow(t, &oid, shallow);
+}
+
+static int recv_fetch_response_v2(transport_smart *t)
+{
+	git_buf line = GIT_BUF_INIT;
+	enum git_pkt_type type;
+	bool in_section = false, acks = false, shallow_info = false;
+	int error;
+
+	while ((error = recv_line_v2(&type, &line, &t->buffer)) == 0) {
+		if (type == GIT_PKT_FLUSH)
+			break;
+
+		if (type == GIT_PKT_DELIM) {
+			in_section = false;
+			continue;
+		}
+
+		if (!in_section) {
+			if (!strcmp(line.ptr, "packfile")) {
+				error = 1;
+				break;
+			}
+
+			/* wanted-refs and the like are skipped over */
+			acks = !strcmp(line.ptr, "acknowledgments");
+			shallow_info = !strcmp(line.ptr, "shallow-info");
+			in_section = true;
+			continue;
+		}
+
+		if (acks && !git__prefixcmp(line.ptr, "ACK ") &&
+			(error = store_ack_v2(t, line.ptr + 4)) < 0)
+			break;
+
+		if (shallow_info && (error = store_shallow_v2(t, line.ptr)) < 0)
+			break;
+	}
+
+	git_buf_free(&line);
+	return error;
+}
+
+/*
+ * Protocol v2 is stateless even over a persistent connection, so every
+ * round repeats our wants and the haves the server has acknowledged.
+ * Like the v0 negotiation, we consider the first common commits to be
+ * enough and ask for the pack once we have some.
+ */
+static int negotiate_fetch_v2(
+	transport_smart *t,
+	git_repository *repo,
+	const git_remote_head * const *wants,
+	size_t count)
+{
+	git_buf data = GIT_BUF_INIT;
+	git_negotiator *negotiator = NULL;
+	git_pkt_ack *ack;
+	git_oid oid;
+	size_t i, sent = 0, round;
+	bool done = false;
+	int error;
+
+	if ((error = fetch_setup(t, repo)) < 0 ||
+		(error = fetch_negotiator(&negotiator, t, repo)) < 0)
+		goto on_error;
+
+	while (1) {
+		git_buf_clear(&data);
+		git_pkt_buffer_line(&data, "command=fetch");
+		git_pkt_buffer_delim(&data);
+		git_pkt_buffer_line(&data, GIT_CAP_THIN_PACK);
+		git_pkt_buffer_line(&data, GIT_CAP_OFS_DELTA);
+		git_pkt_buffer_line(&data, GIT_CAP_INCLUDE_TAG);
+
+		for (i = 0; i < count; ++i) {
+			if (!wants[i]->local)
+				buffer_oid_line(&data, "want", &wants[i]->oid);
+		}
+
+		buffer_fetch_limits(t, &data);
+
+		git_vector_foreach(&t->common, i, ack)
+			buffer_oid_line(&data, "have", &ack->oid);
+
+		for (round = 0; !done && t->common.length == 0 &&
+			round < FETCH_V2_HAVES_PER_ROUND; ++round) {
+			if ((error = git_negotiator_next(&oid, negotiator)) == GIT_ITEROVER)
+				break;
+			else if (error < 0)
+				goto on_error;
+
+			buffer_oid_line(&data, "have", &oid);
+			sent++;
+		}
+
+		if (t->common.length > 0 || round < FETCH_V2_HAVES_PER_ROUND ||
+			sent >= FETCH_MAX_HAVES)
+			done = true;
+
+		if (done)
+			git_pkt_buffer_line(&data, "done");
+
+		git_pkt_buffer_flush(&data);
+
+		if (git_buf_oom(&data)) {
+			error = -1;
+			goto on_error;
+		}
+
+		if (t->cancelled.val) {
+			giterr_set(GITERR_NET, "The fetch was cancelled by the user");
+			error = GIT_EUSER;
+			goto on_error;
+		}
+
+		if ((error = git_smart__negotiation_step(&t->parent, data.ptr, data.size)) < 0 ||
+			(error = recv_fetch_response_v2(t)) < 0)
+			goto on_error;
+
+		if (error == 1)
+			break;
+
+		if (done) {
+			giterr_set(GITERR_NET, "Remote did not send a packfile");
+			error = -1;
+			goto on_error;
+		}
+	}
+
+	error = 0;
+
+on_error:
+	git_negotiator_free(negotiator);
+	git_buf_free(&data);
+	return error;
+}
+
+int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, const git_remote_head * const *wants, size_t count)
+{
+	transport_smart *t = (transport_smart *)transport;
+	gitno_buffer *buf = &t->buffer;
+	git_buf data = GIT_BUF_INIT;
+	git_negotiator *negotiator = NULL;
+	int error = -1, pkt_type;
+	unsigned int i;
+	bool shallow_received = false;
+	git_oid oid;
+
+	if (t->version == 2)
+		return negotiate_fetch_v2(t, repo, wants, count);
+
+	if ((error = fetch_setup(t, repo)) < 0 ||
+		(error = buffer_wants(t, wants, count, &data)) < 0)
+		return error;
+
+	if ((error = fetch_negotiator(&negotiator, t, repo)) < 0)
+		goto on_error;
+
+	/*
+	 * Our support for ACK extensions is simply to parse them. On
+	 * the first ACK we will accept that as enough common
+	 * objects. We give up if we haven't found an answer in the
+	 * first 256 we send.
+	 */
+	i = 0;
+	while (i < 256) {
+		error = git_negotiator_next(&oid, negotiator);
+
+		if (error < 0) {
+			if (GIT_ITEROVER == error)
+				break;
+
+			goto on_error;
+		}
+
+		git_pkt_buffer_have(&oid, &data);
+		i++;
+		if (i % 20 == 0) {
+			if (t->cancelled.val) {
+				giterr_set(GITERR_NET, "The fetch was cancelled by the user");
+				error = GIT_EUSER;
+				goto on_error;
+			}
+
+			git_pkt_buffer_flush(&data);
+			if (git_buf_oom(&data)) {
+				error = -1;
+				goto on_error;
+			}
+
+			if ((error = git_smart__negotiation_step(&t->parent, data.ptr, data.size)) < 0 ||
+				(error = recv_shallow_list(t, &shallow_received)) < 0)
+				goto on_error;
+
+			git_buf_clear(&data);
+			if (t->caps.multi_ack || t->caps.multi_ack_detailed) {
+				if ((error = store_common(t)) < 0)
+					goto on_error;
+			} else {
+				pkt_type = recv_pkt(NULL, buf);
+
+				if (pkt_type == GIT_PKT_ACK) {
+					break;
+				} else if (pkt_type == GIT_PKT_NAK) {
+					continue;
+				} else if (pkt_type < 0) {
+					/* recv_pkt returned an error */
 					error = pkt_type;
 					goto on_error;
 				} else {
@@ -406,7 +1071,7 @@ int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, c
 			git_pkt_ack *pkt;
 			unsigned int i;
 
-			if ((error = git_pkt_buffer_wants(wants, count, &t->caps, &data)) < 0)
+			if ((error = buffer_wants(t, wants, count, &data)) < 0)
 				goto on_error;
 
 			git_vector_foreach(&t->common, i, pkt) {
@@ -426,7 +1091,7 @@ int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, c
 		git_pkt_ack *pkt;
 		unsigned int i;
 
-		if ((error = git_pkt_buffer_wants(wants, count, &t->caps, &data)) < 0)
+		if ((error = buffer_wants(t, wants, count, &data)) < 0)
 			goto on_error;
 
 		git_vector_foreach(&t->common, i, pkt) {
@@ -448,11 +1113,12 @@ int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, c
 		error = GIT_EUSER;
 		goto on_error;
 	}
-	if ((error = git_smart__negotiation_step(&t->parent, data.ptr, data.size)) < 0)
+	if ((error = git_smart__negotiation_step(&t->parent, data.ptr, data.size)) < 0 ||
+		(error = recv_shallow_list(t, &shallow_received)) < 0)
 		goto on_error;
 
 	git_buf_free(&data);
-	git_revwalk_free(walk);
+	git_negotiator_free(negotiator);
 
 	/* Now let's eat up whatever the server gives us */
 	if (!t->caps.multi_ack && !t->caps.multi_ack_detailed) {
@@ -471,14 +1137,334 @@ int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, c
 	return error;
 
 on_error:
-	git_revwalk_free(walk);
+	git_negotiator_free(negotiator);
 	git_buf_free(&data);
 	return error;
 }
 
-static int no_sideband(transport_smart *t, struct git_odb_writepack *writepack, gitno_buffer *buf, git_transfer_progress *stats)
+/* The size of the ring buffer between the network and the indexer */
+#define PACK_PIPE_SIZE (1024 * 1024)
+
+/* Which of the pipe's lock and conditions have been set up */
+#define PACK_PIPE_LOCK (1u << 0)
+#define PACK_PIPE_NOT_EMPTY (1u << 1)
+#define PACK_PIPE_NOT_FULL (1u << 2)
+
+/*
+ * Receiving the pack and indexing it both take their time, so with
+ * threads we let them overlap: the network side fills a bounded ring
+ * buffer which a separate thread drains into the writepack. When the
+ * buffer is full, the network side waits for the indexer and stops
+ * reading from the socket. The progress callbacks are called from
+ * both threads, but never concurrently.
+ *
+ * Each side counts its progress in its own copy of the stats: the
+ * indexer in `stats`, the network side in `network`. They trade their
+ * numbers through `shared` while holding the lock.
+ */
+typedef struct {
+	struct git_odb_writepack *writepack;
+	git_transfer_progress *stats;
+	git_transfer_progress network;
+	git_transfer_progress_cb progress_cb;
+	void *progress_payload;
+#ifdef GIT_THREADS
+	git_mutex cb_lock;
+	git_thread thread;
+	git_mutex lock;
+	git_cond not_empty, not_full;
+	unsigned int initialized;
+	git_transfer_progress shared;
+	char *data;
+	size_t start, used;
+	int error;
+	int error_class;
+	char *error_msg;
+	unsigned eof : 1,
+		aborted : 1;
+	/* not a bit field: only the network side touches it, unlocked */
+	bool threaded;
+#endif
+} pack_pipe;
+
+#ifdef GIT_THREADS
+# define pack_pipe_lock_callbacks(p) git_mutex_lock(&(p)->cb_lock)
+# define pack_pipe_unlock_callbacks(p) git_mutex_unlock(&(p)->cb_lock)
+#else
+# define pack_pipe_lock_callbacks(p) (void)0
+# define pack_pipe_unlock_callbacks(p) (void)0
+#endif
+
+static int pack_pipe_progress(const git_transfer_progress *stats, void *payload)
+{
+	pack_pipe *pipe = payload;
+	int error;
+
+	pack_pipe_lock_callbacks(pipe);
+	error = pipe->progress_cb(stats, pipe->progress_payload);
+	pack_pipe_unlock_callbacks(pipe);
+
+	return error;
+}
+
+/* Copy over the numbers only the network side keeps up to date */
+static void progress_take_network(
+	git_transfer_progress *to, const git_transfer_progress *from)
+{
+	to->received_bytes = from->received_bytes;
+	to->network_time = from->network_time;
+	to->bytes_per_second = from->bytes_per_second;
+}
+
+static int pack_pipe_init(
+	pack_pipe *pipe,
+	git_transfer_progress *stats,
+	git_transfer_progress_cb progress_cb,
+	void *progress_payload)
+{
+	memset(pipe, 0, sizeof(*pipe));
+
+	pipe->stats = stats;
+	pipe->progress_cb = progress_cb;
+	pipe->progress_payload = progress_payload;
+
+#ifdef GIT_THREADS
+	if (git_mutex_init(&pipe->cb_lock) < 0) {
+		giterr_set(GITERR_OS, "Failed to initialize pack pipe mutex");
+		return -1;
+	}
+#endif
+
+	return 0;
+}
+
+#ifdef GIT_THREADS
+
+static void *pack_pipe_indexer(void *payload)
+{
+	pack_pipe *pipe = payload;
+	const git_error *e;
+	size_t len;
+	int error = 0;
+
+	git_mutex_lock(&pipe->lock);
+
+	while (1) {
+		while (!pipe->used && !pipe->eof && !pipe->aborted)
+			git_cond_wait(&pipe->not_empty, &pipe->lock);
+
+		if (!pipe->used || pipe->aborted)
+			break;
+
+		/* The writer doesn't touch what we haven't consumed yet */
+		len = min(pipe->used, PACK_PIPE_SIZE - pipe->start);
+		progress_take_network(pipe->stats, &pipe->shared);
+		git_mutex_unlock(&pipe->lock);
+
+		error = pipe->writepack->append(
+			pipe->writepack, pipe->data + pipe->start, len, pipe->stats);
+
+		git_mutex_lock(&pipe->lock);
+
+		progress_take_network(pipe->stats, &pipe->shared);
+		pipe->shared = *pipe->stats;
+
+		if (error < 0 || pipe->aborted)
+			break;
+
+		pipe->start = (pipe->start + len) % PACK_PIPE_SIZE;
+		pipe->used -= len;
+		git_cond_signal(&pipe->not_full);
+	}
+
+	/* Errors are per thread, so hand it over to the network side */
+	if (error < 0) {
+		pipe->error = error;
+
+		if ((e = giterr_last()) != NULL) {
+			pipe->error_class = e->klass;
+			pipe->error_msg = git__strdup(e->message);
+		}
+
+		git_cond_signal(&pipe->not_full);
+	}
+
+	git_mutex_unlock(&pipe->lock);
+	return NULL;
+}
+
+static int pack_pipe_error(pack_pipe *pipe)
+{
+	if (pipe->error_msg)
+		giterr_set_str(pipe->error_class, pipe->error_msg);
+	else
+		giterr_clear();
+
+	return pipe->error;
+}
+
+static int pack_pipe_start(pack_pipe *pipe, struct git_odb_writepack *writepack)
+{
+	pipe->writepack = writepack;
+
+	if ((pipe->data = git__malloc(PACK_PIPE_SIZE)) == NULL)
+		return -1;
+
+	if (git_mutex_init(&pipe->lock) < 0)
+		goto on_error;
+	pipe->initialized |= PACK_PIPE_LOCK;
+
+	if (git_cond_init(&pipe->not_empty) < 0)
+		goto on_error;
+	pipe->initialized |= PACK_PIPE_NOT_EMPTY;
+
+	if (git_cond_init(&pipe->not_full) < 0)
+		goto on_error;
+	pipe->initialized |= PACK_PIPE_NOT_FULL;
+
+	pipe->shared = *pipe->stats;
+
+	/* We can still index as we receive */
+	if (git_thread_create(&pipe->thread, NULL, pack_pipe_indexer, pipe) == 0)
+		pipe->threaded = true;
+
+	return 0;
+
+on_error:
+	giterr_set(GITERR_OS, "Failed to initialize pack pipe");
+	return -1;
+}
+
+static int pack_pipe_write(pack_pipe *pipe, const char *data, size_t len)
+{
+	size_t end, n;
+	int error = 0;
+
+	if (!pipe->threaded)
+		return pipe->writepack->append(pipe->writepack, data, len, pipe->stats);
+
+	git_mutex_lock(&pipe->lock);
+
+	while (len > 0) {
+		while (pipe->used == PACK_PIPE_SIZE && !pipe->error)
+			git_cond_wait(&pipe->not_full, &pipe->lock);
+
+		if (pipe->error) {
+			error = pack_pipe_error(pipe);
+			break;
+		}
+
+		end = (pipe->start + pipe->used) % PACK_PIPE_SIZE;
+		n = min(len, PACK_PIPE_SIZE - pipe->used);
+		n = min(n, PACK_PIPE_SIZE - end);
+
+		memcpy(pipe->data + end, data, n);
+		pipe->used += n;
+		data += n;
+		len -= n;
+
+		git_cond_signal(&pipe->not_empty);
+	}
+
+	git_mutex_unlock(&pipe->lock);
+	return error;
+}
+
+/*
+ * Hand the network side's numbers to the indexer and bring `network`
+ * up to date with how far the indexer has got.
+ */
+static void pack_pipe_publish(pack_pipe *pipe)
+{
+	if (!pipe->threaded) {
+		progress_take_network(pipe->stats, &pipe->network);
+		pipe->network = *pipe->stats;
+		return;
+	}
+
+	git_mutex_lock(&pipe->lock);
+	progress_take_network(&pipe->shared, &pipe->network);
+	pipe->network = pipe->shared;
+	git_mutex_unlock(&pipe->lock);
+}
+
+/* Wait until everything we've received is indexed */
+static int pack_pipe_finish(pack_pipe *pipe)
 {
-	int recvd;
+	if (pipe->threaded) {
+		git_mutex_lock(&pipe->lock);
+		pipe->eof = 1;
+		git_cond_signal(&pipe->not_empty);
+		git_mutex_unlock(&pipe->lock);
+
+		git_thread_join(&pipe->thread, NULL);
+		pipe->threaded = false;
+	}
+
+	pack_pipe_publish(pipe);
+
+	return pipe->error ? pack_pipe_error(pipe) : 0;
+}
+
+static void pack_pipe_free(pack_pipe *pipe)
+{
+	if (pipe->threaded) {
+		/* Bail out early, the pack is broken anyway */
+		git_mutex_lock(&pipe->lock);
+		pipe->aborted = 1;
+		git_cond_signal(&pipe->not_empty);
+		git_mutex_unlock(&pipe->lock);
+
+		pack_pipe_finish(pipe);
+	}
+
+	if (pipe->initialized & PACK_PIPE_NOT_FULL)
+		git_cond_free(&pipe->not_full);
+	if (pipe->initialized & PACK_PIPE_NOT_EMPTY)
+		git_cond_free(&pipe->not_empty);
+	if (pipe->initialized & PACK_PIPE_LOCK)
+		git_mutex_free(&pipe->lock);
+
+	git__free(pipe->data);
+	git__free(pipe->error_msg);
+	git_mutex_free(&pipe->cb_lock);
+}
+
+#else
+
+static int pack_pipe_start(pack_pipe *pipe, struct git_odb_writepack *writepack)
+{
+	pipe->writepack = writepack;
+	return 0;
+}
+
+static int pack_pipe_write(pack_pipe *pipe, const char *data, size_t len)
+{
+	return pipe->writepack->append(pipe->writepack, data, len, pipe->stats);
+}
+
+static void pack_pipe_publish(pack_pipe *pipe)
+{
+	progress_take_network(pipe->stats, &pipe->network);
+	pipe->network = *pipe->stats;
+}
+
+static int pack_pipe_finish(pack_pipe *pipe)
+{
+	pack_pipe_publish(pipe);
+	return 0;
+}
+
+static void pack_pipe_free(pack_pipe *pipe)
+{
+	GIT_UNUSED(pipe);
+}
+
+#endif
+
+static int no_sideband(transport_smart *t, pack_pipe *pipe, gitno_buffer *buf)
+{
+	int recvd, error;
 
 	do {
 		if (t->cancelled.val) {
@@ -486,8 +1472,8 @@ static int no_sideband(transport_smart *t, struct git_odb_writepack *writepack,
 			return GIT_EUSER;
 		}
 
-		if (writepack->append(writepack, buf->data, buf->offset, stats) < 0)
-			return -1;
+		if ((error = pack_pipe_write(pipe, buf->data, buf->offset)) < 0)
+			return error;
 
 		gitno_consume_n(buf, buf->offset);
 
@@ -495,9 +1481,6 @@ static int no_sideband(transport_smart *t, struct git_odb_writepack *writepack,
 			return recvd;
 	} while(recvd > 0);
 
-	if (writepack->commit(writepack, stats) < 0)
-		return -1;
-
 	return 0;
 }
 
@@ -505,28 +1488,62 @@ struct network_packetsize_payload
 {
 	git_transfer_progress_cb callback;
 	void *payload;
+	pack_pipe *pipe;
 	git_transfer_progress *stats;
 	size_t last_fired_bytes;
+	double start_time, last_fired_time;
 };
 
-static int network_packetsize(size_t received, void *payload)
+static void network_update_rate(struct network_packetsize_payload *npp, double now)
+{
+	double elapsed = now - npp->start_time;
+
+	if (elapsed > 0)
+		npp->stats->bytes_per_second = npp->stats->received_bytes / elapsed;
+}
+
+static int network_packetsize(size_t received, double elapsed, void *payload)
 {
 	struct network_packetsize_payload *npp = (struct network_packetsize_payload*)payload;
+	bool fire = false;
+	double now;
 
 	/* Accumulate bytes */
 	npp->stats->received_bytes += received;
+	npp->stats->network_time += elapsed;
 
 	/* Fire notification if the threshold is reached */
-	if ((npp->stats->received_bytes - npp->last_fired_bytes) > NETWORK_XFER_THRESHOLD) {
-		npp->last_fired_bytes = npp->stats->received_bytes;
-
-		if (npp->callback(npp->stats, npp->payload))
-			return GIT_EUSER;
+	if (npp->callback &&
+		(npp->stats->received_bytes - npp->last_fired_bytes) > NETWORK_XFER_THRESHOLD) {
+		now = git__timer();
+
+		if (git_indexer__progress_interval <= 0 ||
+			(now - npp->last_fired_time) * 1000 >= git_indexer__progress_interval) {
+			npp->last_fired_bytes = npp->stats->received_bytes;
+			npp->last_fired_time = now;
+			network_update_rate(npp, now);
+			fire = true;
+		}
 	}
 
+	/* This also brings in the indexer's side for the callback */
+	pack_pipe_publish(npp->pipe);
+
+	if (fire && npp->callback(npp->stats, npp->payload))
+		return GIT_EUSER;
+
 	return 0;
 }
 
+static int sideband_error(const char *msg, size_t len)
+{
+	while (len > 0 && msg[len - 1] == '\n')
+		len--;
+
+	giterr_set(GITERR_NET, "Remote error: %.*s", (int)len, msg);
+	return -1;
+}
+
 int git_smart__download_pack(
 	git_transport *transport,
 	git_repository *repo,
@@ -540,24 +1557,40 @@ int git_smart__download_pack(
 	struct git_odb_writepack *writepack = NULL;
 	int error = 0;
 	struct network_packetsize_payload npp = {0};
+	pack_pipe pipe;
 
 	memset(stats, 0, sizeof(git_transfer_progress));
 
+	if ((error = pack_pipe_init(&pipe, stats, transfer_progress_cb, progress_payload)) < 0)
+		return error;
+
+	/* The byte count and network time are kept even without a callback */
 	if (transfer_progress_cb) {
-		npp.callback = transfer_progress_cb;
-		npp.payload = progress_payload;
-		npp.stats = stats;
-		t->packetsize_cb = &network_packetsize;
-		t->packetsize_payload = &npp;
-
-		/* We might have something in the buffer already from negotiate_fetch */
-		if (t->buffer.offset > 0 && !t->cancelled.val)
-			if (t->packetsize_cb(t->buffer.offset, t->packetsize_payload))
-				git_atomic_set(&t->cancelled, 1);
+		npp.callback = pack_pipe_progress;
+		npp.payload = &pipe;
 	}
 
+	npp.pipe = &pipe;
+	npp.stats = &pipe.network;
+	npp.start_time = git__timer();
+	t->packetsize_cb = &network_packetsize;
+	t->packetsize_payload = &npp;
+
+	/* We might have something in the buffer already from negotiate_fetch */
+	if (t->buffer.offset > 0 && !t->cancelled.val)
+		if (t->packetsize_cb(t->buffer.offset, 0, t->packetsize_payload))
+			git_atomic_set(&t->cancelled, 1);
+
 	if ((error = git_repository_odb__weakptr(&odb, repo)) < 0 ||
-		((error = git_odb_write_pack(&writepack, odb, transfer_progress_cb, progress_payload)) != 0))
+		((error = git_odb_write_pack(&writepack, odb,
+			transfer_progress_cb ? pack_pipe_progress : NULL, &pipe)) != 0))
+		goto done;
+
+	if (t->owner && t->owner->promisor &&
+		(error = git_odb__writepack_promisor(writepack)) < 0)
+		goto done;
+
+	if ((error = pack_pipe_start(&pipe, writepack)) < 0)
 		goto done;
 
 	/*
@@ -566,45 +1599,69 @@ int git_smart__download_pack(
 	 * check which one belongs there.
 	 */
 	if (!t->caps.side_band && !t->caps.side_band_64k) {
-		error = no_sideband(t, writepack, buf, stats);
-		goto done;
-	}
+		if ((error = no_sideband(t, &pipe, buf)) < 0)
+			goto done;
+	} else {
+		git_pkt_view pkt;
+		const char *line_end;
 
-	do {
-		git_pkt *pkt = NULL;
+		do {
+			/* Check cancellation before network call */
+			if (t->cancelled.val) {
+				giterr_clear();
+				error = GIT_EUSER;
+				goto done;
+			}
 
-		/* Check cancellation before network call */
-		if (t->cancelled.val) {
-			giterr_clear();
-			error = GIT_EUSER;
-			goto done;
-		}
+			if ((error = recv_sideband(&pkt, &line_end, buf)) < 0)
+				goto done;
 
-		if ((error = recv_pkt(&pkt, buf)) >= 0) {
 			/* Check cancellation after network call */
 			if (t->cancelled.val) {
 				giterr_clear();
 				error = GIT_EUSER;
-			} else if (pkt->type == GIT_PKT_PROGRESS) {
+				goto done;
+			}
+
+			/*
+			 * The payload still lives in the receive buffer, so it
+			 * must be handed off before the line is consumed.
+			 */
+			switch (pkt.type) {
+			case GIT_PKT_DATA:
+				error = pack_pipe_write(&pipe, pkt.data, pkt.len);
+				break;
+			case GIT_PKT_PROGRESS:
 				if (t->progress_cb) {
-					git_pkt_progress *p = (git_pkt_progress *) pkt;
-					error = t->progress_cb(p->data, p->len, t->message_cb_payload);
+					pack_pipe_lock_callbacks(&pipe);
+					error = t->progress_cb(pkt.data, (int)pkt.len, t->message_cb_payload);
+					pack_pipe_unlock_callbacks(&pipe);
 				}
-			} else if (pkt->type == GIT_PKT_DATA) {
-				git_pkt_data *p = (git_pkt_data *) pkt;
-				error = writepack->append(writepack, p->data, p->len, stats);
-			} else if (pkt->type == GIT_PKT_FLUSH) {
-				/* A flush indicates the end of the packfile */
-				git__free(pkt);
+				break;
+			case GIT_PKT_ERR:
+				error = sideband_error(pkt.data, pkt.len);
+				break;
+			case GIT_PKT_LINE:
+				if (pkt.len >= 4 && !memcmp(pkt.data, "ERR ", 4))
+					error = sideband_error(pkt.data + 4, pkt.len - 4);
+				break;
+			default:
 				break;
 			}
-		}
 
-		git__free(pkt);
-		if (error < 0)
-			goto done;
+			gitno_consume(buf, line_end);
 
-	} while (1);
+			if (error < 0)
+				goto done;
+
+			/* A flush indicates the end of the packfile */
+		} while (pkt.type != GIT_PKT_FLUSH);
+	}
+
+	network_update_rate(&npp, git__timer());
+
+	if ((error = pack_pipe_finish(&pipe)) < 0)
+		goto done;
 
 	/*
 	 * Trailing execution of transfer_progress_cb, if necessary...
@@ -621,60 +1678,105 @@ int git_smart__download_pack(
 			goto done;
 	}
 
-	error = writepack->commit(writepack, stats);
+	if ((error = writepack->commit(writepack, stats)) < 0)
+		goto done;
+
+	if (t->owner)
+		error = git_fetch__received_pack(t->owner, writepack);
 
 done:
+	/* Only now that we have the objects does the new depth apply */
+	if (!error && (t->shallow_added.size || t->shallow_removed.size))
+		error = git_shallow__update(repo, &t->shallow_added, &t->shallow_removed);
+
+	git_array_clear(t->shallow_added);
+	git_array_clear(t->shallow_removed);
+
+	pack_pipe_free(&pipe);
 	if (writepack)
 		writepack->free(writepack);
-	if (transfer_progress_cb) {
-		t->packetsize_cb = NULL;
-		t->packetsize_payload = NULL;
-	}
+	t->packetsize_cb = NULL;
+	t->packetsize_payload = NULL;
 
 	return error;
 }
 
-static int gen_pktline(git_buf *buf, git_push *push)
+static int buffer_command(
+	git_buf *buf, git_push *push, push_spec *spec, bool first)
 {
-	push_spec *spec;
-	size_t i, len;
-	char old_id[41], new_id[41];
+	size_t len;
+	char old_id[GIT_OID_HEXSZ+1], new_id[GIT_OID_HEXSZ+1];
 
-	old_id[40] = '\0'; new_id[40] = '\0';
-
-	git_vector_foreach(&push->specs, i, spec) {
-		len = 2*GIT_OID_HEXSZ + 7 + strlen(spec->rref);
+	len = 2*GIT_OID_HEXSZ + 7 + strlen(spec->rref);
 
-		if (i == 0) {
-			++len; /* '\0' */
-			if (push->report_status)
-				len += strlen(GIT_CAP_REPORT_STATUS) + 1;
-			len += strlen(GIT_CAP_SIDE_BAND_64K) + 1;
-		}
+	if (first) {
+		++len; /* '\0' */
+		if (push->report_status)
+			len += strlen(GIT_CAP_REPORT_STATUS) + 1;
+		len += strlen(GIT_CAP_SIDE_BAND_64K) + 1;
+	}
 
-		git_oid_fmt(old_id, &spec->roid);
-		git_oid_fmt(new_id, &spec->loid);
+	git_oid_tostr(old_id, sizeof(old_id), &spec->roid);
+	git_oid_tostr(new_id, sizeof(new_id), &spec->loid);
 
-		git_buf_printf(buf, "%04"PRIxZ"%s %s %s", len, old_id, new_id, spec->rref);
+	git_buf_printf(buf, "%04"PRIxZ"%s %s %s", len, old_id, new_id, spec->rref);
 
-		if (i == 0) {
-			git_buf_putc(buf, '\0');
-			/* Core git always starts their capabilities string with a space */
-			if (push->report_status) {
-				git_buf_putc(buf, ' ');
-				git_buf_printf(buf, GIT_CAP_REPORT_STATUS);
-			}
+	if (first) {
+		git_buf_putc(buf, '\0');
+		/* Core git always starts their capabilities string with a space */
+		if (push->report_status) {
 			git_buf_putc(buf, ' ');
-			git_buf_printf(buf, GIT_CAP_SIDE_BAND_64K);
+			git_buf_printf(buf, GIT_CAP_REPORT_STATUS);
 		}
-
-		git_buf_putc(buf, '\n');
+		git_buf_putc(buf, ' ');
+		git_buf_printf(buf, GIT_CAP_SIDE_BAND_64K);
 	}
 
-	git_buf_puts(buf, "0000");
+	git_buf_putc(buf, '\n');
+
 	return git_buf_oom(buf) ? -1 : 0;
 }
 
+/*
+ * Send the update commands, a batch at a time, so a push of many refs
+ * doesn't have to hold the whole list in memory.
+ */
+static int send_commands(git_smart_subtransport_stream *stream, git_push *push)
+{
+	git_buf buf = GIT_BUF_INIT;
+	push_spec *spec;
+	size_t i;
+	int error = 0;
+
+	git_vector_foreach(&push->specs, i, spec) {
+		if ((error = buffer_command(&buf, push, spec, i == 0)) < 0)
+			goto done;
+
+		if (git_buf_len(&buf) < PUSH_COMMANDS_BUFSIZE)
+			continue;
+
+		if ((error = stream->write(stream, git_buf_cstr(&buf), git_buf_len(&buf))) < 0)
+			goto done;
+
+		git_buf_clear(&buf);
+	}
+
+	if (git_buf_puts(&buf, "0000") < 0) {
+		error = -1;
+		goto done;
+	}
+
+	error = stream->write(stream, git_buf_cstr(&buf), git_buf_len(&buf));
+
+done:
+	git_buf_free(&buf);
+	return error;
+}
+
+/*
+ * Record the status of a ref update. The strings are taken over from the
+ * pkt rather than copied, as there's one of these for every ref pushed.
+ */
 static int add_push_report_pkt(git_push *push, git_pkt *pkt)
 {
 	push_status *status;
@@ -684,9 +1786,9 @@ static int add_push_report_pkt(git_push *push, git_pkt *pkt)
 			status = git__calloc(sizeof(push_status), 1);
 			GITERR_CHECK_ALLOC(status);
 			status->msg = NULL;
-			status->ref = git__strdup(((git_pkt_ok *)pkt)->ref);
-			if (!status->ref ||
-				git_vector_insert(&push->status, status) < 0) {
+			status->ref = ((git_pkt_ok *)pkt)->ref;
+			((git_pkt_ok *)pkt)->ref = NULL;
+			if (git_vector_insert(&push->status, status) < 0) {
 				git_push_status_free(status);
 				return -1;
 			}
@@ -694,10 +1796,11 @@ static int add_push_report_pkt(git_push *push, git_pkt *pkt)
 		case GIT_PKT_NG:
 			status = git__calloc(sizeof(push_status), 1);
 			GITERR_CHECK_ALLOC(status);
-			status->ref = git__strdup(((git_pkt_ng *)pkt)->ref);
-			status->msg = git__strdup(((git_pkt_ng *)pkt)->msg);
-			if (!status->ref || !status->msg ||
-				git_vector_insert(&push->status, status) < 0) {
+			status->ref = ((git_pkt_ng *)pkt)->ref;
+			status->msg = ((git_pkt_ng *)pkt)->msg;
+			((git_pkt_ng *)pkt)->ref = NULL;
+			((git_pkt_ng *)pkt)->msg = NULL;
+			if (git_vector_insert(&push->status, status) < 0) {
 				git_push_status_free(status);
 				return -1;
 			}
@@ -707,6 +1810,10 @@ static int add_push_report_pkt(git_push *push, git_pkt *pkt)
 			break;
 		case GIT_PKT_FLUSH:
 			return GIT_ITEROVER;
+		case GIT_PKT_ERR:
+			giterr_set(GITERR_NET, "report-status: Error reported: %s",
+				((git_pkt_err *)pkt)->error);
+			return -1;
 		default:
 			giterr_set(GITERR_NET, "report-status: protocol error");
 			return -1;
@@ -715,96 +1822,112 @@ static int add_push_report_pkt(git_push *push, git_pkt *pkt)
 	return 0;
 }
 
-static int add_push_report_sideband_pkt(git_push *push, git_pkt_data *data_pkt)
+/*
+ * On the side-band, the report is a stream of pkt-lines of its own
+ * which may be split across packets at any point. We keep whatever
+ * partial line is left over in `report` until the rest arrives.
+ */
+static int add_push_report_sideband(
+	git_push *push, git_buf *report, const char *data, size_t len)
 {
 	git_pkt *pkt;
-	const char *line = data_pkt->data, *line_end;
-	size_t line_len = data_pkt->len;
-	int error;
+	const char *line, *line_end;
+	size_t line_len;
+	int error = 0;
+
+	if (git_buf_put(report, data, len) < 0)
+		return -1;
+
+	line = git_buf_cstr(report);
+	line_len = git_buf_len(report);
 
 	while (line_len > 0) {
+		pkt = NULL;
 		error = git_pkt_parse_line(&pkt, line, &line_end, line_len);
 
+		if (error == GIT_EBUFS) {
+			error = 0;
+			break;
+		}
+
 		if (error < 0)
-			return error;
+			break;
 
 		/* Advance in the buffer */
 		line_len -= (line_end - line);
 		line = line_end;
 
-		error = add_push_report_pkt(push, pkt);
+		if (!pkt)
+			continue;
 
+		error = add_push_report_pkt(push, pkt);
 		git_pkt_free(pkt);
 
-		if (error < 0 && error != GIT_ITEROVER)
-			return error;
+		if (error == GIT_ITEROVER)
+			error = 0;
+		else if (error < 0)
+			break;
 	}
 
-	return 0;
+	git_buf_consume(report, line);
+	return error;
 }
 
 static int parse_report(transport_smart *transport, git_push *push)
 {
-	git_pkt *pkt = NULL;
+	git_pkt *pkt;
+	git_pkt_view view;
 	const char *line_end = NULL;
 	gitno_buffer *buf = &transport->buffer;
-	int error, recvd;
+	git_buf report = GIT_BUF_INIT;
+	int error;
 
 	for (;;) {
-		if (buf->offset > 0)
-			error = git_pkt_parse_line(&pkt, buf->data,
-						   &line_end, buf->offset);
-		else
-			error = GIT_EBUFS;
-
-		if (error < 0 && error != GIT_EBUFS)
-			return -1;
-
-		if (error == GIT_EBUFS) {
-			if ((recvd = gitno_recv(buf)) < 0)
-				return recvd;
-
-			if (recvd == 0) {
-				giterr_set(GITERR_NET, "Early EOF");
-				return -1;
-			}
-			continue;
-		}
-
-		gitno_consume(buf, line_end);
-
-		error = 0;
+		if ((error = recv_sideband(&view, &line_end, buf)) < 0)
+			break;
 
-		switch (pkt->type) {
+		switch (view.type) {
 			case GIT_PKT_DATA:
-				/* This is a sideband packet which contains other packets */
-				error = add_push_report_sideband_pkt(push, (git_pkt_data *)pkt);
+				error = add_push_report_sideband(
+					push, &report, view.data, view.len);
 				break;
 			case GIT_PKT_ERR:
-				giterr_set(GITERR_NET, "report-status: Error reported: %s",
-					((git_pkt_err *)pkt)->error);
+				while (view.len > 0 && view.data[view.len - 1] == '\n')
+					view.len--;
+				giterr_set(GITERR_NET, "report-status: Error reported: %.*s",
+					(int)view.len, view.data);
 				error = -1;
 				break;
 			case GIT_PKT_PROGRESS:
-				if (transport->progress_cb) {
-					git_pkt_progress *p = (git_pkt_progress *) pkt;
-					error = transport->progress_cb(p->data, p->len, transport->message_cb_payload);
-				}
+				if (transport->progress_cb)
+					error = transport->progress_cb(view.data, (int)view.len,
+						transport->message_cb_payload);
+				break;
+			case GIT_PKT_FLUSH:
+				error = GIT_ITEROVER;
 				break;
 			default:
+				/* Without the side-band, the report comes as plain pkt-lines */
+				pkt = NULL;
+				if ((error = git_pkt_parse_line(
+						&pkt, buf->data, &line_end, buf->offset)) < 0 || !pkt)
+					break;
+
 				error = add_push_report_pkt(push, pkt);
+				git_pkt_free(pkt);
 				break;
 		}
 
-		git_pkt_free(pkt);
-
-		/* add_push_report_pkt returns GIT_ITEROVER when it receives a flush */
-		if (error == GIT_ITEROVER)
-			return 0;
+		gitno_consume(buf, line_end);
 
 		if (error < 0)
-			return error;
+			break;
 	}
+
+	git_buf_free(&report);
+
+	/* add_push_report_pkt returns GIT_ITEROVER when it receives a flush */
+	return error == GIT_ITEROVER ? 0 : error;
 }
 
 static int add_ref_from_push_spec(git_vector *refs, push_spec *push_spec)
@@ -946,7 +2069,6 @@ int git_smart__push(git_transport *transport, git_push *push)
 {
 	transport_smart *t = (transport_smart *)transport;
 	struct push_packbuilder_payload packbuilder_payload = {0};
-	git_buf pktline = GIT_BUF_INIT;
 	int error = 0, need_pack = 0;
 	push_spec *spec;
 	unsigned int i;
@@ -990,8 +2112,7 @@ int git_smart__push(git_transport *transport, git_push *push)
 	}
 
 	if ((error = git_smart__get_push_stream(t, &packbuilder_payload.stream)) < 0 ||
-		(error = gen_pktline(&pktline, push)) < 0 ||
-		(error = packbuilder_payload.stream->write(packbuilder_payload.stream, git_buf_cstr(&pktline), git_buf_len(&pktline))) < 0)
+		(error = send_commands(packbuilder_payload.stream, push)) < 0)
 		goto done;
 
 	if (need_pack &&
@@ -1026,6 +2147,5 @@ int git_smart__push(git_transport *transport, git_push *push)
 	}
 
 done:
-	git_buf_free(&pktline);
 	return error;
 }
@@ -510,6 +510,13 @@ static int _git_ssh_setup_conn(
 
 	libssh2_channel_set_blocking(channel, 1);
 
+	/*
+	 * Ask for protocol v2. Most servers won't accept the variable, in
+	 * which case we get a v0 advertisement, which is fine.
+	 */
+	if (cmd == cmd_uploadpack && t->owner->requested_version == 2)
+		libssh2_channel_setenv(channel, "GIT_PROTOCOL", "version=2");
+
 	s->session = session;
 	s->channel = channel;
 
@@ -47,6 +47,7 @@ static const char *receive_pack_service_url = "/git-receive-pack";
 static const wchar_t *get_verb = L"GET";
 static const wchar_t *post_verb = L"POST";
 static const wchar_t *pragma_nocache = L"Pragma: no-cache";
+static const wchar_t *git_protocol_v2 = L"Git-Protocol: version=2";
 static const wchar_t *transfer_encoding = L"Transfer-Encoding: chunked";
 static const int no_check_cert_flags = SECURITY_FLAG_IGNORE_CERT_CN_INVALID |
 	SECURITY_FLAG_IGNORE_CERT_DATE_INVALID |
@@ -298,6 +299,13 @@ static int winhttp_stream_connect(winhttp_stream *s)
 		goto on_error;
 	}
 
+	/* Ask for protocol v2; servers which don't know it ignore this */
+	if (s->service == upload_pack_service && t->owner->requested_version == 2 &&
+		!WinHttpAddRequestHeaders(s->request, git_protocol_v2, (ULONG) -1L, WINHTTP_ADDREQ_FLAG_ADD)) {
+		giterr_set(GITERR_OS, "Failed to add a header to the request");
+		goto on_error;
+	}
+
 	if (post_verb == s->verb) {
 		/* Send Content-Type and Accept headers -- only necessary on a POST */
 		git_buf_clear(&buf);
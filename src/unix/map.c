@@ -66,5 +66,21 @@ int p_munmap(git_map *map)
 	return 0;
 }
 
+void p_madvise(git_map *map, int advice)
+{
+	int madv;
+
+	assert(map != NULL);
+
+	if (advice == GIT_MADV_RANDOM)
+		madv = POSIX_MADV_RANDOM;
+	else if (advice == GIT_MADV_SEQUENTIAL)
+		madv = POSIX_MADV_SEQUENTIAL;
+	else
+		madv = POSIX_MADV_NORMAL;
+
+	posix_madvise(map->data, map->len, madv);
+}
+
 #endif
 
@@ -119,4 +119,11 @@ int p_munmap(git_map *map)
 	return error;
 }
 
+void p_madvise(git_map *map, int advice)
+{
+	/* the memory manager doesn't take hints for file views */
+	GIT_UNUSED(map);
+	GIT_UNUSED(advice);
+}
+
 #endif
@@ -7,12 +7,20 @@
 
 #include <zlib.h>
 
+#ifdef GIT_LIBDEFLATE
+# include <libdeflate.h>
+#endif
+
 #include "zstream.h"
 #include "buffer.h"
+#include "global.h"
 
 #define ZSTREAM_BUFFER_SIZE (1024 * 1024)
 #define ZSTREAM_BUFFER_MIN_EXTRA 8
 
+int git_zstream__loose_level = Z_BEST_SPEED;
+int git_zstream__pack_level = Z_DEFAULT_COMPRESSION;
+
 static int zstream_seterr(git_zstream *zs)
 {
 	if (zs->zerr == Z_OK || zs->zerr == Z_STREAM_END)
@@ -28,9 +36,9 @@ static int zstream_seterr(git_zstream *zs)
 	return -1;
 }
 
-int git_zstream_init(git_zstream *zstream)
+int git_zstream_init(git_zstream *zstream, int level)
 {
-	zstream->zerr = deflateInit(&zstream->z, Z_DEFAULT_COMPRESSION);
+	zstream->zerr = deflateInit(&zstream->z, level);
 	return zstream_seterr(zstream);
 }
 
@@ -120,12 +128,13 @@ int git_zstream_get_output(void *out, size_t *out_len, git_zstream *zstream)
 	return 0;
 }
 
-int git_zstream_deflatebuf(git_buf *out, const void *in, size_t in_len)
+int git_zstream_deflatebuf(
+	git_buf *out, const void *in, size_t in_len, int level)
 {
 	git_zstream zs = GIT_ZSTREAM_INIT;
 	int error = 0;
 
-	if ((error = git_zstream_init(&zs)) < 0)
+	if ((error = git_zstream_init(&zs, level)) < 0)
 		return error;
 
 	if ((error = git_zstream_set_input(&zs, in, in_len)) < 0)
@@ -154,3 +163,100 @@ done:
 	git_zstream_free(&zs);
 	return error;
 }
+
+#ifdef GIT_LIBDEFLATE
+
+/*
+ * libdeflate decompresses whole buffers only, which is exactly our case
+ * when the object header tells us the inflated size, and it does so
+ * considerably faster than zlib's streaming inflate.
+ */
+int git_zstream_inflatebuf(
+	void *out, size_t out_len,
+	const void *in, size_t in_len, size_t *in_used)
+{
+	git_global_st *st = GIT_GLOBAL;
+	enum libdeflate_result result;
+	size_t actual_in = 0, actual_out = 0;
+
+	/* Decompressors are not cheap to set up, so each thread keeps one */
+	if (st && !st->decompressor)
+		st->decompressor = libdeflate_alloc_decompressor();
+
+	if (!st || !st->decompressor) {
+		giterr_set_oom();
+		return -1;
+	}
+
+	result = libdeflate_zlib_decompress_ex(st->decompressor,
+		in, in_len, out, out_len, &actual_in, &actual_out);
+
+	/*
+	 * libdeflate can't tell a truncated stream from a corrupt one;
+	 * let the caller retry with zlib, which can.
+	 */
+	if (result == LIBDEFLATE_BAD_DATA)
+		return GIT_EBUFS;
+
+	if (result != LIBDEFLATE_SUCCESS || actual_out != out_len) {
+		giterr_set(GITERR_ZLIB,
+			"Failed to inflate buffer. Inflated size does not match");
+		return -1;
+	}
+
+	if (in_used)
+		*in_used = actual_in;
+
+	return 0;
+}
+
+void git_zstream__free_decompressor(struct libdeflate_decompressor *d)
+{
+	if (d)
+		libdeflate_free_decompressor(d);
+}
+
+#else
+
+int git_zstream_inflatebuf(
+	void *out, size_t out_len,
+	const void *in, size_t in_len, size_t *in_used)
+{
+	z_stream zs;
+	int status = Z_OK;
+
+	memset(&zs, 0x0, sizeof(zs));
+
+	zs.next_out = out;
+	zs.avail_out = (uInt)out_len;
+	zs.next_in = (Bytef *)in;
+	zs.avail_in = (uInt)in_len;
+
+	if ((size_t)zs.avail_out != out_len || (size_t)zs.avail_in != in_len)
+		return GIT_EBUFS;
+
+	if (inflateInit(&zs) != Z_OK) {
+		giterr_set(GITERR_ZLIB, "Failed to init zlib stream on inflate");
+		return -1;
+	}
+
+	status = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+
+	/* all the input was used up without reaching the end of the stream */
+	if ((status == Z_OK || status == Z_BUF_ERROR) && zs.avail_in == 0)
+		return GIT_EBUFS;
+
+	if (status != Z_STREAM_END || zs.total_out != out_len) {
+		giterr_set(GITERR_ZLIB,
+			"Failed to inflate buffer. Stream aborted prematurely");
+		return -1;
+	}
+
+	if (in_used)
+		*in_used = in_len - zs.avail_in;
+
+	return 0;
+}
+
+#endif
@@ -21,7 +21,11 @@ typedef struct {
 
 #define GIT_ZSTREAM_INIT {{0}}
 
-int git_zstream_init(git_zstream *zstream);
+/* Compression levels for newly written loose objects and packfiles */
+extern int git_zstream__loose_level;
+extern int git_zstream__pack_level;
+
+int git_zstream_init(git_zstream *zstream, int level);
 void git_zstream_free(git_zstream *zstream);
 
 int git_zstream_set_input(git_zstream *zstream, const void *in, size_t in_len);
@@ -34,6 +38,28 @@ bool git_zstream_done(git_zstream *zstream);
 
 void git_zstream_reset(git_zstream *zstream);
 
-int git_zstream_deflatebuf(git_buf *out, const void *in, size_t in_len);
+int git_zstream_deflatebuf(
+	git_buf *out, const void *in, size_t in_len, int level);
+
+/*
+ * Inflate a complete zlib stream whose inflated size is known up front,
+ * in one go.  `out` must have room for exactly `out_len` bytes.  If
+ * `in_used` is given, it receives the number of input bytes the stream
+ * occupied.
+ *
+ * Returns 0 on success, GIT_EBUFS if `in` ends before the stream does
+ * (the caller can then fall back to inflating in pieces), or -1 if the
+ * data is corrupt or does not inflate to exactly `out_len` bytes.
+ */
+int git_zstream_inflatebuf(
+	void *out, size_t out_len,
+	const void *in, size_t in_len, size_t *in_used);
+
+#ifdef GIT_LIBDEFLATE
+struct libdeflate_decompressor;
+
+/* Free the libdeflate decompressor a thread's global state caches */
+void git_zstream__free_decompressor(struct libdeflate_decompressor *d);
+#endif
 
 #endif /* INCLUDE_zstream_h__ */
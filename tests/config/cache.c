@@ -0,0 +1,66 @@
+#include "clar_libgit2.h"
+
+#ifdef GIT_WIN32
+# include <sys/utime.h>
+#else
+# include <utime.h>
+#endif
+
+#define TEST_FILE "config.cached"
+#define INCLUDED_FILE "config.included"
+
+void test_config_cache__cleanup(void)
+{
+	cl_fixture_cleanup(TEST_FILE);
+	cl_fixture_cleanup(INCLUDED_FILE);
+}
+
+static void set_mtime(const char *path, time_t when)
+{
+	struct utimbuf times;
+
+	times.actime = times.modtime = when;
+	cl_must_pass(utime(path, &times));
+}
+
+static void assert_value(const char *expected)
+{
+	git_config *cfg;
+	const char *value;
+
+	cl_git_pass(git_config_new(&cfg));
+	cl_git_pass(git_config_add_file_ondisk(cfg, TEST_FILE, GIT_CONFIG_LEVEL_GLOBAL, 0));
+
+	cl_git_pass(git_config_get_string(&value, cfg, "section.value"));
+	cl_assert_equal_s(expected, value);
+
+	git_config_free(cfg);
+}
+
+void test_config_cache__shares_the_values_of_unchanged_files(void)
+{
+	cl_git_mkfile(TEST_FILE, "[section]\n\tvalue = one\n");
+	set_mtime(TEST_FILE, 1234567890);
+	assert_value("one");
+
+	/* Without a change to its stamp, the file is not parsed again */
+	cl_git_rewritefile(TEST_FILE, "[section]\n\tvalue = two\n");
+	set_mtime(TEST_FILE, 1234567890);
+	assert_value("one");
+
+	set_mtime(TEST_FILE, 1234567891);
+	assert_value("two");
+}
+
+void test_config_cache__notices_changes_to_included_files(void)
+{
+	cl_git_mkfile(TEST_FILE, "[include]\n\tpath = " INCLUDED_FILE "\n");
+	cl_git_mkfile(INCLUDED_FILE, "[section]\n\tvalue = one\n");
+	set_mtime(TEST_FILE, 1234567890);
+	set_mtime(INCLUDED_FILE, 1234567890);
+	assert_value("one");
+
+	cl_git_rewritefile(INCLUDED_FILE, "[section]\n\tvalue = three\n");
+	set_mtime(INCLUDED_FILE, 1234567890);
+	assert_value("three");
+}
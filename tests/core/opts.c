@@ -17,3 +17,25 @@ void test_core_opts__readwrite(void)
 
 	cl_assert(new_val == old_val);
 }
+
+void test_core_opts__compression_level(void)
+{
+	int old_loose, old_pack, val;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_LOOSE_COMPRESSION_LEVEL, &old_loose));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_COMPRESSION_LEVEL, &old_pack));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_LOOSE_COMPRESSION_LEVEL, 9));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_LOOSE_COMPRESSION_LEVEL, &val));
+	cl_assert_equal_i(9, val);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_COMPRESSION_LEVEL, 0));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_COMPRESSION_LEVEL, &val));
+	cl_assert_equal_i(0, val);
+
+	cl_git_fail(git_libgit2_opts(GIT_OPT_SET_LOOSE_COMPRESSION_LEVEL, 10));
+	cl_git_fail(git_libgit2_opts(GIT_OPT_SET_PACK_COMPRESSION_LEVEL, -2));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_LOOSE_COMPRESSION_LEVEL, old_loose));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_COMPRESSION_LEVEL, old_pack));
+}
@@ -48,7 +48,7 @@ void test_core_zstream__basic(void)
 	char out[128];
 	size_t outlen = sizeof(out);
 
-	cl_git_pass(git_zstream_init(&z));
+	cl_git_pass(git_zstream_init(&z, Z_DEFAULT_COMPRESSION));
 	cl_git_pass(git_zstream_set_input(&z, data, strlen(data) + 1));
 	cl_git_pass(git_zstream_get_output(out, &outlen, &z));
 	cl_assert(git_zstream_done(&z));
@@ -61,7 +61,8 @@ void test_core_zstream__basic(void)
 void test_core_zstream__buffer(void)
 {
 	git_buf out = GIT_BUF_INIT;
-	cl_git_pass(git_zstream_deflatebuf(&out, data, strlen(data) + 1));
+	cl_git_pass(git_zstream_deflatebuf(
+		&out, data, strlen(data) + 1, Z_DEFAULT_COMPRESSION));
 	assert_zlib_equal(data, strlen(data) + 1, out.ptr, out.size);
 	git_buf_free(&out);
 }
@@ -77,7 +78,8 @@ static void compress_input_various_ways(git_buf *input)
 
 	/* compress with deflatebuf */
 
-	cl_git_pass(git_zstream_deflatebuf(&out1, input->ptr, input->size));
+	cl_git_pass(git_zstream_deflatebuf(
+		&out1, input->ptr, input->size, Z_DEFAULT_COMPRESSION));
 	assert_zlib_equal(input->ptr, input->size, out1.ptr, out1.size);
 
 	/* compress with various fixed size buffer (accumulating the output) */
@@ -93,7 +95,7 @@ static void compress_input_various_ways(git_buf *input)
 		}
 		cl_assert(use_fixed_size <= fixed_size);
 
-		cl_git_pass(git_zstream_init(&zs));
+		cl_git_pass(git_zstream_init(&zs, Z_DEFAULT_COMPRESSION));
 		cl_git_pass(git_zstream_set_input(&zs, input->ptr, input->size));
 
 		while (!git_zstream_done(&zs)) {
@@ -141,3 +143,34 @@ void test_core_zstream__big_data(void)
 
 	git_buf_free(&in);
 }
+
+void test_core_zstream__inflatebuf(void)
+{
+	git_buf deflated = GIT_BUF_INIT;
+	char big[8192], out[8192];
+	size_t i, used = 0;
+
+	for (i = 0; i < sizeof(big); ++i)
+		big[i] = (char)('a' + (i * 7) % 23);
+
+	cl_git_pass(git_zstream_deflatebuf(
+		&deflated, big, sizeof(big), Z_BEST_SPEED));
+
+	/* trailing bytes after the stream are left alone */
+	cl_git_pass(git_buf_puts(&deflated, "trailer"));
+
+	cl_git_pass(git_zstream_inflatebuf(
+		out, sizeof(out), deflated.ptr, deflated.size, &used));
+	cl_assert_equal_sz(deflated.size - strlen("trailer"), used);
+	cl_assert(memcmp(out, big, sizeof(big)) == 0);
+
+	/* a truncated stream asks for more input */
+	cl_assert_equal_i(GIT_EBUFS, git_zstream_inflatebuf(
+		out, sizeof(out), deflated.ptr, used / 2, NULL));
+
+	/* the wrong expected size is an error */
+	cl_git_fail(git_zstream_inflatebuf(
+		out, sizeof(out) - 1, deflated.ptr, deflated.size, NULL));
+
+	git_buf_free(&deflated);
+}
@@ -0,0 +1,166 @@
+#include "clar_libgit2.h"
+
+#include "buffer.h"
+#include "fileops.h"
+#include "bundle.h"
+
+static const char *master_tip = "a65fedf39aefe402d3bb6e24df4d4f5fe4547750";
+static const char *master_parent = "be3563ae3f795b2b4353bcce3a527ad0a4f7f644";
+
+static git_repository *g_repo;
+
+void test_network_bundle__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_network_bundle__cleanup(void)
+{
+	cl_fixture_cleanup("foo");
+	cl_fixture_cleanup("test.bundle");
+	cl_git_sandbox_cleanup();
+}
+
+static int fetch_bundle(git_repository *repo)
+{
+	git_remote *origin;
+	int error;
+
+	if (git_remote_load(&origin, repo, "bundle") < 0)
+		cl_git_pass(git_remote_create(&origin, repo, "bundle", "test.bundle"));
+
+	error = git_remote_fetch(origin, NULL, NULL);
+	git_remote_free(origin);
+
+	return error;
+}
+
+static void assert_ref(git_repository *repo, const char *name, const char *target)
+{
+	git_reference *ref;
+
+	cl_git_pass(git_reference_lookup(&ref, repo, name));
+	cl_assert_equal_i(0, git_oid_streq(git_reference_target(ref), target));
+	git_reference_free(ref);
+}
+
+void test_network_bundle__fetches_what_was_bundled(void)
+{
+	git_repository *repo;
+	git_object *obj;
+	char *refs[] = { "master", "refs/tags/e90810b" };
+	git_strarray bundled = { refs, 2 };
+
+	cl_git_pass(git_bundle_create(g_repo, "test.bundle", &bundled, NULL));
+	cl_assert(git_bundle__is_bundle("test.bundle"));
+
+	cl_git_pass(git_repository_init(&repo, "foo", true));
+	cl_git_pass(fetch_bundle(repo));
+
+	assert_ref(repo, "refs/remotes/bundle/master", master_tip);
+	cl_git_pass(git_revparse_single(&obj, repo, "bundle/master~5^{tree}"));
+
+	git_object_free(obj);
+	git_repository_free(repo);
+}
+
+void test_network_bundle__needs_the_prerequisites(void)
+{
+	git_repository *repo;
+	git_buf contents = GIT_BUF_INIT;
+	char *refs[] = { "master" };
+	char *prerequisites[] = { "master~1" };
+	git_strarray bundled = { refs, 1 };
+	git_bundle_create_options opts = GIT_BUNDLE_CREATE_OPTIONS_INIT;
+
+	opts.prerequisites.strings = prerequisites;
+	opts.prerequisites.count = 1;
+
+	cl_git_pass(git_bundle_create(g_repo, "test.bundle", &bundled, &opts));
+
+	cl_git_pass(git_futils_readbuffer(&contents, "test.bundle"));
+	cl_assert(!git__prefixcmp(contents.ptr, GIT_BUNDLE_V2_SIGNATURE));
+	cl_assert(strstr(contents.ptr, master_parent) == contents.ptr + 17);
+	git_buf_free(&contents);
+
+	cl_git_pass(git_repository_init(&repo, "foo", true));
+	cl_git_fail_with(GIT_ENOTFOUND, fetch_bundle(repo));
+	git_repository_free(repo);
+
+	/* A repository with the history can take it */
+	cl_git_pass(fetch_bundle(g_repo));
+	assert_ref(g_repo, "refs/remotes/bundle/master", master_tip);
+}
+
+void test_network_bundle__writes_version_3(void)
+{
+	git_repository *repo;
+	git_buf contents = GIT_BUF_INIT;
+	char *refs[] = { "refs/heads/master" };
+	git_strarray bundled = { refs, 1 };
+	git_bundle_create_options opts = GIT_BUNDLE_CREATE_OPTIONS_INIT;
+
+	opts.format = 3;
+	cl_git_pass(git_bundle_create(g_repo, "test.bundle", &bundled, &opts));
+
+	cl_git_pass(git_futils_readbuffer(&contents, "test.bundle"));
+	cl_assert(!git__prefixcmp(contents.ptr,
+		GIT_BUNDLE_V3_SIGNATURE "@object-format=sha1\n"));
+	git_buf_free(&contents);
+
+	cl_git_pass(git_repository_init(&repo, "foo", true));
+	cl_git_pass(fetch_bundle(repo));
+	assert_ref(repo, "refs/remotes/bundle/master", master_tip);
+	git_repository_free(repo);
+
+	opts.format = 4;
+	cl_git_fail(git_bundle_create(g_repo, "test.bundle", &bundled, &opts));
+}
+
+void test_network_bundle__rejects_broken_headers(void)
+{
+	git_repository *repo;
+
+	cl_git_pass(git_repository_init(&repo, "foo", true));
+
+	cl_git_mkfile("test.bundle", GIT_BUNDLE_V2_SIGNATURE "not an id\n\nPACK");
+	cl_git_fail(fetch_bundle(repo));
+
+	cl_git_mkfile("test.bundle", GIT_BUNDLE_V2_SIGNATURE "@object-format=sha1\n\n");
+	cl_git_fail(fetch_bundle(repo));
+
+	cl_git_mkfile("test.bundle", GIT_BUNDLE_V3_SIGNATURE "@object-format=sha256\n\n");
+	cl_git_fail(fetch_bundle(repo));
+
+	git_repository_free(repo);
+}
+
+void test_network_bundle__reads_headers_spanning_several_reads(void)
+{
+	git_buf contents = GIT_BUF_INIT;
+	git_bundle_header header;
+	git_remote_head *head;
+	git_file fd;
+	size_t i;
+
+	/* A few hundred refs make a header several times the read size */
+	cl_git_pass(git_buf_puts(&contents, GIT_BUNDLE_V2_SIGNATURE));
+	for (i = 0; i < 300; ++i)
+		cl_git_pass(git_buf_printf(&contents,
+			"%s refs/tags/tag-%03d\n", master_tip, (int)i));
+	cl_git_pass(git_buf_puts(&contents, "\nPACK"));
+	cl_git_mkfile("test.bundle", contents.ptr);
+
+	cl_must_pass(fd = p_open("test.bundle", O_RDONLY));
+	cl_git_pass(git_bundle__read_header(&header, fd));
+	p_close(fd);
+
+	cl_assert_equal_sz(300, header.refs.length);
+	cl_assert_equal_i((int)contents.size - 4, (int)header.pack_offset);
+
+	head = git_vector_get(&header.refs, 299);
+	cl_assert_equal_s("refs/tags/tag-299", head->name);
+
+	git_bundle__header_free(&header);
+	git_buf_free(&contents);
+}
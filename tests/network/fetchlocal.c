@@ -3,6 +3,7 @@
 #include "buffer.h"
 #include "path.h"
 #include "remote.h"
+#include "posix.h"
 
 static int transfer_cb(const git_transfer_progress *stats, void *payload)
 {
@@ -112,3 +113,85 @@ void test_network_fetchlocal__clone_into_mirror(void)
 	git_buf_free(&path);
 	cl_fixture_cleanup("./foo.git");
 }
+
+static void commit_on(git_oid *out, git_repository *repo, const git_oid *parent_id)
+{
+	git_signature *sig;
+	git_commit *parent;
+	git_tree *tree;
+	const git_commit *parents[1];
+
+	cl_git_pass(git_commit_lookup(&parent, repo, parent_id));
+	cl_git_pass(git_commit_tree(&tree, parent));
+	cl_git_pass(git_signature_now(&sig, "me", "me@example.com"));
+
+	parents[0] = parent;
+	cl_git_pass(git_commit_create(out, repo, NULL, sig, sig, NULL,
+		"commit", tree, 1, parents));
+
+	git_signature_free(sig);
+	git_tree_free(tree);
+	git_commit_free(parent);
+}
+
+static int write_cb(void *buf, size_t size, void *payload)
+{
+	return git_buf_put((git_buf *)payload, buf, size);
+}
+
+void test_network_fetchlocal__refuses_disconnected_history(void)
+{
+	git_repository *src, *repo;
+	git_remote *origin;
+	git_reference *ref;
+	git_commit *commit;
+	git_packbuilder *pb;
+	git_oid middle, tip;
+	git_buf bundle = GIT_BUF_INIT, expected = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+
+	src = cl_git_sandbox_init("testrepo.git");
+	cl_set_cleanup(&cleanup_local_repo, "foo");
+
+	cl_git_pass(git_reference_name_to_id(&tip, src, "refs/heads/master"));
+	commit_on(&middle, src, &tip);
+	commit_on(&tip, src, &middle);
+
+	/*
+	 * Bundle the new tip with its tree, but leave out its parent, so
+	 * the pack the other side indexes is missing a commit.
+	 */
+	cl_git_pass(git_commit_lookup(&commit, src, &tip));
+	cl_git_pass(git_packbuilder_new(&pb, src));
+	cl_git_pass(git_packbuilder_insert(pb, &tip, NULL));
+	cl_git_pass(git_packbuilder_insert_tree(pb, git_commit_tree_id(commit)));
+
+	git_oid_tostr(hex, sizeof(hex), &tip);
+	cl_git_pass(git_buf_printf(&bundle,
+		"# v2 git bundle\n%s refs/heads/broken\n\n", hex));
+	cl_git_pass(git_packbuilder_foreach(pb, write_cb, &bundle));
+	cl_git_write2file("foo.bundle", bundle.ptr, bundle.size,
+		O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	git_packbuilder_free(pb);
+	git_commit_free(commit);
+
+	cl_git_pass(git_repository_init(&repo, "foo", true));
+	cl_git_pass(git_remote_create(&origin, repo, GIT_REMOTE_ORIGIN, "foo.bundle"));
+
+	cl_git_pass(git_buf_printf(&expected,
+		"Connectivity check failed: object %s is missing",
+		git_oid_tostr(hex, sizeof(hex), &middle)));
+
+	cl_git_fail(git_remote_fetch(origin, NULL, NULL));
+	cl_assert_equal_s(expected.ptr, giterr_last()->message);
+
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, repo, "refs/remotes/origin/broken"));
+
+	git_buf_free(&expected);
+	git_buf_free(&bundle);
+	git_remote_free(origin);
+	git_repository_free(repo);
+	p_unlink("foo.bundle");
+	cl_git_sandbox_cleanup();
+}
@@ -0,0 +1,106 @@
+#include "clar_libgit2.h"
+#include "negotiator.h"
+
+#define CHAIN_LENGTH 100
+
+static git_repository *_repo;
+static git_oid _chain[CHAIN_LENGTH];
+
+/* A linear history with the tip at _chain[0] and the root at the end */
+void test_network_negotiation__initialize(void)
+{
+	git_treebuilder *builder;
+	git_signature *sig;
+	git_tree *tree;
+	git_commit *parent = NULL;
+	git_oid tree_id;
+	int i;
+
+	cl_git_pass(git_repository_init(&_repo, "negotiation.git", true));
+
+	cl_git_pass(git_treebuilder_create(&builder, NULL));
+	cl_git_pass(git_treebuilder_write(&tree_id, _repo, builder));
+	cl_git_pass(git_tree_lookup(&tree, _repo, &tree_id));
+	git_treebuilder_free(builder);
+
+	for (i = CHAIN_LENGTH - 1; i >= 0; --i) {
+		const git_commit *parents[1];
+
+		parents[0] = parent;
+		cl_git_pass(git_signature_new(&sig, "me", "me@example.com",
+			1400000000 + (CHAIN_LENGTH - i) * 60, 0));
+		cl_git_pass(git_commit_create(&_chain[i], _repo,
+			i ? NULL : "refs/heads/master", sig, sig, NULL, "commit",
+			tree, parent ? 1 : 0, parents));
+
+		git_commit_free(parent);
+		cl_git_pass(git_commit_lookup(&parent, _repo, &_chain[i]));
+		git_signature_free(sig);
+	}
+
+	git_commit_free(parent);
+	git_tree_free(tree);
+}
+
+void test_network_negotiation__cleanup(void)
+{
+	git_repository_free(_repo);
+	cl_fixture_cleanup("negotiation.git");
+}
+
+/* Check that the negotiator offers exactly the given commits of the chain */
+static void assert_offers(
+	git_remote_negotiation_t algorithm, const int *expected, size_t count)
+{
+	git_negotiator *negotiator;
+	git_oid oid;
+	size_t i;
+
+	cl_git_pass(git_negotiator_new(&negotiator, _repo, algorithm));
+
+	for (i = 0; i < count; ++i) {
+		cl_git_pass(git_negotiator_next(&oid, negotiator));
+		cl_assert(git_oid_equal(&_chain[expected[i]], &oid));
+	}
+
+	cl_assert_equal_i(GIT_ITEROVER, git_negotiator_next(&oid, negotiator));
+	git_negotiator_free(negotiator);
+}
+
+void test_network_negotiation__consecutive_offers_everything(void)
+{
+	int expected[CHAIN_LENGTH], i;
+
+	for (i = 0; i < CHAIN_LENGTH; ++i)
+		expected[i] = i;
+
+	assert_offers(GIT_REMOTE_NEGOTIATION_CONSECUTIVE, expected, CHAIN_LENGTH);
+	assert_offers(GIT_REMOTE_NEGOTIATION_DEFAULT, expected, CHAIN_LENGTH);
+}
+
+void test_network_negotiation__skipping_widens_the_gaps(void)
+{
+	/* The root is always offered, as it ends the history */
+	int expected[] = { 0, 2, 5, 10, 18, 30, 48, 75, 99 };
+
+	assert_offers(GIT_REMOTE_NEGOTIATION_SKIPPING,
+		expected, ARRAY_SIZE(expected));
+}
+
+void test_network_negotiation__algorithm_from_config(void)
+{
+	git_negotiator *negotiator;
+	git_config *cfg;
+	int expected[] = { 0, 2, 5, 10, 18, 30, 48, 75, 99 };
+
+	cl_git_pass(git_repository_config(&cfg, _repo));
+
+	cl_git_pass(git_config_set_string(cfg, "fetch.negotiationAlgorithm", "skipping"));
+	assert_offers(GIT_REMOTE_NEGOTIATION_DEFAULT,
+		expected, ARRAY_SIZE(expected));
+
+	cl_git_pass(git_config_set_string(cfg, "fetch.negotiationAlgorithm", "unknown"));
+	cl_git_fail(git_negotiator_new(&negotiator, _repo, GIT_REMOTE_NEGOTIATION_DEFAULT));
+
+	git_config_free(cfg);
+}
@@ -0,0 +1,622 @@
+#include "clar_libgit2.h"
+
+#include "buffer.h"
+#include "vector.h"
+#include "fileops.h"
+#include "git2/pack.h"
+
+/*
+ * A stateless stand-in for a protocol v2 upload-pack, serving the
+ * testrepo.git fixture.
+ */
+
+static git_repository *_server;
+static git_repository *_repo;
+static git_remote *_remote;
+static git_buf _ls_refs_request = GIT_BUF_INIT;
+static git_buf _fetch_request = GIT_BUF_INIT;
+static int _fetch_requests;
+static const char *_sideband_error;
+
+typedef struct {
+	git_smart_subtransport_stream parent;
+	git_buf response;
+	size_t pos;
+} v2_stream;
+
+static void buffer_pkt(git_buf *out, const char *line)
+{
+	git_buf_printf(out, "%04x%s\n", (unsigned int)strlen(line) + 5, line);
+}
+
+static int v2_stream_read(
+	git_smart_subtransport_stream *stream,
+	char *buffer,
+	size_t buf_size,
+	size_t *bytes_read)
+{
+	v2_stream *s = (v2_stream *)stream;
+
+	*bytes_read = min(buf_size, s->response.size - s->pos);
+	memcpy(buffer, s->response.ptr + s->pos, *bytes_read);
+	s->pos += *bytes_read;
+
+	return 0;
+}
+
+static bool prefix_requested(const char *request, const char *refname)
+{
+	const char *line = request;
+	bool any = false;
+
+	while ((line = strstr(line, "ref-prefix ")) != NULL) {
+		const char *prefix = line + strlen("ref-prefix "), *end = strchr(prefix, '\n');
+
+		any = true;
+		if (!strncmp(refname, prefix, end - prefix))
+			return true;
+
+		line = end;
+	}
+
+	return !any;
+}
+
+static void serve_ls_refs(git_buf *out, const char *request)
+{
+	git_strarray refs;
+	git_reference *ref, *resolved;
+	git_object *peeled;
+	git_buf line = GIT_BUF_INIT;
+	char oid[GIT_OID_HEXSZ + 1];
+	size_t i;
+
+	cl_git_pass(git_buf_sets(&_ls_refs_request, request));
+
+	cl_git_pass(git_reference_lookup(&ref, _server, "HEAD"));
+	cl_git_pass(git_reference_resolve(&resolved, ref));
+	git_oid_tostr(oid, sizeof(oid), git_reference_target(resolved));
+	git_buf_printf(&line, "%s HEAD symref-target:%s",
+		oid, git_reference_symbolic_target(ref));
+	buffer_pkt(out, line.ptr);
+	git_reference_free(resolved);
+	git_reference_free(ref);
+
+	cl_git_pass(git_reference_list(&refs, _server));
+
+	for (i = 0; i < refs.count; ++i) {
+		if (!prefix_requested(request, refs.strings[i]))
+			continue;
+
+		cl_git_pass(git_reference_lookup(&ref, _server, refs.strings[i]));
+		cl_git_pass(git_reference_peel(&peeled, ref, GIT_OBJ_ANY));
+
+		git_buf_clear(&line);
+		git_oid_tostr(oid, sizeof(oid), git_reference_target(ref));
+		git_buf_printf(&line, "%s %s", oid, refs.strings[i]);
+
+		if (git_oid_cmp(git_reference_target(ref), git_object_id(peeled))) {
+			git_oid_tostr(oid, sizeof(oid), git_object_id(peeled));
+			git_buf_printf(&line, " peeled:%s", oid);
+		}
+
+		buffer_pkt(out, line.ptr);
+
+		git_object_free(peeled);
+		git_reference_free(ref);
+	}
+
+	git_buf_puts(out, "0000");
+
+	git_strarray_free(&refs);
+	git_buf_free(&line);
+}
+
+static int append_sideband(void *buf, size_t size, void *payload)
+{
+	git_buf *out = payload;
+
+	while (size > 0) {
+		size_t chunk = min(size, 65515);
+
+		git_buf_printf(out, "%04x\1", (unsigned int)chunk + 5);
+		git_buf_put(out, buf, chunk);
+
+		buf = (char *)buf + chunk;
+		size -= chunk;
+	}
+
+	return 0;
+}
+
+static void acknowledge_haves(git_buf *out, const char *request)
+{
+	const char *have = request;
+	char line[GIT_OID_HEXSZ + 5];
+	git_object *obj;
+	git_oid oid;
+	bool acked = false;
+
+	buffer_pkt(out, "acknowledgments");
+
+	while ((have = strstr(have, "have ")) != NULL) {
+		have += strlen("have ");
+		cl_git_pass(git_oid_fromstrn(&oid, have, GIT_OID_HEXSZ));
+
+		if (git_object_lookup(&obj, _server, &oid, GIT_OBJ_ANY) < 0) {
+			giterr_clear();
+			continue;
+		}
+
+		p_snprintf(line, sizeof(line), "ACK %.40s", have);
+		buffer_pkt(out, line);
+		git_object_free(obj);
+		acked = true;
+	}
+
+	if (!acked)
+		buffer_pkt(out, "NAK");
+
+	git_buf_puts(out, "0000");
+}
+
+/* Lines of `request` starting with `prefix`, turned into `replacement` */
+static void buffer_oid_lines(
+	git_buf *out, const char *request, const char *prefix, const char *replacement)
+{
+	const char *line = request;
+	char pkt[GIT_OID_HEXSZ + 16];
+
+	while ((line = strstr(line, prefix)) != NULL) {
+		line += strlen(prefix);
+		p_snprintf(pkt, sizeof(pkt), "%s%.40s", replacement, line);
+		buffer_pkt(out, pkt);
+	}
+}
+
+/* What "filter blob:none" sends for a commit */
+static void insert_without_blobs(git_packbuilder *pb, const git_oid *id)
+{
+	git_object *obj;
+	size_t i;
+
+	cl_git_pass(git_object_lookup(&obj, _server, id, GIT_OBJ_ANY));
+	cl_git_pass(git_packbuilder_insert(pb, id, NULL));
+
+	if (git_object_type(obj) == GIT_OBJ_COMMIT) {
+		insert_without_blobs(pb, git_commit_tree_id((git_commit *)obj));
+	} else {
+		const git_tree *tree = (const git_tree *)obj;
+
+		for (i = 0; i < git_tree_entrycount(tree); ++i) {
+			const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+
+			if (git_tree_entry_type(entry) == GIT_OBJ_TREE)
+				insert_without_blobs(pb, git_tree_entry_id(entry));
+		}
+	}
+
+	git_object_free(obj);
+}
+
+static void serve_fetch(git_buf *out, const char *request)
+{
+	git_packbuilder *pb;
+	git_revwalk *walk;
+	git_object *obj, *commit;
+	const char *want = request;
+	bool tips_only = strstr(request, "deepen 1\n") != NULL;
+	bool no_blobs = strstr(request, "filter blob:none\n") != NULL;
+	git_oid oid;
+
+	_fetch_requests++;
+	cl_git_pass(git_buf_sets(&_fetch_request, request));
+
+	if (strstr(request, "0009done\n") == NULL) {
+		acknowledge_haves(out, request);
+		return;
+	}
+
+	/* With a depth of one, the tips are all we have to send */
+	if (tips_only) {
+		buffer_pkt(out, "shallow-info");
+		buffer_oid_lines(out, request, "want ", "shallow ");
+		git_buf_puts(out, "0001");
+	} else if (strstr(request, "deepen 2147483647\n")) {
+		buffer_pkt(out, "shallow-info");
+		buffer_oid_lines(out, request, "shallow ", "unshallow ");
+		git_buf_puts(out, "0001");
+	}
+
+	cl_git_pass(git_packbuilder_new(&pb, _server));
+	cl_git_pass(git_revwalk_new(&walk, _server));
+
+	while ((want = strstr(want, "want ")) != NULL) {
+		want += strlen("want ");
+		cl_git_pass(git_oid_fromstrn(&oid, want, GIT_OID_HEXSZ));
+		cl_git_pass(git_object_lookup(&obj, _server, &oid, GIT_OBJ_ANY));
+
+		if (git_object_peel(&commit, obj, GIT_OBJ_COMMIT) < 0) {
+			giterr_clear();
+			cl_git_pass(git_packbuilder_insert(pb, &oid, NULL));
+		} else {
+			if (git_object_type(obj) != GIT_OBJ_COMMIT)
+				cl_git_pass(git_packbuilder_insert(pb, &oid, NULL));
+
+			if (tips_only)
+				cl_git_pass(git_packbuilder_insert_commit(pb, git_object_id(commit)));
+			else
+				cl_git_pass(git_revwalk_push(walk, git_object_id(commit)));
+
+			git_object_free(commit);
+		}
+
+		git_object_free(obj);
+	}
+
+	while (!tips_only && git_revwalk_next(&oid, walk) == 0) {
+		if (no_blobs)
+			insert_without_blobs(pb, &oid);
+		else
+			cl_git_pass(git_packbuilder_insert_commit(pb, &oid));
+	}
+
+	buffer_pkt(out, "packfile");
+	git_buf_puts(out, "0016\2Counting objects\n");
+
+	if (_sideband_error)
+		git_buf_printf(out, "%04x\3%s\n",
+			(unsigned int)strlen(_sideband_error) + 6, _sideband_error);
+	else
+		cl_git_pass(git_packbuilder_foreach(pb, append_sideband, out));
+
+	git_buf_puts(out, "0000");
+
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+}
+
+static int v2_stream_write(
+	git_smart_subtransport_stream *stream,
+	const char *buffer,
+	size_t len)
+{
+	v2_stream *s = (v2_stream *)stream;
+	git_buf request = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_put(&request, buffer, len));
+
+	if (!git__prefixcmp(request.ptr, "0014command=ls-refs\n"))
+		serve_ls_refs(&s->response, request.ptr);
+	else if (!git__prefixcmp(request.ptr, "0012command=fetch\n"))
+		serve_fetch(&s->response, request.ptr);
+	else
+		cl_fail("unexpected request");
+
+	git_buf_free(&request);
+	return 0;
+}
+
+static void v2_stream_free(git_smart_subtransport_stream *stream)
+{
+	v2_stream *s = (v2_stream *)stream;
+
+	git_buf_free(&s->response);
+	git__free(s);
+}
+
+static int v2_action(
+	git_smart_subtransport_stream **out,
+	git_smart_subtransport *transport,
+	const char *url,
+	git_smart_service_t action)
+{
+	v2_stream *s = git__calloc(1, sizeof(v2_stream));
+	GIT_UNUSED(url);
+
+	cl_assert(s);
+	s->parent.subtransport = transport;
+	s->parent.read = v2_stream_read;
+	s->parent.write = v2_stream_write;
+	s->parent.free = v2_stream_free;
+
+	if (action == GIT_SERVICE_UPLOADPACK_LS) {
+		buffer_pkt(&s->response, "# service=git-upload-pack");
+		git_buf_puts(&s->response, "0000");
+		buffer_pkt(&s->response, "version 2");
+		buffer_pkt(&s->response, "agent=git/2.39.5");
+		buffer_pkt(&s->response, "ls-refs=unborn");
+		buffer_pkt(&s->response, "fetch=shallow filter wait-for-done");
+		buffer_pkt(&s->response, "object-format=sha1");
+		git_buf_puts(&s->response, "0000");
+	} else {
+		cl_assert_equal_i(GIT_SERVICE_UPLOADPACK, action);
+	}
+
+	*out = &s->parent;
+	return 0;
+}
+
+static int v2_close(git_smart_subtransport *transport)
+{
+	GIT_UNUSED(transport);
+	return 0;
+}
+
+static void v2_free(git_smart_subtransport *transport)
+{
+	git__free(transport);
+}
+
+static int v2_subtransport(git_smart_subtransport **out, git_transport *owner)
+{
+	git_smart_subtransport *t = git__calloc(1, sizeof(git_smart_subtransport));
+	GIT_UNUSED(owner);
+
+	cl_assert(t);
+	t->action = v2_action;
+	t->close = v2_close;
+	t->free = v2_free;
+
+	*out = t;
+	return 0;
+}
+
+static git_smart_subtransport_definition v2_definition = { v2_subtransport, 1 };
+
+void test_network_protocolv2__initialize(void)
+{
+	cl_git_pass(git_transport_register(
+		"v2test://", 1, git_transport_smart, &v2_definition));
+
+	cl_git_pass(git_repository_open(&_server, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_init(&_repo, "v2client", true));
+	cl_git_pass(git_remote_create(&_remote, _repo, "origin", "v2test://server"));
+
+	_fetch_requests = 0;
+	_sideband_error = NULL;
+}
+
+void test_network_protocolv2__cleanup(void)
+{
+	git_remote_free(_remote);
+	git_repository_free(_repo);
+	git_repository_free(_server);
+	git_buf_free(&_ls_refs_request);
+	git_buf_free(&_fetch_request);
+
+	cl_git_pass(git_transport_unregister("v2test://", 1));
+	cl_fixture_cleanup("v2client");
+}
+
+void test_network_protocolv2__ls_refs_is_limited_to_the_refspecs(void)
+{
+	const git_remote_head **heads;
+	size_t count, i;
+	bool found_peeled = false;
+
+	cl_git_pass(git_remote_connect(_remote, GIT_DIRECTION_FETCH));
+	cl_git_pass(git_remote_ls(&heads, &count, _remote));
+
+	cl_assert(strstr(_ls_refs_request.ptr, "ref-prefix refs/heads/\n"));
+	cl_assert(strstr(_ls_refs_request.ptr, "ref-prefix HEAD\n"));
+	cl_assert(strstr(_ls_refs_request.ptr, "ref-prefix refs/tags/\n"));
+
+	cl_assert(count > 0);
+	cl_assert_equal_s("HEAD", heads[0]->name);
+	cl_assert_equal_s("refs/heads/master", heads[0]->symref_target);
+
+	for (i = 0; i < count; ++i) {
+		cl_assert(!git__prefixcmp(heads[i]->name, "refs/heads/") ||
+			!git__prefixcmp(heads[i]->name, "refs/tags/") ||
+			!strcmp(heads[i]->name, "HEAD"));
+
+		if (!strcmp(heads[i]->name, "refs/tags/e90810b^{}")) {
+			cl_assert_equal_i(0, git_oid_streq(&heads[i]->oid,
+				"e90810b8df3e80c413d903f631643c716887138d"));
+			found_peeled = true;
+		}
+	}
+
+	cl_assert(found_peeled);
+	git_remote_disconnect(_remote);
+}
+
+void test_network_protocolv2__ls_refs_without_refspecs_lists_everything(void)
+{
+	git_remote *anon;
+	const git_remote_head **heads;
+	size_t count;
+
+	cl_git_pass(git_remote_create_anonymous(&anon, _repo, "v2test://server", NULL));
+	cl_git_pass(git_remote_connect(anon, GIT_DIRECTION_FETCH));
+	cl_git_pass(git_remote_ls(&heads, &count, anon));
+
+	cl_assert(strstr(_ls_refs_request.ptr, "ref-prefix") == NULL);
+	cl_assert(count > 0);
+
+	git_remote_disconnect(anon);
+	git_remote_free(anon);
+}
+
+void test_network_protocolv2__fetch(void)
+{
+	git_object *obj;
+
+	cl_git_pass(git_remote_fetch(_remote, NULL, NULL));
+
+	/* Everything is fetched into an empty repository */
+	cl_assert_equal_i(1, _fetch_requests);
+	cl_assert(strstr(_fetch_request.ptr, "have ") == NULL);
+
+	cl_git_pass(git_revparse_single(&obj, _repo, "refs/remotes/origin/master"));
+	cl_assert_equal_i(0, git_oid_streq(git_object_id(obj),
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	git_object_free(obj);
+
+	cl_git_pass(git_revparse_single(&obj, _repo, "refs/remotes/origin/subtrees^{tree}"));
+	git_object_free(obj);
+}
+
+static int append_progress(const char *str, int len, void *payload)
+{
+	git_buf *progress = payload;
+	return git_buf_put(progress, str, len);
+}
+
+void test_network_protocolv2__sideband_progress_and_errors(void)
+{
+	git_remote_callbacks callbacks = GIT_REMOTE_CALLBACKS_INIT;
+	git_buf progress = GIT_BUF_INIT;
+	const git_error *err;
+
+	callbacks.sideband_progress = append_progress;
+	callbacks.payload = &progress;
+	cl_git_pass(git_remote_set_callbacks(_remote, &callbacks));
+
+	_sideband_error = "upload-pack: out of memory";
+
+	cl_git_fail(git_remote_fetch(_remote, NULL, NULL));
+	cl_assert_equal_s("Counting objects\n", progress.ptr);
+
+	err = giterr_last();
+	cl_assert(err);
+	cl_assert_equal_s("Remote error: upload-pack: out of memory", err->message);
+
+	_sideband_error = NULL;
+	git_buf_clear(&progress);
+
+	cl_git_pass(git_remote_fetch(_remote, NULL, NULL));
+	cl_assert_equal_s("Counting objects\n", progress.ptr);
+
+	git_buf_free(&progress);
+}
+
+static int check_progress(const git_transfer_progress *stats, void *payload)
+{
+	int *calls = payload;
+
+	cl_assert(stats->received_objects <= stats->total_objects);
+	cl_assert(stats->indexed_objects <= stats->received_objects);
+
+	/* Give up right away when asked to */
+	if (*calls < 0)
+		return -1;
+
+	(*calls)++;
+	return 0;
+}
+
+void test_network_protocolv2__transfer_progress(void)
+{
+	git_remote_callbacks callbacks = GIT_REMOTE_CALLBACKS_INIT;
+	const git_transfer_progress *stats;
+	int calls = 0;
+
+	callbacks.transfer_progress = check_progress;
+	callbacks.payload = &calls;
+	cl_git_pass(git_remote_set_callbacks(_remote, &callbacks));
+
+	cl_git_pass(git_remote_fetch(_remote, NULL, NULL));
+	cl_assert(calls > 0);
+
+	stats = git_remote_stats(_remote);
+	cl_assert(stats->total_objects > 0);
+	cl_assert_equal_i(stats->total_objects, stats->indexed_objects);
+	cl_assert(stats->received_bytes > 0);
+}
+
+void test_network_protocolv2__transfer_progress_can_cancel(void)
+{
+	git_remote_callbacks callbacks = GIT_REMOTE_CALLBACKS_INIT;
+	int calls = -1;
+
+	callbacks.transfer_progress = check_progress;
+	callbacks.payload = &calls;
+	cl_git_pass(git_remote_set_callbacks(_remote, &callbacks));
+
+	cl_git_fail(git_remote_fetch(_remote, NULL, NULL));
+}
+
+static int count_commits(const char *tip)
+{
+	git_revwalk *walk;
+	git_oid oid;
+	int count = 0;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_ref(walk, tip));
+
+	while (git_revwalk_next(&oid, walk) == 0)
+		count++;
+
+	git_revwalk_free(walk);
+	return count;
+}
+
+void test_network_protocolv2__shallow_fetch_and_unshallow(void)
+{
+	git_buf contents = GIT_BUF_INIT;
+
+	git_remote_set_depth(_remote, 1);
+	cl_git_pass(git_remote_fetch(_remote, NULL, NULL));
+	cl_assert(strstr(_fetch_request.ptr, "000ddeepen 1\n") != NULL);
+
+	cl_git_pass(git_futils_readbuffer(&contents, "v2client/shallow"));
+	cl_assert(strstr(contents.ptr, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750\n") != NULL);
+	cl_assert_equal_i(1, count_commits("refs/remotes/origin/master"));
+
+	git_remote_set_depth(_remote, GIT_REMOTE_DEPTH_UNSHALLOW);
+	cl_git_pass(git_remote_fetch(_remote, NULL, NULL));
+	cl_assert(strstr(_fetch_request.ptr,
+		"shallow a65fedf39aefe402d3bb6e24df4d4f5fe4547750\n") != NULL);
+	cl_assert(strstr(_fetch_request.ptr, "want a65fedf39aefe402d3bb6e24df4d4f5fe4547750\n") != NULL);
+
+	cl_assert(!git_path_exists("v2client/shallow"));
+	cl_assert_equal_i(7, count_commits("refs/remotes/origin/master"));
+
+	git_buf_free(&contents);
+}
+
+static int count_promisor_packs(void *payload, git_buf *path)
+{
+	if (!git__suffixcmp(path->ptr, ".promisor"))
+		(*(int *)payload)++;
+
+	return 0;
+}
+
+void test_network_protocolv2__partial_clone_fetches_blobs_lazily(void)
+{
+	git_buf path = GIT_BUF_INIT;
+	git_odb *odb;
+	git_blob *blob;
+	git_oid id;
+	int promisor_packs = 0;
+
+	cl_git_fail_with(GIT_EINVALIDSPEC, git_remote_set_filter(_remote, "blob:some"));
+	cl_git_pass(git_remote_set_filter(_remote, "blob:none"));
+	cl_git_pass(git_remote_save(_remote));
+
+	cl_git_pass(git_remote_fetch(_remote, NULL, NULL));
+	cl_assert(strstr(_fetch_request.ptr, "0015filter blob:none\n") != NULL);
+
+	cl_git_pass(git_buf_sets(&path, "v2client/objects/pack"));
+	cl_git_pass(git_path_direach(&path, 0, count_promisor_packs, &promisor_packs));
+	cl_assert_equal_i(1, promisor_packs);
+
+	/* The README of master, which we left out */
+	cl_git_pass(git_oid_fromstr(&id, "a8233120f6ad708f843d861ce2b7228ec4e3dec6"));
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_assert(!git_odb_exists(odb, &id));
+
+	cl_git_pass(git_blob_lookup(&blob, _repo, &id));
+	cl_assert_equal_i(2, _fetch_requests);
+	cl_assert(strstr(_fetch_request.ptr,
+		"want a8233120f6ad708f843d861ce2b7228ec4e3dec6\n") != NULL);
+	cl_assert(strstr(_fetch_request.ptr, "filter ") == NULL);
+
+	git_blob_free(blob);
+	git_odb_free(odb);
+	git_buf_free(&path);
+}
@@ -44,6 +44,39 @@ void test_object_raw_hash__hash_by_blocks(void)
 	git_hash_ctx_cleanup(&ctx);
 }
 
+void test_object_raw_hash__hash_many_blocks_in_uneven_chunks(void)
+{
+	git_hash_ctx ctx;
+	git_oid id1, id2;
+	char *buf;
+	size_t len = 1000000, chunk, pos = 0, i = 0;
+
+	/* FIPS 180 test vector: one million repetitions of 'a' */
+	cl_git_pass(git_oid_fromstr(&id1, "34aa973cd4c4daa4f61eeb2bdbad27316534016f"));
+
+	buf = git__malloc(len);
+	cl_assert(buf);
+	memset(buf, 'a', len);
+
+	cl_git_pass(git_hash_buf(&id2, buf, len));
+	cl_assert(git_oid_cmp(&id1, &id2) == 0);
+
+	/* feed partial and multi-block updates at varying offsets */
+	cl_git_pass(git_hash_ctx_init(&ctx));
+	while (pos < len) {
+		chunk = (i++ * 997) % 4099 + 1;
+		if (chunk > len - pos)
+			chunk = len - pos;
+		cl_git_pass(git_hash_update(&ctx, buf + pos, chunk));
+		pos += chunk;
+	}
+	cl_git_pass(git_hash_final(&id2, &ctx));
+	cl_assert(git_oid_cmp(&id1, &id2) == 0);
+
+	git_hash_ctx_cleanup(&ctx);
+	git__free(buf);
+}
+
 void test_object_raw_hash__hash_buffer_in_single_call(void)
 {
 	git_oid id1, id2;
@@ -70,6 +103,42 @@ void test_object_raw_hash__hash_vector(void)
 	cl_assert(git_oid_cmp(&id1, &id2) == 0);
 }
 
+void test_object_raw_hash__hash_batch(void)
+{
+	git_oid expected, ids[3];
+	git_buf_vec vec[6];
+	char *big;
+	size_t big_len = 3 * 1024 * 1024;
+
+	big = git__malloc(big_len);
+	cl_assert(big);
+	memset(big, 'x', big_len);
+
+	vec[0].data = hello_text;
+	vec[0].len  = 4;
+	vec[1].data = hello_text + 4;
+	vec[1].len  = strlen(hello_text) - 4;
+	vec[2].data = bye_text;
+	vec[2].len  = strlen(bye_text);
+	vec[3].data = NULL;
+	vec[3].len  = 0;
+	vec[4].data = big;
+	vec[4].len  = big_len / 2;
+	vec[5].data = big + big_len / 2;
+	vec[5].len  = big_len - big_len / 2;
+
+	cl_git_pass(git_hash_batch(ids, vec, 3, 2));
+
+	cl_git_pass(git_oid_fromstr(&expected, hello_id));
+	cl_assert(git_oid_cmp(&expected, &ids[0]) == 0);
+	cl_git_pass(git_oid_fromstr(&expected, bye_id));
+	cl_assert(git_oid_cmp(&expected, &ids[1]) == 0);
+	cl_git_pass(git_hash_buf(&expected, big, big_len));
+	cl_assert(git_oid_cmp(&expected, &ids[2]) == 0);
+
+	git__free(big);
+}
+
 void test_object_raw_hash__hash_junk_data(void)
 {
 	git_oid id, id_zero;
@@ -150,3 +150,37 @@ void test_odb_loose__permissions_readwrite(void)
 {
 	test_write_object_permission(0777, 0666, 0777, 0666);
 }
+
+void test_odb_loose__write_batch(void)
+{
+	git_odb *odb;
+	git_oid ids[3], expected;
+	git_rawobj objs[3];
+	git_odb_object *obj;
+	size_t i;
+
+	objs[0].data = "Test data\n";
+	objs[0].len = 10;
+	objs[0].type = GIT_OBJ_BLOB;
+	objs[1].data = NULL;
+	objs[1].len = 0;
+	objs[1].type = GIT_OBJ_BLOB;
+	objs[2] = objs[0];
+
+	cl_git_pass(git_odb_open(&odb, "test-objects"));
+	cl_git_pass(git_odb__write_batch(ids, odb, objs, 3));
+
+	cl_git_pass(git_oid_fromstr(&expected, "67b808feb36201507a77f85e6d898f0a2836e4a5"));
+	cl_assert(git_oid_equal(&expected, &ids[0]));
+	cl_assert(git_oid_equal(&expected, &ids[2]));
+	cl_git_pass(git_oid_fromstr(&expected, "e69de29bb2d1d6434b8b29ae775ad8c2e48c5391"));
+	cl_assert(git_oid_equal(&expected, &ids[1]));
+
+	for (i = 0; i < 3; i++) {
+		cl_git_pass(git_odb_read(&obj, odb, &ids[i]));
+		cl_assert_equal_sz(objs[i].len, git_odb_object_size(obj));
+		git_odb_object_free(obj);
+	}
+
+	git_odb_free(odb);
+}
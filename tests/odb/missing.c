@@ -0,0 +1,129 @@
+#include "clar_libgit2.h"
+#include "odb.h"
+
+static git_repository *_repo;
+static git_odb *_odb, *_source;
+static int _calls;
+static size_t _requested;
+
+void test_odb_missing__initialize(void)
+{
+	cl_git_pass(git_repository_init(&_repo, "missing.git", true));
+	cl_git_pass(git_repository_odb(&_odb, _repo));
+	cl_git_pass(git_odb_open(&_source, cl_fixture("testrepo.git/objects")));
+
+	_calls = 0;
+	_requested = 0;
+}
+
+void test_odb_missing__cleanup(void)
+{
+	git_odb_free(_source);
+	git_odb_free(_odb);
+	git_repository_free(_repo);
+	cl_fixture_cleanup("missing.git");
+}
+
+static int copy_from_source(
+	git_odb *odb, const git_oid *ids, size_t count, void *payload)
+{
+	git_odb_object *obj;
+	git_oid written;
+	size_t i;
+
+	cl_assert(payload == _source);
+
+	_calls++;
+	_requested += count;
+
+	for (i = 0; i < count; ++i) {
+		if (git_odb_read(&obj, _source, &ids[i]) < 0)
+			return GIT_ENOTFOUND;
+
+		cl_git_pass(git_odb_write(&written, odb,
+			git_odb_object_data(obj), git_odb_object_size(obj),
+			git_odb_object_type(obj)));
+		git_odb_object_free(obj);
+	}
+
+	return 0;
+}
+
+void test_odb_missing__read_asks_the_callback(void)
+{
+	git_odb_object *obj;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+
+	/* Without a promisor remote, there is nobody to ask */
+	cl_assert_equal_i(GIT_ENOTFOUND, git_odb_read(&obj, _odb, &id));
+
+	cl_git_pass(git_odb_set_missing_cb(_odb, copy_from_source, _source));
+
+	cl_git_pass(git_odb_read(&obj, _odb, &id));
+	cl_assert_equal_i(GIT_OBJ_COMMIT, git_odb_object_type(obj));
+	cl_assert_equal_i(1, _calls);
+	git_odb_object_free(obj);
+
+	/* It's there now */
+	cl_git_pass(git_odb_read(&obj, _odb, &id));
+	cl_assert_equal_i(1, _calls);
+	git_odb_object_free(obj);
+}
+
+void test_odb_missing__unknown_objects_are_not_found(void)
+{
+	git_odb_object *obj;
+	git_oid id;
+
+	cl_git_pass(git_odb_set_missing_cb(_odb, copy_from_source, _source));
+	cl_git_pass(git_oid_fromstr(&id, "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"));
+
+	cl_assert_equal_i(GIT_ENOTFOUND, git_odb_read(&obj, _odb, &id));
+	cl_assert_equal_i(1, _calls);
+}
+
+void test_odb_missing__prefetch_asks_once_for_the_missing_objects(void)
+{
+	git_odb_object *obj;
+	git_oid ids[3], written;
+	size_t i;
+
+	cl_git_pass(git_oid_fromstr(&ids[0], "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_oid_fromstr(&ids[1], "1385f264afb75a56a5bec74243be9b367ba4ca08"));
+	cl_git_pass(git_oid_fromstr(&ids[2], "a8233120f6ad708f843d861ce2b7228ec4e3dec6"));
+
+	/* One of them is already there */
+	cl_git_pass(git_odb_read(&obj, _source, &ids[1]));
+	cl_git_pass(git_odb_write(&written, _odb, git_odb_object_data(obj),
+		git_odb_object_size(obj), git_odb_object_type(obj)));
+	git_odb_object_free(obj);
+
+	cl_git_pass(git_odb_set_missing_cb(_odb, copy_from_source, _source));
+	cl_git_pass(git_odb_prefetch(_odb, ids, 3));
+
+	cl_assert_equal_i(1, _calls);
+	cl_assert_equal_sz(2, _requested);
+
+	for (i = 0; i < 3; ++i)
+		cl_assert(git_odb_exists(_odb, &ids[i]));
+}
+
+void test_odb_missing__only_partial_clones_fetch_lazily(void)
+{
+	git_remote *remote;
+
+	/* A plain repository doesn't ask anybody */
+	cl_assert(_odb->missing_cb == NULL);
+
+	cl_git_pass(git_remote_create(&remote, _repo, "origin", "file:///nowhere"));
+	cl_assert(_odb->missing_cb == NULL);
+
+	cl_git_pass(git_remote_set_filter(remote, "blob:none"));
+	cl_git_pass(git_remote_save(remote));
+	git_remote_free(remote);
+
+	cl_assert(_odb->missing_cb != NULL);
+	cl_assert(_odb->missing_payload == _repo);
+}
@@ -0,0 +1,91 @@
+#include "clar_libgit2.h"
+#include "delta.h"
+#include "delta-apply.h"
+
+static void assert_delta_roundtrip(
+	const unsigned char *src, size_t src_len,
+	const unsigned char *trg, size_t trg_len,
+	size_t max_delta_len)
+{
+	void *delta;
+	unsigned long delta_len;
+	git_rawobj out;
+
+	delta = git_delta(src, (unsigned long)src_len,
+		trg, (unsigned long)trg_len, &delta_len, 0);
+	cl_assert(delta);
+
+	if (max_delta_len)
+		cl_assert(delta_len <= max_delta_len);
+
+	cl_git_pass(git__delta_apply(&out, src, src_len, delta, delta_len));
+	cl_assert_equal_sz(trg_len, out.len);
+	cl_assert(memcmp(trg, out.data, trg_len) == 0);
+
+	git__free(out.data);
+	git__free(delta);
+}
+
+static void fill_pseudorandom(unsigned char *buf, size_t len, unsigned int seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (unsigned char)(seed >> 16);
+	}
+}
+
+void test_pack_delta__identical_buffers(void)
+{
+	unsigned char buf[4099];
+
+	fill_pseudorandom(buf, sizeof(buf), 42);
+
+	/* a single copy op for the whole buffer */
+	assert_delta_roundtrip(buf, sizeof(buf), buf, sizeof(buf), 16);
+}
+
+void test_pack_delta__unaligned_mismatches(void)
+{
+	unsigned char src[8192], trg[8192];
+	size_t i;
+
+	fill_pseudorandom(src, sizeof(src), 7);
+
+	/*
+	 * Flip a byte at every offset modulo the word size so that the
+	 * mismatch falls in every position of a word-sized comparison.
+	 */
+	for (i = 0; i < 16; i++) {
+		memcpy(trg, src, sizeof(trg));
+		trg[1000 + i * 257] ^= 0xff;
+		trg[5000 + i * 13] ^= 0x5a;
+		assert_delta_roundtrip(src, sizeof(src), trg, sizeof(trg), 64);
+	}
+}
+
+void test_pack_delta__shifted_and_truncated_target(void)
+{
+	unsigned char src[6000], trg[6100];
+
+	fill_pseudorandom(src, sizeof(src), 1234);
+
+	/* insertion at the front, then the source, cut short mid-word */
+	fill_pseudorandom(trg, 100, 99);
+	memcpy(trg + 100, src, sizeof(trg) - 100);
+	assert_delta_roundtrip(src, sizeof(src), trg, sizeof(trg) - 3, 200);
+
+	/* the target ends in the middle of a match */
+	assert_delta_roundtrip(src, sizeof(src), src + 11, 1234, 32);
+}
+
+void test_pack_delta__unrelated_buffers(void)
+{
+	unsigned char src[2048], trg[3001];
+
+	fill_pseudorandom(src, sizeof(src), 1);
+	fill_pseudorandom(trg, sizeof(trg), 2);
+
+	assert_delta_roundtrip(src, sizeof(src), trg, sizeof(trg), 0);
+}
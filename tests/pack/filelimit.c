@@ -0,0 +1,79 @@
+#include "clar_libgit2.h"
+#include "mwindow.h"
+
+static git_repository *g_repo;
+static size_t g_file_limit;
+
+/* one object out of each of the packs in testrepo.git */
+static const char *packed_objects[] = {
+	"fb20a5a4b6185d9188d82c874db3d9729ef31f3b",
+	"41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9",
+	"e90810b8df3e80c413d903f631643c716887138d",
+};
+
+void test_pack_filelimit__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_FILE_LIMIT, &g_file_limit));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0));
+
+	g_repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_pack_filelimit__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_FILE_LIMIT, g_file_limit));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 1));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_WHOLE_PACK_MMAP, 0));
+}
+
+static void read_packed_objects(size_t rounds, size_t max_open)
+{
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid id;
+	size_t i;
+
+	cl_git_pass(git_repository_odb(&odb, g_repo));
+
+	for (i = 0; i < rounds * ARRAY_SIZE(packed_objects); i++) {
+		cl_git_pass(git_oid_fromstr(&id,
+			packed_objects[i % ARRAY_SIZE(packed_objects)]));
+		cl_git_pass(git_odb_read(&obj, odb, &id));
+		cl_assert_equal_i(GIT_OBJ_COMMIT, git_odb_object_type(obj));
+		git_odb_object_free(obj);
+
+		cl_assert(git_mwindow__mem_ctl.windowfiles.length <= max_open);
+	}
+
+	git_odb_free(odb);
+}
+
+void test_pack_filelimit__packs_are_reopened_past_the_limit(void)
+{
+	size_t limit;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_FILE_LIMIT, (size_t)1));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_FILE_LIMIT, &limit));
+	cl_assert_equal_sz(1, limit);
+
+	read_packed_objects(3, 1);
+}
+
+void test_pack_filelimit__no_limit_keeps_packs_open(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_FILE_LIMIT, (size_t)0));
+
+	read_packed_objects(1, ARRAY_SIZE(packed_objects));
+	cl_assert_equal_i(
+		ARRAY_SIZE(packed_objects), git_mwindow__mem_ctl.windowfiles.length);
+}
+
+void test_pack_filelimit__packs_mapped_whole_keep_no_descriptor(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_WHOLE_PACK_MMAP, 1));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_FILE_LIMIT, (size_t)1));
+
+	read_packed_objects(2, 0);
+}
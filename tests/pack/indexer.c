@@ -43,6 +43,11 @@ static const unsigned int thin_pack_len = 78;
 static const unsigned char base_obj[] = { 07, 076 };
 static const unsigned int base_obj_len = 2;
 
+void test_pack_indexer__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_TRANSFER_PROGRESS_INTERVAL, 0));
+}
+
 void test_pack_indexer__out_of_order(void)
 {
 	git_indexer *idx = 0;
@@ -125,3 +130,61 @@ void test_pack_indexer__fix_thin(void)
 		git_indexer_free(idx);
 	}
 }
+
+static int count_progress(const git_transfer_progress *stats, void *payload)
+{
+	GIT_UNUSED(stats);
+	(*(int *)payload)++;
+	return 0;
+}
+
+static int index_out_of_order(git_transfer_progress *stats)
+{
+	git_indexer *idx = NULL;
+	int calls = 0;
+
+	memset(stats, 0, sizeof(*stats));
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, count_progress, &calls));
+	cl_git_pass(git_indexer_append(
+		idx, out_of_order_pack, out_of_order_pack_len, stats));
+	cl_git_pass(git_indexer_commit(idx, stats));
+	git_indexer_free(idx);
+
+	return calls;
+}
+
+void test_pack_indexer__progress_is_throttled(void)
+{
+	git_transfer_progress stats;
+	int interval;
+
+	/* The header, each of the three objects and each of the two deltas */
+	cl_assert_equal_i(6, index_out_of_order(&stats));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_TRANSFER_PROGRESS_INTERVAL, 60000));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_TRANSFER_PROGRESS_INTERVAL, &interval));
+	cl_assert_equal_i(60000, interval);
+
+	/* Only the first and last updates of each phase make it through */
+	cl_assert_equal_i(3, index_out_of_order(&stats));
+	cl_assert_equal_i(3, stats.indexed_objects);
+
+	cl_git_fail(git_libgit2_opts(GIT_OPT_SET_TRANSFER_PROGRESS_INTERVAL, -1));
+}
+
+void test_pack_indexer__measures_the_phases(void)
+{
+	git_transfer_progress stats;
+
+	index_out_of_order(&stats);
+
+	cl_assert(stats.inflate_time > 0);
+	cl_assert(stats.hash_time > 0);
+	cl_assert(stats.resolve_time > 0);
+	cl_assert(stats.objects_per_second > 0);
+
+	/* Nothing came over the network */
+	cl_assert(stats.network_time == 0);
+	cl_assert(stats.bytes_per_second == 0);
+}
@@ -0,0 +1,161 @@
+#include "clar_libgit2.h"
+
+#include "path.h"
+#include "refs.h"
+#include "git2/reflog.h"
+#include "git2/sys/refs.h"
+#include "ref_helpers.h"
+
+static const char *master_tip = "099fabac3a9ea935598528c27f866e34089c2eff";
+static const char *br2_tip = "a4a7dce85cf63874e984719f4fdd239f5145052f";
+
+static git_repository *g_repo;
+static git_signature *g_sig;
+static git_reference *g_refs[8];
+static size_t g_count;
+
+void test_refs_batch__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo");
+	cl_git_pass(git_signature_now(&g_sig, "foo", "foo@bar"));
+	g_count = 0;
+}
+
+void test_refs_batch__cleanup(void)
+{
+	size_t i;
+
+	for (i = 0; i < g_count; ++i)
+		git_reference_free(g_refs[i]);
+
+	git_signature_free(g_sig);
+	cl_git_sandbox_cleanup();
+}
+
+static void add(const char *name, const char *target)
+{
+	git_oid id = {{0}};
+
+	if (target)
+		cl_git_pass(git_oid_fromstr(&id, target));
+
+	cl_assert(g_count < ARRAY_SIZE(g_refs));
+	cl_assert(g_refs[g_count++] = git_reference__alloc(name, &id, NULL));
+}
+
+static void assert_ref(const char *name, const char *target, int packed)
+{
+	git_reference *ref;
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, name));
+	cl_assert_equal_i(packed, reference_is_packed(ref));
+	cl_assert_equal_i(0, git_oid_streq(git_reference_target(ref), target));
+	git_reference_free(ref);
+}
+
+static void assert_last_log(const char *name, const char *old, const char *new)
+{
+	git_reflog *reflog;
+	const git_reflog_entry *entry;
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, name));
+	cl_assert(entry = git_reflog_entry_byindex(reflog, 0));
+	cl_assert_equal_i(0, git_oid_streq(git_reflog_entry_id_old(entry), old));
+	cl_assert_equal_i(0, git_oid_streq(git_reflog_entry_id_new(entry), new));
+	cl_assert_equal_s("batched", git_reflog_entry_message(entry));
+	git_reflog_free(reflog);
+}
+
+void test_refs_batch__writes_and_deletes_in_one_go(void)
+{
+	git_reference *ref;
+
+	add("refs/heads/br2", master_tip);
+	add("refs/remotes/origin/new", br2_tip);
+	add("refs/heads/packed", NULL);
+	add("refs/heads/test", NULL);
+	add("refs/heads/does-not-exist", NULL);
+
+	cl_git_pass(git_reference__update_batch(g_repo, g_refs, g_count, g_sig, "batched"));
+
+	/* A batch this small just writes loose files */
+	assert_ref("refs/heads/br2", master_tip, 0);
+	assert_ref("refs/remotes/origin/new", br2_tip, 0);
+	assert_last_log("refs/heads/br2", br2_tip, master_tip);
+	assert_last_log("refs/remotes/origin/new", GIT_OID_HEX_ZERO, br2_tip);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/packed"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/test"));
+	cl_assert(!git_path_exists("testrepo/.git/refs/heads/test"));
+
+	/* The rest are still there */
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/packed-test"));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+	git_reference_free(ref);
+}
+
+void test_refs_batch__updating_the_current_branch_logs_head(void)
+{
+	add("refs/heads/master", br2_tip);
+
+	cl_git_pass(git_reference__update_batch(g_repo, g_refs, g_count, g_sig, "batched"));
+
+	assert_ref("refs/heads/master", br2_tip, 0);
+	assert_last_log("refs/heads/master", master_tip, br2_tip);
+	assert_last_log(GIT_HEAD_FILE, master_tip, br2_tip);
+}
+
+void test_refs_batch__large_batches_are_packed(void)
+{
+	git_reference *refs[100];
+	git_buf name = GIT_BUF_INIT;
+	git_oid id;
+	size_t i;
+
+	cl_git_pass(git_oid_fromstr(&id, master_tip));
+
+	for (i = 0; i < ARRAY_SIZE(refs); ++i) {
+		git_buf_clear(&name);
+		cl_git_pass(git_buf_printf(&name, "refs/remotes/origin/bulk-%d", (int)i));
+		cl_assert(refs[i] = git_reference__alloc(name.ptr, &id, NULL));
+	}
+
+	cl_git_pass(git_reference__update_batch(g_repo, refs, ARRAY_SIZE(refs), g_sig, "batched"));
+
+	assert_ref("refs/remotes/origin/bulk-0", master_tip, 1);
+	assert_ref("refs/remotes/origin/bulk-99", master_tip, 1);
+	cl_assert(!git_path_exists("testrepo/.git/refs/remotes/origin/bulk-0"));
+
+	for (i = 0; i < ARRAY_SIZE(refs); ++i)
+		git_reference_free(refs[i]);
+	git_buf_free(&name);
+}
+
+void test_refs_batch__rejects_colliding_names(void)
+{
+	git_reference *ref;
+
+	add("refs/remotes/origin/a", master_tip);
+	add("refs/remotes/origin/a/b", master_tip);
+	cl_git_fail(git_reference__update_batch(g_repo, g_refs, g_count, g_sig, "batched"));
+
+	git_reference_free(g_refs[--g_count]);
+	git_reference_free(g_refs[--g_count]);
+
+	add("refs/heads/master/sub", br2_tip);
+	cl_git_fail(git_reference__update_batch(g_repo, g_refs, g_count, g_sig, "batched"));
+
+	git_reference_free(g_refs[--g_count]);
+
+	add("refs/heads/br2", master_tip);
+	add("refs/tags/e90810b/sub", master_tip);
+	cl_git_fail(git_reference__update_batch(g_repo, g_refs, g_count, g_sig, "batched"));
+
+	/* Nothing was written */
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/br2"));
+	cl_assert_equal_i(0, git_oid_streq(git_reference_target(ref), br2_tip));
+	git_reference_free(ref);
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/remotes/origin/a"));
+}
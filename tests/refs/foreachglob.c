@@ -93,3 +93,15 @@ void test_refs_foreachglob__can_cancel(void)
 
 	cl_assert_equal_i(11, count);
 }
+
+void test_refs_foreachglob__retrieve_references_under_a_literal_prefix(void)
+{
+	/* refs/heads/packed is only packed, refs/heads/packed-test loose */
+	assert_retrieval("refs/heads/packed*", 2);
+	assert_retrieval("refs/heads/pack?d", 1);
+	assert_retrieval("refs/remotes/test/*", 1);
+	assert_retrieval("refs/remotes/nulltoken/*", 1);
+	assert_retrieval("refs/tags/e9*", 1);
+	assert_retrieval("refs/nonexistent/*", 0);
+	assert_retrieval("refs/heads/packed-test/*", 0);
+}
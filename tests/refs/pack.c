@@ -103,3 +103,105 @@ void test_refs_pack__symbolic(void)
 
 	packall();
 }
+
+static void write_packed_refs(const char *contents)
+{
+	git_buf path = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(g_repo), GIT_PACKEDREFS_FILE));
+	cl_git_rewritefile(path.ptr, contents);
+	git_buf_free(&path);
+}
+
+static size_t count_refs(const char *glob)
+{
+	git_reference_iterator *iter;
+	const char *name;
+	size_t count = 0;
+	int error;
+
+	cl_git_pass(git_reference_iterator_glob_new(&iter, g_repo, glob));
+
+	while ((error = git_reference_next_name(&name, iter)) == 0) {
+		cl_assert(p_fnmatch(glob, name, 0) == 0);
+		count++;
+	}
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	git_reference_iterator_free(iter);
+	return count;
+}
+
+void test_refs_pack__searches_sorted_files_in_place(void)
+{
+	git_buf contents = GIT_BUF_INIT;
+	git_reference *ref;
+	git_oid peeled;
+	int i;
+
+	git_buf_puts(&contents, GIT_PACKEDREFS_HEADER "\n");
+	for (i = 0; i < 1000; ++i)
+		git_buf_printf(&contents,
+			"a65fedf39aefe402d3bb6e24df4d4f5fe4547750 refs/heads/many-%04d\n", i);
+	git_buf_puts(&contents,
+		"b25fa35b38051e4ae45d4222e795f9df2e43f1d1 refs/tags/annotated\n"
+		"^e90810b8df3e80c413d903f631643c716887138d\n"
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750 refs/tags/last\r\n");
+	write_packed_refs(contents.ptr);
+	git_buf_free(&contents);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/many-0000"));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/many-0999"));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/tags/last"));
+	git_reference_free(ref);
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/heads/many-1000"));
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/heads/many"));
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/tags/annotated"));
+	git_oid_fromstr(&peeled, "e90810b8df3e80c413d903f631643c716887138d");
+	cl_assert(git_oid_equal(&peeled, git_reference_target_peel(ref)));
+	git_reference_free(ref);
+
+	/* loose references are still found, and win over the packed ones */
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+	git_reference_free(ref);
+
+	cl_assert_equal_i(100, count_refs("refs/heads/many-05*"));
+	cl_assert_equal_i(1000, count_refs("refs/heads/many-*"));
+	cl_assert_equal_i(0, count_refs("refs/heads/many-1*"));
+
+	/* a rewritten file gets mapped again */
+	write_packed_refs(GIT_PACKEDREFS_HEADER "\n"
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750 refs/heads/many-1000\n");
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/many-1000"));
+	git_reference_free(ref);
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/heads/many-0000"));
+}
+
+void test_refs_pack__reads_unsorted_files(void)
+{
+	git_reference *ref;
+
+	write_packed_refs("# pack-refs with: peeled \n"
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750 refs/heads/zzz\n"
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750 refs/heads/aaa\n");
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/aaa"));
+	git_reference_free(ref);
+	cl_assert_equal_i(2, count_refs("refs/heads/[az]*"));
+
+	/* what gets written back is sorted */
+	packall();
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/aaa"));
+	cl_assert(reference_is_packed(ref));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/zzz"));
+	git_reference_free(ref);
+}
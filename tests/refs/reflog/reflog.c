@@ -334,3 +334,83 @@ void test_refs_reflog_reflog__logallrefupdates_nonbare_set_false(void)
 
 	assert_no_reflog_update();
 }
+
+void test_refs_reflog_reflog__read_only_the_most_recent_entries(void)
+{
+	git_reflog *reflog, *recent;
+	const git_reflog_entry *expected, *actual;
+	size_t i;
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "HEAD"));
+	cl_assert_equal_i(7, (int)git_reflog_entrycount(reflog));
+
+	cl_git_pass(git_reflog_read_recent(&recent, g_repo, "HEAD", 3));
+	cl_assert_equal_i(3, (int)git_reflog_entrycount(recent));
+
+	for (i = 0; i < 3; i++) {
+		expected = git_reflog_entry_byindex(reflog, i);
+		actual = git_reflog_entry_byindex(recent, i);
+
+		cl_assert(git_oid_equal(&expected->oid_old, &actual->oid_old));
+		cl_assert(git_oid_equal(&expected->oid_cur, &actual->oid_cur));
+		cl_assert_equal_s(expected->msg, actual->msg);
+	}
+
+	/* it only holds part of the log, so it cannot replace it */
+	cl_git_fail(git_reflog_write(recent));
+	git_reflog_free(recent);
+
+	cl_git_pass(git_reflog_read_recent(&recent, g_repo, "HEAD", 100));
+	cl_assert_equal_i(7, (int)git_reflog_entrycount(recent));
+	git_reflog_free(recent);
+
+	cl_git_pass(git_reflog_read_recent(&recent, g_repo, "HEAD", 0));
+	cl_assert_equal_i(0, (int)git_reflog_entrycount(recent));
+	git_reflog_free(recent);
+
+	cl_git_pass(git_reflog_read_recent(&recent, g_repo, "refs/heads/subtrees", 3));
+	cl_assert_equal_i(0, (int)git_reflog_entrycount(recent));
+	git_reflog_free(recent);
+
+	git_reflog_free(reflog);
+}
+
+void test_refs_reflog_reflog__appending_cuts_back_logs_past_logmaxentries(void)
+{
+	const char *ids[] = {
+		"be3563ae3f795b2b4353bcce3a527ad0a4f7f644", current_master_tip
+	};
+	git_config *config;
+	git_reference *ref;
+	git_reflog *reflog;
+	git_oid id;
+	int i;
+
+	cl_git_pass(git_repository_config(&config, g_repo));
+	cl_git_pass(git_config_set_int32(config, "core.logmaxentries", 4));
+	git_config_free(config);
+
+	g_repo = cl_git_sandbox_reopen();
+
+	/* the log grows to six entries, half again the limit */
+	for (i = 0; i < 4; i++) {
+		git_oid_fromstr(&id, ids[i % 2]);
+		cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/master", &id, 1, NULL, NULL));
+		git_reference_free(ref);
+	}
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/master"));
+	cl_assert_equal_i(6, (int)git_reflog_entrycount(reflog));
+	git_reflog_free(reflog);
+
+	/* and the next entry takes it back to the newest four */
+	git_oid_fromstr(&id, ids[0]);
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/master", &id, 1, NULL, NULL));
+	git_reference_free(ref);
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/master"));
+	cl_assert_equal_i(4, (int)git_reflog_entrycount(reflog));
+	cl_assert(git_oid_equal(&id, &git_reflog_entry_byindex(reflog, 0)->oid_cur));
+	cl_assert(git_oid_streq(&git_reflog_entry_byindex(reflog, 3)->oid_old, ids[0]) == 0);
+	git_reflog_free(reflog);
+}
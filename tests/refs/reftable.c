@@ -0,0 +1,504 @@
+#include "clar_libgit2.h"
+
+#include <zlib.h>
+
+#include "buffer.h"
+#include "fileops.h"
+#include "refs.h"
+#include "reftable.h"
+#include "git2/refdb.h"
+#include "git2/reflog.h"
+#include "git2/sys/refdb_backend.h"
+#include "git2/sys/refs.h"
+
+static const char *master_tip = "099fabac3a9ea935598528c27f866e34089c2eff";
+static const char *br2_tip = "a4a7dce85cf63874e984719f4fdd239f5145052f";
+
+static git_repository *g_repo;
+static git_signature *g_sig;
+
+void test_refs_reftable__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo");
+	cl_git_pass(git_signature_now(&g_sig, "foo", "foo@bar"));
+}
+
+void test_refs_reftable__cleanup(void)
+{
+	git_signature_free(g_sig);
+	cl_git_sandbox_cleanup();
+	cl_fixture_cleanup("test.ref");
+}
+
+static int buf_write_cb(const void *data, size_t len, void *payload)
+{
+	return git_buf_put(payload, data, len);
+}
+
+static void use_reftable(void)
+{
+	git_config *cfg;
+
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_set_int32(cfg, "core.repositoryformatversion", 1));
+	cl_git_pass(git_config_set_string(cfg, "extensions.refStorage", "reftable"));
+	git_config_free(cfg);
+
+	g_repo = cl_git_sandbox_reopen();
+}
+
+static void assert_ref(const char *name, const char *target)
+{
+	git_reference *ref;
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, name));
+	cl_assert_equal_i(0, git_oid_streq(git_reference_target(ref), target));
+	git_reference_free(ref);
+}
+
+static size_t count_tables(void)
+{
+	git_buf list = GIT_BUF_INIT;
+	size_t i, count = 0;
+
+	cl_git_pass(git_futils_readbuffer(&list, "testrepo/.git/reftable/tables.list"));
+
+	for (i = 0; i < list.size; ++i)
+		count += (list.ptr[i] == '\n');
+
+	git_buf_free(&list);
+	return count;
+}
+
+void test_refs_reftable__round_trips_many_records(void)
+{
+	git_reftable_writer *writer;
+	git_reftable *table;
+	git_reftable_iter iter;
+	git_reftable_ref ref;
+	git_reftable_log log;
+	git_buf out = GIT_BUF_INIT, name = GIT_BUF_INIT;
+	int i;
+
+	memset(&ref, 0, sizeof(ref));
+	memset(&log, 0, sizeof(log));
+
+	cl_git_pass(git_reftable_writer_new(&writer, 1, 2, buf_write_cb, &out));
+
+	/* Enough references for several blocks and an index over them */
+	ref.type = GIT_REFTABLE_REF_VAL1;
+	ref.update_index = 1;
+	cl_git_pass(git_oid_fromstr(&ref.id, master_tip));
+
+	for (i = 0; i < 2000; ++i) {
+		git_buf_clear(&name);
+		cl_git_pass(git_buf_printf(&name, "refs/heads/branch-%04d", i));
+		ref.name = name.ptr;
+		cl_git_pass(git_reftable_writer_add_ref(writer, &ref));
+	}
+
+	ref.name = "refs/heads/branch-0000";
+	cl_git_fail(git_reftable_writer_add_ref(writer, &ref));
+
+	log.name = "refs/heads/branch-0001";
+	log.type = GIT_REFTABLE_LOG_UPDATE;
+	log.committer_name = "foo";
+	log.committer_email = "foo@bar";
+	log.time = 1234567890;
+	log.offset = -120;
+	log.message = "second\n";
+	log.update_index = 2;
+	cl_git_pass(git_oid_fromstr(&log.old_id, br2_tip));
+	cl_git_pass(git_oid_fromstr(&log.new_id, master_tip));
+	cl_git_pass(git_reftable_writer_add_log(writer, &log));
+
+	log.message = "first";
+	log.update_index = 1;
+	cl_git_pass(git_reftable_writer_add_log(writer, &log));
+
+	cl_git_pass(git_reftable_writer_finish(writer));
+	git_reftable_writer_free(writer);
+
+	cl_git_pass(git_futils_writebuffer(&out, "test.ref", O_WRONLY | O_CREAT | O_TRUNC, 0666));
+	cl_git_pass(git_reftable_open(&table, "test.ref"));
+	cl_assert_equal_i(1, (int)git_reftable_min_update_index(table));
+	cl_assert_equal_i(2, (int)git_reftable_max_update_index(table));
+
+	git_reftable_iter_init(&iter, table, GIT_REFTABLE_BLOCK_REF);
+
+	cl_git_pass(git_reftable_iter_seek(&iter, "refs/heads/branch-1234", 22));
+	cl_git_pass(git_reftable_iter_next(&iter));
+	cl_assert_equal_s("refs/heads/branch-1234", iter.record.ref.name);
+	cl_assert_equal_i(0, git_oid_streq(&iter.record.ref.id, master_tip));
+
+	/* Seeking between two keys stops at the next one */
+	cl_git_pass(git_reftable_iter_seek(&iter, "refs/heads/branch-1234a", 23));
+	cl_git_pass(git_reftable_iter_next(&iter));
+	cl_assert_equal_s("refs/heads/branch-1235", iter.record.ref.name);
+
+	cl_git_pass(git_reftable_iter_seek(&iter, "", 0));
+	for (i = 0; i < 2000; ++i)
+		cl_git_pass(git_reftable_iter_next(&iter));
+	cl_assert_equal_i(GIT_ITEROVER, git_reftable_iter_next(&iter));
+
+	cl_git_pass(git_reftable_iter_seek(&iter, "refs/heads/z", 12));
+	cl_assert_equal_i(GIT_ITEROVER, git_reftable_iter_next(&iter));
+	git_reftable_iter_free(&iter);
+
+	/* The newest log entry comes first */
+	git_reftable_iter_init(&iter, table, GIT_REFTABLE_BLOCK_LOG);
+	cl_git_pass(git_reftable_iter_seek(&iter, "", 0));
+	cl_git_pass(git_reftable_iter_next(&iter));
+	cl_assert_equal_s("refs/heads/branch-0001", iter.record.log.name);
+	cl_assert_equal_s("second", iter.record.log.message);
+	cl_assert_equal_i(-120, iter.record.log.offset);
+	cl_assert_equal_i(0, git_oid_streq(&iter.record.log.old_id, br2_tip));
+	cl_git_pass(git_reftable_iter_next(&iter));
+	cl_assert_equal_s("first", iter.record.log.message);
+	cl_assert_equal_i(1, (int)iter.record.log.update_index);
+	cl_assert_equal_i(GIT_ITEROVER, git_reftable_iter_next(&iter));
+	git_reftable_iter_free(&iter);
+
+	git_reftable_free(table);
+	git_buf_free(&name);
+	git_buf_free(&out);
+}
+
+void test_refs_reftable__reads_tables_with_only_logs(void)
+{
+	git_reftable_writer *writer;
+	git_reftable *table;
+	git_reftable_iter iter;
+	git_reftable_log log;
+	git_buf out = GIT_BUF_INIT, name = GIT_BUF_INIT;
+	int i;
+
+	memset(&log, 0, sizeof(log));
+
+	cl_git_pass(git_reftable_writer_new(&writer, 1, 1, buf_write_cb, &out));
+
+	/* Enough entries for several log blocks and an index over them */
+	log.type = GIT_REFTABLE_LOG_UPDATE;
+	log.committer_name = "foo";
+	log.committer_email = "foo@bar";
+	log.message = "update";
+	log.update_index = 1;
+	cl_git_pass(git_oid_fromstr(&log.old_id, br2_tip));
+	cl_git_pass(git_oid_fromstr(&log.new_id, master_tip));
+
+	for (i = 0; i < 2000; ++i) {
+		git_buf_clear(&name);
+		cl_git_pass(git_buf_printf(&name, "refs/heads/branch-%04d", i));
+		log.name = name.ptr;
+		cl_git_pass(git_reftable_writer_add_log(writer, &log));
+	}
+
+	cl_git_pass(git_reftable_writer_finish(writer));
+	git_reftable_writer_free(writer);
+
+	/* Like git, the first log block shares its space with the file header */
+	cl_assert_equal_i(GIT_REFTABLE_BLOCK_LOG, out.ptr[24]);
+
+	cl_git_pass(git_futils_writebuffer(&out, "test.ref", O_WRONLY | O_CREAT | O_TRUNC, 0666));
+	cl_git_pass(git_reftable_open(&table, "test.ref"));
+
+	git_reftable_iter_init(&iter, table, GIT_REFTABLE_BLOCK_REF);
+	cl_git_pass(git_reftable_iter_seek(&iter, "", 0));
+	cl_assert_equal_i(GIT_ITEROVER, git_reftable_iter_next(&iter));
+	git_reftable_iter_free(&iter);
+
+	git_reftable_iter_init(&iter, table, GIT_REFTABLE_BLOCK_LOG);
+	cl_git_pass(git_reftable_iter_seek(&iter, "", 0));
+	for (i = 0; i < 2000; ++i)
+		cl_git_pass(git_reftable_iter_next(&iter));
+	cl_assert_equal_i(GIT_ITEROVER, git_reftable_iter_next(&iter));
+
+	cl_git_pass(git_reftable_iter_seek(&iter, "refs/heads/branch-0000", 22));
+	cl_git_pass(git_reftable_iter_next(&iter));
+	cl_assert_equal_s("refs/heads/branch-0000", iter.record.log.name);
+	cl_assert_equal_s("update", iter.record.log.message);
+	git_reftable_iter_free(&iter);
+
+	git_reftable_free(table);
+	git_buf_free(&name);
+	git_buf_free(&out);
+}
+
+void test_refs_reftable__rejects_corrupt_tables(void)
+{
+	git_reftable *table;
+
+	cl_git_mkfile("test.ref", "REFT not really a reftable");
+	cl_git_fail(git_reftable_open(&table, "test.ref"));
+}
+
+static void put_index_block(git_buf *out, unsigned char child)
+{
+	/* A single record, "z", pointing at `child`, and its restart point */
+	static const unsigned char block[] = {
+		'i', 0, 0, 13, 0, 1 << 3, 'z', 0, 0, 0, 4, 0, 1
+	};
+
+	cl_git_pass(git_buf_put(out, (const char *)block, sizeof(block)));
+	out->ptr[out->size - 6] = child;
+}
+
+void test_refs_reftable__rejects_index_loops(void)
+{
+	static const unsigned char header[] = {
+		'R', 'E', 'F', 'T', 1, 0, 0x10, 0,
+		0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1
+	};
+	git_reftable *table;
+	git_reftable_iter iter;
+	git_buf out = GIT_BUF_INIT;
+	unsigned char crc[4];
+	uLong sum;
+	size_t footer;
+
+	/* An index block at 24 which points at itself, below the top one at 37 */
+	cl_git_pass(git_buf_put(&out, (const char *)header, sizeof(header)));
+	put_index_block(&out, 24);
+	put_index_block(&out, 24);
+
+	footer = out.size;
+	cl_git_pass(git_buf_put(&out, (const char *)header, sizeof(header)));
+	cl_git_pass(git_buf_put(&out, "\0\0\0\0\0\0\0\x25", 8));
+	cl_git_pass(git_buf_put(&out, "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", 16));
+	cl_git_pass(git_buf_put(&out, "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", 16));
+
+	sum = crc32(0L, (const Bytef *)out.ptr + footer, (uInt)(out.size - footer));
+	crc[0] = (sum >> 24) & 0xff;
+	crc[1] = (sum >> 16) & 0xff;
+	crc[2] = (sum >> 8) & 0xff;
+	crc[3] = sum & 0xff;
+	cl_git_pass(git_buf_put(&out, (const char *)crc, 4));
+
+	cl_git_pass(git_futils_writebuffer(&out, "test.ref", O_WRONLY | O_CREAT | O_TRUNC, 0666));
+	cl_git_pass(git_reftable_open(&table, "test.ref"));
+
+	git_reftable_iter_init(&iter, table, GIT_REFTABLE_BLOCK_REF);
+	cl_git_fail(git_reftable_iter_seek(&iter, "refs/heads/master", 17));
+	git_reftable_iter_free(&iter);
+
+	git_reftable_free(table);
+	git_buf_free(&out);
+}
+
+void test_refs_reftable__takes_over_the_files(void)
+{
+	git_reference_iterator *iter;
+	git_reference *ref;
+	const char *name;
+	size_t count = 0;
+	int error;
+
+	use_reftable();
+
+	assert_ref("refs/heads/master", master_tip);
+	assert_ref("refs/heads/br2", br2_tip);
+	cl_assert(git_path_isfile("testrepo/.git/reftable/tables.list"));
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "HEAD"));
+	cl_assert_equal_s("refs/heads/master", git_reference_symbolic_target(ref));
+	git_reference_free(ref);
+
+	cl_git_pass(git_reference_iterator_glob_new(&iter, g_repo, "refs/heads/*"));
+	while ((error = git_reference_next_name(&name, iter)) == 0) {
+		cl_assert(!git__prefixcmp(name, "refs/heads/"));
+		count++;
+	}
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	cl_assert_equal_i(8, (int)count);
+	git_reference_iterator_free(iter);
+
+	/* Loose and packed ones alike */
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/tags/foo/foo/bar"));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/tags/packed-tag"));
+	git_reference_free(ref);
+}
+
+void test_refs_reftable__writes_deletes_and_renames(void)
+{
+	git_reference *ref, *renamed;
+	git_oid id;
+	git_reflog *reflog;
+
+	use_reftable();
+	cl_git_pass(git_oid_fromstr(&id, br2_tip));
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/new", &id, 0, g_sig, "created"));
+	git_reference_free(ref);
+	assert_ref("refs/heads/new", br2_tip);
+
+	cl_git_fail_with(GIT_EEXISTS,
+		git_reference_create(&ref, g_repo, "refs/heads/new", &id, 0, g_sig, NULL));
+	cl_git_fail(git_reference_create(&ref, g_repo, "refs/heads/new/nested", &id, 1, g_sig, NULL));
+	cl_git_fail(git_reference_create(&ref, g_repo, "refs/heads", &id, 1, g_sig, NULL));
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/new"));
+	cl_git_pass(git_reference_rename(&renamed, ref, "refs/heads/renamed", 0, g_sig, "renamed"));
+	git_reference_free(ref);
+	git_reference_free(renamed);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/new"));
+	assert_ref("refs/heads/renamed", br2_tip);
+
+	/* The log moved along, with the rename on top */
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/renamed"));
+	cl_assert_equal_i(2, (int)git_reflog_entrycount(reflog));
+	cl_assert_equal_s("renamed", git_reflog_entry_message(git_reflog_entry_byindex(reflog, 0)));
+	cl_assert_equal_s("created", git_reflog_entry_message(git_reflog_entry_byindex(reflog, 1)));
+	git_reflog_free(reflog);
+	cl_assert_equal_i(0, git_reference_has_log(g_repo, "refs/heads/new"));
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/renamed"));
+	cl_git_pass(git_reference_delete(ref));
+	git_reference_free(ref);
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/renamed"));
+
+	/* Now that the name is free, it can be a directory */
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/renamed/nested", &id, 0, g_sig, NULL));
+	git_reference_free(ref);
+}
+
+void test_refs_reftable__logs_updates_to_the_branch_of_head(void)
+{
+	git_reference *ref;
+	git_reflog *reflog;
+	git_oid id;
+
+	use_reftable();
+	cl_git_pass(git_oid_fromstr(&id, br2_tip));
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/master", &id, 1, g_sig, "moved"));
+	git_reference_free(ref);
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "HEAD"));
+	cl_assert_equal_i(1, (int)git_reflog_entrycount(reflog));
+	cl_assert_equal_i(0, git_oid_streq(
+		git_reflog_entry_id_old(git_reflog_entry_byindex(reflog, 0)), master_tip));
+	cl_assert_equal_s("foo", git_reflog_entry_committer(git_reflog_entry_byindex(reflog, 0))->name);
+	git_reflog_free(reflog);
+
+	/* Rewriting and dropping a log works on the tables as well */
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/master"));
+	cl_git_pass(git_reflog_append(reflog, &id, g_sig, "appended"));
+	cl_git_pass(git_reflog_write(reflog));
+	git_reflog_free(reflog);
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/master"));
+	cl_assert_equal_i(2, (int)git_reflog_entrycount(reflog));
+	cl_assert_equal_s("appended", git_reflog_entry_message(git_reflog_entry_byindex(reflog, 0)));
+	git_reflog_free(reflog);
+
+	cl_git_pass(git_reflog_read_recent(&reflog, g_repo, "refs/heads/master", 1));
+	cl_assert_equal_i(1, (int)git_reflog_entrycount(reflog));
+	cl_assert_equal_s("appended", git_reflog_entry_message(git_reflog_entry_byindex(reflog, 0)));
+	git_reflog_free(reflog);
+
+	cl_git_pass(git_reflog_delete(g_repo, "refs/heads/master"));
+	cl_assert_equal_i(0, git_reference_has_log(g_repo, "refs/heads/master"));
+}
+
+void test_refs_reftable__keeps_the_stack_small(void)
+{
+	git_reference *ref, *batch[2];
+	git_repository *other;
+	git_refdb *refdb;
+	git_buf name = GIT_BUF_INIT;
+	git_oid id;
+	int i;
+
+	use_reftable();
+	cl_git_pass(git_oid_fromstr(&id, br2_tip));
+
+	for (i = 0; i < 64; ++i) {
+		git_buf_clear(&name);
+		cl_git_pass(git_buf_printf(&name, "refs/heads/many-%02d", i));
+		cl_git_pass(git_reference_create(&ref, g_repo, name.ptr, &id, 0, g_sig, NULL));
+		git_reference_free(ref);
+	}
+
+	cl_assert(count_tables() <= 8);
+
+	cl_assert(batch[0] = git_reference__alloc("refs/heads/many-00", &id, NULL));
+	memset(&id, 0, sizeof(id));
+	cl_assert(batch[1] = git_reference__alloc("refs/heads/many-01", &id, NULL));
+	cl_git_pass(git_reference__update_batch(g_repo, batch, 2, g_sig, "batched"));
+	git_reference_free(batch[0]);
+	git_reference_free(batch[1]);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/many-00"));
+	git_reference_free(ref);
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/many-01"));
+
+	/* Packing everything leaves a single table behind */
+	cl_git_pass(git_repository_refdb(&refdb, g_repo));
+	cl_git_pass(git_refdb_compress(refdb));
+	git_refdb_free(refdb);
+	cl_assert_equal_i(1, (int)count_tables());
+
+	/* Another repository sees it all */
+	cl_git_pass(git_repository_open(&other, "testrepo"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, other, "refs/heads/many-01"));
+	cl_git_pass(git_reference_lookup(&ref, other, "refs/heads/many-63"));
+	git_reference_free(ref);
+	git_repository_free(other);
+
+	git_buf_free(&name);
+}
+
+void test_refs_reftable__rejects_unknown_storage(void)
+{
+	git_config *cfg;
+	git_reference *ref;
+
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_set_int32(cfg, "core.repositoryformatversion", 1));
+	cl_git_pass(git_config_set_string(cfg, "extensions.refStorage", "nonsense"));
+	git_config_free(cfg);
+
+	g_repo = cl_git_sandbox_reopen();
+	cl_git_fail(git_reference_lookup(&ref, g_repo, "HEAD"));
+}
+
+void test_refs_reftable__needs_repository_format_version_1(void)
+{
+	git_config *cfg;
+	git_reference *ref;
+
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_set_string(cfg, "extensions.refStorage", "reftable"));
+	git_config_free(cfg);
+
+	g_repo = cl_git_sandbox_reopen();
+	cl_git_fail(git_reference_lookup(&ref, g_repo, "HEAD"));
+	cl_assert(!git_path_exists("testrepo/.git/reftable"));
+}
+
+void test_refs_reftable__moving_over_records_the_storage(void)
+{
+	git_refdb *refdb;
+	git_refdb_backend *backend;
+	git_config *cfg;
+	const char *storage;
+	int version;
+
+	cl_git_pass(git_repository_refdb(&refdb, g_repo));
+	cl_git_pass(git_refdb_backend_reftable(&backend, g_repo));
+	cl_git_pass(git_refdb_set_backend(refdb, backend));
+	git_refdb_free(refdb);
+
+	g_repo = cl_git_sandbox_reopen();
+
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_get_int32(&version, cfg, "core.repositoryformatversion"));
+	cl_assert_equal_i(1, version);
+	cl_git_pass(git_config_get_string(&storage, cfg, "extensions.refstorage"));
+	cl_assert_equal_s("reftable", storage);
+	git_config_free(cfg);
+
+	assert_ref("refs/heads/master", master_tip);
+}
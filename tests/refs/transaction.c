@@ -0,0 +1,273 @@
+#include "clar_libgit2.h"
+
+#include "path.h"
+#include "refs.h"
+#include "git2/refdb.h"
+#include "git2/reflog.h"
+#include "git2/sys/refdb_backend.h"
+#include "ref_helpers.h"
+
+static const char *master_tip = "099fabac3a9ea935598528c27f866e34089c2eff";
+static const char *br2_tip = "a4a7dce85cf63874e984719f4fdd239f5145052f";
+static const char *test_tip = "e90810b8df3e80c413d903f631643c716887138d";
+
+static git_repository *g_repo;
+static git_signature *g_sig;
+static git_refdb *g_refdb;
+static git_refdb_transaction *g_tx;
+
+void test_refs_transaction__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo");
+	cl_git_pass(git_signature_now(&g_sig, "foo", "foo@bar"));
+}
+
+void test_refs_transaction__cleanup(void)
+{
+	git_refdb_transaction_free(g_tx);
+	g_tx = NULL;
+	git_refdb_free(g_refdb);
+	g_refdb = NULL;
+
+	git_signature_free(g_sig);
+	cl_git_sandbox_cleanup();
+}
+
+static void begin(unsigned int flags)
+{
+	git_refdb_transaction_free(g_tx);
+	git_refdb_free(g_refdb);
+
+	cl_git_pass(git_repository_refdb(&g_refdb, g_repo));
+	cl_git_pass(git_refdb_transaction_new(&g_tx, g_refdb, flags));
+}
+
+static void set_target(const char *name, const char *target, const char *old)
+{
+	git_oid id, old_id;
+
+	cl_git_pass(git_oid_fromstr(&id, target));
+	if (old)
+		cl_git_pass(git_oid_fromstr(&old_id, old));
+
+	cl_git_pass(git_refdb_transaction_set_target(
+		g_tx, name, &id, old ? &old_id : NULL));
+}
+
+static void delete(const char *name, const char *old)
+{
+	git_oid old_id;
+
+	if (old)
+		cl_git_pass(git_oid_fromstr(&old_id, old));
+
+	cl_git_pass(git_refdb_transaction_delete(g_tx, name, old ? &old_id : NULL));
+}
+
+static void assert_ref(const char *name, const char *target, int packed)
+{
+	git_reference *ref;
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, name));
+	cl_assert_equal_i(0, git_oid_streq(git_reference_target(ref), target));
+	if (packed >= 0)
+		cl_assert_equal_i(packed, reference_is_packed(ref));
+	git_reference_free(ref);
+}
+
+static void assert_last_log(const char *name, const char *old, const char *new)
+{
+	git_reflog *reflog;
+	const git_reflog_entry *entry;
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, name));
+	cl_assert(entry = git_reflog_entry_byindex(reflog, 0));
+	cl_assert_equal_i(0, git_oid_streq(git_reflog_entry_id_old(entry), old));
+	cl_assert_equal_i(0, git_oid_streq(git_reflog_entry_id_new(entry), new));
+	cl_assert_equal_s("transaction", git_reflog_entry_message(entry));
+	git_reflog_free(reflog);
+}
+
+void test_refs_transaction__commits_every_update(void)
+{
+	git_reference *ref;
+
+	begin(GIT_REFDB_TRANSACTION_DEFAULT);
+	set_target("refs/heads/br2", master_tip, br2_tip);
+	set_target("refs/heads/new", br2_tip, GIT_OID_HEX_ZERO);
+	set_target("refs/heads/packed", master_tip, NULL);
+	delete("refs/heads/test", test_tip);
+	delete("refs/heads/does-not-exist", NULL);
+
+	cl_git_pass(git_refdb_transaction_commit(g_tx, g_sig, "transaction"));
+
+	/* each of them gets its own file */
+	assert_ref("refs/heads/br2", master_tip, 0);
+	assert_ref("refs/heads/new", br2_tip, 0);
+	assert_ref("refs/heads/packed", master_tip, 0);
+	assert_last_log("refs/heads/br2", br2_tip, master_tip);
+	assert_last_log("refs/heads/new", GIT_OID_HEX_ZERO, br2_tip);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/test"));
+	cl_assert(!git_path_exists("testrepo/.git/refs/heads/br2.lock"));
+	cl_assert(!git_path_exists("testrepo/.git/packed-refs.lock"));
+}
+
+void test_refs_transaction__writes_into_the_packfile(void)
+{
+	begin(GIT_REFDB_TRANSACTION_PACKED);
+	set_target("refs/heads/packed", br2_tip, NULL);
+	set_target("refs/heads/new", master_tip, GIT_OID_HEX_ZERO);
+
+	cl_git_pass(git_refdb_transaction_commit(g_tx, g_sig, "transaction"));
+
+	assert_ref("refs/heads/packed", br2_tip, 1);
+	assert_ref("refs/heads/new", master_tip, 1);
+	assert_last_log("refs/heads/new", GIT_OID_HEX_ZERO, master_tip);
+	cl_assert(!git_path_exists("testrepo/.git/refs/heads/new"));
+}
+
+void test_refs_transaction__keeps_loose_references_loose(void)
+{
+	begin(GIT_REFDB_TRANSACTION_PACKED);
+	set_target("refs/heads/br2", master_tip, br2_tip);
+	set_target("refs/heads/master", br2_tip, master_tip);
+	set_target("refs/heads/new", master_tip, GIT_OID_HEX_ZERO);
+
+	cl_git_pass(git_refdb_transaction_commit(g_tx, g_sig, "transaction"));
+
+	assert_ref("refs/heads/br2", master_tip, 0);
+	assert_ref("refs/heads/master", br2_tip, 0);
+	assert_ref("refs/heads/new", master_tip, 0);
+	assert_last_log(GIT_HEAD_FILE, master_tip, br2_tip);
+}
+
+void test_refs_transaction__changes_nothing_when_a_check_fails(void)
+{
+	git_reference *ref;
+	unsigned int flags[] = {
+		GIT_REFDB_TRANSACTION_DEFAULT, GIT_REFDB_TRANSACTION_PACKED
+	};
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(flags); ++i) {
+		begin(flags[i]);
+		set_target("refs/heads/br2", master_tip, br2_tip);
+		delete("refs/heads/test", NULL);
+		set_target("refs/heads/master", br2_tip, br2_tip);
+
+		cl_git_fail_with(GIT_EMODIFIED,
+			git_refdb_transaction_commit(g_tx, g_sig, "transaction"));
+
+		begin(flags[i]);
+		set_target("refs/heads/br2", master_tip, br2_tip);
+		set_target("refs/heads/master", br2_tip, GIT_OID_HEX_ZERO);
+
+		cl_git_fail_with(GIT_EMODIFIED,
+			git_refdb_transaction_commit(g_tx, g_sig, "transaction"));
+
+		begin(flags[i]);
+		set_target("refs/heads/br2", master_tip, br2_tip);
+		delete("refs/heads/does-not-exist", master_tip);
+
+		cl_git_fail_with(GIT_EMODIFIED,
+			git_refdb_transaction_commit(g_tx, g_sig, "transaction"));
+
+		assert_ref("refs/heads/br2", br2_tip, -1);
+		assert_ref("refs/heads/master", master_tip, -1);
+		cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/test"));
+		git_reference_free(ref);
+
+		cl_assert(!git_path_exists("testrepo/.git/refs/heads/br2.lock"));
+		cl_assert(!git_path_exists("testrepo/.git/packed-refs.lock"));
+	}
+}
+
+void test_refs_transaction__undoes_updates_without_backend_support(void)
+{
+	git_refdb_backend *backend;
+	git_reference *ref;
+
+	begin(GIT_REFDB_TRANSACTION_DEFAULT);
+
+	/* a backend which leaves the transaction to the refdb */
+	cl_git_pass(git_refdb_backend_fs(&backend, g_repo));
+	backend->transaction = NULL;
+	cl_git_pass(git_refdb_set_backend(g_refdb, backend));
+
+	set_target("refs/heads/br2", master_tip, br2_tip);
+	delete("refs/heads/test", test_tip);
+	set_target("refs/heads/master/sub", br2_tip, NULL);
+
+	cl_git_fail(git_refdb_transaction_commit(g_tx, g_sig, "transaction"));
+
+	assert_ref("refs/heads/br2", br2_tip, -1);
+	assert_ref("refs/heads/test", test_tip, -1);
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/heads/master/sub"));
+
+	/* a failed check changes nothing to begin with */
+	begin(GIT_REFDB_TRANSACTION_DEFAULT);
+	cl_git_pass(git_refdb_backend_fs(&backend, g_repo));
+	backend->transaction = NULL;
+	cl_git_pass(git_refdb_set_backend(g_refdb, backend));
+
+	set_target("refs/heads/br2", master_tip, br2_tip);
+	set_target("refs/heads/master", br2_tip, br2_tip);
+
+	cl_git_fail_with(GIT_EMODIFIED,
+		git_refdb_transaction_commit(g_tx, g_sig, "transaction"));
+	assert_ref("refs/heads/br2", br2_tip, -1);
+}
+
+void test_refs_transaction__rejects_bad_updates(void)
+{
+	git_oid id;
+
+	begin(GIT_REFDB_TRANSACTION_DEFAULT);
+
+	cl_git_pass(git_oid_fromstr(&id, master_tip));
+	cl_git_fail(git_refdb_transaction_set_target(g_tx, "refs/heads/a..b", &id, NULL));
+
+	cl_git_pass(git_oid_fromstr(&id, "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"));
+	cl_git_fail(git_refdb_transaction_set_target(g_tx, "refs/heads/br2", &id, NULL));
+
+	set_target("refs/heads/br2", master_tip, NULL);
+	delete("refs/heads/br2", NULL);
+	cl_git_fail(git_refdb_transaction_commit(g_tx, g_sig, "transaction"));
+
+	assert_ref("refs/heads/br2", br2_tip, -1);
+}
+
+void test_refs_transaction__works_with_reftables(void)
+{
+	git_config *cfg;
+	git_reference *ref;
+
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_set_int32(cfg, "core.repositoryformatversion", 1));
+	cl_git_pass(git_config_set_string(cfg, "extensions.refStorage", "reftable"));
+	git_config_free(cfg);
+
+	g_repo = cl_git_sandbox_reopen();
+
+	begin(GIT_REFDB_TRANSACTION_DEFAULT);
+	set_target("refs/heads/br2", master_tip, br2_tip);
+	delete("refs/heads/test", master_tip);
+
+	cl_git_fail_with(GIT_EMODIFIED,
+		git_refdb_transaction_commit(g_tx, g_sig, "transaction"));
+	assert_ref("refs/heads/br2", br2_tip, -1);
+
+	begin(GIT_REFDB_TRANSACTION_DEFAULT);
+	set_target("refs/heads/br2", master_tip, br2_tip);
+	set_target("refs/heads/new", br2_tip, GIT_OID_HEX_ZERO);
+	delete("refs/heads/test", test_tip);
+
+	cl_git_pass(git_refdb_transaction_commit(g_tx, g_sig, "transaction"));
+
+	assert_ref("refs/heads/br2", master_tip, -1);
+	assert_ref("refs/heads/new", br2_tip, -1);
+	assert_last_log("refs/heads/br2", br2_tip, master_tip);
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/test"));
+}
@@ -155,6 +155,31 @@ void test_repo_init__reinit_too_recent_bare_repo(void)
 	cl_fixture_cleanup("reinit.git");
 }
 
+void test_repo_init__reinit_with_unknown_extension(void)
+{
+	git_config *config;
+
+	cl_git_pass(git_repository_init(&_repo, "reinit.git", 1));
+	cl_git_pass(git_repository_config(&config, _repo));
+
+	cl_git_pass(git_config_set_int32(config, "core.repositoryformatversion", 1));
+	cl_git_pass(git_config_set_string(config, "extensions.refstorage", "files"));
+	git_repository_free(_repo);
+
+	/* Extensions we know about are fine */
+	cl_git_pass(git_repository_init(&_repo, "reinit.git", 1));
+	git_repository_free(_repo);
+
+	cl_git_pass(git_config_set_bool(config, "extensions.frobnicate", true));
+	git_config_free(config);
+
+	cl_git_fail(git_repository_init(&_repo, "reinit.git", 1));
+	cl_assert_equal_s("Unsupported repository extension 'frobnicate'",
+		giterr_last()->message);
+
+	cl_fixture_cleanup("reinit.git");
+}
+
 void test_repo_init__additional_templates(void)
 {
 	git_buf path = GIT_BUF_INIT;
@@ -7,6 +7,8 @@ void test_repo_open__cleanup(void)
 {
 	cl_git_sandbox_cleanup();
 
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DISCOVERY_CACHE_SIZE, (size_t)0));
+
 	if (git_path_isdir("alternate"))
 		git_futils_rmdir_r("alternate", NULL, GIT_RMDIR_REMOVE_FILES);
 }
@@ -377,3 +379,90 @@ void test_repo_open__force_bare(void)
 	cl_assert(git_repository_is_bare(barerepo));
 	git_repository_free(barerepo);
 }
+
+void test_repo_open__gitdir_is_not_searched(void)
+{
+	git_repository *repo;
+
+	cl_git_sandbox_init("empty_standard_repo");
+	cl_git_pass(p_mkdir("empty_standard_repo/subdir", 0777));
+
+	cl_git_pass(git_repository_open_ext(
+		&repo, "empty_standard_repo/.git", GIT_REPOSITORY_OPEN_GITDIR, NULL));
+	cl_assert(git__suffixcmp(git_repository_path(repo), "empty_standard_repo/.git/") == 0);
+	cl_assert(git__suffixcmp(git_repository_workdir(repo), "empty_standard_repo/") == 0);
+	git_repository_free(repo);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_repository_open_ext(
+		&repo, "empty_standard_repo", GIT_REPOSITORY_OPEN_GITDIR, NULL));
+	cl_git_fail_with(GIT_ENOTFOUND, git_repository_open_ext(
+		&repo, "empty_standard_repo/subdir", GIT_REPOSITORY_OPEN_GITDIR, NULL));
+}
+
+void test_repo_open__deferred_config(void)
+{
+	git_repository *repo;
+	git_config *cfg;
+
+	cl_fixture_sandbox("testrepo.git");
+	cl_git_sandbox_init("empty_standard_repo");
+	cl_git_pass(p_mkdir("empty_standard_repo/subdir", 0777));
+
+	cl_git_pass(git_repository_open_ext(
+		&repo, "empty_standard_repo/subdir", GIT_REPOSITORY_OPEN_DEFER_CONFIG, NULL));
+	cl_assert(!git_repository_is_bare(repo));
+	cl_assert(git__suffixcmp(git_repository_workdir(repo), "empty_standard_repo/") == 0);
+	git_repository_free(repo);
+
+	cl_git_pass(git_repository_open_ext(&repo, "testrepo.git",
+		GIT_REPOSITORY_OPEN_GITDIR | GIT_REPOSITORY_OPEN_DEFER_CONFIG, NULL));
+	cl_assert(git_repository_workdir(repo) == NULL);
+	cl_assert(git_repository_is_bare(repo));
+	git_repository_free(repo);
+
+	cl_fixture_cleanup("testrepo.git");
+
+	/* core.worktree is honoured once the config is read */
+	cl_git_pass(git_repository_open(&repo, "empty_standard_repo"));
+	cl_git_pass(git_repository_config(&cfg, repo));
+	cl_git_pass(git_config_set_string(cfg, "core.worktree", "../subdir"));
+	git_config_free(cfg);
+	git_repository_free(repo);
+
+	cl_git_pass(git_repository_open_ext(&repo, "empty_standard_repo/.git",
+		GIT_REPOSITORY_OPEN_GITDIR | GIT_REPOSITORY_OPEN_DEFER_CONFIG, NULL));
+	cl_assert(git__suffixcmp(git_repository_workdir(repo), "empty_standard_repo/subdir/") == 0);
+	git_repository_free(repo);
+}
+
+void test_repo_open__discovery_cache(void)
+{
+	static const char *variants[] = {
+		"attr", "attr/sub", "attr/sub/sub/", "attr/sub", "attr/sub/sub/",
+		NULL
+	};
+	git_repository *repo;
+	const char **scan;
+	size_t size;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DISCOVERY_CACHE_SIZE, (size_t)2));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DISCOVERY_CACHE_SIZE, &size));
+	cl_assert_equal_sz(2, size);
+
+	cl_fixture_sandbox("attr");
+	cl_git_pass(p_rename("attr/.gitted", "attr/.git"));
+
+	for (scan = variants; *scan != NULL; scan++) {
+		cl_git_pass(git_repository_open_ext(&repo, *scan, 0, NULL));
+		cl_assert(git__suffixcmp(git_repository_path(repo), "attr/.git/") == 0);
+		cl_assert(git__suffixcmp(git_repository_workdir(repo), "attr/") == 0);
+		git_repository_free(repo);
+	}
+
+	/* a cached repository that has gone away is not handed out */
+	cl_git_pass(git_futils_rmdir_r("attr/.git", NULL, GIT_RMDIR_REMOVE_FILES));
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_repository_open_ext(&repo, "attr/sub", 0, NULL));
+
+	cl_fixture_cleanup("attr");
+}
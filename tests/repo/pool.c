@@ -0,0 +1,143 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "repository.h"
+
+static git_repository_pool *g_pool;
+
+void test_repo_pool__initialize(void)
+{
+	cl_fixture_sandbox("testrepo.git");
+}
+
+void test_repo_pool__cleanup(void)
+{
+	git_repository_pool_free(g_pool);
+	g_pool = NULL;
+
+	cl_fixture_cleanup("testrepo.git");
+}
+
+void test_repo_pool__reuses_released_repositories(void)
+{
+	git_repository *one, *two, *again;
+
+	cl_git_pass(git_repository_pool_new(&g_pool, 4));
+
+	cl_git_pass(git_repository_pool_open(&one, g_pool, "testrepo.git"));
+	cl_git_pass(git_repository_pool_open(&two, g_pool, "testrepo.git"));
+	cl_assert(one != two);
+
+	git_repository_pool_release(g_pool, one);
+	cl_git_pass(git_repository_pool_open(&again, g_pool, "testrepo.git"));
+	cl_assert(again == one);
+
+	git_repository_pool_release(g_pool, again);
+	git_repository_pool_release(g_pool, two);
+
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_repository_pool_open(&one, g_pool, "does-not-exist.git"));
+}
+
+void test_repo_pool__frees_the_least_recently_released(void)
+{
+	git_repository *one, *two, *again;
+
+	cl_git_pass(git_repository_pool_new(&g_pool, 1));
+
+	cl_git_pass(git_repository_pool_open(&one, g_pool, "testrepo.git"));
+	cl_git_pass(git_repository_pool_open(&two, g_pool, "testrepo.git/"));
+
+	git_repository_pool_release(g_pool, one);
+	git_repository_pool_release(g_pool, two);
+
+	cl_git_pass(git_repository_pool_open(&again, g_pool, "testrepo.git/"));
+	cl_assert(again == two);
+
+	/* a pooled repository may also just be freed */
+	git_repository_free(again);
+
+	git_repository_pool_clear(g_pool);
+}
+
+void test_repo_pool__reopens_after_a_config_change(void)
+{
+	git_repository *repo, *first;
+	git_config *cfg;
+	const char *value;
+
+	cl_git_pass(git_repository_pool_new(&g_pool, 4));
+	cl_git_pass(git_repository_pool_open(&repo, g_pool, "testrepo.git"));
+
+	cl_git_pass(git_repository_config(&cfg, repo));
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_config_get_string(&value, cfg, "pool.value"));
+	git_config_free(cfg);
+
+	git_repository_set_namespace(repo, "tenant");
+	git_repository_pool_release(g_pool, (first = repo));
+
+	/* unchanged, we get the same one back */
+	cl_git_pass(git_repository_pool_open(&repo, g_pool, "testrepo.git"));
+	cl_assert(repo == first);
+	cl_assert(git_repository_get_namespace(repo) == NULL);
+	git_repository_pool_release(g_pool, repo);
+
+	cl_git_append2file("testrepo.git/config", "[pool]\n\tvalue = changed\n");
+
+	/* the config may say anything about the repository, so start over */
+	cl_git_pass(git_repository_pool_open(&repo, g_pool, "testrepo.git"));
+	cl_assert(git_repository_is_bare(repo));
+
+	cl_git_pass(git_repository_config(&cfg, repo));
+	cl_git_pass(git_config_get_string(&value, cfg, "pool.value"));
+	cl_assert_equal_s("changed", value);
+	git_config_free(cfg);
+
+	git_repository_pool_release(g_pool, repo);
+}
+
+void test_repo_pool__reuses_repositories_without_a_config(void)
+{
+	git_repository *repo;
+	git_object *head;
+
+	cl_must_pass(p_unlink("testrepo.git/config"));
+	cl_git_pass(git_repository_pool_new(&g_pool, 4));
+
+	cl_git_pass(git_repository_pool_open(&repo, g_pool, "testrepo.git"));
+	cl_git_pass(git_revparse_single(&head, repo, "HEAD"));
+	git_object_free(head);
+	git_repository_pool_release(g_pool, repo);
+
+	/* a missing config is as good as an unchanged one: the cache stays */
+	cl_git_pass(git_repository_pool_open(&repo, g_pool, "testrepo.git"));
+	cl_assert(git_cache_size(&repo->objects) > 0);
+	git_repository_pool_release(g_pool, repo);
+}
+
+void test_repo_pool__drops_packs_removed_from_disk(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+	git_oid id;
+
+	/* only found in a pack */
+	cl_git_pass(git_oid_fromstr(&id, "fb20a5a4b6185d9188d82c874db3d9729ef31f3b"));
+
+	cl_git_pass(git_repository_pool_new(&g_pool, 4));
+	cl_git_pass(git_repository_pool_open(&repo, g_pool, "testrepo.git"));
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_assert(git_odb_exists(odb, &id));
+	git_odb_free(odb);
+	git_repository_pool_release(g_pool, repo);
+
+	cl_git_pass(git_futils_rmdir_r(
+		"testrepo.git/objects/pack", NULL, GIT_RMDIR_REMOVE_FILES));
+	cl_git_pass(p_mkdir("testrepo.git/objects/pack", 0777));
+
+	cl_git_pass(git_repository_pool_open(&repo, g_pool, "testrepo.git"));
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_assert(!git_odb_exists(odb, &id));
+	git_odb_free(odb);
+	git_repository_pool_release(g_pool, repo);
+}
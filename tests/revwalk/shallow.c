@@ -0,0 +1,64 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+
+/*
+*   a4a7dce [0] Merge branch 'master' into br2
+|\
+| * 9fd738e [1] a fourth commit
+| * 4a202b3 [2] a third commit
+* | c47800c [3] branch commit one
+|/
+* 5b5b025 [5] another commit
+* 8496071 [4] testing
+*/
+
+static git_repository *_repo;
+
+void test_revwalk_shallow__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_revwalk_shallow__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static int count_commits_from(const char *tip)
+{
+	git_revwalk *walk;
+	git_oid oid;
+	int count = 0, error;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_oid_fromstr(&oid, tip));
+	cl_git_pass(git_revwalk_push(walk, &oid));
+
+	while ((error = git_revwalk_next(&oid, walk)) == 0)
+		count++;
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	git_revwalk_free(walk);
+
+	return count;
+}
+
+void test_revwalk_shallow__history_ends_at_the_shallow_commits(void)
+{
+	cl_assert_equal_i(6, count_commits_from("a4a7dce85cf63874e984719f4fdd239f5145052f"));
+
+	cl_git_mkfile("testrepo.git/shallow",
+		"c47800c7266a2be04c571c04d5a6614691ea99bd\n"
+		"4a202b346bb0fb0db7eff3cffeb3c70babbd2045\n");
+
+	cl_assert_equal_i(4, count_commits_from("a4a7dce85cf63874e984719f4fdd239f5145052f"));
+	cl_assert_equal_i(1, count_commits_from("c47800c7266a2be04c571c04d5a6614691ea99bd"));
+}
+
+void test_revwalk_shallow__invalid_shallow_file(void)
+{
+	git_revwalk *walk;
+
+	cl_git_mkfile("testrepo.git/shallow", "c47800c7266a2be04c571c04d5a6614\n");
+	cl_git_fail(git_revwalk_new(&walk, _repo));
+}